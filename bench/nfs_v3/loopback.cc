@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <atomic>
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+#if ENABLE_LOGGING
+#include <spdlog/spdlog.h>
+#endif
+
+/*
+ * The client end to end against the loopback server, on a scratch
+ * directory. The file handle is made up by the server, so it is taken from
+ * an MNT call; GETATTRs bypass the attribute cache by disabling it.
+ */
+struct bench_env {
+  std::string         dir;
+  struct nfs_server*  srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+  std::string         rootfh;
+  int                 pending;
+  int                 errors;
+
+  bench_env( int nconnect, int transport = RPC_TRANSPORT_SOCKET ) {
+    char tmpl[] = "/tmp/nfs_loopback_bench.XXXXXX";
+    dir         = mkdtemp( tmpl );
+    srv         = nfs_server_start( dir.c_str(), 0, RPC_SERVER_DEF_WORKERS );
+    loop        = rpc_loop_create();
+    nfs         = nfs_init_context();
+    nfs_set_nconnect( nfs, nconnect );
+    nfs_set_attrcache( nfs, 0 );
+    nfs_set_transport( nfs, transport );
+    nfs_loop_add( loop, nfs );
+    pending = 1;
+    errors  = 0;
+    nfs_connect_async( nfs, "127.0.0.1", nfs_server_get_port( srv ), done_cb, this );
+    wait();
+  }
+
+  ~bench_env() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+    nfs_server_stop( srv );
+    std::filesystem::remove_all( dir );
+  }
+
+  static void done_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+    bench_env* env = (bench_env*) private_data;
+    env->errors += err < 0;
+    env->pending--;
+  }
+
+  static void mnt_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    bench_env* env = (bench_env*) private_data;
+    mountres3* res = (mountres3*) data;
+    if ( status == RPC_STATUS_SUCCESS && res->fhs_status == MNT3_OK ) {
+      env->rootfh.assign( res->mountres3_u.mountinfo.fhandle.fhandle3_val, res->mountres3_u.mountinfo.fhandle.fhandle3_len );
+    }
+    env->pending--;
+  }
+
+  void wait() {
+    while ( pending > 0 ) {
+      rpc_loop_run_once( loop, 100 );
+    }
+  }
+
+  bool mount() {
+    dirpath         path = (dirpath) nfs_server_get_export( srv );
+    struct rpc_pdu* pdu  = rpc_allocate_pdu( nfs_get_rpc_context( nfs ), MOUNT_PROGRAM, MOUNT_V3, MOUNT3_MNT, mnt_cb, this,
+                                             (zdrproc_t) zdr_mountres3, sizeof( mountres3 ), 0 );
+    if ( !pdu || !zdr_dirpath( &pdu->zdr, &path ) || rpc_queue_pdu( nfs_get_rpc_context( nfs ), pdu ) < 0 ) {
+      return false;
+    }
+    pending = 1;
+    wait();
+    struct nfs_fh fh { (int) rootfh.size(), &rootfh[ 0 ] };
+    return !rootfh.empty() && nfs_fh_inline_set( &nfs->nfsi->rootfh, &fh ) == 0;
+  }
+
+  bool lookup( const char* path, struct nfs_fh_inline* fh ) {
+    struct lookup_state {
+      bench_env*            env;
+      struct nfs_fh_inline* fh;
+    } s { this, fh };
+    pending = 1;
+    nfs_lookup_path_async(
+      nfs, path,
+      []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+        lookup_state* s = (lookup_state*) private_data;
+        if ( err == 0 ) {
+          *s->fh = ( (struct nfsdirent*) data )->fh;
+        }
+        done_cb( err, nfs, data, s->env );
+      },
+      &s );
+    wait();
+    return errors == 0;
+  }
+};
+
+/* round trips with `depth` GETATTRs in flight, over sockets or io_uring */
+static void BM_loopback_getattr( benchmark::State& state ) {
+  const int depth     = state.range( 0 );
+  const int transport = state.range( 1 );
+  bench_env env( 1, transport );
+  if ( !env.srv || !env.mount() ) {
+    state.SkipWithError( "mount failed" );
+    return;
+  }
+  struct rpc_context* rpc = nfs_get_rpc_context( env.nfs );
+  if ( rpc_get_transport( rpc ) != transport ) {
+    state.SkipWithError( "io_uring is not available" );
+    return;
+  }
+  struct nfs_fh root     = nfs_fh_inline_get( &env.nfs->nfsi->rootfh );
+  uint64_t      syscalls = rpc->stats.num_syscalls;
+
+  for ( auto _ : state ) {
+    env.pending = depth;
+    for ( int i = 0; i < depth; i++ ) {
+      nfs_getattr_async( env.nfs, &root, bench_env::done_cb, &env );
+    }
+    env.wait();
+  }
+  if ( env.errors ) {
+    state.SkipWithError( "GETATTR failed" );
+  }
+  state.SetItemsProcessed( state.iterations() * depth );
+  state.counters[ "syscalls/rpc" ] = (double) ( rpc->stats.num_syscalls - syscalls ) / ( state.iterations() * depth );
+}
+BENCHMARK( BM_loopback_getattr )
+  ->ArgNames( { "depth", "uring" } )
+  ->ArgsProduct( { { 1, 16, 64 }, { RPC_TRANSPORT_SOCKET, RPC_TRANSPORT_URING } } )
+  ->UseRealTime();
+
+/* sequential reads of a 64 MiB file, over 1 and 4 connections */
+static void BM_loopback_read( benchmark::State& state ) {
+  const uint64_t size = 64 << 20;
+  bench_env      env( state.range( 0 ) );
+  if ( !env.srv ) {
+    state.SkipWithError( "server failed" );
+    return;
+  }
+  int fd = open( ( env.dir + "/file" ).c_str(), O_CREAT | O_WRONLY, 0644 );
+  if ( fd < 0 || ftruncate( fd, size ) < 0 ) {
+    state.SkipWithError( "no scratch file" );
+    return;
+  }
+  close( fd );
+
+  struct nfs_fh_inline ifh;
+  if ( !env.mount() || !env.lookup( "/file", &ifh ) ) {
+    state.SkipWithError( "mount failed" );
+    return;
+  }
+  struct nfs_fh       fh = nfs_fh_inline_get( &ifh );
+  std::vector< char > buf( size );
+
+  for ( auto _ : state ) {
+    env.pending = 1;
+    nfs_pread_async( env.nfs, &fh, 0, size, buf.data(), bench_env::done_cb, &env );
+    env.wait();
+  }
+  if ( env.errors ) {
+    state.SkipWithError( "READ failed" );
+  }
+  state.SetBytesProcessed( state.iterations() * size );
+}
+BENCHMARK( BM_loopback_read )->ArgName( "nconnect" )->Arg( 1 )->Arg( 4 )->UseRealTime()->Unit( benchmark::kMillisecond );
+
+/* NULLs from `threads` application threads through one I/O thread, 64 in flight each */
+static void BM_loopback_mt_null( benchmark::State& state ) {
+  const int threads = state.range( 0 );
+  const int depth   = 64;
+  bench_env env( 1 );
+  if ( !env.srv || env.errors ) {
+    state.SkipWithError( "connect failed" );
+    return;
+  }
+  /* connected: hand the context over to an I/O thread */
+  rpc_loop_remove( env.loop, nfs_get_rpc_context( env.nfs ) );
+  struct nfs_mt*     mt = nfs_mt_start( env.nfs );
+  std::atomic< int > errors { 0 };
+
+  auto submitter = [ & ]() {
+    struct nfs_mt_cq* cq   = nfs_mt_cq_create();
+    int               done = 0;
+    for ( int i = 0; i < depth; i++ ) {
+      nfs_mt_null(
+        mt, cq,
+        []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+          ( *(std::atomic< int >*) private_data ) += err < 0;
+        },
+        &errors );
+    }
+    while ( done < depth ) {
+      done += std::max( nfs_mt_cq_run( cq, 100 ), 0 );
+    }
+    nfs_mt_cq_destroy( cq );
+  };
+  for ( auto _ : state ) {
+    std::vector< std::thread > workers;
+    for ( int t = 0; t < threads; t++ ) {
+      workers.emplace_back( submitter );
+    }
+    for ( std::thread& w : workers ) {
+      w.join();
+    }
+  }
+  nfs_mt_stop( mt );
+  if ( errors ) {
+    state.SkipWithError( "NULL failed" );
+  }
+  state.SetItemsProcessed( state.iterations() * threads * depth );
+}
+BENCHMARK( BM_loopback_mt_null )->ArgName( "threads" )->Arg( 1 )->Arg( 4 )->UseRealTime();
+
+int main( int argc, char* argv[] ) {
+#if ENABLE_LOGGING
+  spdlog::set_level( spdlog::level::warn );
+#endif
+  benchmark::Initialize( &argc, argv );
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,41 @@
+#include <benchmark/benchmark.h>
+#include <string>
+
+#include <nfs/v3/nfs_v3.h>
+#if ENABLE_LOGGING
+#include <spdlog/spdlog.h>
+#endif
+
+/* URL parsing, including applying its options to the context */
+static void BM_nfs_parse_url( benchmark::State& state ) {
+  struct nfs_context* nfs = nfs_init_context();
+  const std::string   url = state.range( 0 )
+                              ? "nfs://user@server.example.com:2049/export/some/dir/file.dat"
+                                "?nconnect=4&timeo=600&retrans=3&rsize=1048576&wsize=1048576"
+                                "&readahead=8&lookupcache=65536&negative-ttl=3&actimeo=30"
+                              : "nfs://server.example.com/export/some/dir/file.dat";
+
+  for ( auto _ : state ) {
+    struct nfs_url* u = nfs_parse_url_full( nfs, url );
+    if ( !u ) {
+      state.SkipWithError( "parse failed" );
+      break;
+    }
+    benchmark::DoNotOptimize( u->file.data() );
+    nfs_destroy_url( u );
+  }
+  state.SetItemsProcessed( state.iterations() );
+  nfs_destroy_context( nfs );
+}
+BENCHMARK( BM_nfs_parse_url )->ArgName( "options" )->Arg( 0 )->Arg( 1 );
+
+int main( int argc, char* argv[] ) {
+#if ENABLE_LOGGING
+  /* every parsed URL is logged at info */
+  spdlog::set_level( spdlog::level::warn );
+#endif
+  benchmark::Initialize( &argc, argv );
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
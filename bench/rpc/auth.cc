@@ -0,0 +1,24 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <vector>
+
+#include <rpc/auth.h>
+#include <rpc/rpc.h>
+
+/* Building an AUTH_UNIX credential, as done per context or per user switch. */
+static void BM_authunix_create( benchmark::State& state ) {
+  std::vector< uint32_t > groups( state.range( 0 ) );
+  for ( uint32_t i = 0; i < groups.size(); i++ ) {
+    groups[ i ] = 1000 + i;
+  }
+
+  for ( auto _ : state ) {
+    struct auth* auth = authunix_create( "client.example.com", 1000, 1000, groups.size(), groups.data() );
+    benchmark::DoNotOptimize( auth->ah_cred.oa_base );
+    auth_destroy( auth );
+  }
+  state.SetItemsProcessed( state.iterations() );
+}
+BENCHMARK( BM_authunix_create )->ArgName( "groups" )->Arg( 0 )->Arg( 16 );
+
+BENCHMARK_MAIN();
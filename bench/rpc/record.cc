@@ -0,0 +1,71 @@
+#include <arpa/inet.h>
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <fcntl.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <rpc/rpc.h>
+
+static void put_u32( std::string& s, uint32_t v ) {
+  v = htonl( v );
+  s.append( (const char*) &v, 4 );
+}
+
+/*
+ * Receiving replies of range(0) bytes split into range(1) record fragments
+ * from a socketpair: record marking, reassembly and reply header decoding.
+ * The xids match no call, so replies are dropped after the header, and the
+ * figure includes writing them into the socket.
+ */
+static void BM_rpc_record_reassembly( benchmark::State& state ) {
+  const uint32_t size  = state.range( 0 );
+  const uint32_t frags = state.range( 1 );
+  const uint32_t count = size < 64 * 1024 ? 64 * 1024 / size : 1;
+  int            sv[ 2 ];
+
+  if ( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) < 0 ) {
+    state.SkipWithError( "socketpair failed" );
+    return;
+  }
+  fcntl( sv[ 0 ], F_SETFL, fcntl( sv[ 0 ], F_GETFL ) | O_NONBLOCK );
+  struct rpc_context* rpc = rpc_init_context();
+  rpc->fd                 = sv[ 0 ];
+
+  std::string batch;
+  for ( uint32_t i = 0; i < count; i++ ) {
+    std::string reply;
+    put_u32( reply, 0xdead0000 + i );
+    put_u32( reply, RPC_MSG_REPLY );
+    put_u32( reply, RPC_MSG_ACCEPTED );
+    put_u32( reply, 0 );
+    put_u32( reply, 0 );
+    put_u32( reply, RPC_SUCCESS );
+    reply.resize( size );
+    for ( uint32_t f = 0, pos = 0; f < frags; f++ ) {
+      uint32_t len = f + 1 < frags ? size / frags : size - pos;
+      put_u32( batch, ( f + 1 < frags ? 0 : 0x80000000u ) | len );
+      batch.append( reply, pos, len );
+      pos += len;
+    }
+  }
+
+  for ( auto _ : state ) {
+    if ( write( sv[ 1 ], batch.data(), batch.size() ) != (ssize_t) batch.size() ) {
+      state.SkipWithError( "short write" );
+      break;
+    }
+    if ( rpc_read_from_socket( rpc ) < 0 ) {
+      state.SkipWithError( rpc_get_error( rpc ) );
+      break;
+    }
+  }
+  state.SetItemsProcessed( state.iterations() * count );
+  state.SetBytesProcessed( state.iterations() * batch.size() );
+  rpc_destroy_context( rpc );
+  close( sv[ 1 ] );
+}
+BENCHMARK( BM_rpc_record_reassembly )->ArgNames( { "size", "frags" } )->ArgsProduct( { { 128, 4096, 65536 }, { 1, 4 } } );
+
+BENCHMARK_MAIN();
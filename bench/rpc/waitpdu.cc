@@ -0,0 +1,62 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <vector>
+
+#include <rpc/rpc.h>
+
+/*
+ * Reply matching with N requests in flight: every iteration matches the
+ * oldest outstanding xid and sends a new request in its place, which is what
+ * a pipelined client does in steady state.
+ */
+static void BM_waitpdu_match( benchmark::State& state ) {
+  const uint32_t         inflight = state.range( 0 );
+  struct rpc_hash_table  t {};
+  std::vector< rpc_pdu > pdus( inflight );
+  uint32_t               xid = 0x10000000;
+
+  rpc_hash_init( &t, 2 * inflight );
+  for ( auto& pdu : pdus ) {
+    pdu.xid = xid++;
+    rpc_hash_insert( &t, &pdu );
+  }
+
+  uint32_t oldest = 0x10000000;
+  for ( auto _ : state ) {
+    struct rpc_pdu* pdu = rpc_hash_remove( &t, oldest++ );
+    benchmark::DoNotOptimize( pdu );
+    pdu->xid = xid++;
+    rpc_hash_insert( &t, pdu );
+  }
+  state.SetItemsProcessed( state.iterations() );
+  rpc_hash_destroy( &t );
+}
+BENCHMARK( BM_waitpdu_match )->RangeMultiplier( 4 )->Range( 1, 1 << 16 );
+
+/* Same, but replies come back in a scrambled order. */
+static void BM_waitpdu_match_unordered( benchmark::State& state ) {
+  const uint32_t         inflight = state.range( 0 );
+  struct rpc_hash_table  t {};
+  std::vector< rpc_pdu > pdus( inflight );
+  uint32_t               xid = 0x10000000;
+
+  rpc_hash_init( &t, 2 * inflight );
+  for ( auto& pdu : pdus ) {
+    pdu.xid = xid++;
+    rpc_hash_insert( &t, &pdu );
+  }
+
+  uint32_t i = 0;
+  for ( auto _ : state ) {
+    i                   = ( i + 7919 ) % inflight;
+    struct rpc_pdu* pdu = rpc_hash_remove( &t, pdus[ i ].xid );
+    benchmark::DoNotOptimize( pdu );
+    pdu->xid = xid++;
+    rpc_hash_insert( &t, pdu );
+  }
+  state.SetItemsProcessed( state.iterations() );
+  rpc_hash_destroy( &t );
+}
+BENCHMARK( BM_waitpdu_match_unordered )->RangeMultiplier( 4 )->Range( 1, 1 << 16 );
+
+BENCHMARK_MAIN();
@@ -8,6 +8,9 @@ function(generate_libs lib_name lib_src)
   if(ENABLE_SHARED_LIBS)
     add_library(${lib_name} SHARED ${${lib_src}})
     set_target_properties(${lib_name} PROPERTIES OUTPUT_NAME ${lib_name})
+    if (${ENABLE_LOGGING})
+      target_link_libraries(${lib_name} PRIVATE spdlog)
+    endif()
     message(STATUS "Will Generated shared library: ${lib_name}")
   endif()
 
@@ -47,12 +50,16 @@ function(rpcgen_files file_name file_src enable_xdr)
   endif()
 
   file(READ ${OUTPUT_DIR}/rpcgen_${file_name}.h FILE_CONTENT)
-  string(REPLACE "CLIENT" "void" FILE_CONTENT "${FILE_CONTENT}")
-  string(REPLACE "bool_t" "uint32_t" FILE_CONTENT "${FILE_CONTENT}")
-  string(REPLACE "u_int" "uint32_t" FILE_CONTENT "${FILE_CONTENT}")
-  string(REPLACE "SVCXPRT" "void" FILE_CONTENT "${FILE_CONTENT}")
-  string(REPLACE "xdr" "zdr" FILE_CONTENT "${FILE_CONTENT}")
-  string(REPLACE "XDR" "zdr_t" FILE_CONTENT "${FILE_CONTENT}")
+  # Only whole identifiers are rewritten, so protocol constants that merely
+  # contain one of these words (e.g. SET_TO_CLIENT_TIME) survive untouched.
+  set(ID_L "(^|[^A-Za-z0-9_])")
+  set(ID_R "([^A-Za-z0-9_]|$)")
+  string(REGEX REPLACE "${ID_L}CLIENT${ID_R}" "\\1void\\2" FILE_CONTENT "${FILE_CONTENT}")
+  string(REGEX REPLACE "${ID_L}bool_t${ID_R}" "\\1uint32_t\\2" FILE_CONTENT "${FILE_CONTENT}")
+  string(REGEX REPLACE "${ID_L}u_int${ID_R}" "\\1uint32_t\\2" FILE_CONTENT "${FILE_CONTENT}")
+  string(REGEX REPLACE "${ID_L}SVCXPRT${ID_R}" "\\1void\\2" FILE_CONTENT "${FILE_CONTENT}")
+  string(REGEX REPLACE "${ID_L}xdr" "\\1zdr" FILE_CONTENT "${FILE_CONTENT}")
+  string(REGEX REPLACE "${ID_L}XDR${ID_R}" "\\1zdr_t\\2" FILE_CONTENT "${FILE_CONTENT}")
   string(REPLACE "#include <rpc/rpc.h>" "#include <zdr/zdr.h>" FILE_CONTENT "${FILE_CONTENT}")
 
   file(WRITE ${OUTPUT_DIR}/rpcgen_${file_name}.h "${FILE_CONTENT}")
@@ -104,3 +111,30 @@ function(enable_test_module module_name)
     endforeach()
   endforeach()
 endfunction()
+
+function(enable_bench_module module_name)
+  set(BENCH_ROOT ${CMAKE_SOURCE_DIR}/bench)
+  file(GLOB_RECURSE MODULE_SOURCE ${BENCH_ROOT}/${module_name}/*.cc)
+  foreach(mod_src ${MODULE_SOURCE})
+    get_filename_component(filename ${mod_src} NAME_WE)
+    set(bench_exe bench_${module_name}_${filename})
+    add_executable(${bench_exe} ${mod_src})
+    target_link_libraries(${bench_exe} PRIVATE nfs_v3 rpc_v2 mount benchmark::benchmark pthread)
+    if (${ENABLE_LOGGING})
+      target_link_libraries(${bench_exe} PRIVATE spdlog)
+      target_compile_definitions(${bench_exe} PRIVATE ENABLE_LOGGING)
+    endif()
+    target_include_directories(${bench_exe} PRIVATE
+      ${CMAKE_BINARY_DIR}/rpc
+      ${CMAKE_SOURCE_DIR}/include
+      ${CMAKE_SOURCE_DIR}/include/mount
+      ${CMAKE_SOURCE_DIR}/include/nfs
+      ${CMAKE_SOURCE_DIR}/include/rpc
+    )
+
+    set_property(GLOBAL APPEND PROPERTY BENCH_TARGETS ${bench_exe})
+
+    message(STATUS  "Generate BENCH")
+    message(STATUS " - ${bench_exe}")
+  endforeach()
+endfunction()
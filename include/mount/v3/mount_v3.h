@@ -1,4 +1,47 @@
 #ifndef MOUNT_PROTOCOL_H
 #define MOUNT_PROTOCOL_H
 
+#include <rpc/rpc.h>
+#include <rpcgen_mount.h>
+#include <string>
+#include <vector>
+
+/*
+ * MOUNT v3 service of an rpc_server exporting a single directory: MNT of
+ * `path` returns `fh` with AUTH_UNIX as the only flavor, EXPORT lists it
+ * for everyone, DUMP is always empty and UMNT/UMNTALL do nothing. The
+ * export must outlive the server.
+ */
+struct mount3_export {
+  std::string path;
+  char        fh[ FHSIZE3 ];
+  uint32_t    fh_len;
+};
+
+extern int mount3_server_register( struct rpc_server* srv, struct mount3_export* exp );
+
+/*
+ * Client calls, on any connected or UDP context. EXPORT hands the callback
+ * an `exports*`, valid until it returns.
+ */
+extern int mount3_null_async( struct rpc_context* rpc, rpc_cb cb, void* private_data );
+extern int mount3_export_async( struct rpc_context* rpc, rpc_cb cb, void* private_data );
+
+/*
+ * Scan `servers` for a MOUNT service at `port` in one pass over a UDP
+ * context, see rpc_bind_udp(): an EXPORT (or, without `exports`, a NULL)
+ * to each, all sent in as few sendmmsg()s as fit. The callback runs once
+ * per server, rpc_get_udp_src() telling which; with `is_broadcast` each
+ * entry is a broadcast address, and the callback runs for every server that
+ * answers and then once with RPC_STATUS_TIMEOUT. Returns the number of calls
+ * queued, or -1 if none could be.
+ */
+extern int mount3_discover_async( struct rpc_context*               rpc,
+                                  const std::vector< std::string >& servers,
+                                  int                               port,
+                                  bool                              exports,
+                                  int                               is_broadcast,
+                                  rpc_cb                            cb,
+                                  void*                             private_data );
+
 #endif//! MOUNT_PROTOCOL_H
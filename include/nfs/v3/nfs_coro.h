@@ -0,0 +1,482 @@
+#ifndef NFS_V3_CORO_H
+#define NFS_V3_CORO_H
+
+/*
+ * C++20 coroutine layer over the nfs_*_async() calls:
+ *
+ *   nfs_coro::task< int > copy( struct nfs_context* nfs, const char* path, char* buf ) {
+ *     nfs_coro::lookup_result f = co_await nfs_coro::lookup( nfs, path );
+ *     if ( f.err ) {
+ *       co_return f.err;
+ *     }
+ *     struct nfs_fh fh = nfs_fh_inline_get( &f.fh );
+ *     co_return co_await nfs_coro::pread( nfs, &fh, 0, 4096, buf );
+ *   }
+ *
+ *   int n = nfs_coro::run( loop, copy( nfs, "/etc/motd", buf ) );
+ *
+ * Awaiting an operation starts it and suspends until its callback runs.
+ * The awaiter lives in the coroutine frame and is the callback's
+ * private_data, so nothing is allocated besides the frame and what the
+ * call itself needs. Results are copied out of the callback's data, which
+ * is only valid while it runs; errors are negative errnos as with nfs_cb.
+ *
+ * Tasks are lazy: they start when awaited, passed to when_all() or run().
+ * Everything runs on the thread driving the rpc_loop the context was added
+ * to, see nfs_loop_add(); nothing here is thread-safe.
+ *
+ * The libraries are built as C++17; only code including this header needs
+ * C++20.
+ */
+#if !defined( __cpp_impl_coroutine )
+#error "nfs_coro.h needs C++20 coroutines"
+#endif
+
+#include <cassert>
+#include <cerrno>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+#include <utility>
+#include <vector>
+
+namespace nfs_coro {
+
+template < class T >
+class task;
+
+namespace detail {
+
+struct promise_base {
+  std::coroutine_handle<> continuation;
+  int*                    pending = nullptr; /* outstanding tasks of a when_all() */
+
+  struct final_awaiter {
+    bool await_ready() const noexcept { return false; }
+    template < class P >
+    std::coroutine_handle<> await_suspend( std::coroutine_handle< P > h ) noexcept {
+      promise_base& p = h.promise();
+      if ( p.pending && --*p.pending > 0 ) {
+        return std::noop_coroutine();
+      }
+      return p.continuation ? p.continuation : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter       final_suspend() noexcept { return {}; }
+  void                unhandled_exception() { std::terminate(); }
+};
+
+template < class T >
+struct promise : promise_base {
+  T value {};
+
+  task< T > get_return_object();
+  void      return_value( T v ) { value = std::move( v ); }
+  T         result() { return std::move( value ); }
+};
+
+template < >
+struct promise< void > : promise_base {
+  task< void > get_return_object();
+  void         return_void() {}
+  void         result() {}
+};
+
+}// namespace detail
+
+template < class T >
+class task {
+ public:
+  using promise_type = detail::promise< T >;
+  using handle_type  = std::coroutine_handle< promise_type >;
+
+  task() = default;
+  explicit task( handle_type h ) : h_( h ) {}
+  task( task&& o ) noexcept : h_( std::exchange( o.h_, {} ) ) {}
+  task& operator=( task&& o ) noexcept {
+    if ( this != &o ) {
+      if ( h_ ) {
+        h_.destroy();
+      }
+      h_ = std::exchange( o.h_, {} );
+    }
+    return *this;
+  }
+  task( const task& )            = delete;
+  task& operator=( const task& ) = delete;
+  ~task() {
+    if ( h_ ) {
+      h_.destroy();
+    }
+  }
+
+  bool done() const { return !h_ || h_.done(); }
+
+  /* an empty or moved-from task has nothing to await */
+  bool await_ready() const noexcept {
+    assert( h_ && "awaiting an empty task" );
+    return h_.done();
+  }
+  std::coroutine_handle<> await_suspend( std::coroutine_handle<> waiter ) noexcept {
+    h_.promise().continuation = waiter;
+    return h_;
+  }
+  T await_resume() { return h_.promise().result(); }
+
+ private:
+  template < class U >
+  friend class when_all_awaiter;
+  template < class U >
+  friend U run( struct rpc_loop* loop, task< U > t );
+
+  handle_type h_;
+};
+
+template < class T >
+task< T > detail::promise< T >::get_return_object() {
+  return task< T >( std::coroutine_handle< promise< T > >::from_promise( *this ) );
+}
+
+inline task< void > detail::promise< void >::get_return_object() {
+  return task< void >( std::coroutine_handle< promise< void > >::from_promise( *this ) );
+}
+
+/*
+ * Start all of `tasks` at once and resume when the last one has finished,
+ * with their results in order (nothing for task< void >).
+ */
+template < class T >
+class when_all_awaiter {
+ public:
+  explicit when_all_awaiter( std::vector< task< T > > tasks ) : tasks_( std::move( tasks ) ) {}
+
+  bool await_ready() const noexcept { return tasks_.empty(); }
+  bool await_suspend( std::coroutine_handle<> waiter ) {
+    /* one extra count so that tasks finishing right away cannot resume us */
+    pending_ = (int) tasks_.size() + 1;
+    for ( task< T >& t : tasks_ ) {
+      t.h_.promise().continuation = waiter;
+      t.h_.promise().pending      = &pending_;
+      t.h_.resume();
+    }
+    return --pending_ > 0;
+  }
+  auto await_resume() {
+    if constexpr ( std::is_void_v< T > ) {
+      return;
+    } else {
+      std::vector< T > results;
+      results.reserve( tasks_.size() );
+      for ( task< T >& t : tasks_ ) {
+        results.push_back( t.await_resume() );
+      }
+      return results;
+    }
+  }
+
+ private:
+  std::vector< task< T > > tasks_;
+  int                      pending_ = 0;
+};
+
+template < class T >
+when_all_awaiter< T > when_all( std::vector< task< T > > tasks ) {
+  return when_all_awaiter< T >( std::move( tasks ) );
+}
+
+/* Run `t` to completion on `loop` and return its result. */
+template < class T >
+T run( struct rpc_loop* loop, task< T > t ) {
+  assert( t.h_ && "running an empty task" );
+  t.h_.resume();
+  while ( !t.h_.done() ) {
+    rpc_loop_run_once( loop, 100 );
+  }
+  return t.h_.promise().result();
+}
+
+namespace detail {
+
+/*
+ * An nfs_*_async() call as an awaitable: Op::start() issues it with the
+ * given callback, Op::complete() stores what the callback got. A call that
+ * fails to start, or completes before returning (e.g. from a cache),
+ * does not suspend at all; one that fails to start completes with
+ * rpc_get_errno() and rpc_get_error() of the context, as nfs_cb would.
+ */
+template < class Op, class R >
+struct nfs_op {
+  struct nfs_context*     nfs;
+  R                       result {};
+  std::coroutine_handle<> waiter;
+  bool                    starting = false;
+  bool                    finished = false;
+
+  explicit nfs_op( struct nfs_context* n ) : nfs( n ) {}
+  nfs_op( const nfs_op& )            = delete;
+  nfs_op& operator=( const nfs_op& ) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend( std::coroutine_handle<> h ) {
+    waiter   = h;
+    starting = true;
+    if ( static_cast< Op* >( this )->start( &nfs_op::callback, this ) < 0 ) {
+      static_cast< Op* >( this )->complete( -rpc_get_errno( nfs->rpc ), (void*) rpc_get_error( nfs->rpc ) );
+      finished = true;
+    }
+    starting = false;
+    return !finished;
+  }
+  R await_resume() { return std::move( result ); }
+
+  static void callback( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+    nfs_op* self = (nfs_op*) private_data;
+    static_cast< Op* >( self )->complete( err, data );
+    self->finished = true;
+    if ( !self->starting ) {
+      self->waiter.resume();
+    }
+  }
+};
+
+/* for calls that only report an error or a count */
+template < class Op >
+struct nfs_int_op : nfs_op< Op, int > {
+  using nfs_op< Op, int >::nfs_op;
+  void complete( int err, void* data ) { this->result = err; }
+};
+
+}// namespace detail
+
+struct attr_result {
+  int             err;
+  struct nfs_attr attr;
+};
+
+struct lookup_result {
+  int                  err;
+  struct nfs_fh_inline fh;
+  struct nfs_attr      attr;
+  int                  has_attr;
+};
+
+struct dir_result {
+  int            err;
+  struct nfsdir* dir; /* to be closed with nfs_closedir() */
+};
+
+/* nfs_connect_async() */
+inline auto connect( struct nfs_context* nfs, const char* server, int port ) {
+  struct op : detail::nfs_int_op< op > {
+    const char* server;
+    int         port;
+    op( struct nfs_context* n, const char* s, int p ) : nfs_int_op( n ), server( s ), port( p ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_connect_async( nfs, server, port, cb, pd ); }
+  };
+  return op( nfs, server, port );
+}
+
+/* NFS3_NULL */
+inline auto null( struct nfs_context* nfs ) {
+  struct op : detail::nfs_int_op< op > {
+    using nfs_int_op::nfs_int_op;
+    int start( nfs_cb cb, void* pd ) { return nfs_null_async( nfs, cb, pd ); }
+  };
+  return op( nfs );
+}
+
+/* nfs_getattr_async(); the handle is copied before the call returns */
+inline auto getattr( struct nfs_context* nfs, const struct nfs_fh* fh ) {
+  struct op : detail::nfs_op< op, attr_result > {
+    const struct nfs_fh* fh;
+    op( struct nfs_context* n, const struct nfs_fh* f ) : nfs_op( n ), fh( f ) {}
+    int  start( nfs_cb cb, void* pd ) { return nfs_getattr_async( nfs, fh, cb, pd ); }
+    void complete( int err, void* data ) {
+      result.err = err;
+      if ( err == 0 ) {
+        result.attr = *(struct nfs_attr*) data;
+      }
+    }
+  };
+  return op( nfs, fh );
+}
+
+namespace detail {
+
+template < class Op >
+struct nfs_lookup_op : nfs_op< Op, lookup_result > {
+  using nfs_op< Op, lookup_result >::nfs_op;
+  void complete( int err, void* data ) {
+    this->result.err = err;
+    if ( err == 0 ) {
+      const struct nfsdirent* ent = (const struct nfsdirent*) data;
+      this->result.fh             = ent->fh;
+      this->result.attr           = ent->attr;
+      this->result.has_attr       = ent->has_attr;
+    }
+  }
+};
+
+}// namespace detail
+
+/* nfs_lookup_path_async() */
+inline auto lookup( struct nfs_context* nfs, const char* path ) {
+  struct op : detail::nfs_lookup_op< op > {
+    const char* path;
+    op( struct nfs_context* n, const char* p ) : nfs_lookup_op( n ), path( p ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_lookup_path_async( nfs, path, cb, pd ); }
+  };
+  return op( nfs, path );
+}
+
+/* nfs_lookup_async() */
+inline auto lookup( struct nfs_context* nfs, const struct nfs_fh* dirfh, const char* name ) {
+  struct op : detail::nfs_lookup_op< op > {
+    const struct nfs_fh* dirfh;
+    const char*          name;
+    op( struct nfs_context* n, const struct nfs_fh* d, const char* nm ) : nfs_lookup_op( n ), dirfh( d ), name( nm ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_lookup_async( nfs, dirfh, name, cb, pd ); }
+  };
+  return op( nfs, dirfh, name );
+}
+
+/* nfs_pread_async(): bytes read, less than count only at EOF */
+inline auto pread( struct nfs_context* nfs, const struct nfs_fh* fh, uint64_t offset, uint64_t count, void* buf ) {
+  struct op : detail::nfs_int_op< op > {
+    const struct nfs_fh* fh;
+    uint64_t             offset, count;
+    void*                buf;
+    op( struct nfs_context* n, const struct nfs_fh* f, uint64_t o, uint64_t c, void* b )
+      : nfs_int_op( n ), fh( f ), offset( o ), count( c ), buf( b ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_pread_async( nfs, fh, offset, count, buf, cb, pd ); }
+  };
+  return op( nfs, fh, offset, count, buf );
+}
+
+/* nfs_fh_pread_async(), with readahead */
+inline auto pread( struct nfs_context* nfs, struct nfsfh* fh, uint64_t offset, uint64_t count, void* buf ) {
+  struct op : detail::nfs_int_op< op > {
+    struct nfsfh* fh;
+    uint64_t      offset, count;
+    void*         buf;
+    op( struct nfs_context* n, struct nfsfh* f, uint64_t o, uint64_t c, void* b )
+      : nfs_int_op( n ), fh( f ), offset( o ), count( c ), buf( b ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_fh_pread_async( nfs, fh, offset, count, buf, cb, pd ); }
+  };
+  return op( nfs, fh, offset, count, buf );
+}
+
+/* nfs_pwrite_async(), see there for when it completes */
+inline auto pwrite( struct nfs_context* nfs, struct nfsfh* fh, uint64_t offset, uint64_t count, const void* buf ) {
+  struct op : detail::nfs_int_op< op > {
+    struct nfsfh* fh;
+    uint64_t      offset, count;
+    const void*   buf;
+    op( struct nfs_context* n, struct nfsfh* f, uint64_t o, uint64_t c, const void* b )
+      : nfs_int_op( n ), fh( f ), offset( o ), count( c ), buf( b ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_pwrite_async( nfs, fh, offset, count, buf, cb, pd ); }
+  };
+  return op( nfs, fh, offset, count, buf );
+}
+
+inline auto fsync( struct nfs_context* nfs, struct nfsfh* fh ) {
+  struct op : detail::nfs_int_op< op > {
+    struct nfsfh* fh;
+    op( struct nfs_context* n, struct nfsfh* f ) : nfs_int_op( n ), fh( f ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_fsync_async( nfs, fh, cb, pd ); }
+  };
+  return op( nfs, fh );
+}
+
+inline auto close( struct nfs_context* nfs, struct nfsfh* fh ) {
+  struct op : detail::nfs_int_op< op > {
+    struct nfsfh* fh;
+    op( struct nfs_context* n, struct nfsfh* f ) : nfs_int_op( n ), fh( f ) {}
+    int start( nfs_cb cb, void* pd ) { return nfs_close_async( nfs, fh, cb, pd ); }
+  };
+  return op( nfs, fh );
+}
+
+inline auto opendir( struct nfs_context* nfs, const struct nfs_fh* fh ) {
+  struct op : detail::nfs_op< op, dir_result > {
+    const struct nfs_fh* fh;
+    op( struct nfs_context* n, const struct nfs_fh* f ) : nfs_op( n ), fh( f ) {}
+    int  start( nfs_cb cb, void* pd ) { return nfs_opendir_async( nfs, fh, cb, pd ); }
+    void complete( int err, void* data ) {
+      result.err = err;
+      result.dir = err == 0 ? (struct nfsdir*) data : nullptr;
+    }
+  };
+  return op( nfs, fh );
+}
+
+/*
+ * A raw call on `rpc`: encode( zdr_t* ) writes the arguments and returns
+ * false on failure; on_reply( int status, void* data ) is called with the
+ * decoded reply and must copy out whatever it needs. Yields the
+ * RPC_STATUS_* of the call, or -1 if it could not be sent.
+ */
+template < class Encode, class OnReply >
+struct rpc_call_op {
+  struct rpc_context*     rpc;
+  uint32_t                program, version, procedure;
+  zdrproc_t               decode;
+  uint32_t                decode_size;
+  Encode                  encode;
+  OnReply                 on_reply;
+  int                     status   = -1;
+  bool                    starting = false;
+  bool                    finished = false;
+  std::coroutine_handle<> waiter;
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend( std::coroutine_handle<> h ) {
+    waiter              = h;
+    starting            = true;
+    struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, program, version, procedure, &rpc_call_op::callback, this, decode, decode_size, 0 );
+    if ( !pdu ) {
+      finished = true;
+    } else if ( !encode( &pdu->zdr ) ) {
+      rpc_set_error( rpc, "Failed to encode arguments" );
+      rpc_free_pdu( rpc, pdu );
+      finished = true;
+    } else if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+      rpc_free_pdu( rpc, pdu );
+      finished = true;
+    }
+    starting = false;
+    return !finished;
+  }
+  int await_resume() { return status; }
+
+  static void callback( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    rpc_call_op* self = (rpc_call_op*) private_data;
+    self->status      = status;
+    self->on_reply( status, data );
+    self->finished = true;
+    if ( !self->starting ) {
+      self->waiter.resume();
+    }
+  }
+};
+
+template < class Encode, class OnReply >
+rpc_call_op< Encode, OnReply > rpc_call( struct rpc_context* rpc,
+                                         uint32_t            program,
+                                         uint32_t            version,
+                                         uint32_t            procedure,
+                                         zdrproc_t           decode,
+                                         uint32_t            decode_size,
+                                         Encode              encode,
+                                         OnReply             on_reply ) {
+  return { rpc, program, version, procedure, decode, decode_size, std::move( encode ), std::move( on_reply ), -1, false, false, {} };
+}
+
+}// namespace nfs_coro
+
+#endif//! NFS_V3_CORO_H
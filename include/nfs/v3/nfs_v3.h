@@ -5,6 +5,7 @@
 #include <rpcgen_mount.h>
 #include <rpcgen_nfs_v3.h>
 
+#include <cstring>
 #include <memory>
 #include <string>
 #include <utility>
@@ -80,46 +81,199 @@ struct nfs_fh {
   char* val;
 };
 
+/*
+ * A handle held in place rather than on the heap, for long-lived
+ * structures and cache keys. The bytes past len are zero, so equality
+ * compares all NFS3_FHSIZE bytes a word at a time with no length-dependent
+ * branches; hash is set once by nfs_fh_inline_set().
+ */
+struct nfs_fh_inline {
+  alignas( 8 ) char val[ NFS3_FHSIZE ];
+  uint32_t len;
+  uint32_t hash;
+};
+
+extern int           nfs_fh_inline_set( struct nfs_fh_inline* ifh, const struct nfs_fh* fh );
+extern struct nfs_fh nfs_fh_inline_get( const struct nfs_fh_inline* ifh );
+
+static inline bool nfs_fh_inline_equal( const struct nfs_fh_inline* a, const struct nfs_fh_inline* b ) {
+  uint64_t diff = ( a->len ^ b->len ) | ( a->hash ^ b->hash );
+  for ( int i = 0; i < NFS3_FHSIZE; i += 8 ) {
+    uint64_t x, y;
+    memcpy( &x, a->val + i, 8 );
+    memcpy( &y, b->val + i, 8 );
+    diff |= x ^ y;
+  }
+  return diff == 0;
+}
+
+/* for unordered containers keyed by handles, or by pointers into entries */
+struct nfs_fh_inline_hasher {
+  size_t operator()( const struct nfs_fh_inline& fh ) const { return fh.hash; }
+  size_t operator()( const struct nfs_fh_inline* fh ) const { return fh->hash; }
+};
+
+struct nfs_fh_inline_eq {
+  bool operator()( const struct nfs_fh_inline& a, const struct nfs_fh_inline& b ) const { return nfs_fh_inline_equal( &a, &b ); }
+  bool operator()( const struct nfs_fh_inline* a, const struct nfs_fh_inline* b ) const { return nfs_fh_inline_equal( a, b ); }
+};
+
+/*
+ * An open file: a handle plus the write-behind state of nfs_pwrite_async()
+ * and the readahead state of nfs_fh_pread_async(), see nfs_open_fh().
+ */
+struct nfs_wb;
+struct nfs_ra;
+struct nfsfh {
+  struct nfs_fh  fh;
+  struct nfs_wb* wb;
+  struct nfs_ra* ra;
+};
+
+/*
+ * A directory entry from READDIRPLUS or LOOKUP; fh.len is 0 and has_attr
+ * unset when the server did not send them.
+ */
+struct nfsdirent {
+  struct nfsdirent*    next;
+  char*                name;
+  uint64_t             inode;
+  uint64_t             cookie;
+  struct nfs_fh_inline fh;
+  struct nfs_attr      attr;
+  int                  has_attr;
+};
+
+/*
+ * An open directory listing, see nfs_opendir_async(). attr is the
+ * directory's as of the end of the listing, if has_attr.
+ */
 struct nfsdir {
-  struct nfs_fh   fh;
-  struct nfs_attr attr;
-  struct nfsdir*  next;
+  struct nfs_fh_inline fh;
+  struct nfs_attr      attr;
+  struct nfsdir*       next;
 
   struct nfsdirent* entries;
   struct nfsdirent* current;
+
+  char cookieverf[ NFS3_COOKIEVERFSIZE ];
+  int  has_attr;
 };
 
 struct nested_mounts {
   struct nested_mounts* next;
   char*                 path;
-  struct nfs_fh         fh;
+  struct nfs_fh_inline  fh;
   struct nfs_attr       attr;
 };
 
+/* upper bound of the nconnect URL argument */
+#define NFS_MAX_NCONNECT 16
+
+struct nfs_context;
+
+/* READ calls kept in flight by one nfs_pread_async(), see read-window */
+#define NFS_DEF_READ_WINDOW 8
+#define NFS_MAX_READ_WINDOW 128
+
+/* UNSTABLE WRITE calls kept in flight per file, see write-window */
+#define NFS_DEF_WRITE_WINDOW 8
+#define NFS_MAX_WRITE_WINDOW 128
+
+/* dirty bytes per file before write-behind flushes and commits, see max-dirty */
+#define NFS_DEF_MAX_DIRTY ( 64 * 1024 * 1024 )
+
+/* bytes read ahead of a sequential reader per file, see readahead */
+#define NFS_DEF_READAHEAD ( 8 * 1024 * 1024 )
+
+/* bytes held in readahead buffers by all files of a context, see readahead-max */
+#define NFS_DEF_READAHEAD_MAX ( 64 * 1024 * 1024 )
+
+/* directory listings kept by nfs_closedir(), see dircache */
+#define NFS_MAX_DIRCACHE 128
+
+/* attribute cache: entries, shards and timeouts in seconds, see attrcache */
+#define NFS_DEF_ATTRCACHE_SIZE ( 64 * 1024 )
+#define NFS_ATTRCACHE_SHARDS   16
+#define NFS_DEF_ACREGMIN       3
+#define NFS_DEF_ACREGMAX       60
+#define NFS_DEF_ACDIRMIN       30
+#define NFS_DEF_ACDIRMAX       60
+
+/* name lookups: cached entries and seconds ENOENT is cached, see lookupcache */
+#define NFS_DEF_LOOKUPCACHE_SIZE ( 64 * 1024 )
+#define NFS_DEF_NEGATIVE_TTL     3
+
+struct nfs_attrcache;
+struct nfs_attrcache_stats {
+  uint64_t hits;
+  uint64_t misses; /* ... including expired entries */
+  uint64_t evictions;
+  uint64_t entries;
+};
+
+/*
+ * Completion of an asynchronous nfs call: err is 0 (or the byte count of a
+ * read) on success or a negative errno, in which case data is the error
+ * message. A call that cannot be started returns -1 instead, with
+ * rpc_get_error() and rpc_get_errno() of nfs->rpc saying why.
+ */
+typedef void ( *nfs_cb )( int err, struct nfs_context* nfs, void* data, void* private_data );
+
 struct nfs_context_internal {
-  char*         server;
-  char*         ex_port;
-  char*         cwd;
-  struct nfs_fh rootfh;
-  size_t        readmax;
-  size_t        writemax;
+  char*                server;
+  char*                ex_port;
+  char*                cwd;
+  struct nfs_fh_inline rootfh;
+  size_t               readmax;
+  size_t               writemax;
 
   int auto_reconnect;
   int timeout;
   int retrans;
 
-  int                   dircache_enabled;
-  struct nfsdir*        dircache;
-  uint16_t              mask;
-  int                   auto_traverse_mounts;
-  struct nested_mounts* nested_mounts;
-  int                   default_version;
+  int                        dircache_enabled;
+  struct nfsdir*             dircache; /* most recently closed first */
+  struct nfs_dircache_index* dircache_index;
+  uint16_t                   mask;
+  int                        auto_traverse_mounts;
+  struct nested_mounts*      nested_mounts;
+  int                        default_version;
 
   int      version;
   int      nfsport;
   int      mountport;
   uint32_t readdir_dircount;
   uint32_t readdir_maxcount;
+
+  /*
+   * Connections to the server, rpcs[ 0 ] being nfs_context::rpc. Requests
+   * are spread over them, see nfs_select_rpc().
+   */
+  int                 nconnect;
+  struct rpc_context* rpcs[ NFS_MAX_NCONNECT ];
+
+  int      read_window;
+  int      write_window;
+  uint64_t max_dirty;
+  uint64_t readahead;
+  uint64_t readahead_max;
+  uint64_t readahead_bytes; /* held by all open files */
+
+  struct nfs_attrcache* attrcache; /* nullptr when disabled */
+  int                   acregmin;
+  int                   acregmax;
+  int                   acdirmin;
+  int                   acdirmax;
+
+  struct nfs_dentry_cache* dentries;
+  int                      negative_ttl;
+
+  /* nfs_connect_async() in progress */
+  nfs_cb connect_cb;
+  void*  connect_data;
+  int    connect_pending;
+  int    connect_err;
 };
 
 struct nfs_url {
@@ -135,6 +289,7 @@ struct nfs_context {
 };
 
 extern struct nfs_context* nfs_init_context( void );
+extern void                nfs_destroy_context( struct nfs_context* nfs );
 
 extern struct nfs_url* nfs_parse_url_full( struct nfs_context* nfs,
                                            const std::string&  url );
@@ -147,17 +302,228 @@ extern struct nfs_url*     nfs_parse_url_incomplete( struct nfs_context* nfs,
 extern struct rpc_context* nfs_get_rpc_context( struct nfs_context* nfs );
 extern void                nfs_destroy_url( struct nfs_url* url );
 
+/*
+ * Event loop integration, see rpc_get_fd() / rpc_which_events() /
+ * rpc_service(). These only cover the first connection; with nconnect > 1
+ * either attach the context to an rpc_loop or drive every
+ * nfs_get_connection() yourself.
+ */
+extern int nfs_get_fd( struct nfs_context* nfs );
+extern int nfs_which_events( struct nfs_context* nfs );
+extern int nfs_service( struct nfs_context* nfs, int revents );
+
+/*
+ * Batch the requests issued between these into as few writes as possible,
+ * see rpc_cork().
+ */
+extern void nfs_cork( struct nfs_context* nfs );
+extern void nfs_uncork( struct nfs_context* nfs );
+
+/*
+ * Open nconnect connections to `server` (port 0 means the nfsport argument,
+ * or 2049) and call `cb` once all of them are up or one has failed.
+ */
+extern int nfs_connect_async( struct nfs_context* nfs,
+                              const char*         server,
+                              int                 port,
+                              nfs_cb              cb,
+                              void*               private_data );
+extern int nfs_loop_add( struct rpc_loop* loop, struct nfs_context* nfs );
+
+extern int                 nfs_num_connections( struct nfs_context* nfs );
+extern struct rpc_context* nfs_get_connection( struct nfs_context* nfs, int i );
+extern struct rpc_context* nfs_select_rpc( struct nfs_context* nfs );
+/* the stats of all connections, into a snapshot from rpc_alloc_stats() */
+extern void                nfs_get_stats( struct nfs_context* nfs, struct rpc_stats* stats );
+extern std::string         nfs_format_stats( struct nfs_context* nfs, bool json );
+
+extern int nfs_null_async( struct nfs_context* nfs, nfs_cb cb, void* private_data );
+extern int nfs_getattr_async( struct nfs_context* nfs, const struct nfs_fh* fh, nfs_cb cb, void* private_data );
+
+/*
+ * Single NFSv3 calls on any connected or UDP context, see rpc_bind_udp(),
+ * bypassing the caches and connections of an nfs_context: health and
+ * metadata scans over many servers from one socket. The callback gets the
+ * GETATTR3res*, ACCESS3res* or LOOKUP3res*, valid until it returns; NULL is
+ * rpc_null_async( rpc, NFS_PROGRAM, NFS_V3, ... ).
+ */
+extern int nfs3_getattr_async( struct rpc_context* rpc, const struct nfs_fh* fh, rpc_cb cb, void* private_data );
+extern int nfs3_access_async( struct rpc_context* rpc, const struct nfs_fh* fh, uint32_t access, rpc_cb cb, void* private_data );
+extern int nfs3_lookup_async( struct rpc_context* rpc, const struct nfs_fh* dirfh, const char* name, rpc_cb cb, void* private_data );
+
+/*
+ * Name lookups, cached by parent handle and name including ENOENT, see
+ * nfs_set_lookupcache(). cb gets a struct nfsdirent* as data.
+ */
+extern int                      nfs_lookup_async( struct nfs_context* nfs, const struct nfs_fh* dirfh, const char* name, nfs_cb cb, void* private_data );
+extern int                      nfs_lookup_path_async( struct nfs_context* nfs, const char* path, nfs_cb cb, void* private_data );
+extern struct nfs_dentry_cache* nfs_dentry_cache_create( size_t max_entries );
+extern void                     nfs_dentry_cache_destroy( struct nfs_dentry_cache* dc );
+extern void                     nfs_dentry_put( struct nfs_context* nfs, const struct nfs_fh_inline* dirfh, const char* name, const struct nfs_fh_inline* child );
+extern void                     nfs_dentry_invalidate( struct nfs_context* nfs, const struct nfs_fh* dirfh, const char* name );
+
+extern int               nfs_opendir_async( struct nfs_context* nfs, const struct nfs_fh* fh, nfs_cb cb, void* private_data );
+extern struct nfsdirent* nfs_readdir( struct nfs_context* nfs, struct nfsdir* dir );
+extern void              nfs_rewinddir( struct nfs_context* nfs, struct nfsdir* dir );
+extern void              nfs_closedir( struct nfs_context* nfs, struct nfsdir* dir );
+extern void              nfs_free_dircache( struct nfs_context* nfs );
+extern int               nfs_dircache_lookup( struct nfs_context* nfs, const struct nfs_fh_inline* dirfh, const char* name, struct nfsdirent** ent );
+extern int nfs_pread_async( struct nfs_context*  nfs,
+                            const struct nfs_fh* fh,
+                            uint64_t             offset,
+                            uint64_t             count,
+                            void*                buf,
+                            nfs_cb               cb,
+                            void*                private_data );
+
+/*
+ * Write-behind: nfs_pwrite_async() copies the data and completes at once
+ * unless the file already has max_dirty bytes buffered, in which case it
+ * completes once enough of them have been committed. Data goes out as
+ * writemax-sized UNSTABLE WRITEs and is kept until a COMMIT with a matching
+ * verifier; nfs_fsync_async() and nfs_close_async() report write errors.
+ */
+extern struct nfsfh* nfs_open_fh( struct nfs_context* nfs, const struct nfs_fh* fh );
+extern int           nfs_pwrite_async( struct nfs_context* nfs,
+                                       struct nfsfh*       nfsfh,
+                                       uint64_t            offset,
+                                       uint64_t            count,
+                                       const void*         buf,
+                                       nfs_cb              cb,
+                                       void*               private_data );
+extern int           nfs_fsync_async( struct nfs_context* nfs, struct nfsfh* nfsfh, nfs_cb cb, void* private_data );
+/*
+ * Like nfs_pread_async(), on an open file: sequential and strided readers
+ * are served from buffers read ahead of them, see nfs_set_readahead().
+ */
+extern int           nfs_fh_pread_async( struct nfs_context* nfs,
+                                         struct nfsfh*       nfsfh,
+                                         uint64_t            offset,
+                                         uint64_t            count,
+                                         void*               buf,
+                                         nfs_cb              cb,
+                                         void*               private_data );
+extern int           nfs_close_async( struct nfs_context* nfs, struct nfsfh* nfsfh, nfs_cb cb, void* private_data );
+extern void          nfs_ra_release( struct nfs_context* nfs, struct nfsfh* nfsfh );
+extern void          nfs_ra_invalidate( struct nfs_context* nfs, struct nfsfh* nfsfh, uint64_t offset, uint64_t count );
+/*
+ * Reads of bytes that are buffered by nfs_pwrite_async() and not on the
+ * server yet wait for them to be written, see nfs_fh_pread_async().
+ */
+extern bool          nfs_wb_pending( struct nfsfh* nfsfh, uint64_t offset, uint64_t count );
+extern int           nfs_wb_wait_read( struct nfs_context* nfs,
+                                       struct nfsfh*       nfsfh,
+                                       uint64_t            offset,
+                                       uint64_t            count,
+                                       void*               buf,
+                                       nfs_cb              cb,
+                                       void*               private_data );
+
+/*
+ * Attribute cache, filled from GETATTR and the post-op attributes of other
+ * replies. nfs_attrcache_get() returns 0 with fresh attributes, -1 if there
+ * are none.
+ */
+extern struct nfs_attrcache* nfs_attrcache_create( size_t max_entries );
+extern void                  nfs_attrcache_destroy( struct nfs_attrcache* ac );
+extern int                   nfs_attrcache_get( struct nfs_context* nfs, const struct nfs_fh* fh, struct nfs_attr* attr );
+extern void                  nfs_attrcache_put( struct nfs_context* nfs, const struct nfs_fh* fh, const fattr3* attr );
+extern void                  nfs_attrcache_invalidate( struct nfs_context* nfs, const struct nfs_fh* fh );
+extern void                  nfs_attrcache_update( struct nfs_context* nfs, const struct nfs_fh* fh, const post_op_attr* attr );
+extern void                  nfs_attrcache_update_wcc( struct nfs_context* nfs, const struct nfs_fh* fh, const wcc_data* wcc );
+extern void                  nfs_get_attrcache_stats( struct nfs_context* nfs, struct nfs_attrcache_stats* stats );
+extern void                  nfs_fattr3_to_attr( const fattr3* f, struct nfs_attr* attr );
+
+extern int         nfs_status_to_errno( int rpc_status );
+extern int         nfsstat3_to_errno( int status );
+extern const char* nfsstat3_to_str( int status );
+
 extern void nfs_set_timeout( struct nfs_context* nfs, int timeout_msecs );
 extern void nfs_set_retrans( struct nfs_context* nfs, int retrans );
+extern void nfs_set_adaptive_timeout( struct nfs_context* nfs, int enable );
+extern void nfs_set_transport( struct nfs_context* nfs, int transport );
+extern void nfs_set_timer_slack( struct nfs_context* nfs, int msecs );
 extern void nfs_set_auto_traverse_mounts( struct nfs_context* nfs, int enabled );
 extern void nfs_set_dircache( struct nfs_context* nfs, int enabled );
 extern void nfs_set_autoreconnect( struct nfs_context* nfs, int num_retries );
+extern void nfs_set_nconnect( struct nfs_context* nfs, int num_connections );
 extern int  nfs_set_version( struct nfs_context* nfs, int version );
 extern void nfs_set_nfsport( struct nfs_context* nfs, int port );
 extern void nfs_set_mountport( struct nfs_context* nfs, int port );
 extern void nfs_set_readmax( struct nfs_context* nfs, size_t readmax );
 extern void nfs_set_writemax( struct nfs_context* nfs, size_t writemax );
+extern void nfs_set_read_window( struct nfs_context* nfs, int window );
+extern void nfs_set_write_window( struct nfs_context* nfs, int window );
+extern void nfs_set_max_dirty( struct nfs_context* nfs, uint64_t bytes );
+extern void nfs_set_readahead( struct nfs_context* nfs, uint64_t bytes );
+extern void nfs_set_readahead_max( struct nfs_context* nfs, uint64_t bytes );
+extern void nfs_set_attrcache( struct nfs_context* nfs, size_t max_entries );
+extern void nfs_set_attrcache_timeouts( struct nfs_context* nfs, int acregmin, int acregmax, int acdirmin, int acdirmax );
+extern void nfs_set_lookupcache( struct nfs_context* nfs, size_t max_entries );
+extern void nfs_set_negative_ttl( struct nfs_context* nfs, int seconds );
 extern void nfs_set_readdir_max_buffer_size( struct nfs_context* nfs,
                                              uint32_t            dircount,
                                              uint32_t            maxcount );
+
+/*
+ * Loopback NFSv3 + MOUNT server exporting the directory `root` on
+ * 127.0.0.1:port (0 picks a free port), for tests and benchmarks. MNT of
+ * nfs_server_get_export() returns the root handle. Latency, loss and
+ * counters are set and read through nfs_server_get_rpc_server().
+ */
+struct nfs_server;
+extern struct nfs_server* nfs_server_start( const char* root, int port, int num_workers );
+extern int                nfs_server_get_port( struct nfs_server* srv );
+extern const char*        nfs_server_get_export( struct nfs_server* srv );
+extern struct rpc_server* nfs_server_get_rpc_server( struct nfs_server* srv );
+extern void               nfs_server_stop( struct nfs_server* srv );
+
+/*
+ * Multi-threaded mode, see nfs_mt.cc. nfs_mt_start() hands the context,
+ * configured and not attached to a loop, to a new I/O thread; from then on
+ * it is only used through the calls below, which any thread may make.
+ * Completions are queued on `cq` and their callbacks run from
+ * nfs_mt_cq_run() on the thread calling it, with data pointing to a copy of
+ * the result; with a nullptr cq they run on the I/O thread. nfs_mt_exec()
+ * runs `fn` on the I/O thread, for anything else. Files are opened with
+ * nfs_open_fh() and then only used through nfs_mt_pwrite(), nfs_mt_fsync()
+ * and nfs_mt_close(); buffers passed to nfs_mt_pread() and nfs_mt_pwrite()
+ * must stay valid until the callback. A call that fails on the I/O thread
+ * completes with its errno and the error message as data. A queue can only
+ * be destroyed once none of its calls are in flight, else -1 with EBUSY.
+ * After nfs_mt_stop() the context is owned by the caller again; calls still
+ * in flight complete on destruction.
+ */
+struct nfs_mt;
+struct nfs_mt_cq;
+typedef void ( *nfs_mt_fn )( struct nfs_context* nfs, void* arg );
+extern struct nfs_mt*    nfs_mt_start( struct nfs_context* nfs );
+extern void              nfs_mt_stop( struct nfs_mt* mt );
+extern int               nfs_mt_exec( struct nfs_mt* mt, nfs_mt_fn fn, void* arg );
+extern struct nfs_mt_cq* nfs_mt_cq_create( void );
+extern int               nfs_mt_cq_destroy( struct nfs_mt_cq* cq );
+extern int               nfs_mt_cq_fd( struct nfs_mt_cq* cq );
+extern int               nfs_mt_cq_run( struct nfs_mt_cq* cq, int timeout_msecs );
+extern int               nfs_mt_connect( struct nfs_mt* mt, const char* server, int port, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data );
+extern int               nfs_mt_null( struct nfs_mt* mt, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data );
+extern int               nfs_mt_getattr( struct nfs_mt* mt, const struct nfs_fh* fh, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data );
+extern int               nfs_mt_lookup_path( struct nfs_mt* mt, const char* path, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data );
+extern int               nfs_mt_pread( struct nfs_mt*       mt,
+                                       const struct nfs_fh* fh,
+                                       uint64_t             offset,
+                                       uint64_t             count,
+                                       void*                buf,
+                                       struct nfs_mt_cq*    cq,
+                                       nfs_cb               cb,
+                                       void*                private_data );
+extern int               nfs_mt_pwrite( struct nfs_mt*    mt,
+                                        struct nfsfh*     nfsfh,
+                                        uint64_t          offset,
+                                        uint64_t          count,
+                                        const void*       buf,
+                                        struct nfs_mt_cq* cq,
+                                        nfs_cb            cb,
+                                        void*             private_data );
+extern int               nfs_mt_fsync( struct nfs_mt* mt, struct nfsfh* nfsfh, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data );
+extern int               nfs_mt_close( struct nfs_mt* mt, struct nfsfh* nfsfh, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data );
 #endif//! NFS_V3_H
@@ -38,5 +38,6 @@ struct auth* authunix_create( const char* host,
                               uint32_t    len,
                               uint32_t*   groups );
 struct auth* authunix_create_default( void );
+void         auth_destroy( struct auth* auth );
 
 #endif//! RPC_V2_AUTH_H
@@ -5,11 +5,14 @@
 #include <cstdint>
 #include <memory>
 #include <net/if.h>
+#include <string>
 #include <sys/socket.h>
 
 #include <auth.h>
+#include <zdr/zdr.h>
 
-#define DEFAULT_HASHES      4
+#define NFSMAXDATA2         8192 /* NFSv2 transfer size, the smallest we use */
+#define DEFAULT_HASHES      64
 #define NFS_RA_TIMEOUT      5
 #define NFS_MIN_XFER_SIZE   NFSMAXDATA2
 #define NFS_MAX_XFER_SIZE   ( 4 * 1024 * 1024 )
@@ -17,17 +20,73 @@
 #define RPC_CONTEXT_MAGIC   0xc6e46435
 #define RPC_PARAM_UNDEFINED -1
 
+#define RPC_STATUS_SUCCESS 0
+#define RPC_STATUS_ERROR   1
+#define RPC_STATUS_CANCEL  2
+#define RPC_STATUS_TIMEOUT 3
+
+#define RPC_MSG_VERSION     2
+#define RPC_MAX_AUTH_SIZE   400
+#define RPC_PDU_HEADER_ROOM ( 64 * 1024 )
+#define RPC_MAX_PDU_SIZE    ( NFS_MAX_XFER_SIZE + RPC_PDU_HEADER_ROOM )
+#define RPC_DEF_ARGS_SIZE   2048
+#define RPC_DECODE_BUF_SIZE 512
+
+/*
+ * Bytes of a READ reply read into inbuf before the payload is located: the
+ * reply header with an AUTH_NONE verifier (24) and a READ3resok with
+ * attributes (104). Whatever part of the payload is already in there is
+ * copied, the rest is received straight into rpc_pdu::indata.
+ */
+#define RPC_IOVEC_HEADER_SIZE 128
+
+/* iovec entries gathered into one sendmsg(), at most three per PDU */
+#define RPC_MAX_IOVECS 64
+
+/*
+ * Decoded lists (READDIR entries, export lists) need scratch memory next to
+ * the reply; every list node is at most this many times larger than the
+ * smallest wire encoding it can come from.
+ */
+#define RPC_DECODE_SCRATCH_RATIO 5
+
+/* back-off between reconnect attempts, doubling from min to max (msecs) */
+#define RPC_RECONNECT_MIN_DELAY 100
+#define RPC_RECONNECT_MAX_DELAY 5000
+
+/* rpc_set_transport(), taking effect from the next connect */
+#define RPC_TRANSPORT_SOCKET 0 /* non-blocking readv() / sendmsg() */
+#define RPC_TRANSPORT_URING  1 /* io_uring, falling back to the above */
+
+enum rpc_msg_type {
+  RPC_MSG_CALL  = 0,
+  RPC_MSG_REPLY = 1,
+};
+
+enum rpc_reply_stat {
+  RPC_MSG_ACCEPTED = 0,
+  RPC_MSG_DENIED   = 1,
+};
+
+enum rpc_accept_stat {
+  RPC_SUCCESS       = 0,
+  RPC_PROG_UNAVAIL  = 1,
+  RPC_PROG_MISMATCH = 2,
+  RPC_PROC_UNAVAIL  = 3,
+  RPC_GARBAGE_ARGS  = 4,
+  RPC_SYSTEM_ERR    = 5,
+};
+
+enum rpc_reject_stat {
+  RPC_MISMATCH   = 0,
+  RPC_AUTH_ERROR = 1,
+};
+
 struct rpc_data {
   int32_t size;
   char*   data;
 };
 
-struct rpc_pdu {
-  struct rpc_pdu* next;
-  uint32_t        xid;
-  struct rpc_data outdata;
-};
-
 struct rpc_context;
 typedef void ( *rpc_cb )(
   struct rpc_context* rpc,
@@ -35,10 +94,116 @@ typedef void ( *rpc_cb )(
   void*               data,
   void*               private_data );
 
+/* rpc_pdu::flags */
+#define PDU_DECODE_LISTS 0x00000001 /* reply contains optional-data lists */
+#define PDU_SENDING      0x00000002 /* in an io_uring send that has not completed */
+#define PDU_BROADCAST    0x00000004 /* UDP call answered by any number of servers */
+
+/*
+ * Per-context timer wheel, see timer.cc. A timer is armed while pprev is
+ * set; data is the owner's. Expired timers run cb, or time out the rpc_pdu
+ * in data when it is not set.
+ */
+#define RPC_TIMER_LEVELS    4
+#define RPC_TIMER_BITS      6
+#define RPC_TIMER_SLOTS     ( 1 << RPC_TIMER_BITS )
+#define RPC_DEF_TIMER_SLACK 10
+
+/*
+ * Classes of procedures that get separate round-trip time estimates, as a
+ * READ of a few MiB takes far longer than a GETATTR. The protocol layer
+ * sets rpc_pdu::rtt_class; anything it does not set is metadata.
+ */
+enum rpc_rtt_class {
+  RPC_RTT_METADATA    = 0,
+  RPC_RTT_READ        = 1,
+  RPC_RTT_WRITE       = 2,
+  RPC_RTT_COMMIT      = 3,
+  RPC_RTT_NUM_CLASSES = 4,
+};
+
+/* msecs; a retransmit timeout never goes below this */
+#define RPC_MIN_RTO 50
+
+struct rpc_timer {
+  struct rpc_timer*  next;
+  struct rpc_timer** pprev;
+  uint64_t           expires;
+  int                level;
+  void*              data;
+  void ( *cb )( struct rpc_context* rpc, struct rpc_timer* t );
+};
+
+struct rpc_timer_wheel {
+  struct rpc_timer* slots[ RPC_TIMER_LEVELS ][ RPC_TIMER_SLOTS ];
+  uint32_t          count[ RPC_TIMER_LEVELS ];
+  uint64_t          now; /* ticks before this one have been expired */
+  uint32_t          slack;
+
+  /* a wheel nested in parent's: proxy is armed there no later than any timer here */
+  struct rpc_timer_wheel* parent;
+  struct rpc_timer        proxy;
+};
+
+struct rpc_pdu {
+  struct rpc_pdu* next;
+  uint32_t        xid;
+  struct rpc_data outdata;    /* record marker + call header + arguments */
+  struct rpc_data outpayload; /* optional bulk argument sent after outdata */
+  struct rpc_data indata;     /* optional destination of the reply payload */
+  uint32_t        written;    /* bytes of the record already on the wire */
+  uint32_t        procedure;
+  uint32_t        flags;
+
+  rpc_cb    cb;
+  void*     private_data;
+  zdrproc_t zdr_decode_fn;
+  uint32_t  zdr_decode_bufsize;
+
+  /* encode cursor, positioned after the call header */
+  zdr_t zdr;
+
+  /* absolute deadline in rpc_current_time() units, 0 for none */
+  uint64_t         timeout;
+  struct rpc_timer timer;
+  uint32_t         retransmits; /* after minor timeouts, see rpc_set_retrans() */
+  uint32_t         rtt_class;   /* enum rpc_rtt_class */
+  uint64_t         queued_at;   /* rpc_current_time_us() when first queued */
+  uint64_t         sent_at;     /* rpc_current_time_us() when last written out */
+  uint32_t         decode_us;   /* spent decoding a READ_IOVEC reply header, */
+  uint32_t         reply_size;  /* and the size of that reply */
+
+  /* request plus expected reply bytes, see rpc_context::outstanding_bytes */
+  uint32_t cost;
+
+  /* where a UDP call goes, rpc_context::udp_dest when it was queued */
+  struct sockaddr_storage udp_dest;
+};
+
 struct rpc_queue {
   struct rpc_pdu *head, *tail;
 };
 
+/*
+ * Pending (sent, awaiting reply) PDUs, keyed by xid.
+ *
+ * Open addressing with linear probing over a power-of-two slot array. The xid
+ * is kept next to the PDU pointer so a probe never touches the PDU itself,
+ * and deletion shifts the following cluster back instead of leaving
+ * tombstones, so lookups stay short no matter how many replies have been
+ * matched. The table doubles once it is half full.
+ */
+struct rpc_hash_slot {
+  uint32_t        xid;
+  struct rpc_pdu* pdu;
+};
+
+struct rpc_hash_table {
+  struct rpc_hash_slot* slots;
+  uint32_t              mask;
+  uint32_t              count;
+};
+
 enum input_state {
   READ_RM       = 0,
   READ_PAYLOAD  = 1,
@@ -48,10 +213,73 @@ enum input_state {
   READ_UNKNOWN  = 5,
 };
 
-struct rpc_fragment {
-  struct rpc_fragment* next;
-  uint32_t             size;
-  char*                data;
+/*
+ * Refcounted segment of a chained buffer. Each fragment of a multi-fragment
+ * record is received straight into one, and the record is decoded where
+ * the fragments are, see rpc_process_iobuf(); views into it stay valid for
+ * as long as a reference is held. seg.data is ZDR_UNIT bytes into mem, as
+ * zdr_chain_create() wants, and seg.next links the chain.
+ */
+struct rpc_iobuf {
+  struct zdr_seg seg;
+  char*          mem;
+  uint32_t       capacity;
+  uint32_t       refs;
+};
+
+static inline struct rpc_iobuf* rpc_iobuf_next( const struct rpc_iobuf* iob ) {
+  return (struct rpc_iobuf*) iob->seg.next;
+}
+
+/*
+ * Jacobson/Karels estimate for one rpc_rtt_class, in usecs, and the
+ * retransmit timeout derived from it, srtt + 4 * rttvar, in msecs.
+ */
+struct rpc_rtt_stats {
+  uint64_t samples;
+  uint32_t srtt;
+  uint32_t rttvar;
+  uint32_t rto;
+};
+
+/*
+ * Latencies in usecs, log-linear: exact below RPC_HIST_SUB, then
+ * RPC_HIST_SUB buckets per power of two, so a bucket is at most a quarter
+ * of its lower bound wide. The last bucket takes anything above an hour.
+ */
+#define RPC_HIST_SUB_BITS 2
+#define RPC_HIST_SUB      ( 1 << RPC_HIST_SUB_BITS )
+#define RPC_HIST_BUCKETS  ( 32 << RPC_HIST_SUB_BITS )
+
+struct rpc_histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[ RPC_HIST_BUCKETS ];
+};
+
+/*
+ * Where the time of a call goes: waiting in the outqueue and being written,
+ * from then on until its reply has been received, and decoding that reply.
+ * Total runs from queueing to decoded.
+ */
+enum rpc_latency {
+  RPC_LAT_QUEUE  = 0,
+  RPC_LAT_WIRE   = 1,
+  RPC_LAT_DECODE = 2,
+  RPC_LAT_TOTAL  = 3,
+  RPC_LAT_NUM    = 4,
+};
+
+/* procedures 0 to 21, NFSv3 NULL..COMMIT; others are not broken down */
+#define RPC_STATS_NUM_PROCS 22
+
+struct rpc_proc_stats {
+  uint64_t              ops;    /* replies received */
+  uint64_t              errors; /* timed out, or a reply that failed to decode */
+  uint64_t              bytes_sent;
+  uint64_t              bytes_rcvd;
+  struct rpc_histogram* latency; /* RPC_LAT_NUM of them from the first reply on, else nullptr */
 };
 
 struct rpc_stats {
@@ -105,6 +333,99 @@ struct rpc_stats {
    * - Major timeout was observed.
    */
   uint64_t num_reconnects;
+
+  /*
+   * System calls made to move data: readv() and sendmsg() on a socket, or
+   * io_uring_enter() with the io_uring transport.
+   */
+  uint64_t num_syscalls;
+
+  /*
+   * Round-trip times per rpc_rtt_class, sampled from replies to requests
+   * that were sent only once. See rpc_set_adaptive_timeout().
+   */
+  struct rpc_rtt_stats rtt[ RPC_RTT_NUM_CLASSES ];
+
+  /*
+   * Per procedure number. Like every word above, only the context's own
+   * thread writes these, each with a single relaxed atomic store, so
+   * recording never waits and rpc_get_stats() may take a snapshot from any
+   * thread.
+   */
+  struct rpc_proc_stats procs[ RPC_STATS_NUM_PROCS ];
+};
+
+/*
+ * Per-context free lists for PDUs, iobufs and buffers.
+ *
+ * Buffers come in size classes from RPC_POOL_MIN_SIZE up to max_class (the
+ * negotiated transfer size plus header room, see rpc_set_max_xfer_size());
+ * bigger requests go straight to the heap. Freed objects are cached, but
+ * rpc_pool_trim() (run about every RPC_POOL_TRIM_INTERVAL msecs) gives back
+ * whatever was not needed at the high-water mark of the previous period, and
+ * no more than max_cached bytes are ever kept.
+ */
+#define RPC_POOL_MIN_SIZE      256
+#define RPC_POOL_NUM_CLASSES   64
+#define RPC_POOL_MAX_CACHED    ( 32 * 1024 * 1024 )
+#define RPC_POOL_TRIM_INTERVAL 1000
+
+struct rpc_pool_list {
+  void*    head; /* singly linked through the first word */
+  uint32_t num_free;
+  uint32_t in_use;
+  uint32_t hiwat; /* max in_use since the last trim */
+};
+
+struct rpc_pool_stats {
+  uint64_t num_allocs;   /* objects and buffers handed out */
+  uint64_t num_hits;     /* ... of which came from a free list */
+  uint64_t num_oversize; /* ... of which were too big for any class */
+  uint64_t num_trimmed;  /* cached objects given back to the heap */
+  uint64_t bytes_in_use;
+  uint64_t bytes_cached;
+};
+
+struct rpc_pool {
+  struct rpc_pool_list  classes[ RPC_POOL_NUM_CLASSES ];
+  struct rpc_pool_list  pdus;
+  struct rpc_pool_list  iobufs;
+  uint32_t              max_class;
+  uint64_t              max_cached;
+  uint64_t              last_trim;
+  struct rpc_pool_stats stats;
+};
+
+/*
+ * A call header from the xid through the verifier, encoded once for a
+ * program, version and credential. rpc_allocate_pdu() copies it and only
+ * patches in the xid and procedure.
+ */
+#define RPC_CALL_TEMPLATES     4
+#define RPC_CALL_TEMPLATE_SIZE ( 6 * 4 + 2 * ( 8 + RPC_MAX_AUTH_SIZE ) )
+#define RPC_CALL_XID_OFFSET    0
+#define RPC_CALL_PROC_OFFSET   20
+
+struct rpc_call_template {
+  const struct auth* auth;
+  uint32_t           program;
+  uint32_t           version;
+  uint32_t           size; /* 0 for an unused slot */
+  char               data[ RPC_CALL_TEMPLATE_SIZE ];
+};
+
+/*
+ * AUTH_UNIX credentials by uid/gid, so that a client switching between
+ * users with rpc_set_uid()/rpc_set_gid() builds each one only once. The
+ * least recently used one goes when the cache is full.
+ */
+#define RPC_CRED_CACHE_SIZE 8
+
+struct rpc_cred {
+  struct auth* auth; /* nullptr for an unused slot */
+  int          uid;
+  int          gid;
+  uint64_t     last_used;
 };
 
 struct rpc_context {
@@ -116,6 +437,7 @@ struct rpc_context {
   int      is_nonblocking;
 
   char* error_string;
+  int   error_errno; /* what error_string is about, see rpc_get_errno() */
 
   uint32_t program;
   uint32_t version;
@@ -123,16 +445,20 @@ struct rpc_context {
   rpc_cb connect_cb;
   void*  connect_data;
 
-  struct auth* auth;
-  uint32_t     xid;
+  struct auth*             auth; /* nullptr until needed after a uid/gid change */
+  uint32_t                 xid;
+  struct rpc_cred          creds[ RPC_CRED_CACHE_SIZE ];
+  uint64_t                 cred_clock;
+  struct rpc_call_template templates[ RPC_CALL_TEMPLATES ];
+  uint32_t                 next_template; /* slot to replace on a miss */
 
   struct rpc_queue        outqueue;
   struct sockaddr_storage udp_src;
   uint32_t                num_hashes;
 
-  struct rpc_queue* waitpdu;
-  uint32_t          waitpdu_len;
-  uint32_t          max_waitpdu_len;
+  struct rpc_hash_table waitpdu;
+  uint32_t              waitpdu_len;
+  uint32_t              max_waitpdu_len;
 
   uint32_t         inpos;
   uint32_t         inbuf_size;
@@ -141,17 +467,21 @@ struct rpc_context {
   uint32_t         rm_xid[ 2 ]; /* array holding the record marker and the next 4 bytes */
   uint32_t         pdu_size;    /* used in rpc_read_from_socket() */
   char*            buf;         /* used in rpc_read_from_socket() */
-  struct rpc_pdu*  pdu;
+  uint32_t         iov_len;     /* payload bytes still to be received at buf */
+  struct rpc_pdu*  pdu;         /* reply being received into pdu->indata */
 
   int                     is_udp;
   struct sockaddr_storage udp_dest;
   int                     is_broadcast;
+  char*                   udp_buf; /* RPC_UDP_RECV_BATCH datagrams */
 
   struct sockaddr_storage s;
   int                     auto_reconnect;
   int                     num_retries;
   char*                   server;
-  struct rpc_fragment*    fragments;
+  struct rpc_iobuf*       fragments; /* of the record being received */
+  struct rpc_iobuf*       last_fragment;
+  struct rpc_iobuf*       reply_iobuf; /* being decoded, see rpc_process_iobuf() */
 
   int      tcp_syncnt;
   int      uid;
@@ -161,27 +491,333 @@ struct rpc_context {
   uint64_t last_successful_rpc_response;
   int      timeout;
   int      retrans;
+  int      adaptive_timeout;
+
+  /* deadlines of queued and pending PDUs */
+  struct rpc_timer_wheel timers;
 
   char ifname[ IFNAMSIZ ];
   int  poll_timeout;
 
   /* Is a server context ? */
-  int                  is_server_context;
-  struct rpc_endpoint* endpoints;
+  int                     is_server_context;
+  struct rpc_endpoint*    endpoints;
+  struct rpc_server_conn* server_conn; /* connection of a server context */
 
   /* Per-transport RPC stats */
   struct rpc_stats stats;
+
+  /* Event loop driving this context, if any */
+  struct rpc_loop* loop;
+
+  /* RPC_TRANSPORT_*, and the io_uring of the connection if it has one */
+  int               transport;
+  struct rpc_uring* uring;
+
+  /* while non-zero, queued PDUs are held back, see rpc_cork() */
+  int corked;
+
+  /* the last sendmsg() hit EAGAIN: nothing goes out before POLLOUT */
+  bool write_blocked;
+
+  /* rpc_pdu::cost of everything queued or awaiting a reply */
+  uint64_t outstanding_bytes;
+
+  /* lost connection being re-established, see rpc_set_autoreconnect() */
+  int      is_reconnecting;
+  int      reconnect_attempts;
+  uint64_t reconnect_at;
+
+  struct rpc_pool pool;
+
+  /*
+   * Replies are decoded into these and handed to the callback, so they are
+   * only valid until the callback returns. Reused for every reply.
+   */
+  alignas( 8 ) char decode_buf[ RPC_DECODE_BUF_SIZE ];
+  char*    decode_scratch;
+  uint32_t decode_scratch_size;
 };
 
 extern struct rpc_context* rpc_init_context( void );
 extern bool                rpc_set_hash_size( struct rpc_context* rpc, int hashes );
 extern uint64_t            rpc_current_time( void );
+extern uint64_t            rpc_current_time_us( void );
 extern void                rpc_reset_queue( struct rpc_queue* q );
 extern bool                rpc_set_username( struct rpc_context* rpc, const std::string& username );
 extern void                rpc_set_tcp_syncnt( struct rpc_context* rpc, int v );
 extern void                rpc_set_uid( struct rpc_context* rpc, int uid );
 extern void                rpc_set_gid( struct rpc_context* rpc, int gid );
+extern struct auth*        rpc_get_auth( struct rpc_context* rpc );
+extern void                rpc_free_creds( struct rpc_context* rpc );
 extern void                rpc_set_debug( struct rpc_context* rpc, int level );
 extern void                rpc_set_timeout( struct rpc_context* rpc, int timeout_msecs );
+extern void                rpc_set_autoreconnect( struct rpc_context* rpc, int num_retries );
+extern void                rpc_set_retrans( struct rpc_context* rpc, int retrans );
+extern void                rpc_set_timer_slack( struct rpc_context* rpc, uint32_t msecs );
+extern void                rpc_set_adaptive_timeout( struct rpc_context* rpc, int enable );
+extern void                rpc_set_transport( struct rpc_context* rpc, int transport );
+extern int                 rpc_get_transport( struct rpc_context* rpc );
+
+/*
+ * rpc_get_stats() copies the stats of a context into a snapshot from
+ * rpc_alloc_stats(), and may be called from any thread; rpc_merge_stats()
+ * adds those of another connection. Snapshots own their histograms, so they
+ * are released with rpc_free_stats() and not copied. Percentiles (p in
+ * [0, 1]) are bucket upper bounds in usecs. rpc_format_stats() names
+ * procedure N proc_names[ N ] (may be nullptr) and returns text or JSON.
+ */
+extern struct rpc_stats* rpc_alloc_stats( void );
+extern void              rpc_free_stats( struct rpc_stats* stats );
+extern void              rpc_get_stats( struct rpc_context* rpc, struct rpc_stats* stats );
+extern void              rpc_merge_stats( struct rpc_stats* dst, const struct rpc_stats* src );
+extern uint64_t          rpc_histogram_percentile( const struct rpc_histogram* h, double p );
+extern std::string       rpc_format_stats( const struct rpc_stats* stats, const char* const* proc_names, bool json );
+
+extern void        rpc_destroy_context( struct rpc_context* rpc );
+extern void        rpc_set_error( struct rpc_context* rpc, const char* fmt, ... )
+  __attribute__( ( format( printf, 2, 3 ) ) );
+extern void        rpc_set_error_errno( struct rpc_context* rpc, int err, const char* fmt, ... )
+  __attribute__( ( format( printf, 3, 4 ) ) );
+extern const char* rpc_get_error( struct rpc_context* rpc );
+extern int         rpc_get_errno( struct rpc_context* rpc );
+
+extern struct rpc_pdu* rpc_allocate_pdu( struct rpc_context* rpc,
+                                         uint32_t            program,
+                                         uint32_t            version,
+                                         uint32_t            procedure,
+                                         rpc_cb              cb,
+                                         void*               private_data,
+                                         zdrproc_t           zdr_decode_fn,
+                                         uint32_t            zdr_decode_bufsize,
+                                         uint32_t            args_size );
+extern void            rpc_free_pdu( struct rpc_context* rpc, struct rpc_pdu* pdu );
+extern void            rpc_pdu_set_payload( struct rpc_pdu* pdu, char* data, uint32_t len );
+extern int             rpc_queue_pdu( struct rpc_context* rpc, struct rpc_pdu* pdu );
+extern int             rpc_process_pdu( struct rpc_context* rpc, char* buf, uint32_t size );
+extern int             rpc_process_iobuf( struct rpc_context* rpc, struct rpc_iobuf* chain );
+extern bool            rpc_decode_iovec_reply( struct rpc_context* rpc,
+                                               struct rpc_pdu*     pdu,
+                                               char*               buf,
+                                               uint32_t            size,
+                                               uint32_t*           len,
+                                               uint32_t*           have );
+extern void            rpc_error_all_pdus( struct rpc_context* rpc, int status, const char* error );
+extern void            rpc_requeue_pending_pdus( struct rpc_context* rpc );
+extern void            rpc_timeout_scan( struct rpc_context* rpc );
+extern void            rpc_pdu_sent( struct rpc_context* rpc, struct rpc_pdu* pdu );
+extern void            rpc_pdu_replied( struct rpc_context* rpc, struct rpc_pdu* pdu, uint32_t size );
+extern void            rpc_stats_sent( struct rpc_context* rpc, struct rpc_pdu* pdu );
+extern void            rpc_stats_replied( struct rpc_context* rpc, struct rpc_pdu* pdu, uint32_t size, uint64_t now );
+extern void            rpc_stats_decoded( struct rpc_context* rpc, struct rpc_pdu* pdu, uint32_t decode_us, bool ok );
+extern void            rpc_stats_failed( struct rpc_context* rpc, struct rpc_pdu* pdu );
+extern void            rpc_reset_stats( struct rpc_stats* stats );
+
+/* writes to struct rpc_stats, by the servicing thread only, see stats.cc */
+static inline void rpc_stat_add( uint64_t* v, uint64_t n ) {
+  __atomic_store_n( v, *v + n, __ATOMIC_RELAXED );
+}
+
+static inline void rpc_stat_set( uint32_t* v, uint32_t x ) {
+  __atomic_store_n( v, x, __ATOMIC_RELAXED );
+}
+
+extern int             rpc_null_async( struct rpc_context* rpc,
+                                       uint32_t            program,
+                                       uint32_t            version,
+                                       rpc_cb              cb,
+                                       void*               private_data );
+
+extern int  rpc_connect_async( struct rpc_context* rpc,
+                               const char*         server,
+                               int                 port,
+                               rpc_cb              cb,
+                               void*               private_data );
+extern void rpc_disconnect( struct rpc_context* rpc, const char* error );
+extern void rpc_socket_error( struct rpc_context* rpc, const char* error );
+extern int  rpc_get_fd( struct rpc_context* rpc );
+extern int  rpc_which_events( struct rpc_context* rpc );
+extern int  rpc_service( struct rpc_context* rpc, int revents );
+extern int  rpc_queue_length( struct rpc_context* rpc );
+extern void rpc_cork( struct rpc_context* rpc );
+extern void rpc_uncork( struct rpc_context* rpc );
+extern int  rpc_read_from_socket( struct rpc_context* rpc );
+extern int  rpc_write_to_socket( struct rpc_context* rpc );
+extern int  rpc_pdu_iov( const struct rpc_pdu* pdu, struct iovec* iov );
+extern void rpc_retire_written( struct rpc_context* rpc, size_t n );
+extern void rpc_free_fragments( struct rpc_context* rpc );
+
+/*
+ * UDP transport, see udp.cc, for small calls to many servers from one
+ * socket. Calls go to the destination set when they are queued, in batches
+ * of up to RPC_UDP_BATCH datagrams per sendmmsg(); replies come in through
+ * recvmmsg() and rpc_get_udp_src() tells the callback who sent them. A
+ * broadcast call is answered by every server that hears it: its callback
+ * runs once per reply, then a last time with RPC_STATUS_TIMEOUT when the
+ * timeout ends the collection. The calls are those of mount3_*_async() and
+ * nfs3_*_async(), which take any context.
+ */
+#define RPC_UDP_BATCH      64
+#define RPC_UDP_RECV_BATCH 16
+#define RPC_UDP_BUF_SIZE   ( 16 << 10 ) /* largest reply taken over UDP */
+extern int                    rpc_bind_udp( struct rpc_context* rpc, const char* addr, int port );
+extern int                    rpc_set_udp_destination( struct rpc_context* rpc, const char* addr, int port, int is_broadcast );
+extern const struct sockaddr* rpc_get_udp_src( struct rpc_context* rpc );
+extern socklen_t              rpc_sockaddr_len( const struct sockaddr_storage* s );
+extern int                    rpc_read_from_udp( struct rpc_context* rpc );
+extern int                    rpc_write_to_udp( struct rpc_context* rpc );
+
+/*
+ * io_uring transport, see uring.cc. rpc_uring_create() fails when the
+ * kernel (or the build) lacks what it needs, and the connection then uses
+ * plain socket I/O. rpc_uring_reap() turns completions into the revents
+ * rpc_service() expects; rpc_write_to_socket() only prepares sends and
+ * rpc_uring_submit() hands everything to the kernel in one system call.
+ */
+#define RPC_URING_ENTRIES  64          /* submission queue */
+#define RPC_URING_BUFS     64          /* receive buffers, a power of two */
+#define RPC_URING_BUF_SIZE ( 16 << 10 )
+#define RPC_URING_SENDS    8           /* linked sendmsg()s in flight */
+extern int     rpc_uring_create( struct rpc_context* rpc );
+extern void    rpc_uring_destroy( struct rpc_context* rpc );
+extern int     rpc_uring_fd( struct rpc_context* rpc );
+extern int     rpc_uring_poll_connect( struct rpc_context* rpc );
+extern int     rpc_uring_reap( struct rpc_context* rpc );
+extern ssize_t rpc_uring_readv( struct rpc_context* rpc, const struct iovec* iov, int iovcnt );
+extern int     rpc_uring_write( struct rpc_context* rpc );
+extern bool    rpc_uring_pending( struct rpc_context* rpc );
+extern int     rpc_uring_submit( struct rpc_context* rpc );
+
+/*
+ * Built-in edge-triggered epoll loop. Any number of contexts can be attached;
+ * each context's socket is (re-)registered automatically whenever it is
+ * (re)connected, and its timer wheel nested in the loop's, so that only
+ * contexts with events or due timers are serviced. Only rpc_loop_post(),
+ * rpc_loop_wakeup() and rpc_loop_stop() may be called from other threads
+ * than the one running it.
+ */
+struct rpc_loop;
+typedef void ( *rpc_loop_fn )( void* arg );
+#define RPC_LOOP_RING_SIZE 4096 /* tasks posted but not yet run, a power of two */
+extern struct rpc_loop* rpc_loop_create( void );
+extern void             rpc_loop_destroy( struct rpc_loop* loop );
+extern int              rpc_loop_add( struct rpc_loop* loop, struct rpc_context* rpc );
+extern void             rpc_loop_remove( struct rpc_loop* loop, struct rpc_context* rpc );
+extern int              rpc_loop_update_fd( struct rpc_context* rpc, int old_fd );
+extern void             rpc_loop_service_by( struct rpc_context* rpc, uint64_t deadline );
+extern int              rpc_loop_run_once( struct rpc_loop* loop, int timeout_msecs );
+extern int              rpc_loop_run( struct rpc_loop* loop );
+extern void             rpc_loop_stop( struct rpc_loop* loop );
+extern void             rpc_loop_wakeup( struct rpc_loop* loop );
+extern int              rpc_loop_post( struct rpc_loop* loop, rpc_loop_fn fn, void* arg );
+
+/*
+ * Server side, see server.cc. Every accepted connection is a server context
+ * read by its own thread; the calls it receives are matched against the
+ * endpoints registered for their program and version and run on a pool of
+ * worker threads, which send the replies.
+ *
+ * A service procedure decodes its arguments from `args`, encodes its
+ * results into `res` and returns an rpc_accept_stat. Bulk results (READ
+ * data) are read into call->payload and passed with zdr_set_payload(), so
+ * they are sent from there rather than copied into `res`.
+ */
+struct rpc_call {
+  uint32_t xid;
+  uint32_t program;
+  uint32_t version;
+  uint32_t procedure;
+  uint32_t flavor; /* of the credentials; uid and gid are set for AUTH_UNIX */
+  uint32_t uid;
+  uint32_t gid;
+
+  char*    payload; /* the worker's, payload_size bytes */
+  uint32_t payload_size;
+};
+
+typedef uint32_t ( *rpc_service_fn )( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data );
+
+struct rpc_service_proc {
+  uint32_t       procedure;
+  rpc_service_fn fn;
+};
+
+struct rpc_endpoint {
+  struct rpc_endpoint*           next;
+  uint32_t                       program;
+  uint32_t                       version;
+  const struct rpc_service_proc* procs;
+  uint32_t                       num_procs;
+  void*                          private_data;
+};
+
+struct rpc_server_stats {
+  uint64_t num_calls;    /* calls received */
+  uint64_t num_replies;  /* replies sent */
+  uint64_t num_dropped;  /* replies thrown away, see rpc_server_set_loss() */
+  uint64_t num_rejected; /* calls answered with an error accept_stat, or denied */
+  uint64_t num_conns;    /* connections accepted */
+};
+
+/* default worker threads of rpc_server_create() */
+#define RPC_SERVER_DEF_WORKERS 4
+
+struct rpc_server;
+extern struct rpc_server* rpc_server_create( int port, int num_workers );
+extern int                rpc_server_register( struct rpc_server*             srv,
+                                               uint32_t                       program,
+                                               uint32_t                       version,
+                                               const struct rpc_service_proc* procs,
+                                               uint32_t                       num_procs,
+                                               void*                          private_data );
+extern int                rpc_server_start( struct rpc_server* srv );
+extern int                rpc_server_get_port( struct rpc_server* srv );
+extern void               rpc_server_set_latency( struct rpc_server* srv, uint32_t usecs, uint32_t jitter_usecs );
+extern void               rpc_server_set_loss( struct rpc_server* srv, double probability );
+extern void               rpc_server_get_stats( struct rpc_server* srv, struct rpc_server_stats* stats );
+extern void               rpc_server_destroy( struct rpc_server* srv );
+extern int                rpc_process_call( struct rpc_context* rpc, char* buf, uint32_t size );
+
+extern void                 rpc_pool_init( struct rpc_pool* pool, uint32_t max_size );
+extern void                 rpc_pool_destroy( struct rpc_pool* pool );
+extern void                 rpc_pool_set_max_size( struct rpc_pool* pool, uint32_t max_size );
+extern char*                rpc_pool_alloc( struct rpc_pool* pool, uint32_t size, uint32_t* capacity );
+extern void                 rpc_pool_free( struct rpc_pool* pool, char* p, uint32_t capacity );
+extern struct rpc_pdu*      rpc_pool_get_pdu( struct rpc_pool* pool );
+extern void                 rpc_pool_put_pdu( struct rpc_pool* pool, struct rpc_pdu* pdu );
+extern void                 rpc_pool_trim( struct rpc_pool* pool, bool all );
+extern void                 rpc_set_max_xfer_size( struct rpc_context* rpc, uint32_t size );
+extern void                 rpc_get_pool_stats( struct rpc_context* rpc, struct rpc_pool_stats* stats );
+
+/*
+ * rpc_iobuf_alloc() returns a segment of `size` bytes holding one
+ * reference. rpc_iobuf_get() takes another reference to every segment of a
+ * chain, rpc_iobuf_put() drops one, and a segment goes back to the pool
+ * with its last. Only on the thread that services the context.
+ *
+ * A reply callback that keeps views into a multi-fragment reply takes a
+ * reference to rpc_get_reply_iobuf(), which is nullptr for a flat record.
+ */
+extern struct rpc_iobuf* rpc_iobuf_alloc( struct rpc_pool* pool, uint32_t size );
+extern void              rpc_iobuf_get( struct rpc_iobuf* chain );
+extern void              rpc_iobuf_put( struct rpc_pool* pool, struct rpc_iobuf* chain );
+extern uint32_t          rpc_iobuf_length( const struct rpc_iobuf* chain );
+extern struct rpc_iobuf* rpc_get_reply_iobuf( struct rpc_context* rpc );
+
+extern void              rpc_timer_init( struct rpc_timer_wheel* w, uint64_t now );
+extern void              rpc_timer_arm( struct rpc_timer_wheel* w, struct rpc_timer* t, uint64_t deadline );
+extern void              rpc_timer_cancel( struct rpc_timer_wheel* w, struct rpc_timer* t );
+extern struct rpc_timer* rpc_timer_expire( struct rpc_timer_wheel* w, uint64_t now );
+extern uint64_t          rpc_timer_next( const struct rpc_timer_wheel* w );
+
+extern bool            rpc_hash_init( struct rpc_hash_table* t, uint32_t size );
+extern void            rpc_hash_destroy( struct rpc_hash_table* t );
+extern bool            rpc_hash_insert( struct rpc_hash_table* t, struct rpc_pdu* pdu );
+extern struct rpc_pdu* rpc_hash_lookup( const struct rpc_hash_table* t, uint32_t xid );
+extern struct rpc_pdu* rpc_hash_remove( struct rpc_hash_table* t, uint32_t xid );
+
+extern bool            rpc_add_waitpdu( struct rpc_context* rpc, struct rpc_pdu* pdu );
+extern struct rpc_pdu* rpc_find_waitpdu( struct rpc_context* rpc, uint32_t xid );
+extern struct rpc_pdu* rpc_remove_waitpdu( struct rpc_context* rpc, uint32_t xid );
 
 #endif//! RPC_V2_H
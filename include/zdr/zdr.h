@@ -1,12 +1,547 @@
 #ifndef NFS_ZDR_H
 #define NFS_ZDR_H
 
+#include <arpa/inet.h>
 #include <cstdint>
+#include <cstring>
 #include <sys/types.h>
+#include <type_traits>
 
+#define ZDR_UNIT           4
+#define ZDR_ROUNDUP( len ) ( ( ( len ) + ZDR_UNIT - 1 ) & ~( ZDR_UNIT - 1 ) )
+
+#if defined( __GNUC__ )
+#define ZDR_LIKELY( x )   __builtin_expect( !!( x ), 1 )
+#define ZDR_UNLIKELY( x ) __builtin_expect( !!( x ), 0 )
+#else
+#define ZDR_LIKELY( x )   ( x )
+#define ZDR_UNLIKELY( x ) ( x )
+#endif
+
+enum zdr_op {
+  ZDR_ENCODE = 0,
+  ZDR_DECODE = 1,
+};
+
+/*
+ * One segment of a chained buffer, see zdr_chain_create(). The ZDR_UNIT
+ * bytes in front of data must be writable: zdr_string() may slide a string
+ * that starts a segment back over them.
+ */
+struct zdr_seg {
+  struct zdr_seg* next;
+  char*           data;
+  uint32_t        size;
+};
+
+/**
+ * @brief bounded cursor over a caller-owned buffer
+ *
+ * Encoding stores big-endian XDR units into [buf, buf + size), decoding loads
+ * them back. Nothing is ever allocated from the heap:
+ *  - variable-length opaques (file handles, READ/WRITE payloads) decode as
+ *    views into buf, so buf must outlive the decoded object;
+ *  - strings decode as views as well, and are NUL-terminated in place (see
+ *    zdr_string()), so decoding is destructive and must only be done once;
+ *  - optional-data (READDIR entries, export lists, ...) is carved out of the
+ *    scratch arena [mem, mem + mem_size) given by zdr_set_scratch().
+ *
+ * A chained buffer is decoded segment by segment, buf being the current one;
+ * an item that straddles two segments is gathered into the scratch arena.
+ *
+ * @ref [rfc4506](https://www.rfc-editor.org/rfc/rfc4506)
+ */
 struct zdr_t {
+  enum zdr_op x_op;
+  char*       buf;
+  uint32_t    size;
+  uint32_t    pos;
+
+  char*    mem;
+  uint32_t mem_size;
+  uint32_t mem_pos;
+
+  /* caller-owned destination for a bulk payload, see zdr_set_payload() */
+  char*    ext;
+  uint32_t ext_size;
+  uint32_t ext_len;
+  uint32_t ext_have;
+
+  /* segments after buf, and how many bytes they hold */
+  struct zdr_seg* seg;
+  uint32_t        rest;
 };
 
 typedef uint32_t ( *zdrproc_t )( zdr_t*, void*, ... );
 
+static inline void zdrmem_create( zdr_t*      zdrs,
+                                  char*       buf,
+                                  uint32_t    size,
+                                  enum zdr_op op ) {
+  zdrs->x_op     = op;
+  zdrs->buf      = buf;
+  zdrs->size     = size;
+  zdrs->pos      = 0;
+  zdrs->mem      = nullptr;
+  zdrs->mem_size = 0;
+  zdrs->mem_pos  = 0;
+  zdrs->ext      = nullptr;
+  zdrs->ext_size = 0;
+  zdrs->ext_len  = 0;
+  zdrs->ext_have = 0;
+  zdrs->seg      = nullptr;
+  zdrs->rest     = 0;
+}
+
+/*
+ * Decode a chain of segments as if they were one buffer. Positions
+ * (zdr_getpos()) are relative to the current segment.
+ */
+static inline void zdr_chain_create( zdr_t* zdrs, struct zdr_seg* first ) {
+  zdrmem_create( zdrs, first->data, first->size, ZDR_DECODE );
+  zdrs->seg = first->next;
+  for ( struct zdr_seg* s = zdrs->seg; s; s = s->next ) {
+    zdrs->rest += s->size;
+  }
+}
+
+static inline void zdr_set_scratch( zdr_t* zdrs, char* mem, uint32_t size ) {
+  zdrs->mem      = mem;
+  zdrs->mem_size = size;
+  zdrs->mem_pos  = 0;
+}
+
+/*
+ * Move a variable-length opaque out of line, ext_len is its length.
+ *
+ * Decoding copies the next one into [ext, ext + size) instead of returning a view. The
+ * opaque may run past the end of buf: whatever part is present is copied
+ * (ext_have) and the rest is left for the caller to receive straight into
+ * ext + ext_have, which is how READ payloads avoid passing through the
+ * socket buffer.
+ *
+ * Encoding only emits the length word of the opaque whose data is ext; the
+ * caller sends the data (which must be the last item) and its padding right
+ * after buf, which is how WRITE payloads avoid being copied into it.
+ */
+static inline void zdr_set_payload( zdr_t* zdrs, char* ext, uint32_t size ) {
+  zdrs->ext      = ext;
+  zdrs->ext_size = size;
+  zdrs->ext_len  = 0;
+  zdrs->ext_have = 0;
+}
+
+static inline uint32_t zdr_getpos( const zdr_t* zdrs ) {
+  return zdrs->pos;
+}
+
+static inline uint32_t zdr_setpos( zdr_t* zdrs, uint32_t pos ) {
+  if ( pos > zdrs->size ) {
+    return 0;
+  }
+  zdrs->pos = pos;
+  return 1;
+}
+
+static inline uint32_t zdr_remaining( const zdr_t* zdrs ) {
+  return zdrs->size - zdrs->pos + zdrs->rest;
+}
+
+/*
+ * Carve size bytes out of the scratch arena, zero-filled and 8-byte aligned.
+ */
+static inline void* zdr_alloc( zdr_t* zdrs, uint32_t size ) {
+  uint32_t pos = ( zdrs->mem_pos + 7 ) & ~7u;
+  if ( ZDR_UNLIKELY( pos > zdrs->mem_size || zdrs->mem_size - pos < size ) ) {
+    return nullptr;
+  }
+  zdrs->mem_pos = pos + size;
+  return memset( zdrs->mem + pos, 0, size );
+}
+
+/* step into the next segment of a chain */
+static inline void zdr_next_seg( zdr_t* zdrs ) {
+  zdrs->buf  = zdrs->seg->data;
+  zdrs->size = zdrs->seg->size;
+  zdrs->pos  = 0;
+  zdrs->rest -= zdrs->size;
+  zdrs->seg = zdrs->seg->next;
+}
+
+/*
+ * Copy the next len bytes to dst (or skip them if dst is nullptr), across
+ * segments; len must not be more than zdr_remaining().
+ */
+static inline void zdr_gather( zdr_t* zdrs, char* dst, uint32_t len ) {
+  while ( len ) {
+    if ( zdrs->pos == zdrs->size ) {
+      zdr_next_seg( zdrs );
+    }
+    uint32_t n = zdrs->size - zdrs->pos < len ? zdrs->size - zdrs->pos : len;
+    if ( dst ) {
+      memcpy( dst, zdrs->buf + zdrs->pos, n );
+      dst += n;
+    }
+    zdrs->pos += n;
+    len -= n;
+  }
+}
+
+/*
+ * zdr_inline() past the end of the current segment: step into the next one
+ * if the item starts there, otherwise gather it into the scratch arena,
+ * with ZDR_UNIT bytes of room in front for zdr_string().
+ */
+static inline char* zdr_inline_chain( zdr_t* zdrs, uint32_t len ) {
+  if ( !zdrs->seg || len > zdr_remaining( zdrs ) ) {
+    return nullptr;
+  }
+  while ( zdrs->pos == zdrs->size && zdrs->seg ) {
+    zdr_next_seg( zdrs );
+  }
+  if ( zdrs->size - zdrs->pos >= len ) {
+    char* p = zdrs->buf + zdrs->pos;
+    zdrs->pos += len;
+    return p;
+  }
+  char* p = static_cast< char* >( zdr_alloc( zdrs, ZDR_UNIT + len ) );
+  if ( !p ) {
+    return nullptr;
+  }
+  zdr_gather( zdrs, p + ZDR_UNIT, len );
+  return p + ZDR_UNIT;
+}
+
+/*
+ * Reserve len bytes at the cursor and return a pointer to them, or nullptr if
+ * the buffer is exhausted. Fixed-size structures use this to pay for a single
+ * bounds check and then move every field without further branches.
+ */
+static inline char* zdr_inline( zdr_t* zdrs, uint32_t len ) {
+  if ( ZDR_UNLIKELY( zdrs->size - zdrs->pos < len ) ) {
+    return zdr_inline_chain( zdrs, len );
+  }
+  char* p = zdrs->buf + zdrs->pos;
+  zdrs->pos += len;
+  return p;
+}
+
+static inline uint32_t zdr_get_u32( const char* p ) {
+  uint32_t v;
+  memcpy( &v, p, sizeof( v ) );
+  return ntohl( v );
+}
+
+static inline void zdr_put_u32( char* p, uint32_t v ) {
+  v = htonl( v );
+  memcpy( p, &v, sizeof( v ) );
+}
+
+static inline uint64_t zdr_get_u64( const char* p ) {
+  return ( (uint64_t) zdr_get_u32( p ) << 32 ) | zdr_get_u32( p + 4 );
+}
+
+static inline void zdr_put_u64( char* p, uint64_t v ) {
+  zdr_put_u32( p, (uint32_t) ( v >> 32 ) );
+  zdr_put_u32( p + 4, (uint32_t) v );
+}
+
+/*
+ * Move one 32/64-bit quantity through an already reserved region and step
+ * the region pointer. Used by the fixed-size fast paths.
+ */
+template < typename T >
+static inline void zdr_move( enum zdr_op op, char*& p, T* v ) {
+  static_assert( sizeof( T ) == 4 || sizeof( T ) == 8, "XDR unit size" );
+  if constexpr ( sizeof( T ) == 4 ) {
+    if ( op == ZDR_ENCODE ) {
+      zdr_put_u32( p, (uint32_t) *v );
+    } else {
+      *v = (T) zdr_get_u32( p );
+    }
+  } else {
+    if ( op == ZDR_ENCODE ) {
+      zdr_put_u64( p, (uint64_t) *v );
+    } else {
+      *v = (T) zdr_get_u64( p );
+    }
+  }
+  p += sizeof( T );
+}
+
+static inline uint32_t zdr_void( void ) {
+  return 1;
+}
+
+template < typename T >
+static inline uint32_t zdr_scalar( zdr_t* zdrs, T* v ) {
+  char* p = zdr_inline( zdrs, sizeof( T ) );
+  if ( !p ) {
+    return 0;
+  }
+  zdr_move( zdrs->x_op, p, v );
+  return 1;
+}
+
+static inline uint32_t zdr_u_int( zdr_t* zdrs, uint32_t* v ) {
+  return zdr_scalar( zdrs, v );
+}
+
+static inline uint32_t zdr_int( zdr_t* zdrs, int32_t* v ) {
+  return zdr_scalar( zdrs, v );
+}
+
+static inline uint32_t zdr_uint64_t( zdr_t* zdrs, uint64_t* v ) {
+  return zdr_scalar( zdrs, v );
+}
+
+static inline uint32_t zdr_int64_t( zdr_t* zdrs, int64_t* v ) {
+  return zdr_scalar( zdrs, v );
+}
+
+static inline uint32_t zdr_bool( zdr_t* zdrs, uint32_t* v ) {
+  uint32_t b = *v ? 1 : 0;
+  if ( !zdr_u_int( zdrs, &b ) || b > 1 ) {
+    return 0;
+  }
+  *v = b;
+  return 1;
+}
+
+template < typename E >
+static inline uint32_t zdr_enum( zdr_t* zdrs, E* v ) {
+  static_assert( std::is_enum_v< E > && sizeof( E ) == 4, "XDR enum" );
+  return zdr_scalar( zdrs, reinterpret_cast< int32_t* >( v ) );
+}
+
+/*
+ * Fixed-length opaque (verifiers, v1 handles): copied, since it lives inline
+ * in the decoded structure.
+ */
+static inline uint32_t zdr_opaque( zdr_t* zdrs, char* cp, uint32_t len ) {
+  char* p = zdr_inline( zdrs, ZDR_ROUNDUP( len ) );
+  if ( !p ) {
+    return 0;
+  }
+  if ( zdrs->x_op == ZDR_ENCODE ) {
+    memcpy( p, cp, len );
+    memset( p + len, 0, ZDR_ROUNDUP( len ) - len );
+  } else {
+    memcpy( cp, p, len );
+  }
+  return 1;
+}
+
+template < uint32_t N >
+static inline uint32_t zdr_opaque_fixed( zdr_t* zdrs, char ( &cp )[ N ] ) {
+  constexpr uint32_t wire = ZDR_ROUNDUP( N );
+  char*              p    = zdr_inline( zdrs, wire );
+  if ( !p ) {
+    return 0;
+  }
+  if ( zdrs->x_op == ZDR_ENCODE ) {
+    memcpy( p, cp, N );
+    if constexpr ( wire != N ) {
+      memset( p + N, 0, wire - N );
+    }
+  } else {
+    memcpy( cp, p, N );
+  }
+  return 1;
+}
+
+static inline uint32_t zdr_bytes_ext( zdr_t* zdrs, char** cpp, uint32_t len ) {
+  if ( len > zdrs->ext_size ) {
+    return 0;
+  }
+  if ( zdrs->x_op == ZDR_ENCODE ) {
+    zdrs->ext_len = len;
+    zdrs->ext     = nullptr;
+    return 1;
+  }
+  uint32_t have = zdr_remaining( zdrs ) < len ? zdr_remaining( zdrs ) : len;
+  uint32_t pad  = ZDR_ROUNDUP( len ) - len;
+  zdr_gather( zdrs, zdrs->ext, have );
+  zdr_gather( zdrs, nullptr, zdr_remaining( zdrs ) < pad ? zdr_remaining( zdrs ) : pad );
+
+  *cpp           = len ? zdrs->ext : nullptr;
+  zdrs->ext_len  = len;
+  zdrs->ext_have = have;
+  zdrs->ext      = nullptr;
+  return 1;
+}
+
+/*
+ * Variable-length opaque. Decoding points *cpp into the buffer, or into the
+ * payload buffer if one was set with zdr_set_payload().
+ */
+static inline uint32_t zdr_bytes( zdr_t*    zdrs,
+                                  char**    cpp,
+                                  uint32_t* sizep,
+                                  uint32_t  maxsize ) {
+  if ( !zdr_u_int( zdrs, sizep ) || *sizep > maxsize ) {
+    return 0;
+  }
+  uint32_t len = *sizep;
+  if ( ZDR_UNLIKELY( zdrs->ext != nullptr ) && ( zdrs->x_op == ZDR_DECODE || *cpp == zdrs->ext ) ) {
+    return zdr_bytes_ext( zdrs, cpp, len );
+  }
+  char* p = zdr_inline( zdrs, ZDR_ROUNDUP( len ) );
+  if ( !p ) {
+    return 0;
+  }
+  if ( zdrs->x_op == ZDR_ENCODE ) {
+    if ( len ) {
+      memcpy( p, *cpp, len );
+    }
+    memset( p + len, 0, ZDR_ROUNDUP( len ) - len );
+  } else {
+    *cpp = len ? p : nullptr;
+  }
+  return 1;
+}
+
+/*
+ * Counted string. Decoding returns a NUL-terminated view into the buffer:
+ * when the string is not a multiple of four bytes the terminator goes into
+ * its own padding, otherwise the bytes are slid back over the (already
+ * consumed) length word so that the terminator fits.
+ */
+static inline uint32_t zdr_string( zdr_t* zdrs, char** cpp, uint32_t maxsize ) {
+  uint32_t len = 0;
+  if ( zdrs->x_op == ZDR_ENCODE ) {
+    len = *cpp ? (uint32_t) strlen( *cpp ) : 0;
+  }
+  if ( !zdr_u_int( zdrs, &len ) || len > maxsize ) {
+    return 0;
+  }
+  char* p = zdr_inline( zdrs, ZDR_ROUNDUP( len ) );
+  if ( !p ) {
+    return 0;
+  }
+  if ( zdrs->x_op == ZDR_ENCODE ) {
+    memcpy( p, *cpp, len );
+    memset( p + len, 0, ZDR_ROUNDUP( len ) - len );
+    return 1;
+  }
+  if ( len & ( ZDR_UNIT - 1 ) ) {
+    p[ len ] = '\0';
+  } else {
+    p -= ZDR_UNIT;
+    memmove( p, p + ZDR_UNIT, len );
+    p[ len ] = '\0';
+  }
+  *cpp = p;
+  return 1;
+}
+
+/*
+ * Counted array. Arrays of 32-bit scalars are byte-swapped in place on decode
+ * and returned as a view; anything else goes element by element into the
+ * scratch arena.
+ */
+template < typename T >
+static inline uint32_t zdr_array( zdr_t*    zdrs,
+                                  T**       arrp,
+                                  uint32_t* sizep,
+                                  uint32_t  maxsize,
+                                  uint32_t ( *proc )( zdr_t*, T* ) ) {
+  if ( !zdr_u_int( zdrs, sizep ) || *sizep > maxsize ) {
+    return 0;
+  }
+  uint32_t n = *sizep;
+  if constexpr ( std::is_integral_v< T > && sizeof( T ) == 4 ) {
+    if ( zdrs->x_op == ZDR_DECODE ) {
+      if ( n > zdr_remaining( zdrs ) / 4 ) {
+        return 0;
+      }
+      char* p = zdr_inline( zdrs, n * 4 );
+      if ( !p ) {
+        return 0;
+      }
+      for ( uint32_t i = 0; i < n; i++ ) {
+        uint32_t v = zdr_get_u32( p + i * 4 );
+        memcpy( p + i * 4, &v, 4 );
+      }
+      *arrp = n ? reinterpret_cast< T* >( p ) : nullptr;
+      return 1;
+    }
+  }
+  if ( zdrs->x_op == ZDR_DECODE ) {
+    if ( n > zdr_remaining( zdrs ) / 4 ) {
+      return 0;
+    }
+    *arrp = nullptr;
+    if ( n ) {
+      *arrp = static_cast< T* >( zdr_alloc( zdrs, n * sizeof( T ) ) );
+      if ( !*arrp ) {
+        return 0;
+      }
+    }
+  }
+  for ( uint32_t i = 0; i < n; i++ ) {
+    if ( !proc( zdrs, &( *arrp )[ i ] ) ) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Optional-data, i.e. "T *ptr" in the .x file.
+ */
+template < typename T >
+static inline uint32_t zdr_pointer( zdr_t* zdrs,
+                                    T**    objpp,
+                                    uint32_t ( *proc )( zdr_t*, T* ) ) {
+  uint32_t more = *objpp != nullptr;
+  if ( !zdr_bool( zdrs, &more ) ) {
+    return 0;
+  }
+  if ( !more ) {
+    *objpp = nullptr;
+    return 1;
+  }
+  if ( zdrs->x_op == ZDR_DECODE ) {
+    *objpp = static_cast< T* >( zdr_alloc( zdrs, sizeof( T ) ) );
+    if ( !*objpp ) {
+      return 0;
+    }
+  }
+  return proc( zdrs, *objpp );
+}
+
+/*
+ * Optional-data chained through a next pointer (READDIR entries, export and
+ * mount lists). Walked iteratively so that long directories do not recurse
+ * once per entry; body must encode every member except the link.
+ */
+template < typename T >
+static inline uint32_t zdr_list( zdr_t* zdrs,
+                                 T**    headp,
+                                 T* T::*next,
+                                 uint32_t ( *body )( zdr_t*, T* ) ) {
+  T** linkp = headp;
+  for ( ;; ) {
+    uint32_t more = *linkp != nullptr;
+    if ( !zdr_bool( zdrs, &more ) ) {
+      return 0;
+    }
+    if ( !more ) {
+      *linkp = nullptr;
+      return 1;
+    }
+    if ( zdrs->x_op == ZDR_DECODE ) {
+      *linkp = static_cast< T* >( zdr_alloc( zdrs, sizeof( T ) ) );
+      if ( !*linkp ) {
+        return 0;
+      }
+    }
+    if ( !body( zdrs, *linkp ) ) {
+      return 0;
+    }
+    linkp = &( ( *linkp )->*next );
+  }
+}
+
 #endif//! NFS_ZDR_H
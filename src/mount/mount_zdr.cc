@@ -0,0 +1,91 @@
+#include <rpcgen_mount.h>
+#include <zdr/zdr.h>
+
+/*
+ * Hand-written ZDR routines for every type in rpc/mount.x, shared by the
+ * MOUNT v1 and v3 clients.
+ */
+
+uint32_t zdr_fhandle3( zdr_t* zdrs, fhandle3* objp ) {
+  return zdr_bytes( zdrs, &objp->fhandle3_val, &objp->fhandle3_len, FHSIZE3 );
+}
+
+uint32_t zdr_dirpath( zdr_t* zdrs, dirpath* objp ) {
+  return zdr_string( zdrs, objp, MNTPATHLEN );
+}
+
+uint32_t zdr_name( zdr_t* zdrs, name* objp ) {
+  return zdr_string( zdrs, objp, MNTNAMLEN );
+}
+
+uint32_t zdr_mountstat3( zdr_t* zdrs, mountstat3* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+static uint32_t zdr_mountbody_body( zdr_t* zdrs, mountbody* objp ) {
+  return zdr_name( zdrs, &objp->ml_hostname ) && zdr_dirpath( zdrs, &objp->ml_directory );
+}
+
+uint32_t zdr_mountlist( zdr_t* zdrs, mountlist* objp ) {
+  return zdr_list( zdrs, objp, &mountbody::ml_next, zdr_mountbody_body );
+}
+
+uint32_t zdr_mountbody( zdr_t* zdrs, mountbody* objp ) {
+  return zdr_mountbody_body( zdrs, objp ) && zdr_mountlist( zdrs, &objp->ml_next );
+}
+
+static uint32_t zdr_groupnode_body( zdr_t* zdrs, groupnode* objp ) {
+  return zdr_name( zdrs, &objp->gr_name );
+}
+
+uint32_t zdr_groups( zdr_t* zdrs, groups* objp ) {
+  return zdr_list( zdrs, objp, &groupnode::gr_next, zdr_groupnode_body );
+}
+
+uint32_t zdr_groupnode( zdr_t* zdrs, groupnode* objp ) {
+  return zdr_groupnode_body( zdrs, objp ) && zdr_groups( zdrs, &objp->gr_next );
+}
+
+static uint32_t zdr_exportnode_body( zdr_t* zdrs, exportnode* objp ) {
+  return zdr_dirpath( zdrs, &objp->ex_dir ) && zdr_groups( zdrs, &objp->ex_groups );
+}
+
+uint32_t zdr_exports( zdr_t* zdrs, exports* objp ) {
+  return zdr_list( zdrs, objp, &exportnode::ex_next, zdr_exportnode_body );
+}
+
+uint32_t zdr_exportnode( zdr_t* zdrs, exportnode* objp ) {
+  return zdr_exportnode_body( zdrs, objp ) && zdr_exports( zdrs, &objp->ex_next );
+}
+
+uint32_t zdr_mountres3_ok( zdr_t* zdrs, mountres3_ok* objp ) {
+  return zdr_fhandle3( zdrs, &objp->fhandle )
+         && zdr_array( zdrs, &objp->auth_flavors.auth_flavors_val,
+                       &objp->auth_flavors.auth_flavors_len, ~0u, zdr_int );
+}
+
+uint32_t zdr_mountres3( zdr_t* zdrs, mountres3* objp ) {
+  if ( !zdr_mountstat3( zdrs, &objp->fhs_status ) ) {
+    return 0;
+  }
+  return objp->fhs_status == MNT3_OK ? zdr_mountres3_ok( zdrs, &objp->mountres3_u.mountinfo ) : 1;
+}
+
+uint32_t zdr_mountstat1( zdr_t* zdrs, mountstat1* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+uint32_t zdr_fhandle1( zdr_t* zdrs, fhandle1 objp ) {
+  return zdr_opaque( zdrs, objp, FHSIZE );
+}
+
+uint32_t zdr_mountres1_ok( zdr_t* zdrs, mountres1_ok* objp ) {
+  return zdr_fhandle1( zdrs, objp->fhandle );
+}
+
+uint32_t zdr_mountres1( zdr_t* zdrs, mountres1* objp ) {
+  if ( !zdr_mountstat1( zdrs, &objp->fhs_status ) ) {
+    return 0;
+  }
+  return objp->fhs_status == MNT1_OK ? zdr_mountres1_ok( zdrs, &objp->mountres1_u.mountinfo ) : 1;
+}
@@ -1 +1,118 @@
+#include <cstring>
 #include <mount/v3/mount_v3.h>
+
+static uint32_t mount3_null( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  return RPC_SUCCESS;
+}
+
+/* the export itself, with or without trailing slashes */
+static bool mount3_match( const struct mount3_export* exp, const char* path ) {
+  size_t len = strlen( path );
+  while ( len > 1 && path[ len - 1 ] == '/' ) {
+    len--;
+  }
+  return exp->path.size() == len && !memcmp( exp->path.data(), path, len );
+}
+
+static uint32_t mount3_mnt( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct mount3_export* exp    = (struct mount3_export*) private_data;
+  int                   flavor = AUTH_UNIX;
+  dirpath               path;
+  mountres3             r {};
+
+  if ( !zdr_dirpath( args, &path ) ) {
+    return RPC_GARBAGE_ARGS;
+  }
+  if ( mount3_match( exp, path ) ) {
+    mountres3_ok* ok                  = &r.mountres3_u.mountinfo;
+    r.fhs_status                      = MNT3_OK;
+    ok->fhandle.fhandle3_val          = exp->fh;
+    ok->fhandle.fhandle3_len          = exp->fh_len;
+    ok->auth_flavors.auth_flavors_val = &flavor;
+    ok->auth_flavors.auth_flavors_len = 1;
+  } else {
+    r.fhs_status = MNT3ERR_NOENT;
+  }
+  return zdr_mountres3( res, &r ) ? RPC_SUCCESS : RPC_SYSTEM_ERR;
+}
+
+static uint32_t mount3_dump( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  mountlist list = nullptr;
+  return zdr_mountlist( res, &list ) ? RPC_SUCCESS : RPC_SYSTEM_ERR;
+}
+
+static uint32_t mount3_umnt( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  dirpath path;
+  return zdr_dirpath( args, &path ) ? RPC_SUCCESS : RPC_GARBAGE_ARGS;
+}
+
+static uint32_t mount3_export( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct mount3_export* exp = (struct mount3_export*) private_data;
+  exportnode            node {};
+  exports               list = &node;
+
+  node.ex_dir = (char*) exp->path.c_str();
+  return zdr_exports( res, &list ) ? RPC_SUCCESS : RPC_SYSTEM_ERR;
+}
+
+static const struct rpc_service_proc mount3_procs[] = {
+  { MOUNT3_NULL, mount3_null },
+  { MOUNT3_MNT, mount3_mnt },
+  { MOUNT3_DUMP, mount3_dump },
+  { MOUNT3_UMNT, mount3_umnt },
+  { MOUNT3_UMNTALL, mount3_null },
+  { MOUNT3_EXPORT, mount3_export },
+};
+
+int mount3_server_register( struct rpc_server* srv, struct mount3_export* exp ) {
+  return rpc_server_register( srv, MOUNT_PROGRAM, MOUNT_V3, mount3_procs,
+                              sizeof( mount3_procs ) / sizeof( mount3_procs[ 0 ] ), exp );
+}
+
+int mount3_null_async( struct rpc_context* rpc, rpc_cb cb, void* private_data ) {
+  struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, MOUNT_PROGRAM, MOUNT_V3, MOUNT3_NULL, cb, private_data, nullptr, 0, 0 );
+  if ( !pdu ) {
+    return -1;
+  }
+  if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+    rpc_free_pdu( rpc, pdu );
+    return -1;
+  }
+  return 0;
+}
+
+int mount3_export_async( struct rpc_context* rpc, rpc_cb cb, void* private_data ) {
+  struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, MOUNT_PROGRAM, MOUNT_V3, MOUNT3_EXPORT, cb, private_data,
+                                          (zdrproc_t) zdr_exports, sizeof( exports ), 0 );
+  if ( !pdu ) {
+    return -1;
+  }
+  pdu->flags |= PDU_DECODE_LISTS;
+  if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+    rpc_free_pdu( rpc, pdu );
+    return -1;
+  }
+  return 0;
+}
+
+int mount3_discover_async( struct rpc_context*               rpc,
+                           const std::vector< std::string >& servers,
+                           int                               port,
+                           bool                              exports,
+                           int                               is_broadcast,
+                           rpc_cb                            cb,
+                           void*                             private_data ) {
+  int queued = 0;
+
+  /* a server that does not resolve is skipped, the error is left set */
+  rpc_cork( rpc );
+  for ( const std::string& server : servers ) {
+    if ( rpc_set_udp_destination( rpc, server.c_str(), port, is_broadcast ) < 0 ) {
+      continue;
+    }
+    int err = exports ? mount3_export_async( rpc, cb, private_data ) : mount3_null_async( rpc, cb, private_data );
+    queued += err == 0;
+  }
+  rpc_uncork( rpc );
+  return queued || servers.empty() ? queued : -1;
+}
@@ -0,0 +1,290 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <ctime>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+#include <unordered_map>
+
+/*
+ * Attributes by file handle, split over NFS_ATTRCACHE_SHARDS independently
+ * locked shards, each an LRU list of at most max_entries / shards entries.
+ *
+ * Every reply carrying post-op attributes refreshes its entry. An entry is
+ * good for a tenth of the time since the file last changed, by its server
+ * mtime/ctime, clamped to acregmin..acregmax (acdirmin/acdirmax for
+ * directories): files nobody has touched in a while are asked about less
+ * often, however many replies refresh them. Replies come back out of order
+ * over nconnect, so attributes with an older ctime than the cached ones
+ * are ignored.
+ */
+struct nfs_ac_entry {
+  struct nfs_fh_inline fh;
+  struct nfs_attr      attr;
+  uint64_t             expires;
+};
+
+struct nfs_ac_shard {
+  std::mutex                mtx;
+  std::list< nfs_ac_entry > lru; /* most recently used first */
+
+  /* keys point into the entries */
+  std::unordered_map< const struct nfs_fh_inline*, std::list< nfs_ac_entry >::iterator, nfs_fh_inline_hasher, nfs_fh_inline_eq > map;
+};
+
+struct nfs_attrcache {
+  struct nfs_ac_shard        shards[ NFS_ATTRCACHE_SHARDS ];
+  size_t                     max_per_shard;
+  struct nfs_attrcache_stats stats;
+  std::mutex                 stats_mtx;
+};
+
+struct nfs_attrcache* nfs_attrcache_create( size_t max_entries ) {
+  struct nfs_attrcache* ac = new ( std::nothrow ) nfs_attrcache();
+  if ( ac ) {
+    ac->max_per_shard = std::max< size_t >( max_entries / NFS_ATTRCACHE_SHARDS, 1 );
+  }
+  return ac;
+}
+
+void nfs_attrcache_destroy( struct nfs_attrcache* ac ) {
+  delete ac;
+}
+
+static struct nfs_ac_shard* nfs_ac_shard( struct nfs_attrcache* ac, const struct nfs_fh_inline* key ) {
+  return &ac->shards[ key->hash % NFS_ATTRCACHE_SHARDS ];
+}
+
+static void nfs_ac_count( struct nfs_attrcache* ac, uint64_t nfs_attrcache_stats::*field ) {
+  std::lock_guard< std::mutex > lock( ac->stats_mtx );
+  ac->stats.*field += 1;
+}
+
+void nfs_fattr3_to_attr( const fattr3* f, struct nfs_attr* attr ) {
+  attr->type           = f->type;
+  attr->mode           = f->mode;
+  attr->uid            = f->uid;
+  attr->gid            = f->gid;
+  attr->nlink          = f->nlink;
+  attr->size           = f->size;
+  attr->used           = f->used;
+  attr->fsid           = f->fsid;
+  attr->rdev.specdata1 = f->rdev.specdata1;
+  attr->rdev.specdata2 = f->rdev.specdata2;
+  attr->atime.seconds  = f->atime.seconds;
+  attr->atime.nseconds = f->atime.nseconds;
+  attr->mtime.seconds  = f->mtime.seconds;
+  attr->mtime.nseconds = f->mtime.nseconds;
+  attr->ctime.seconds  = f->ctime.seconds;
+  attr->ctime.nseconds = f->ctime.nseconds;
+}
+
+/* are the attributes in `b` older than those in `a` */
+static bool nfs_ac_older( const struct nfs_attr* a, const struct nfs_attr* b ) {
+  return b->ctime.seconds < a->ctime.seconds
+         || ( b->ctime.seconds == a->ctime.seconds && b->ctime.nseconds < a->ctime.nseconds );
+}
+
+/* a tenth of the time since the last change, in ms */
+static uint64_t nfs_ac_timeout( const struct nfs_attr* attr, uint64_t min, uint64_t max ) {
+  struct timespec tp;
+  clock_gettime( CLOCK_REALTIME, &tp );
+  uint64_t now      = (uint64_t) tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+  uint64_t mtime_ms = (uint64_t) attr->mtime.seconds * 1000 + attr->mtime.nseconds / 1000000;
+  uint64_t ctime_ms = (uint64_t) attr->ctime.seconds * 1000 + attr->ctime.nseconds / 1000000;
+  uint64_t changed  = std::max( mtime_ms, ctime_ms );
+  /* a server clock ahead of ours makes the file look brand new */
+  return std::clamp( now > changed ? ( now - changed ) / 10 : 0, min, max );
+}
+
+/*
+ * Fresh attributes in `attr`: 0 on a hit, -1 when there are none or they
+ * have expired.
+ */
+int nfs_attrcache_get( struct nfs_context* nfs, const struct nfs_fh* fh, struct nfs_attr* attr ) {
+  struct nfs_attrcache* ac = nfs->nfsi->attrcache;
+  struct nfs_fh_inline  key;
+  if ( !ac || nfs_fh_inline_set( &key, fh ) < 0 ) {
+    return -1;
+  }
+  struct nfs_ac_shard* shard = nfs_ac_shard( ac, &key );
+  bool                 hit   = false;
+  {
+    std::lock_guard< std::mutex > lock( shard->mtx );
+    auto                          it = shard->map.find( &key );
+    if ( it != shard->map.end() && rpc_current_time() < it->second->expires ) {
+      shard->lru.splice( shard->lru.begin(), shard->lru, it->second );
+      *attr = it->second->attr;
+      hit   = true;
+    }
+  }
+  nfs_ac_count( ac, hit ? &nfs_attrcache_stats::hits : &nfs_attrcache_stats::misses );
+  return hit ? 0 : -1;
+}
+
+void nfs_attrcache_put( struct nfs_context* nfs, const struct nfs_fh* fh, const fattr3* f ) {
+  struct nfs_context_internal* nfsi = nfs->nfsi;
+  struct nfs_attrcache*        ac   = nfsi->attrcache;
+  struct nfs_fh_inline         key;
+  if ( !ac || nfs_fh_inline_set( &key, fh ) < 0 ) {
+    return;
+  }
+  struct nfs_attr attr;
+  nfs_fattr3_to_attr( f, &attr );
+
+  bool     dir     = f->type == NF3DIR;
+  uint64_t min     = 1000ull * ( dir ? nfsi->acdirmin : nfsi->acregmin );
+  uint64_t max     = 1000ull * ( dir ? nfsi->acdirmax : nfsi->acregmax );
+  uint64_t expires = rpc_current_time() + nfs_ac_timeout( &attr, min, max );
+  int      evicted = 0;
+
+  struct nfs_ac_shard* shard = nfs_ac_shard( ac, &key );
+  {
+    std::lock_guard< std::mutex > lock( shard->mtx );
+    auto                          it = shard->map.find( &key );
+    if ( it != shard->map.end() ) {
+      struct nfs_ac_entry& e = *it->second;
+      if ( nfs_ac_older( &e.attr, &attr ) ) {
+        return;
+      }
+      e.attr    = attr;
+      e.expires = expires;
+      shard->lru.splice( shard->lru.begin(), shard->lru, it->second );
+    } else {
+      shard->lru.push_front( nfs_ac_entry{ key, attr, expires } );
+      shard->map.emplace( &shard->lru.front().fh, shard->lru.begin() );
+      while ( shard->lru.size() > ac->max_per_shard ) {
+        shard->map.erase( &shard->lru.back().fh );
+        shard->lru.pop_back();
+        evicted++;
+      }
+    }
+  }
+  if ( evicted ) {
+    std::lock_guard< std::mutex > lock( ac->stats_mtx );
+    ac->stats.evictions += evicted;
+  }
+}
+
+void nfs_attrcache_invalidate( struct nfs_context* nfs, const struct nfs_fh* fh ) {
+  struct nfs_attrcache* ac = nfs->nfsi->attrcache;
+  struct nfs_fh_inline  key;
+  if ( !ac || nfs_fh_inline_set( &key, fh ) < 0 ) {
+    return;
+  }
+  struct nfs_ac_shard* shard = nfs_ac_shard( ac, &key );
+
+  std::lock_guard< std::mutex > lock( shard->mtx );
+  auto                          it = shard->map.find( &key );
+  if ( it != shard->map.end() ) {
+    auto e = it->second;
+    shard->map.erase( it );
+    shard->lru.erase( e );
+  }
+}
+
+/* post-op attributes of a call that did not change the file */
+void nfs_attrcache_update( struct nfs_context* nfs, const struct nfs_fh* fh, const post_op_attr* attr ) {
+  if ( attr->attributes_follow ) {
+    nfs_attrcache_put( nfs, fh, &attr->post_op_attr_u.attributes );
+  }
+}
+
+/* weak cache consistency data of a call that did; without it the entry goes */
+void nfs_attrcache_update_wcc( struct nfs_context* nfs, const struct nfs_fh* fh, const wcc_data* wcc ) {
+  if ( wcc->after.attributes_follow ) {
+    nfs_attrcache_put( nfs, fh, &wcc->after.post_op_attr_u.attributes );
+  } else {
+    nfs_attrcache_invalidate( nfs, fh );
+  }
+}
+
+void nfs_get_attrcache_stats( struct nfs_context* nfs, struct nfs_attrcache_stats* stats ) {
+  struct nfs_attrcache* ac = nfs->nfsi->attrcache;
+  *stats                   = {};
+  if ( !ac ) {
+    return;
+  }
+  {
+    std::lock_guard< std::mutex > lock( ac->stats_mtx );
+    *stats = ac->stats;
+  }
+  stats->entries = 0;
+  for ( struct nfs_ac_shard& shard : ac->shards ) {
+    std::lock_guard< std::mutex > lock( shard.mtx );
+    stats->entries += shard.lru.size();
+  }
+}
+
+struct nfs_getattr_call {
+  struct nfs_context* nfs;
+  char                fh[ NFS3_FHSIZE ];
+  uint32_t            fh_len;
+  nfs_cb              cb;
+  void*               private_data;
+};
+
+static void nfs_getattr_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_getattr_call* call = (struct nfs_getattr_call*) private_data;
+  struct nfs_context*      nfs  = call->nfs;
+  struct nfs_fh            fh { (int) call->fh_len, call->fh };
+  GETATTR3res*             res  = (GETATTR3res*) data;
+
+  if ( status != RPC_STATUS_SUCCESS ) {
+    call->cb( nfs_status_to_errno( status ), nfs, data, call->private_data );
+  } else if ( res->status != NFS3_OK ) {
+    if ( res->status == NFS3ERR_STALE || res->status == NFS3ERR_NOENT ) {
+      nfs_attrcache_invalidate( nfs, &fh );
+    }
+    call->cb( nfsstat3_to_errno( res->status ), nfs, (void*) nfsstat3_to_str( res->status ), call->private_data );
+  } else {
+    struct nfs_attr attr;
+    nfs_fattr3_to_attr( &res->GETATTR3res_u.resok.obj_attributes, &attr );
+    nfs_attrcache_put( nfs, &fh, &res->GETATTR3res_u.resok.obj_attributes );
+    call->cb( 0, nfs, &attr, call->private_data );
+  }
+  delete call;
+}
+
+/*
+ * Attributes of `fh`: cb gets a struct nfs_attr* as data, valid during the
+ * callback. Cached attributes are returned at once, without a GETATTR.
+ */
+int nfs_getattr_async( struct nfs_context* nfs, const struct nfs_fh* fh, nfs_cb cb, void* private_data ) {
+  struct nfs_attr          attr;
+  struct rpc_context*      rpc;
+  struct nfs_getattr_call* call;
+
+  if ( fh->len < 0 || fh->len > NFS3_FHSIZE ) {
+    rpc_set_error_errno( nfs->rpc, EINVAL, "Invalid file handle length %d", fh->len );
+    return -1;
+  }
+  if ( nfs_attrcache_get( nfs, fh, &attr ) == 0 ) {
+    cb( 0, nfs, &attr, private_data );
+    return 0;
+  }
+  if ( !( call = new ( std::nothrow ) nfs_getattr_call() ) ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate getattr" );
+    return -1;
+  }
+  memcpy( call->fh, fh->val, fh->len );
+  call->nfs          = nfs;
+  call->fh_len       = fh->len;
+  call->cb           = cb;
+  call->private_data = private_data;
+
+  struct nfs_fh object { (int) call->fh_len, call->fh };
+  rpc = nfs_select_rpc( nfs );
+  if ( nfs3_getattr_async( rpc, &object, nfs_getattr_cb, call ) < 0 ) {
+    delete call;
+    if ( rpc != nfs->rpc ) {
+      rpc_set_error_errno( nfs->rpc, rpc_get_errno( rpc ), "%s", rpc_get_error( rpc ) );
+    }
+    return -1;
+  }
+  return 0;
+}
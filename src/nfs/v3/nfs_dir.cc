@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+#include <unordered_map>
+
+/*
+ * Directory listings come from READDIRPLUS, readdir_dircount/maxcount per
+ * call, and every entry's handle and attributes go into the attribute
+ * cache on the way.
+ *
+ * nfs_closedir() keeps a listing in the dircache, nfsi->dircache being the
+ * most recently closed of at most NFS_MAX_DIRCACHE, indexed by handle.
+ * nfs_opendir_async() takes it back out if the directory's mtime is still
+ * the one it was listed at, which the attribute cache usually answers
+ * without a GETATTR; nfs_dircache_lookup() answers lookups from cached
+ * listings the same way. A changed cookie verifier in the middle of a
+ * listing restarts it from the beginning.
+ */
+struct nfs_dircache_index {
+  /* keys point into nfsdir::fh */
+  std::unordered_map< const struct nfs_fh_inline*, struct nfsdir*, nfs_fh_inline_hasher, nfs_fh_inline_eq > map;
+};
+
+/* a listing restarted more often than this fails with EIO */
+#define NFS_READDIR_MAX_RESTARTS 3
+
+static void nfs_free_dirents( struct nfsdir* dir ) {
+  while ( dir->entries ) {
+    struct nfsdirent* e = dir->entries;
+    dir->entries        = e->next;
+    free( e->name );
+    delete e;
+  }
+  dir->current = nullptr;
+}
+
+static void nfs_free_dir( struct nfsdir* dir ) {
+  nfs_free_dirents( dir );
+  delete dir;
+}
+
+static int nfs_same_mtime( const struct nfs_attr* a, const struct nfs_attr* b ) {
+  return a->mtime.seconds == b->mtime.seconds && a->mtime.nseconds == b->mtime.nseconds;
+}
+
+static struct nfsdir* nfs_dircache_find( struct nfs_context* nfs, const struct nfs_fh_inline* fh ) {
+  struct nfs_dircache_index* index = nfs->nfsi->dircache_index;
+  if ( !index ) {
+    return nullptr;
+  }
+  auto it = index->map.find( fh );
+  return it == index->map.end() ? nullptr : it->second;
+}
+
+static void nfs_dircache_remove( struct nfs_context* nfs, struct nfsdir* dir ) {
+  struct nfsdir** pp = &nfs->nfsi->dircache;
+  while ( *pp && *pp != dir ) {
+    pp = &( *pp )->next;
+  }
+  if ( *pp ) {
+    *pp = dir->next;
+  }
+  dir->next = nullptr;
+  nfs->nfsi->dircache_index->map.erase( &dir->fh );
+}
+
+static void nfs_dircache_add( struct nfs_context* nfs, struct nfsdir* dir ) {
+  struct nfs_context_internal* nfsi = nfs->nfsi;
+  struct nfsdir*               old;
+
+  if ( !nfsi->dircache_index && !( nfsi->dircache_index = new ( std::nothrow ) nfs_dircache_index() ) ) {
+    nfs_free_dir( dir );
+    return;
+  }
+  if ( ( old = nfs_dircache_find( nfs, &dir->fh ) ) ) {
+    nfs_dircache_remove( nfs, old );
+    nfs_free_dir( old );
+  }
+  dir->next      = nfsi->dircache;
+  nfsi->dircache = dir;
+  nfsi->dircache_index->map.emplace( &dir->fh, dir );
+
+  /* drop the least recently closed */
+  int            n    = 0;
+  struct nfsdir* last = dir;
+  while ( last->next && ++n < NFS_MAX_DIRCACHE ) {
+    last = last->next;
+  }
+  while ( last->next ) {
+    struct nfsdir* victim = last->next;
+    last->next            = victim->next;
+    nfsi->dircache_index->map.erase( &victim->fh );
+    nfs_free_dir( victim );
+  }
+}
+
+void nfs_free_dircache( struct nfs_context* nfs ) {
+  struct nfs_context_internal* nfsi = nfs->nfsi;
+  while ( nfsi->dircache ) {
+    struct nfsdir* dir = nfsi->dircache;
+    nfsi->dircache     = dir->next;
+    nfs_free_dir( dir );
+  }
+  delete nfsi->dircache_index;
+  nfsi->dircache_index = nullptr;
+}
+
+/*
+ * A cached listing of `fh` that is known to be current: 1 if so, 0 if
+ * unknown without asking the server, -1 if it has changed (and was dropped).
+ */
+static int nfs_dircache_check( struct nfs_context* nfs, struct nfsdir* dir ) {
+  struct nfs_attr attr;
+  struct nfs_fh   fh = nfs_fh_inline_get( &dir->fh );
+  if ( nfs_attrcache_get( nfs, &fh, &attr ) < 0 ) {
+    return 0;
+  }
+  if ( !nfs_same_mtime( &attr, &dir->attr ) ) {
+    nfs_dircache_remove( nfs, dir );
+    nfs_free_dir( dir );
+    return -1;
+  }
+  return 1;
+}
+
+struct nfs_opendir_op {
+  struct nfs_context* nfs;
+  struct nfsdir*      dir;
+  struct nfsdirent**  tail;
+  uint64_t            cookie;
+  int                 restarts;
+  nfs_cb              cb;
+  void*               private_data;
+};
+
+static int nfs_readdirplus_issue( struct nfs_opendir_op* op );
+
+static void nfs_opendir_done( struct nfs_opendir_op* op, int err, const char* msg ) {
+  struct nfs_context* nfs = op->nfs;
+  if ( err ) {
+    nfs_free_dir( op->dir );
+    op->cb( err, nfs, (void*) msg, op->private_data );
+  } else {
+    op->dir->current = op->dir->entries;
+    op->cb( 0, nfs, op->dir, op->private_data );
+  }
+  delete op;
+}
+
+static void nfs_opendir_restart( struct nfs_opendir_op* op ) {
+  nfs_free_dirents( op->dir );
+  memset( op->dir->cookieverf, 0, NFS3_COOKIEVERFSIZE );
+  op->tail   = &op->dir->entries;
+  op->cookie = 0;
+}
+
+static struct nfsdirent* nfs_make_dirent( const entryplus3* e ) {
+  struct nfsdirent* ent = new ( std::nothrow ) nfsdirent();
+  if ( !ent ) {
+    return nullptr;
+  }
+  ent->inode  = e->fileid;
+  ent->cookie = e->cookie;
+  ent->name   = strdup( e->name ? e->name : "" );
+  if ( e->name_attributes.attributes_follow ) {
+    nfs_fattr3_to_attr( &e->name_attributes.post_op_attr_u.attributes, &ent->attr );
+    ent->has_attr = 1;
+  }
+  if ( e->name_handle.handle_follows ) {
+    const nfs_fh3* h = &e->name_handle.post_op_fh3_u.handle;
+    struct nfs_fh  fh { (int) h->data.data_len, h->data.data_val };
+    /* a handle too long for NFSv3 is as good as none */
+    nfs_fh_inline_set( &ent->fh, &fh );
+  }
+  if ( !ent->name ) {
+    delete ent;
+    return nullptr;
+  }
+  return ent;
+}
+
+static void nfs_readdirplus_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_opendir_op* op  = (struct nfs_opendir_op*) private_data;
+  struct nfs_context*    nfs = op->nfs;
+  struct nfsdir*         dir = op->dir;
+  READDIRPLUS3res*       res = (READDIRPLUS3res*) data;
+
+  if ( status != RPC_STATUS_SUCCESS ) {
+    nfs_opendir_done( op, nfs_status_to_errno( status ), (const char*) data );
+    return;
+  }
+  struct nfs_fh dirfh = nfs_fh_inline_get( &dir->fh );
+  nfs_attrcache_update( nfs, &dirfh,
+                        res->status == NFS3_OK ? &res->READDIRPLUS3res_u.resok.dir_attributes : &res->READDIRPLUS3res_u.resfail.dir_attributes );
+
+  READDIRPLUS3resok* ok = &res->READDIRPLUS3res_u.resok;
+  bool               restart;
+  if ( res->status == NFS3ERR_BAD_COOKIE ) {
+    restart = true;
+  } else if ( res->status != NFS3_OK ) {
+    nfs_opendir_done( op, nfsstat3_to_errno( res->status ), nfsstat3_to_str( res->status ) );
+    return;
+  } else {
+    /* the directory changed under a listing in progress */
+    restart = op->cookie && memcmp( ok->cookieverf, dir->cookieverf, NFS3_COOKIEVERFSIZE );
+  }
+  if ( restart ) {
+    if ( ++op->restarts > NFS_READDIR_MAX_RESTARTS ) {
+      nfs_opendir_done( op, -EIO, "Directory keeps changing while being listed" );
+      return;
+    }
+    nfs_opendir_restart( op );
+  } else {
+    memcpy( dir->cookieverf, ok->cookieverf, NFS3_COOKIEVERFSIZE );
+    for ( entryplus3* e = ok->reply.entries; e; e = e->nextentry ) {
+      struct nfsdirent* ent = nfs_make_dirent( e );
+      if ( !ent ) {
+        nfs_opendir_done( op, -ENOMEM, "Out of memory: Failed to allocate dirent" );
+        return;
+      }
+      if ( ent->has_attr && ent->fh.len ) {
+        struct nfs_fh fh = nfs_fh_inline_get( &ent->fh );
+        nfs_attrcache_put( nfs, &fh, &e->name_attributes.post_op_attr_u.attributes );
+      }
+      if ( ent->fh.len ) {
+        nfs_dentry_put( nfs, &dir->fh, ent->name, &ent->fh );
+      }
+      *op->tail  = ent;
+      op->tail   = &ent->next;
+      op->cookie = ent->cookie;
+    }
+    if ( ok->reply.eof ) {
+      if ( ok->dir_attributes.attributes_follow ) {
+        nfs_fattr3_to_attr( &ok->dir_attributes.post_op_attr_u.attributes, &dir->attr );
+        dir->has_attr = 1;
+      }
+      nfs_opendir_done( op, 0, nullptr );
+      return;
+    }
+  }
+  if ( nfs_readdirplus_issue( op ) < 0 ) {
+    nfs_opendir_done( op, -rpc_get_errno( nfs->rpc ), rpc_get_error( nfs->rpc ) );
+  }
+}
+
+static int nfs_readdirplus_issue( struct nfs_opendir_op* op ) {
+  struct nfs_context* nfs = op->nfs;
+  struct rpc_context* rpc = nfs_select_rpc( nfs );
+  struct rpc_pdu*     pdu = nullptr;
+
+  READDIRPLUS3args args;
+  args.dir.data.data_len = op->dir->fh.len;
+  args.dir.data.data_val = op->dir->fh.val;
+  args.cookie            = op->cookie;
+  args.dircount          = nfs->nfsi->readdir_dircount;
+  args.maxcount          = nfs->nfsi->readdir_maxcount;
+  memcpy( args.cookieverf, op->dir->cookieverf, NFS3_COOKIEVERFSIZE );
+
+  pdu = rpc_allocate_pdu( rpc, NFS_PROGRAM, NFS_V3, NFS3_READDIRPLUS, nfs_readdirplus_cb, op,
+                          (zdrproc_t) zdr_READDIRPLUS3res, sizeof( READDIRPLUS3res ), 0 );
+  if ( !pdu ) {
+    goto fail;
+  }
+  pdu->flags |= PDU_DECODE_LISTS;
+  if ( !zdr_READDIRPLUS3args( &pdu->zdr, &args ) ) {
+    rpc_set_error( rpc, "ZDR error: Failed to encode READDIRPLUS3args" );
+    goto fail;
+  }
+  if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+    goto fail;
+  }
+  return 0;
+
+fail:
+  if ( pdu ) {
+    rpc_free_pdu( rpc, pdu );
+  }
+  if ( rpc != nfs->rpc ) {
+    rpc_set_error_errno( nfs->rpc, rpc_get_errno( rpc ), "%s", rpc_get_error( rpc ) );
+  }
+  return -1;
+}
+
+/* a cached listing whose directory attributes had to be fetched */
+static void nfs_opendir_getattr_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  struct nfs_opendir_op* op = (struct nfs_opendir_op*) private_data;
+
+  if ( err == 0 && nfs_same_mtime( (struct nfs_attr*) data, &op->dir->attr ) ) {
+    nfs_opendir_done( op, 0, nullptr );
+    return;
+  }
+  nfs_opendir_restart( op );
+  op->dir->has_attr = 0;
+  if ( nfs_readdirplus_issue( op ) < 0 ) {
+    nfs_opendir_done( op, -rpc_get_errno( nfs->rpc ), rpc_get_error( nfs->rpc ) );
+  }
+}
+
+/*
+ * List the directory `fh`: cb gets a struct nfsdir* as data, to be walked
+ * with nfs_readdir() and given back with nfs_closedir().
+ */
+int nfs_opendir_async( struct nfs_context* nfs, const struct nfs_fh* fh, nfs_cb cb, void* private_data ) {
+  struct nfs_opendir_op* op;
+  struct nfsdir*         dir;
+  struct nfs_fh_inline   key;
+
+  if ( nfs_fh_inline_set( &key, fh ) < 0 ) {
+    rpc_set_error_errno( nfs->rpc, EINVAL, "Invalid file handle length %d", fh->len );
+    return -1;
+  }
+
+  /* a cached listing that is still current is handed over at once */
+  if ( nfs->nfsi->dircache_enabled && ( dir = nfs_dircache_find( nfs, &key ) ) ) {
+    int fresh = nfs_dircache_check( nfs, dir );
+    if ( fresh > 0 ) {
+      nfs_dircache_remove( nfs, dir );
+      dir->current = dir->entries;
+      cb( 0, nfs, dir, private_data );
+      return 0;
+    }
+    if ( fresh == 0 ) {
+      if ( !( op = new ( std::nothrow ) nfs_opendir_op() ) ) {
+        rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate opendir" );
+        return -1;
+      }
+      nfs_dircache_remove( nfs, dir );
+      op->nfs          = nfs;
+      op->dir          = dir;
+      op->tail         = &dir->entries;
+      op->cb           = cb;
+      op->private_data = private_data;
+      if ( nfs_getattr_async( nfs, fh, nfs_opendir_getattr_cb, op ) < 0 ) {
+        nfs_free_dir( dir );
+        delete op;
+        return -1;
+      }
+      return 0;
+    }
+  }
+
+  if ( !( op = new ( std::nothrow ) nfs_opendir_op() ) || !( dir = new ( std::nothrow ) nfsdir() ) ) {
+    delete op;
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate opendir" );
+    return -1;
+  }
+  dir->fh          = key;
+  op->nfs          = nfs;
+  op->dir          = dir;
+  op->tail         = &dir->entries;
+  op->cb           = cb;
+  op->private_data = private_data;
+  if ( nfs_readdirplus_issue( op ) < 0 ) {
+    nfs_free_dir( dir );
+    delete op;
+    return -1;
+  }
+  return 0;
+}
+
+/* the next entry of an open directory, nullptr at the end */
+struct nfsdirent* nfs_readdir( struct nfs_context* nfs, struct nfsdir* dir ) {
+  struct nfsdirent* ent = dir->current;
+  if ( ent ) {
+    dir->current = ent->next;
+  }
+  return ent;
+}
+
+void nfs_rewinddir( struct nfs_context* nfs, struct nfsdir* dir ) {
+  dir->current = dir->entries;
+}
+
+/* listings with directory attributes to revalidate them by go to the dircache */
+void nfs_closedir( struct nfs_context* nfs, struct nfsdir* dir ) {
+  if ( nfs->nfsi->dircache_enabled && dir->has_attr ) {
+    nfs_dircache_add( nfs, dir );
+  } else {
+    nfs_free_dir( dir );
+  }
+}
+
+/*
+ * `name` in a current cached listing of `dirfh`: 1 with the entry in *ent,
+ * -1 if the listing does not have it, 0 if there is no such listing or the
+ * entry came without a handle.
+ */
+int nfs_dircache_lookup( struct nfs_context* nfs, const struct nfs_fh_inline* dirfh, const char* name, struct nfsdirent** ent ) {
+  struct nfsdir* dir;
+
+  if ( !nfs->nfsi->dircache_enabled || !( dir = nfs_dircache_find( nfs, dirfh ) ) || nfs_dircache_check( nfs, dir ) <= 0 ) {
+    return 0;
+  }
+  for ( struct nfsdirent* e = dir->entries; e; e = e->next ) {
+    if ( !strcmp( e->name, name ) ) {
+      *ent = e;
+      return e->fh.len ? 1 : 0;
+    }
+  }
+  return -1;
+}
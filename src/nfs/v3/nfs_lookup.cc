@@ -0,0 +1,363 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * LOOKUP and path resolution.
+ *
+ * Name to handle translations go into a dentry cache keyed by parent handle
+ * and name: found ones for acdirmin seconds, ENOENT for negative_ttl
+ * seconds, at most lookupcache entries in LRU order. A lookup of a name
+ * that is already on its way to the server waits for that reply instead of
+ * sending another LOOKUP.
+ *
+ * nfs_lookup_path_async() walks a path from rootfh. Cached components are
+ * resolved on the spot; as every LOOKUP needs its parent's handle, the
+ * remaining ones are sent back to back, each straight from the reply to the
+ * one before.
+ */
+struct nfs_dentry_key {
+  struct nfs_fh_inline parent;
+  std::string          name;
+};
+
+struct nfs_dentry_key_hasher {
+  size_t operator()( const nfs_dentry_key& k ) const { return k.parent.hash ^ std::hash< std::string >()( k.name ); }
+  size_t operator()( const nfs_dentry_key* k ) const { return ( *this )( *k ); }
+};
+
+struct nfs_dentry_key_eq {
+  bool operator()( const nfs_dentry_key& a, const nfs_dentry_key& b ) const {
+    return a.name == b.name && nfs_fh_inline_equal( &a.parent, &b.parent );
+  }
+  bool operator()( const nfs_dentry_key* a, const nfs_dentry_key* b ) const { return ( *this )( *a, *b ); }
+};
+
+struct nfs_dentry {
+  nfs_dentry_key       key;
+  struct nfs_fh_inline child; /* len 0 for a negative entry */
+  uint64_t             expires;
+};
+
+struct nfs_lookup_waiter {
+  nfs_cb cb;
+  void*  private_data;
+};
+
+struct nfs_dentry_cache {
+  std::list< nfs_dentry > lru; /* most recently used first */
+  size_t                  max_entries;
+
+  /* keys point into the entries */
+  std::unordered_map< const nfs_dentry_key*, std::list< nfs_dentry >::iterator, nfs_dentry_key_hasher, nfs_dentry_key_eq > map;
+
+  /* LOOKUPs in flight, with everyone waiting for them */
+  std::unordered_map< nfs_dentry_key, std::vector< nfs_lookup_waiter >, nfs_dentry_key_hasher, nfs_dentry_key_eq > pending;
+};
+
+struct nfs_dentry_cache* nfs_dentry_cache_create( size_t max_entries ) {
+  struct nfs_dentry_cache* dc = new ( std::nothrow ) nfs_dentry_cache();
+  if ( dc ) {
+    dc->max_entries = max_entries;
+  }
+  return dc;
+}
+
+void nfs_dentry_cache_destroy( struct nfs_dentry_cache* dc ) {
+  delete dc;
+}
+
+static void nfs_dentry_trim( struct nfs_dentry_cache* dc ) {
+  while ( dc->lru.size() > dc->max_entries ) {
+    dc->map.erase( &dc->lru.back().key );
+    dc->lru.pop_back();
+  }
+}
+
+/* sets the cached number of entries, 0 disables the cache */
+void nfs_set_lookupcache( struct nfs_context* nfs, size_t max_entries ) {
+  struct nfs_dentry_cache* dc = nfs->nfsi->dentries;
+  dc->max_entries             = max_entries;
+  nfs_dentry_trim( dc );
+}
+
+static void nfs_dentry_set( struct nfs_context* nfs, const nfs_dentry_key& key, const struct nfs_fh_inline* child ) {
+  struct nfs_dentry_cache* dc  = nfs->nfsi->dentries;
+  uint64_t                 ttl = 1000ull * ( child ? nfs->nfsi->acdirmin : nfs->nfsi->negative_ttl );
+  if ( !dc->max_entries || !ttl ) {
+    return;
+  }
+  struct nfs_fh_inline value {};
+  if ( child ) {
+    value = *child;
+  }
+  auto it = dc->map.find( &key );
+  if ( it != dc->map.end() ) {
+    it->second->child   = value;
+    it->second->expires = rpc_current_time() + ttl;
+    dc->lru.splice( dc->lru.begin(), dc->lru, it->second );
+    return;
+  }
+  dc->lru.push_front( nfs_dentry{ key, value, rpc_current_time() + ttl } );
+  dc->map.emplace( &dc->lru.front().key, dc->lru.begin() );
+  nfs_dentry_trim( dc );
+}
+
+void nfs_dentry_put( struct nfs_context* nfs, const struct nfs_fh_inline* dirfh, const char* name, const struct nfs_fh_inline* child ) {
+  nfs_dentry_set( nfs, nfs_dentry_key{ *dirfh, name }, child );
+}
+
+void nfs_dentry_invalidate( struct nfs_context* nfs, const struct nfs_fh* dirfh, const char* name ) {
+  struct nfs_dentry_cache* dc = nfs->nfsi->dentries;
+  nfs_dentry_key           key;
+  if ( nfs_fh_inline_set( &key.parent, dirfh ) < 0 ) {
+    return;
+  }
+  key.name = name;
+  auto it  = dc->map.find( &key );
+  if ( it != dc->map.end() ) {
+    auto e = it->second;
+    dc->map.erase( it );
+    dc->lru.erase( e );
+  }
+}
+
+/* 1 with the child handle in *child, -1 for a cached ENOENT, 0 for a miss */
+static int nfs_dentry_get( struct nfs_context* nfs, const nfs_dentry_key& key, struct nfs_fh_inline* child ) {
+  struct nfs_dentry_cache* dc = nfs->nfsi->dentries;
+  auto                     it = dc->map.find( &key );
+  if ( it == dc->map.end() || it->second->expires <= rpc_current_time() ) {
+    return 0;
+  }
+  dc->lru.splice( dc->lru.begin(), dc->lru, it->second );
+  if ( !it->second->child.len ) {
+    return -1;
+  }
+  *child = it->second->child;
+  return 1;
+}
+
+static void nfs_lookup_enoent( struct nfs_context* nfs, nfs_cb cb, void* private_data ) {
+  cb( -ENOENT, nfs, (void*) nfsstat3_to_str( NFS3ERR_NOENT ), private_data );
+}
+
+/* answer with a cached handle, and its attributes if they are cached too */
+static void nfs_lookup_cached( struct nfs_context* nfs, const char* name, const struct nfs_fh_inline* child, nfs_cb cb, void* private_data ) {
+  struct nfsdirent ent {};
+  struct nfs_fh    fh = nfs_fh_inline_get( child );
+
+  ent.name     = (char*) name;
+  ent.fh       = *child;
+  ent.has_attr = nfs_attrcache_get( nfs, &fh, &ent.attr ) == 0;
+  cb( 0, nfs, &ent, private_data );
+}
+
+struct nfs_lookup_call {
+  struct nfs_context* nfs;
+  nfs_dentry_key      key;
+};
+
+static void nfs_lookup_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_lookup_call* call  = (struct nfs_lookup_call*) private_data;
+  struct nfs_context*     nfs   = call->nfs;
+  struct nfs_fh           dirfh = nfs_fh_inline_get( &call->key.parent );
+  LOOKUP3res*             res   = (LOOKUP3res*) data;
+  int                     err   = 0;
+  struct nfsdirent        ent {};
+
+  if ( status != RPC_STATUS_SUCCESS ) {
+    err = nfs_status_to_errno( status );
+  } else if ( res->status != NFS3_OK ) {
+    nfs_attrcache_update( nfs, &dirfh, &res->LOOKUP3res_u.resfail.dir_attributes );
+    err  = nfsstat3_to_errno( res->status );
+    data = (void*) nfsstat3_to_str( res->status );
+    if ( res->status == NFS3ERR_NOENT ) {
+      nfs_dentry_set( nfs, call->key, nullptr );
+    }
+  } else {
+    LOOKUP3resok* ok = &res->LOOKUP3res_u.resok;
+    struct nfs_fh fh { (int) ok->object.data.data_len, ok->object.data.data_val };
+    if ( nfs_fh_inline_set( &ent.fh, &fh ) < 0 ) {
+      err  = -EIO;
+      data = (void*) "Invalid file handle length";
+    } else {
+      ent.name = (char*) call->key.name.c_str();
+      nfs_attrcache_update( nfs, &dirfh, &ok->dir_attributes );
+      nfs_attrcache_update( nfs, &fh, &ok->obj_attributes );
+      if ( ok->obj_attributes.attributes_follow ) {
+        nfs_fattr3_to_attr( &ok->obj_attributes.post_op_attr_u.attributes, &ent.attr );
+        ent.has_attr = 1;
+        ent.inode    = ok->obj_attributes.post_op_attr_u.attributes.fileid;
+      }
+      nfs_dentry_set( nfs, call->key, &ent.fh );
+      data = &ent;
+    }
+  }
+
+  std::vector< nfs_lookup_waiter > waiters;
+  auto                             it = nfs->nfsi->dentries->pending.find( call->key );
+  waiters.swap( it->second );
+  nfs->nfsi->dentries->pending.erase( it );
+  for ( const nfs_lookup_waiter& w : waiters ) {
+    w.cb( err, nfs, data, w.private_data );
+  }
+  delete call;
+}
+
+static int nfs_lookup_key_async( struct nfs_context* nfs, const nfs_dentry_key& key, nfs_cb cb, void* private_data ) {
+  struct nfs_lookup_call* call;
+  struct nfsdirent*       cached;
+  struct rpc_context*     rpc;
+  struct nfs_fh_inline    child;
+
+  switch ( nfs_dentry_get( nfs, key, &child ) ) {
+    case 1: nfs_lookup_cached( nfs, key.name.c_str(), &child, cb, private_data ); return 0;
+    case -1: nfs_lookup_enoent( nfs, cb, private_data ); return 0;
+  }
+  switch ( nfs_dircache_lookup( nfs, &key.parent, key.name.c_str(), &cached ) ) {
+    case 1:
+      nfs_dentry_set( nfs, key, &cached->fh );
+      cb( 0, nfs, cached, private_data );
+      return 0;
+    case -1:
+      nfs_dentry_set( nfs, key, nullptr );
+      nfs_lookup_enoent( nfs, cb, private_data );
+      return 0;
+  }
+
+  /* someone asked already */
+  auto pending = nfs->nfsi->dentries->pending.find( key );
+  if ( pending != nfs->nfsi->dentries->pending.end() ) {
+    pending->second.push_back( { cb, private_data } );
+    return 0;
+  }
+
+  if ( !( call = new ( std::nothrow ) nfs_lookup_call() ) ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate lookup" );
+    return -1;
+  }
+  call->nfs = nfs;
+  call->key = key;
+
+  /* the reply can arrive before nfs3_lookup_async() returns */
+  struct nfs_fh dir = nfs_fh_inline_get( &call->key.parent );
+  nfs->nfsi->dentries->pending[ key ].push_back( { cb, private_data } );
+  rpc = nfs_select_rpc( nfs );
+  if ( nfs3_lookup_async( rpc, &dir, call->key.name.c_str(), nfs_lookup_cb, call ) < 0 ) {
+    nfs->nfsi->dentries->pending.erase( key );
+    delete call;
+    if ( rpc != nfs->rpc ) {
+      rpc_set_error_errno( nfs->rpc, rpc_get_errno( rpc ), "%s", rpc_get_error( rpc ) );
+    }
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Look `name` up in the directory `dirfh`: cb gets a struct nfsdirent* as
+ * data, valid during the callback. The dentry cache, or a current cached
+ * listing of the directory, may answer at once, also with -ENOENT.
+ */
+int nfs_lookup_async( struct nfs_context* nfs, const struct nfs_fh* dirfh, const char* name, nfs_cb cb, void* private_data ) {
+  nfs_dentry_key key;
+
+  if ( nfs_fh_inline_set( &key.parent, dirfh ) < 0 ) {
+    rpc_set_error_errno( nfs->rpc, EINVAL, "Invalid file handle length %d", dirfh->len );
+    return -1;
+  }
+  key.name = name;
+  return nfs_lookup_key_async( nfs, key, cb, private_data );
+}
+
+struct nfs_walk_op {
+  struct nfs_context*        nfs;
+  std::vector< std::string > comps;
+  size_t                     next;
+  struct nfs_fh_inline       fh;
+  nfs_cb                     cb;
+  void*                      private_data;
+};
+
+static void nfs_walk_cb( int err, struct nfs_context* nfs, void* data, void* private_data );
+
+static int nfs_walk_next( struct nfs_walk_op* op ) {
+  return nfs_lookup_key_async( op->nfs, nfs_dentry_key{ op->fh, op->comps[ op->next ] }, nfs_walk_cb, op );
+}
+
+static void nfs_walk_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  struct nfs_walk_op* op  = (struct nfs_walk_op*) private_data;
+  struct nfsdirent*   ent = (struct nfsdirent*) data;
+
+  if ( err ) {
+    op->cb( err, nfs, data, op->private_data );
+    delete op;
+    return;
+  }
+  if ( ++op->next == op->comps.size() ) {
+    op->cb( 0, nfs, ent, op->private_data );
+    delete op;
+    return;
+  }
+  op->fh = ent->fh;
+  if ( nfs_walk_next( op ) < 0 ) {
+    op->cb( -rpc_get_errno( nfs->rpc ), nfs, (void*) rpc_get_error( nfs->rpc ), op->private_data );
+    delete op;
+  }
+}
+
+/*
+ * Resolve `path`, relative to cwd unless it starts with '/', from rootfh:
+ * cb gets a struct nfsdirent* for the last component as data, valid during
+ * the callback. "." and ".." are resolved lexically.
+ */
+int nfs_lookup_path_async( struct nfs_context* nfs, const char* path, nfs_cb cb, void* private_data ) {
+  struct nfs_context_internal* nfsi = nfs->nfsi;
+  struct nfs_walk_op*          op;
+
+  if ( !nfsi->rootfh.len ) {
+    rpc_set_error_errno( nfs->rpc, ENOTCONN, "No root file handle, not mounted" );
+    return -1;
+  }
+  if ( !( op = new ( std::nothrow ) nfs_walk_op() ) ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate path walk" );
+    return -1;
+  }
+  std::string full = path[ 0 ] == '/' || !nfsi->cwd ? path : std::string( nfsi->cwd ) + "/" + path;
+  for ( size_t pos = 0; pos < full.size(); ) {
+    size_t      end  = full.find( '/', pos );
+    std::string comp = full.substr( pos, end == std::string::npos ? std::string::npos : end - pos );
+    pos              = end == std::string::npos ? full.size() : end + 1;
+    if ( comp == ".." ) {
+      if ( !op->comps.empty() ) {
+        op->comps.pop_back();
+      }
+    } else if ( !comp.empty() && comp != "." ) {
+      op->comps.push_back( std::move( comp ) );
+    }
+  }
+  op->nfs          = nfs;
+  op->fh           = nfsi->rootfh;
+  op->cb           = cb;
+  op->private_data = private_data;
+
+  /* the root itself */
+  if ( op->comps.empty() ) {
+    delete op;
+    nfs_lookup_cached( nfs, "/", &nfsi->rootfh, cb, private_data );
+    return 0;
+  }
+  if ( nfs_walk_next( op ) < 0 ) {
+    delete op;
+    return -1;
+  }
+  return 0;
+}
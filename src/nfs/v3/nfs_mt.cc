@@ -0,0 +1,454 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <poll.h>
+#include <rpc/rpc.h>
+#include <string>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+
+/*
+ * Multi-threaded mode.
+ *
+ * A dedicated I/O thread runs an rpc_loop holding every connection of the
+ * context, so the sockets, the pending tables and the caches are only ever
+ * touched by that thread. Other threads hand it requests through the loop's
+ * lock-free ring (rpc_loop_post()); arguments are copied into an nfs_mt_req
+ * that also carries the result back. Completions are pushed onto the
+ * submitting thread's nfs_mt_cq, an intrusive lock-free stack with an
+ * eventfd, and their callbacks run from nfs_mt_cq_run() on that thread.
+ */
+struct nfs_mt {
+  struct nfs_context* nfs;
+  struct rpc_loop*    loop;
+  std::thread         thread;
+};
+
+struct nfs_mt_cq {
+  std::atomic< struct nfs_mt_req* > head { nullptr }; /* newest first */
+  std::atomic< int >                pending { 0 };    /* submitted, callback not run yet */
+  std::atomic< int >                pushing { 0 };    /* in nfs_mt_complete() */
+  int                               fd;
+};
+
+enum nfs_mt_op {
+  NFS_MT_CONNECT,
+  NFS_MT_NULL,
+  NFS_MT_GETATTR,
+  NFS_MT_LOOKUP_PATH,
+  NFS_MT_PREAD,
+  NFS_MT_PWRITE,
+  NFS_MT_FSYNC,
+  NFS_MT_CLOSE,
+};
+
+struct nfs_mt_req {
+  struct nfs_mt_req*  next;
+  struct nfs_mt*      mt;
+  struct nfs_context* nfs; /* outlives mt, see nfs_mt_stop() */
+  struct nfs_mt_cq*   cq;
+  enum nfs_mt_op      op;
+  nfs_cb              cb;
+  void*               private_data;
+
+  /* arguments */
+  std::string          str; /* server or path, then the error message */
+  int                  port;
+  struct nfs_fh_inline fh;
+  struct nfsfh*        nfsfh;
+  uint64_t             offset;
+  uint64_t             count;
+  void*                buf;
+
+  /* result, handed to cb as data */
+  int   err;
+  void* data;
+  union {
+    struct nfs_attr  attr;
+    struct nfsdirent ent;
+  } res;
+};
+
+static void nfs_mt_complete( struct nfs_mt_req* req ) {
+  struct nfs_mt_cq* cq = req->cq;
+
+  if ( !cq ) {
+    req->cb( req->err, req->nfs, req->data, req->private_data );
+    delete req;
+    return;
+  }
+  cq->pushing.fetch_add( 1, std::memory_order_relaxed );
+  struct nfs_mt_req* head = cq->head.load( std::memory_order_relaxed );
+  do {
+    req->next = head;
+  } while ( !cq->head.compare_exchange_weak( head, req, std::memory_order_release, std::memory_order_relaxed ) );
+  if ( !head ) {
+    uint64_t one = 1;
+    if ( write( cq->fd, &one, sizeof( one ) ) < 0 ) {
+      /* the counter only saturates if nobody ever reads it */
+    }
+  }
+  /* last touch of cq: from here on nfs_mt_cq_destroy() may free it */
+  cq->pushing.fetch_sub( 1, std::memory_order_release );
+}
+
+/* on the I/O thread: copy what the callback's data points to */
+static void nfs_mt_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  struct nfs_mt_req* req = (struct nfs_mt_req*) private_data;
+
+  req->err = err;
+  if ( err < 0 && data ) {
+    req->str  = (const char*) data;
+    req->data = (void*) req->str.c_str();
+  } else if ( err >= 0 && data ) {
+    switch ( req->op ) {
+      case NFS_MT_GETATTR:
+        req->res.attr = *(struct nfs_attr*) data;
+        req->data     = &req->res.attr;
+        break;
+      case NFS_MT_LOOKUP_PATH:
+        req->res.ent      = *(struct nfsdirent*) data;
+        req->res.ent.next = nullptr;
+        req->res.ent.name = nullptr;
+        req->data         = &req->res.ent;
+        break;
+      case NFS_MT_PREAD:
+        req->data = req->buf;
+        break;
+      default:
+        break;
+    }
+  }
+  nfs_mt_complete( req );
+}
+
+static void nfs_mt_issue( void* arg ) {
+  struct nfs_mt_req*  req = (struct nfs_mt_req*) arg;
+  struct nfs_context* nfs = req->nfs;
+  struct nfs_fh       fh  = nfs_fh_inline_get( &req->fh );
+  int                 ret = -1;
+
+  switch ( req->op ) {
+    case NFS_MT_CONNECT:
+      ret = nfs_connect_async( nfs, req->str.c_str(), req->port, nfs_mt_cb, req );
+      break;
+    case NFS_MT_NULL:
+      ret = nfs_null_async( nfs, nfs_mt_cb, req );
+      break;
+    case NFS_MT_GETATTR:
+      ret = nfs_getattr_async( nfs, &fh, nfs_mt_cb, req );
+      break;
+    case NFS_MT_LOOKUP_PATH:
+      ret = nfs_lookup_path_async( nfs, req->str.c_str(), nfs_mt_cb, req );
+      break;
+    case NFS_MT_PREAD:
+      ret = nfs_pread_async( nfs, &fh, req->offset, req->count, req->buf, nfs_mt_cb, req );
+      break;
+    case NFS_MT_PWRITE:
+      ret = nfs_pwrite_async( nfs, req->nfsfh, req->offset, req->count, req->buf, nfs_mt_cb, req );
+      break;
+    case NFS_MT_FSYNC:
+      ret = nfs_fsync_async( nfs, req->nfsfh, nfs_mt_cb, req );
+      break;
+    case NFS_MT_CLOSE:
+      ret = nfs_close_async( nfs, req->nfsfh, nfs_mt_cb, req );
+      break;
+  }
+  if ( ret < 0 ) {
+    req->str  = rpc_get_error( nfs->rpc );
+    req->err  = -rpc_get_errno( nfs->rpc );
+    req->data = (void*) req->str.c_str();
+    nfs_mt_complete( req );
+  }
+}
+
+static void nfs_mt_stop_cb( void* arg ) {
+  rpc_loop_stop( (struct rpc_loop*) arg );
+}
+
+struct nfs_mt* nfs_mt_start( struct nfs_context* nfs ) {
+  struct nfs_mt* mt = new ( std::nothrow ) nfs_mt();
+  if ( !mt ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate nfs_mt" );
+    return nullptr;
+  }
+  mt->nfs  = nfs;
+  mt->loop = rpc_loop_create();
+  if ( !mt->loop || nfs_loop_add( mt->loop, nfs ) < 0 ) {
+    rpc_set_error( nfs->rpc, "Failed to create the I/O loop" );
+    if ( mt->loop ) {
+      rpc_loop_destroy( mt->loop );
+    }
+    delete mt;
+    return nullptr;
+  }
+  mt->thread = std::thread( rpc_loop_run, mt->loop );
+  return mt;
+}
+
+void nfs_mt_stop( struct nfs_mt* mt ) {
+  /* posted, so that whatever was submitted before is issued first */
+  while ( rpc_loop_post( mt->loop, nfs_mt_stop_cb, mt->loop ) < 0 ) {
+    std::this_thread::yield();
+  }
+  mt->thread.join();
+  rpc_loop_destroy( mt->loop );
+  delete mt;
+}
+
+/*
+ * A full ring is back-pressure: wait for the I/O thread to catch up, unless
+ * this is the I/O thread, which would wait for itself.
+ */
+static int nfs_mt_post( struct nfs_mt* mt, rpc_loop_fn fn, void* arg ) {
+  while ( rpc_loop_post( mt->loop, fn, arg ) < 0 ) {
+    if ( std::this_thread::get_id() == mt->thread.get_id() ) {
+      errno = EAGAIN;
+      return -1;
+    }
+    std::this_thread::yield();
+  }
+  return 0;
+}
+
+int nfs_mt_exec( struct nfs_mt* mt, nfs_mt_fn fn, void* arg ) {
+  struct exec {
+    struct nfs_mt* mt;
+    nfs_mt_fn      fn;
+    void*          arg;
+  };
+  exec* e = new ( std::nothrow ) exec { mt, fn, arg };
+  if ( !e ) {
+    errno = ENOMEM;
+    return -1;
+  }
+  auto run = []( void* arg ) {
+    exec* e = (exec*) arg;
+    e->fn( e->mt->nfs, e->arg );
+    delete e;
+  };
+  if ( nfs_mt_post( mt, run, e ) < 0 ) {
+    delete e;
+    return -1;
+  }
+  return 0;
+}
+
+static struct nfs_mt_req* nfs_mt_req_alloc( struct nfs_mt* mt, enum nfs_mt_op op, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data ) {
+  struct nfs_mt_req* req = new ( std::nothrow ) nfs_mt_req();
+  if ( !req ) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  req->mt           = mt;
+  req->nfs          = mt->nfs;
+  req->cq           = cq;
+  req->op           = op;
+  req->cb           = cb;
+  req->private_data = private_data;
+  return req;
+}
+
+static int nfs_mt_submit( struct nfs_mt_req* req ) {
+  struct nfs_mt_cq* cq = req->cq;
+
+  if ( cq ) {
+    cq->pending.fetch_add( 1, std::memory_order_relaxed );
+  }
+  if ( nfs_mt_post( req->mt, nfs_mt_issue, req ) < 0 ) {
+    if ( cq ) {
+      cq->pending.fetch_sub( 1, std::memory_order_relaxed );
+    }
+    delete req;
+    return -1;
+  }
+  return 0;
+}
+
+int nfs_mt_connect( struct nfs_mt* mt, const char* server, int port, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_CONNECT, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  req->str  = server;
+  req->port = port;
+  return nfs_mt_submit( req );
+}
+
+int nfs_mt_null( struct nfs_mt* mt, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_NULL, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  return nfs_mt_submit( req );
+}
+
+int nfs_mt_getattr( struct nfs_mt* mt, const struct nfs_fh* fh, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_GETATTR, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  if ( nfs_fh_inline_set( &req->fh, fh ) < 0 ) {
+    delete req;
+    errno = EINVAL;
+    return -1;
+  }
+  return nfs_mt_submit( req );
+}
+
+int nfs_mt_lookup_path( struct nfs_mt* mt, const char* path, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_LOOKUP_PATH, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  req->str = path;
+  return nfs_mt_submit( req );
+}
+
+int nfs_mt_pread( struct nfs_mt*       mt,
+                  const struct nfs_fh* fh,
+                  uint64_t             offset,
+                  uint64_t             count,
+                  void*                buf,
+                  struct nfs_mt_cq*    cq,
+                  nfs_cb               cb,
+                  void*                private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_PREAD, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  if ( nfs_fh_inline_set( &req->fh, fh ) < 0 ) {
+    delete req;
+    errno = EINVAL;
+    return -1;
+  }
+  req->offset = offset;
+  req->count  = count;
+  req->buf    = buf;
+  return nfs_mt_submit( req );
+}
+
+int nfs_mt_pwrite( struct nfs_mt*    mt,
+                   struct nfsfh*     nfsfh,
+                   uint64_t          offset,
+                   uint64_t          count,
+                   const void*       buf,
+                   struct nfs_mt_cq* cq,
+                   nfs_cb            cb,
+                   void*             private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_PWRITE, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  req->nfsfh  = nfsfh;
+  req->offset = offset;
+  req->count  = count;
+  req->buf    = (void*) buf;
+  return nfs_mt_submit( req );
+}
+
+int nfs_mt_fsync( struct nfs_mt* mt, struct nfsfh* nfsfh, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_FSYNC, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  req->nfsfh = nfsfh;
+  return nfs_mt_submit( req );
+}
+
+int nfs_mt_close( struct nfs_mt* mt, struct nfsfh* nfsfh, struct nfs_mt_cq* cq, nfs_cb cb, void* private_data ) {
+  struct nfs_mt_req* req = nfs_mt_req_alloc( mt, NFS_MT_CLOSE, cq, cb, private_data );
+  if ( !req ) {
+    return -1;
+  }
+  req->nfsfh = nfsfh;
+  return nfs_mt_submit( req );
+}
+
+struct nfs_mt_cq* nfs_mt_cq_create( void ) {
+  struct nfs_mt_cq* cq = new ( std::nothrow ) nfs_mt_cq();
+  if ( !cq ) {
+    return nullptr;
+  }
+  cq->fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( cq->fd < 0 ) {
+    delete cq;
+    return nullptr;
+  }
+  return cq;
+}
+
+/*
+ * Refused while requests are in flight, as their completions would be pushed
+ * onto freed memory; completions already queued are dropped without their
+ * callbacks. Only the thread running the queue may destroy it, so nothing
+ * below the head is popped meanwhile.
+ */
+int nfs_mt_cq_destroy( struct nfs_mt_cq* cq ) {
+  int queued = 0;
+  for ( struct nfs_mt_req* req = cq->head.load( std::memory_order_acquire ); req; req = req->next ) {
+    queued++;
+  }
+  if ( cq->pending.load( std::memory_order_acquire ) > queued ) {
+    errno = EBUSY;
+    return -1;
+  }
+  struct nfs_mt_req* req = cq->head.exchange( nullptr, std::memory_order_acquire );
+  while ( req ) {
+    struct nfs_mt_req* next = req->next;
+    delete req;
+    req = next;
+  }
+  /* the last completions may still be signalling the eventfd */
+  while ( cq->pushing.load( std::memory_order_acquire ) ) {
+    std::this_thread::yield();
+  }
+  close( cq->fd );
+  delete cq;
+  return 0;
+}
+
+int nfs_mt_cq_fd( struct nfs_mt_cq* cq ) {
+  return cq->fd;
+}
+
+static struct nfs_mt_req* nfs_mt_cq_take( struct nfs_mt_cq* cq ) {
+  uint64_t count;
+  if ( read( cq->fd, &count, sizeof( count ) ) < 0 ) {
+    /* EAGAIN: nothing was signalled */
+  }
+  return cq->head.exchange( nullptr, std::memory_order_acquire );
+}
+
+int nfs_mt_cq_run( struct nfs_mt_cq* cq, int timeout_msecs ) {
+  struct nfs_mt_req* req = nfs_mt_cq_take( cq );
+  if ( !req && timeout_msecs != 0 ) {
+    struct pollfd pfd = { cq->fd, POLLIN, 0 };
+    if ( poll( &pfd, 1, timeout_msecs ) < 0 && errno != EINTR ) {
+      return -1;
+    }
+    req = nfs_mt_cq_take( cq );
+  }
+
+  /* pushed newest first, run oldest first */
+  struct nfs_mt_req* fifo = nullptr;
+  while ( req ) {
+    struct nfs_mt_req* next = req->next;
+    req->next               = fifo;
+    fifo                    = req;
+    req                     = next;
+  }
+  int n = 0;
+  while ( fifo ) {
+    struct nfs_mt_req* next = fifo->next;
+    fifo->cb( fifo->err, fifo->nfs, fifo->data, fifo->private_data );
+    delete fifo;
+    cq->pending.fetch_sub( 1, std::memory_order_release );
+    fifo = next;
+    n++;
+  }
+  return n;
+}
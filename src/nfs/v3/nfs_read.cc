@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * Large reads are split into readmax-sized READ3 calls, of which up to
+ * read_window are kept in flight over all connections. Every call receives
+ * straight into its part of the caller's buffer, so they may complete in
+ * any order; a short read is continued by another call for the rest of its
+ * range and the first EOF caps what is issued and what is reported.
+ */
+struct nfs_read_op {
+  struct nfs_context* nfs;
+  char                fh[ NFS3_FHSIZE ];
+  uint32_t            fh_len;
+  uint64_t            offset;
+  uint64_t            count;
+  char*               buf;
+
+  uint64_t next;     /* start of the first range not yet issued */
+  uint64_t eof;      /* first position past EOF, count until one is seen */
+  int      inflight; /* READ calls outstanding */
+  int      issued;
+  int      busy;     /* inside nfs_read_fill(), completion is deferred */
+  int      err;
+
+  nfs_cb cb;
+  void*  private_data;
+};
+
+struct nfs_read_call {
+  struct nfs_read_op* op;
+  uint64_t            pos; /* relative to op->offset */
+  uint32_t            len;
+};
+
+static void nfs_read_cb( struct rpc_context* rpc, int status, void* data, void* private_data );
+
+static int nfs_read_issue( struct nfs_read_op* op, uint64_t pos, uint32_t len ) {
+  struct nfs_context*   nfs = op->nfs;
+  struct rpc_context*   rpc = nfs_select_rpc( nfs );
+  struct rpc_pdu*       pdu = nullptr;
+  struct nfs_read_call* call;
+
+  if ( !( call = new ( std::nothrow ) nfs_read_call{ op, pos, len } ) ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate read call" );
+    goto fail;
+  }
+
+  READ3args args;
+  args.file.data.data_len = op->fh_len;
+  args.file.data.data_val = op->fh;
+  args.offset             = op->offset + pos;
+  args.count              = len;
+
+  pdu = rpc_allocate_pdu( rpc, NFS_PROGRAM, NFS_V3, NFS3_READ, nfs_read_cb, call,
+                          (zdrproc_t) zdr_READ3res, sizeof( READ3res ), 0 );
+  if ( !pdu ) {
+    goto fail;
+  }
+  pdu->rtt_class = RPC_RTT_READ;
+  if ( !zdr_READ3args( &pdu->zdr, &args ) ) {
+    rpc_set_error( rpc, "ZDR error: Failed to encode READ3args" );
+    goto fail;
+  }
+  pdu->indata.data = op->buf + pos;
+  pdu->indata.size = len;
+
+  /* the reply can arrive before rpc_queue_pdu() returns */
+  op->inflight++;
+  op->issued++;
+  if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+    op->inflight--;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  if ( pdu ) {
+    rpc_free_pdu( rpc, pdu );
+  }
+  delete call;
+  if ( rpc != nfs->rpc ) {
+    rpc_set_error_errno( nfs->rpc, rpc_get_errno( rpc ), "%s", rpc_get_error( rpc ) );
+  }
+  return -1;
+}
+
+static void nfs_read_finish( struct nfs_read_op* op ) {
+  if ( op->busy || op->inflight ) {
+    return;
+  }
+  if ( op->err ) {
+    op->cb( op->err, op->nfs, op->nfs->error_string, op->private_data );
+  } else {
+    op->cb( (int) std::min< uint64_t >( op->eof, INT32_MAX ), op->nfs, nullptr, op->private_data );
+  }
+  delete op;
+}
+
+static void nfs_read_fail( struct nfs_read_op* op, int err, const char* msg ) {
+  if ( !op->err ) {
+    op->err = err;
+    free( op->nfs->error_string );
+    op->nfs->error_string = strdup( msg );
+  }
+}
+
+/* issue READs until the window is full or everything up to EOF is out */
+static int nfs_read_fill( struct nfs_read_op* op ) {
+  size_t readmax = std::max< size_t >( op->nfs->nfsi->readmax, NFS_MIN_XFER_SIZE );
+  int    window  = op->nfs->nfsi->read_window;
+  int    ret     = 0;
+
+  op->busy++;
+  nfs_cork( op->nfs );
+  while ( !op->err && op->inflight < window && ( op->next < op->eof || !op->issued ) ) {
+    uint32_t len = (uint32_t) std::min< uint64_t >( readmax, op->eof - op->next );
+    if ( nfs_read_issue( op, op->next, len ) < 0 ) {
+      nfs_read_fail( op, -rpc_get_errno( op->nfs->rpc ), rpc_get_error( op->nfs->rpc ) );
+      ret = -1;
+      break;
+    }
+    op->next += len;
+  }
+  nfs_uncork( op->nfs );
+  op->busy--;
+  return ret;
+}
+
+static void nfs_read_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_read_call* call = (struct nfs_read_call*) private_data;
+  struct nfs_read_op*   op   = call->op;
+  READ3res*             res  = (READ3res*) data;
+
+  op->inflight--;
+  if ( status == RPC_STATUS_SUCCESS ) {
+    struct nfs_fh fh { (int) op->fh_len, op->fh };
+    nfs_attrcache_update( op->nfs, &fh,
+                          res->status == NFS3_OK ? &res->READ3res_u.resok.file_attributes : &res->READ3res_u.resfail.file_attributes );
+  }
+  if ( status != RPC_STATUS_SUCCESS ) {
+    nfs_read_fail( op, nfs_status_to_errno( status ), (const char*) data );
+  } else if ( res->status != NFS3_OK ) {
+    nfs_read_fail( op, nfsstat3_to_errno( res->status ), nfsstat3_to_str( res->status ) );
+  } else if ( res->READ3res_u.resok.data.data_len > call->len ) {
+    nfs_read_fail( op, -EIO, "READ returned more data than requested" );
+  } else if ( !op->err ) {
+    uint32_t n   = res->READ3res_u.resok.data.data_len;
+    uint64_t end = call->pos + n;
+
+    /* an empty reply without the EOF flag would only be asked again */
+    if ( res->READ3res_u.resok.eof || n == 0 ) {
+      op->eof = std::min( op->eof, end );
+    } else if ( n < call->len && end < op->eof ) {
+      /* short read: ask for the rest of this range right away */
+      op->busy++;
+      if ( nfs_read_issue( op, end, call->len - n ) < 0 ) {
+        nfs_read_fail( op, -rpc_get_errno( op->nfs->rpc ), rpc_get_error( op->nfs->rpc ) );
+      }
+      op->busy--;
+    }
+  }
+  delete call;
+
+  nfs_read_fill( op );
+  nfs_read_finish( op );
+}
+
+/*
+ * Read `count` bytes at `offset` of `fh` into `buf`. cb gets the number of
+ * bytes read, less than count only at EOF, or a negative errno. The handle
+ * is copied, buf must stay valid until cb has run.
+ */
+int nfs_pread_async( struct nfs_context*  nfs,
+                     const struct nfs_fh* fh,
+                     uint64_t             offset,
+                     uint64_t             count,
+                     void*                buf,
+                     nfs_cb               cb,
+                     void*                private_data ) {
+  struct nfs_read_op* op;
+
+  if ( fh->len < 0 || fh->len > NFS3_FHSIZE ) {
+    rpc_set_error_errno( nfs->rpc, EINVAL, "Invalid file handle length %d", fh->len );
+    return -1;
+  }
+  if ( count > INT32_MAX ) {
+    rpc_set_error_errno( nfs->rpc, EINVAL, "Read of %llu bytes is too large", (unsigned long long) count );
+    return -1;
+  }
+  if ( !( op = new ( std::nothrow ) nfs_read_op() ) ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate read" );
+    return -1;
+  }
+  memcpy( op->fh, fh->val, fh->len );
+  op->nfs          = nfs;
+  op->fh_len       = fh->len;
+  op->offset       = offset;
+  op->count        = count;
+  op->buf          = (char*) buf;
+  op->eof          = count;
+  op->cb           = cb;
+  op->private_data = private_data;
+
+  if ( nfs_read_fill( op ) < 0 && !op->inflight ) {
+    delete op;
+    return -1;
+  }
+  /* everything may already have failed while it was being queued */
+  nfs_read_finish( op );
+  return 0;
+}
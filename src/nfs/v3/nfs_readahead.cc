@@ -0,0 +1,459 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+#include <vector>
+
+/*
+ * Readahead for reads through an nfsfh.
+ *
+ * Every read is compared with the previous one: starting where it ended is
+ * sequential, starting the same distance after its start as last time is
+ * strided, anything else is random. From the second sequential (or strided)
+ * read on, buffers ahead of the reader are filled with nfs_pread_async();
+ * the window doubles with every further hit up to nfsi->readahead bytes.
+ * All files of a context together hold at most nfsi->readahead_max bytes.
+ * Reads that are covered by buffers are copied out of them (after waiting
+ * for the ones still in flight), everything else goes to the server
+ * directly.
+ *
+ * Buffers behind the reader are dropped as it passes them, all of them
+ * when it turns random, and any left unused for NFS_RA_TIMEOUT seconds,
+ * by a timer so that files nobody reads any more let go of theirs too.
+ *
+ * Writes through the same nfsfh drop the buffers they overlap. Reads of
+ * bytes that are still only in write-behind buffers wait until those are
+ * on the server, and nothing is read ahead over them.
+ */
+struct nfs_ra_req;
+
+struct nfs_ra_piece {
+  struct nfs_ra_req* req;
+  uint64_t           offset;
+  uint32_t           len;
+  char*              dst;
+};
+
+struct nfs_ra_buf {
+  uint64_t offset;
+  uint32_t len;
+  uint32_t capacity;
+  uint32_t have; /* valid bytes once ready, less than len at EOF */
+  char*    data;
+  bool     ready;
+  bool     dropped; /* free once the READ is back */
+  int      err;
+  uint64_t last_used;
+
+  std::vector< nfs_ra_piece > waiters;
+};
+
+struct nfs_ra {
+  struct nfs_context*      nfs;
+  std::list< nfs_ra_buf* > bufs;
+  uint64_t                 bytes; /* capacity of all buffers */
+  int                      inflight;
+  bool                     closed; /* nfsfh is gone, free when idle */
+  struct rpc_timer         expiry;
+
+  uint64_t prev_offset;
+  uint64_t prev_end = UINT64_MAX; /* no read yet */
+  uint64_t stride;
+  int      hits;
+  uint64_t window;
+  uint64_t next; /* sequential: first byte not read ahead yet */
+  uint64_t eof = UINT64_MAX; /* first byte past EOF, once seen */
+};
+
+struct nfs_ra_req {
+  struct nfs_context* nfs;
+  uint64_t            offset;
+  uint64_t            end_ok; /* data is complete up to here */
+  int                 pending;
+  int                 err;
+  nfs_cb              cb;
+  void*               private_data;
+};
+
+struct nfs_ra_call {
+  struct nfs_context* nfs;
+  struct nfs_ra*      ra;
+  struct nfs_ra_buf*  b;
+};
+
+static void nfs_ra_free_buf( struct nfs_context* nfs, struct nfs_ra* ra, struct nfs_ra_buf* b ) {
+  ra->bytes -= b->capacity;
+  nfs->nfsi->readahead_bytes -= b->capacity;
+  rpc_pool_free( &nfs->rpc->pool, b->data, b->capacity );
+  delete b;
+}
+
+/* buffers still being read are only marked, see nfs_ra_read_cb() */
+static void nfs_ra_drop( struct nfs_context* nfs, struct nfs_ra* ra, bool ( *pred )( nfs_ra_buf*, uint64_t ), uint64_t arg ) {
+  for ( auto it = ra->bufs.begin(); it != ra->bufs.end(); ) {
+    struct nfs_ra_buf* b = *it;
+    if ( !b->dropped && b->waiters.empty() && pred( b, arg ) ) {
+      if ( b->ready ) {
+        it = ra->bufs.erase( it );
+        nfs_ra_free_buf( nfs, ra, b );
+        continue;
+      }
+      b->dropped = true;
+    }
+    ++it;
+  }
+}
+
+static bool nfs_ra_any( nfs_ra_buf* b, uint64_t ) {
+  return true;
+}
+
+static bool nfs_ra_behind( nfs_ra_buf* b, uint64_t pos ) {
+  return b->offset + b->len <= pos;
+}
+
+static bool nfs_ra_stale( nfs_ra_buf* b, uint64_t now ) {
+  return b->ready && b->last_used + NFS_RA_TIMEOUT * 1000 <= now;
+}
+
+static void nfs_ra_expire( struct rpc_context* rpc, struct rpc_timer* t );
+
+/* wake up when the least recently used buffer goes stale */
+static void nfs_ra_arm( struct nfs_ra* ra, uint64_t now ) {
+  uint64_t deadline = UINT64_MAX;
+  for ( struct nfs_ra_buf* b : ra->bufs ) {
+    deadline = std::min( deadline, ( b->ready ? b->last_used : now ) + NFS_RA_TIMEOUT * 1000 );
+  }
+  if ( deadline == UINT64_MAX ) {
+    rpc_timer_cancel( &ra->nfs->rpc->timers, &ra->expiry );
+    return;
+  }
+  ra->expiry.cb   = nfs_ra_expire;
+  ra->expiry.data = ra;
+  rpc_timer_arm( &ra->nfs->rpc->timers, &ra->expiry, deadline );
+}
+
+static void nfs_ra_expire( struct rpc_context* rpc, struct rpc_timer* t ) {
+  struct nfs_ra* ra  = (struct nfs_ra*) t->data;
+  uint64_t       now = rpc_current_time();
+  nfs_ra_drop( ra->nfs, ra, nfs_ra_stale, now );
+  nfs_ra_arm( ra, now );
+}
+
+static void nfs_ra_complete( struct nfs_ra_req* req ) {
+  if ( --req->pending ) {
+    return;
+  }
+  if ( req->err ) {
+    req->cb( req->err, req->nfs, req->nfs->error_string, req->private_data );
+  } else {
+    req->cb( (int) ( req->end_ok - req->offset ), req->nfs, nullptr, req->private_data );
+  }
+  delete req;
+}
+
+/* copy a piece out of its buffer; the request completes separately */
+static void nfs_ra_copy( struct nfs_ra_buf* b, const nfs_ra_piece& p ) {
+  struct nfs_ra_req* req = p.req;
+  uint64_t           rel = p.offset - b->offset;
+  uint32_t           n   = rel >= b->have ? 0 : std::min< uint64_t >( p.len, b->have - rel );
+
+  if ( b->err ) {
+    req->err = req->err ? req->err : b->err;
+  }
+  memcpy( p.dst, b->data + rel, n );
+  if ( n < p.len ) {
+    req->end_ok = std::min( req->end_ok, p.offset + n );
+  }
+}
+
+static void nfs_ra_read_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  struct nfs_ra_call* call = (struct nfs_ra_call*) private_data;
+  struct nfs_ra*      ra   = call->ra;
+  struct nfs_ra_buf*  b    = call->b;
+  delete call;
+
+  b->ready     = true;
+  b->err       = err < 0 ? err : 0;
+  b->have      = err < 0 ? 0 : err;
+  b->last_used = rpc_current_time();
+  if ( err >= 0 && b->have < b->len ) {
+    ra->eof = std::min( ra->eof, b->offset + b->have );
+  }
+
+  /* a failed buffer must not satisfy later reads */
+  bool keep = !b->dropped && !b->err && b->have && !ra->closed;
+  if ( !keep ) {
+    ra->bufs.remove( b );
+  }
+
+  /*
+   * Copy everything before completing anything: a callback may close the
+   * file, which frees the buffers. ra stays until inflight drops below.
+   */
+  std::vector< nfs_ra_piece > waiters;
+  waiters.swap( b->waiters );
+  for ( const nfs_ra_piece& p : waiters ) {
+    nfs_ra_copy( b, p );
+  }
+  for ( const nfs_ra_piece& p : waiters ) {
+    nfs_ra_complete( p.req );
+  }
+  if ( !keep ) {
+    nfs_ra_free_buf( nfs, ra, b );
+  }
+  if ( --ra->inflight == 0 && ra->closed ) {
+    delete ra;
+  }
+}
+
+static bool nfs_ra_fetch( struct nfs_context* nfs, struct nfsfh* fh, uint64_t offset, uint32_t len ) {
+  struct nfs_ra*      ra = fh->ra;
+  struct nfs_ra_buf*  b;
+  struct nfs_ra_call* call;
+
+  if ( nfs->nfsi->readahead_bytes + len > nfs->nfsi->readahead_max || nfs_wb_pending( fh, offset, len ) ) {
+    return false;
+  }
+  if ( !( b = new ( std::nothrow ) nfs_ra_buf() ) ) {
+    return false;
+  }
+  if ( !( b->data = rpc_pool_alloc( &nfs->rpc->pool, len, &b->capacity ) ) ) {
+    delete b;
+    return false;
+  }
+  b->offset    = offset;
+  b->len       = len;
+  b->last_used = rpc_current_time();
+  ra->bytes += b->capacity;
+  nfs->nfsi->readahead_bytes += b->capacity;
+  ra->bufs.push_back( b );
+
+  if ( !( call = new ( std::nothrow ) nfs_ra_call{ nfs, ra, b } )
+       || nfs_pread_async( nfs, &fh->fh, offset, len, b->data, nfs_ra_read_cb, call ) < 0 ) {
+    delete call;
+    ra->bufs.pop_back();
+    nfs_ra_free_buf( nfs, ra, b );
+    return false;
+  }
+  ra->inflight++;
+  return true;
+}
+
+/* fill the window ahead of a read that ended at `end` */
+static void nfs_ra_fill( struct nfs_context* nfs, struct nfsfh* fh, uint64_t offset, uint64_t end ) {
+  struct nfs_ra* ra    = fh->ra;
+  uint64_t       limit = nfs->nfsi->readahead;
+  uint64_t       chunk = std::min< uint64_t >( std::max< size_t >( nfs->nfsi->readmax, NFS_MIN_XFER_SIZE ), ra->window );
+
+  if ( ra->stride > end - offset ) {
+    /* strided: the next reads of the same size, one buffer each */
+    uint64_t len = end - offset;
+    for ( uint64_t pos = offset + ra->stride; pos < offset + ra->stride * ( 1 + ra->window / len ); pos += ra->stride ) {
+      if ( pos >= ra->eof || ra->bytes + len > limit ) {
+        break;
+      }
+      bool have = false;
+      for ( struct nfs_ra_buf* b : ra->bufs ) {
+        have |= b->offset == pos && !b->dropped;
+      }
+      if ( !have && !nfs_ra_fetch( nfs, fh, pos, len ) ) {
+        break;
+      }
+    }
+    return;
+  }
+
+  ra->next = std::max( ra->next, end );
+  while ( ra->next < end + ra->window && ra->next < ra->eof && ra->bytes + chunk <= limit ) {
+    uint32_t len = (uint32_t) std::min( chunk, end + ra->window - ra->next );
+    if ( !nfs_ra_fetch( nfs, fh, ra->next, len ) ) {
+      break;
+    }
+    ra->next += len;
+  }
+}
+
+/*
+ * Queue the parts of [offset, offset + count) on the buffers covering them.
+ * Returns false, having done nothing, unless all of it is covered.
+ */
+static bool nfs_ra_serve( struct nfs_ra* ra, struct nfs_ra_req* req, uint64_t count, char* dst ) {
+  std::vector< std::pair< nfs_ra_buf*, nfs_ra_piece > > pieces;
+  uint64_t                                              pos = req->offset;
+  uint64_t                                              end = req->offset + count;
+
+  while ( pos < end ) {
+    struct nfs_ra_buf* found = nullptr;
+    for ( struct nfs_ra_buf* b : ra->bufs ) {
+      if ( !b->dropped && b->offset <= pos && pos < b->offset + b->len ) {
+        found = b;
+        break;
+      }
+    }
+    if ( !found ) {
+      /* past EOF nothing is missing */
+      if ( pos >= ra->eof ) {
+        req->end_ok = std::min( req->end_ok, pos );
+        break;
+      }
+      return false;
+    }
+    uint32_t len = (uint32_t) std::min( end, found->offset + found->len ) - pos;
+    pieces.push_back( { found, { req, pos, len, dst + ( pos - req->offset ) } } );
+    pos += len;
+  }
+
+  uint64_t now = rpc_current_time();
+  req->pending = 1 + (int) pieces.size();
+  for ( auto& [ b, p ] : pieces ) {
+    b->last_used = now;
+    if ( b->ready ) {
+      nfs_ra_copy( b, p );
+      nfs_ra_complete( req );
+    } else {
+      b->waiters.push_back( p );
+    }
+  }
+  return true;
+}
+
+static void nfs_ra_direct_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  struct nfs_ra_req* req = (struct nfs_ra_req*) private_data;
+  if ( err < 0 ) {
+    req->err = err;
+  } else {
+    req->end_ok = req->offset + err;
+  }
+  nfs_ra_complete( req );
+}
+
+/*
+ * Read `count` bytes at `offset` of an open file, with readahead. cb gets
+ * the number of bytes read, less than count only at EOF, or a negative
+ * errno; buf must stay valid until then.
+ */
+int nfs_fh_pread_async( struct nfs_context* nfs,
+                        struct nfsfh*       fh,
+                        uint64_t            offset,
+                        uint64_t            count,
+                        void*               buf,
+                        nfs_cb              cb,
+                        void*               private_data ) {
+  struct nfs_ra*     ra;
+  struct nfs_ra_req* req;
+
+  if ( nfs_wb_pending( fh, offset, count ) ) {
+    return nfs_wb_wait_read( nfs, fh, offset, count, buf, cb, private_data );
+  }
+  if ( !nfs->nfsi->readahead || !count ) {
+    return nfs_pread_async( nfs, &fh->fh, offset, count, buf, cb, private_data );
+  }
+  if ( !fh->ra ) {
+    if ( !( fh->ra = new ( std::nothrow ) nfs_ra() ) ) {
+      rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate readahead" );
+      return -1;
+    }
+    fh->ra->nfs = nfs;
+  }
+  ra = fh->ra;
+  if ( !( req = new ( std::nothrow ) nfs_ra_req{ nfs, offset, offset + count, 0, 0, cb, private_data } ) ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate read" );
+    return -1;
+  }
+
+  /* classify against the previous read */
+  uint64_t end = offset + count;
+  if ( offset == ra->prev_end ) {
+    ra->stride = 0;
+    ra->hits++;
+  } else if ( offset > ra->prev_offset && offset - ra->prev_offset == ra->stride ) {
+    ra->hits++;
+  } else {
+    /* random: start over, remembering the distance in case it repeats */
+    bool first = ra->prev_end == UINT64_MAX;
+    ra->stride = offset > ra->prev_offset && !first ? offset - ra->prev_offset : 0;
+    ra->hits   = 0;
+    ra->window = 0;
+    ra->next   = 0;
+    ra->eof    = UINT64_MAX;
+    nfs_ra_drop( nfs, ra, nfs_ra_any, 0 );
+  }
+  ra->prev_offset = offset;
+  ra->prev_end    = end;
+  if ( ra->hits ) {
+    ra->window = std::min< uint64_t >( ra->window ? 2 * ra->window : 4 * count, nfs->nfsi->readahead );
+  }
+
+  uint64_t now = rpc_current_time();
+  nfs_ra_drop( nfs, ra, nfs_ra_stale, now );
+
+  if ( !nfs_ra_serve( ra, req, count, (char*) buf ) ) {
+    req->pending = 2;
+    if ( nfs_pread_async( nfs, &fh->fh, offset, count, buf, nfs_ra_direct_cb, req ) < 0 ) {
+      delete req;
+      return -1;
+    }
+  }
+
+  /* the reader moved past these */
+  if ( ra->hits ) {
+    nfs_ra_drop( nfs, ra, nfs_ra_behind, offset );
+  }
+  if ( ra->hits ) {
+    nfs_ra_fill( nfs, fh, offset, end );
+  }
+  if ( !ra->expiry.pprev ) {
+    nfs_ra_arm( ra, now );
+  }
+  nfs_ra_complete( req );
+  return 0;
+}
+
+/* a write to [offset, offset + count): buffers holding what it overwrites go */
+void nfs_ra_invalidate( struct nfs_context* nfs, struct nfsfh* fh, uint64_t offset, uint64_t count ) {
+  struct nfs_ra* ra = fh->ra;
+  if ( !ra ) {
+    return;
+  }
+  for ( auto it = ra->bufs.begin(); it != ra->bufs.end(); ) {
+    struct nfs_ra_buf* b = *it;
+    if ( !b->dropped && b->offset < offset + count && offset < b->offset + b->len ) {
+      /* reads waiting on one still in flight were issued before the write */
+      if ( b->ready ) {
+        it = ra->bufs.erase( it );
+        nfs_ra_free_buf( nfs, ra, b );
+        continue;
+      }
+      b->dropped = true;
+    }
+    ++it;
+  }
+}
+
+/* the nfsfh is being freed; buffers still being read go when they are back */
+void nfs_ra_release( struct nfs_context* nfs, struct nfsfh* fh ) {
+  struct nfs_ra* ra = fh->ra;
+  if ( !ra ) {
+    return;
+  }
+  fh->ra     = nullptr;
+  ra->closed = true;
+  rpc_timer_cancel( &nfs->rpc->timers, &ra->expiry );
+  for ( auto it = ra->bufs.begin(); it != ra->bufs.end(); ) {
+    struct nfs_ra_buf* b = *it;
+    if ( b->ready ) {
+      it = ra->bufs.erase( it );
+      nfs_ra_free_buf( nfs, ra, b );
+    } else {
+      ++it;
+    }
+  }
+  if ( !ra->inflight ) {
+    delete ra;
+  }
+}
@@ -0,0 +1,1123 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mount/v3/mount_v3.h>
+#include <mutex>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <random>
+#include <rpc/rpc.h>
+#include <shared_mutex>
+#include <string>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Loopback NFSv3 server over a local directory.
+ *
+ * A file handle is the server's boot cookie followed by the inode number.
+ * Inodes are mapped back to names as they are handed out (MNT, LOOKUP,
+ * CREATE, READDIRPLUS, ...) as a parent inode plus a name, so a RENAME only
+ * has to update the entry of what was moved. Every operation resolves its
+ * handle to a path and checks the inode number found there: handles of
+ * files removed or replaced behind the server's back go stale. Symlinks
+ * below the export are not followed, but nothing stops the directory from
+ * being changed underneath; this is a test and benchmark server.
+ */
+
+#define NFS_SERVER_FH_SIZE 16
+
+struct nfs_server_node {
+  uint64_t    parent; /* 0 for the root */
+  std::string name;
+};
+
+struct nfs_server {
+  struct rpc_server*   rpc;
+  std::string          root;
+  uint64_t             root_ino;
+  uint64_t             fsid;
+  uint64_t             cookie; /* changes with every server instance */
+  char                 writeverf[ NFS3_WRITEVERFSIZE ];
+  struct mount3_export exp;
+
+  std::shared_mutex                                nodes_mtx;
+  std::unordered_map< uint64_t, nfs_server_node > nodes;
+};
+
+/* a handle in its wire form, with its own storage */
+struct nfs_server_fh {
+  char     val[ NFS_SERVER_FH_SIZE ];
+  nfs_fh3  fh;
+};
+
+static nfsstat3 nfs_server_errno( int err ) {
+  switch ( err ) {
+    case EPERM:
+      return NFS3ERR_PERM;
+    case ENOENT:
+      return NFS3ERR_NOENT;
+    case ENXIO:
+      return NFS3ERR_NXIO;
+    case EACCES:
+      return NFS3ERR_ACCES;
+    case EEXIST:
+      return NFS3ERR_EXIST;
+    case EXDEV:
+      return NFS3ERR_XDEV;
+    case ENODEV:
+      return NFS3ERR_NODEV;
+    case ENOTDIR:
+      return NFS3ERR_NOTDIR;
+    case EISDIR:
+      return NFS3ERR_ISDIR;
+    case EINVAL:
+      return NFS3ERR_INVAL;
+    case EFBIG:
+      return NFS3ERR_FBIG;
+    case ENOSPC:
+      return NFS3ERR_NOSPC;
+    case EROFS:
+      return NFS3ERR_ROFS;
+    case EMLINK:
+      return NFS3ERR_MLINK;
+    case ENAMETOOLONG:
+      return NFS3ERR_NAMETOOLONG;
+    case ENOTEMPTY:
+      return NFS3ERR_NOTEMPTY;
+    case EDQUOT:
+      return NFS3ERR_DQUOT;
+    case ESTALE:
+      return NFS3ERR_STALE;
+    default:
+      return NFS3ERR_IO;
+  }
+}
+
+static void nfs_server_make_fh( struct nfs_server* srv, uint64_t ino, struct nfs_server_fh* out ) {
+  memcpy( out->val, &srv->cookie, 8 );
+  memcpy( out->val + 8, &ino, 8 );
+  out->fh.data.data_val = out->val;
+  out->fh.data.data_len = NFS_SERVER_FH_SIZE;
+}
+
+static void nfs_server_remember( struct nfs_server* srv, uint64_t parent, const char* name, uint64_t ino ) {
+  if ( ino == srv->root_ino ) {
+    return;
+  }
+  std::unique_lock< std::shared_mutex > lock( srv->nodes_mtx );
+  nfs_server_node&                      node = srv->nodes[ ino ];
+  node.parent                                = parent;
+  node.name                                  = name;
+}
+
+static void nfs_server_forget( struct nfs_server* srv, uint64_t parent, const char* name, uint64_t ino ) {
+  std::unique_lock< std::shared_mutex > lock( srv->nodes_mtx );
+  auto                                  it = srv->nodes.find( ino );
+  if ( it != srv->nodes.end() && it->second.parent == parent && it->second.name == name ) {
+    srv->nodes.erase( it );
+  }
+}
+
+/*
+ * Resolve a handle to the path of its object, which is lstat()ed into *st.
+ */
+static nfsstat3 nfs_server_resolve( struct nfs_server* srv, const nfs_fh3* fh, std::string* path, struct stat* st ) {
+  uint64_t cookie, ino;
+
+  if ( fh->data.data_len != NFS_SERVER_FH_SIZE ) {
+    return NFS3ERR_BADHANDLE;
+  }
+  memcpy( &cookie, fh->data.data_val, 8 );
+  memcpy( &ino, fh->data.data_val + 8, 8 );
+  if ( cookie != srv->cookie ) {
+    return NFS3ERR_STALE;
+  }
+
+  std::vector< const std::string* > names;
+  {
+    std::shared_lock< std::shared_mutex > lock( srv->nodes_mtx );
+    for ( uint64_t i = ino; i != srv->root_ino; ) {
+      auto it = srv->nodes.find( i );
+      if ( it == srv->nodes.end() || names.size() > PATH_MAX / 2 ) {
+        return NFS3ERR_STALE;
+      }
+      names.push_back( &it->second.name );
+      i = it->second.parent;
+    }
+    *path = srv->root;
+    for ( auto it = names.rbegin(); it != names.rend(); ++it ) {
+      *path += '/';
+      *path += **it;
+    }
+  }
+
+  if ( lstat( path->c_str(), st ) < 0 ) {
+    return errno == ENOENT ? NFS3ERR_STALE : nfs_server_errno( errno );
+  }
+  return st->st_ino == ino ? NFS3_OK : NFS3ERR_STALE;
+}
+
+/* a directory handle, for operations on one of its entries */
+static nfsstat3 nfs_server_resolve_dir( struct nfs_server* srv, const nfs_fh3* fh, std::string* path, struct stat* st ) {
+  nfsstat3 status = nfs_server_resolve( srv, fh, path, st );
+  if ( status == NFS3_OK && !S_ISDIR( st->st_mode ) ) {
+    return NFS3ERR_NOTDIR;
+  }
+  return status;
+}
+
+/* a name to be created or removed in a directory */
+static nfsstat3 nfs_server_check_name( const char* name ) {
+  if ( !name || !*name || strchr( name, '/' ) || !strcmp( name, "." ) || !strcmp( name, ".." ) ) {
+    return NFS3ERR_INVAL;
+  }
+  return strlen( name ) > NAME_MAX ? NFS3ERR_NAMETOOLONG : NFS3_OK;
+}
+
+static void nfs_server_fattr( struct nfs_server* srv, const struct stat* st, fattr3* f ) {
+  if ( S_ISREG( st->st_mode ) ) {
+    f->type = NF3REG;
+  } else if ( S_ISDIR( st->st_mode ) ) {
+    f->type = NF3DIR;
+  } else if ( S_ISLNK( st->st_mode ) ) {
+    f->type = NF3LNK;
+  } else if ( S_ISBLK( st->st_mode ) ) {
+    f->type = NF3BLK;
+  } else if ( S_ISCHR( st->st_mode ) ) {
+    f->type = NF3CHR;
+  } else if ( S_ISSOCK( st->st_mode ) ) {
+    f->type = NF3SOCK;
+  } else {
+    f->type = NF3FIFO;
+  }
+  f->mode           = st->st_mode & 07777;
+  f->nlink          = st->st_nlink;
+  f->uid            = st->st_uid;
+  f->gid            = st->st_gid;
+  f->size           = st->st_size;
+  f->used           = (uint64_t) st->st_blocks * 512;
+  f->rdev.specdata1 = major( st->st_rdev );
+  f->rdev.specdata2 = minor( st->st_rdev );
+  f->fsid           = srv->fsid;
+  f->fileid         = st->st_ino;
+  f->atime          = { (uint32_t) st->st_atim.tv_sec, (uint32_t) st->st_atim.tv_nsec };
+  f->mtime          = { (uint32_t) st->st_mtim.tv_sec, (uint32_t) st->st_mtim.tv_nsec };
+  f->ctime          = { (uint32_t) st->st_ctim.tv_sec, (uint32_t) st->st_ctim.tv_nsec };
+}
+
+static void nfs_server_post_op( struct nfs_server* srv, const struct stat* st, post_op_attr* attr ) {
+  attr->attributes_follow = st != nullptr;
+  if ( st ) {
+    nfs_server_fattr( srv, st, &attr->post_op_attr_u.attributes );
+  }
+}
+
+/* post-op attributes of whatever is at path now */
+static void nfs_server_post_op_path( struct nfs_server* srv, const std::string& path, post_op_attr* attr ) {
+  struct stat st;
+  nfs_server_post_op( srv, lstat( path.c_str(), &st ) == 0 ? &st : nullptr, attr );
+}
+
+static void nfs_server_pre_op( const struct stat* st, pre_op_attr* attr ) {
+  attr->attributes_follow = st != nullptr;
+  if ( st ) {
+    wcc_attr* w = &attr->pre_op_attr_u.attributes;
+    w->size     = st->st_size;
+    w->mtime    = { (uint32_t) st->st_mtim.tv_sec, (uint32_t) st->st_mtim.tv_nsec };
+    w->ctime    = { (uint32_t) st->st_ctim.tv_sec, (uint32_t) st->st_ctim.tv_nsec };
+  }
+}
+
+static void nfs_server_wcc( struct nfs_server* srv, const struct stat* before, const std::string& path, wcc_data* wcc ) {
+  nfs_server_pre_op( before, &wcc->before );
+  nfs_server_post_op_path( srv, path, &wcc->after );
+}
+
+static struct timespec nfs_server_time( time_how how, const nfstime3* t ) {
+  switch ( how ) {
+    case SET_TO_SERVER_TIME:
+      return { 0, UTIME_NOW };
+    case SET_TO_CLIENT_TIME:
+      return { (time_t) t->seconds, (long) t->nseconds };
+    default:
+      return { 0, UTIME_OMIT };
+  }
+}
+
+static nfsstat3 nfs_server_setattr_path( const std::string& path, const struct stat* st, const sattr3* a ) {
+  const char* p = path.c_str();
+
+  if ( a->size.set_it ) {
+    if ( !S_ISREG( st->st_mode ) ) {
+      return S_ISDIR( st->st_mode ) ? NFS3ERR_ISDIR : NFS3ERR_INVAL;
+    }
+    if ( truncate( p, a->size.set_size3_u.size ) < 0 ) {
+      return nfs_server_errno( errno );
+    }
+  }
+  if ( a->mode.set_it && !S_ISLNK( st->st_mode ) && chmod( p, a->mode.set_mode3_u.mode & 07777 ) < 0 ) {
+    return nfs_server_errno( errno );
+  }
+  if ( ( a->uid.set_it || a->gid.set_it )
+       && lchown( p, a->uid.set_it ? a->uid.set_uid3_u.uid : (uid_t) -1,
+                  a->gid.set_it ? a->gid.set_gid3_u.gid : (gid_t) -1 ) < 0 ) {
+    return nfs_server_errno( errno );
+  }
+  if ( a->atime.set_it != DONT_CHANGE || a->mtime.set_it != DONT_CHANGE ) {
+    struct timespec ts[ 2 ] = { nfs_server_time( a->atime.set_it, &a->atime.set_atime_u.atime ),
+                                nfs_server_time( a->mtime.set_it, &a->mtime.set_mtime_u.mtime ) };
+    if ( utimensat( AT_FDCWD, p, ts, AT_SYMLINK_NOFOLLOW ) < 0 ) {
+      return nfs_server_errno( errno );
+    }
+  }
+  return NFS3_OK;
+}
+
+#define NFS_SERVER_DECODE( type, args, a ) \
+  type a {};                               \
+  if ( !zdr_##type( args, &a ) ) {         \
+    return RPC_GARBAGE_ARGS;               \
+  }
+
+#define NFS_SERVER_ENCODE( type, res, r ) ( zdr_##type( res, &r ) ? RPC_SUCCESS : RPC_SYSTEM_ERR )
+
+static uint32_t nfs3_null( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  return RPC_SUCCESS;
+}
+
+static uint32_t nfs3_getattr( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( GETATTR3args, args, a );
+  GETATTR3res r {};
+  std::string path;
+  struct stat st;
+
+  r.status = nfs_server_resolve( srv, &a.object, &path, &st );
+  if ( r.status == NFS3_OK ) {
+    nfs_server_fattr( srv, &st, &r.GETATTR3res_u.resok.obj_attributes );
+  }
+  return NFS_SERVER_ENCODE( GETATTR3res, res, r );
+}
+
+static uint32_t nfs3_setattr( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( SETATTR3args, args, a );
+  SETATTR3res r {};
+  std::string path;
+  struct stat st;
+
+  r.status = nfs_server_resolve( srv, &a.object, &path, &st );
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( SETATTR3res, res, r );
+  }
+  if ( a.guard.check
+       && ( a.guard.sattrguard3_u.obj_ctime.seconds != (uint32_t) st.st_ctim.tv_sec
+            || a.guard.sattrguard3_u.obj_ctime.nseconds != (uint32_t) st.st_ctim.tv_nsec ) ) {
+    r.status = NFS3ERR_NOT_SYNC;
+  } else {
+    r.status = nfs_server_setattr_path( path, &st, &a.new_attributes );
+  }
+  nfs_server_wcc( srv, &st, path, &r.SETATTR3res_u.resok.obj_wcc );
+  return NFS_SERVER_ENCODE( SETATTR3res, res, r );
+}
+
+static uint32_t nfs3_lookup( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( LOOKUP3args, args, a );
+  LOOKUP3res           r {};
+  LOOKUP3resok*        ok = &r.LOOKUP3res_u.resok;
+  std::string          dir, path;
+  struct stat          dst, st;
+  struct nfs_server_fh fh;
+  const char*          name = a.what.name;
+
+  r.status = nfs_server_resolve_dir( srv, &a.what.dir, &dir, &dst );
+  if ( r.status != NFS3_OK ) {
+    nfs_server_post_op( srv, r.status == NFS3ERR_NOTDIR ? &dst : nullptr, &r.LOOKUP3res_u.resfail.dir_attributes );
+    return NFS_SERVER_ENCODE( LOOKUP3res, res, r );
+  }
+
+  /* "", "." and ".." would make a directory its own parent, or worse, in the inode map */
+  r.status = nfs_server_check_name( name );
+  if ( r.status == NFS3_OK ) {
+    path = dir + '/' + name;
+    if ( lstat( path.c_str(), &st ) < 0 ) {
+      r.status = nfs_server_errno( errno );
+    } else {
+      nfs_server_remember( srv, dst.st_ino, name, st.st_ino );
+    }
+  }
+
+  if ( r.status != NFS3_OK ) {
+    nfs_server_post_op( srv, &dst, &r.LOOKUP3res_u.resfail.dir_attributes );
+  } else {
+    nfs_server_make_fh( srv, st.st_ino, &fh );
+    ok->object = fh.fh;
+    nfs_server_post_op( srv, &st, &ok->obj_attributes );
+    nfs_server_post_op( srv, &dst, &ok->dir_attributes );
+  }
+  return NFS_SERVER_ENCODE( LOOKUP3res, res, r );
+}
+
+/*
+ * Judged from the mode bits against the caller's AUTH_UNIX identity, which
+ * is what the later operations will be checked against as well, as long as
+ * the server runs as root.
+ */
+static uint32_t nfs3_access( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( ACCESS3args, args, a );
+  ACCESS3res  r {};
+  std::string path;
+  struct stat st;
+
+  r.status = nfs_server_resolve( srv, &a.object, &path, &st );
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( ACCESS3res, res, r );
+  }
+
+  uint32_t perm;
+  if ( call->uid == 0 ) {
+    perm = 06 | ( ( st.st_mode & 0111 ) ? 01 : 0 );
+  } else if ( call->uid == st.st_uid ) {
+    perm = ( st.st_mode >> 6 ) & 07;
+  } else if ( call->gid == st.st_gid ) {
+    perm = ( st.st_mode >> 3 ) & 07;
+  } else {
+    perm = st.st_mode & 07;
+  }
+
+  uint32_t granted = 0;
+  if ( perm & 04 ) {
+    granted |= ACCESS3_READ;
+  }
+  if ( perm & 02 ) {
+    granted |= ACCESS3_MODIFY | ACCESS3_EXTEND | ( S_ISDIR( st.st_mode ) ? ACCESS3_DELETE : 0 );
+  }
+  if ( perm & 01 ) {
+    granted |= S_ISDIR( st.st_mode ) ? ACCESS3_LOOKUP : ACCESS3_EXECUTE;
+  }
+  r.ACCESS3res_u.resok.access = a.access & granted;
+  nfs_server_post_op( srv, &st, &r.ACCESS3res_u.resok.obj_attributes );
+  return NFS_SERVER_ENCODE( ACCESS3res, res, r );
+}
+
+static uint32_t nfs3_readlink( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( READLINK3args, args, a );
+  READLINK3res r {};
+  std::string  path;
+  struct stat  st;
+  char         target[ PATH_MAX + 1 ];
+
+  r.status = nfs_server_resolve( srv, &a.symlink, &path, &st );
+  if ( r.status == NFS3_OK && !S_ISLNK( st.st_mode ) ) {
+    r.status = NFS3ERR_INVAL;
+  }
+  if ( r.status == NFS3_OK ) {
+    ssize_t n = readlink( path.c_str(), target, PATH_MAX );
+    if ( n < 0 ) {
+      r.status = nfs_server_errno( errno );
+    } else {
+      target[ n ]              = '\0';
+      r.READLINK3res_u.resok.data = target;
+    }
+  }
+  nfs_server_post_op( srv, r.status == NFS3ERR_STALE || r.status == NFS3ERR_BADHANDLE ? nullptr : &st,
+                      &r.READLINK3res_u.resok.symlink_attributes );
+  return NFS_SERVER_ENCODE( READLINK3res, res, r );
+}
+
+/* The data is read into call->payload and sent from there. */
+static uint32_t nfs3_read( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( READ3args, args, a );
+  READ3res    r {};
+  READ3resok* ok = &r.READ3res_u.resok;
+  std::string path;
+  struct stat st;
+  int         fd = -1;
+
+  r.status = nfs_server_resolve( srv, &a.file, &path, &st );
+  if ( r.status == NFS3_OK && !S_ISREG( st.st_mode ) ) {
+    r.status = S_ISDIR( st.st_mode ) ? NFS3ERR_ISDIR : NFS3ERR_INVAL;
+  }
+  if ( r.status == NFS3_OK && ( fd = open( path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  if ( r.status != NFS3_OK ) {
+    nfs_server_post_op( srv, r.status == NFS3ERR_STALE || r.status == NFS3ERR_BADHANDLE ? nullptr : &st,
+                        &r.READ3res_u.resfail.file_attributes );
+    return NFS_SERVER_ENCODE( READ3res, res, r );
+  }
+
+  uint32_t count = std::min( a.count, call->payload_size );
+  ssize_t  n     = pread( fd, call->payload, count, a.offset );
+  if ( n < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  fstat( fd, &st );
+  close( fd );
+  if ( r.status != NFS3_OK ) {
+    nfs_server_post_op( srv, &st, &r.READ3res_u.resfail.file_attributes );
+    return NFS_SERVER_ENCODE( READ3res, res, r );
+  }
+
+  ok->count          = n;
+  ok->eof            = a.offset + n >= (uint64_t) st.st_size;
+  ok->data.data_val  = call->payload;
+  ok->data.data_len  = n;
+  nfs_server_post_op( srv, &st, &ok->file_attributes );
+  zdr_set_payload( res, call->payload, n );
+  return NFS_SERVER_ENCODE( READ3res, res, r );
+}
+
+static uint32_t nfs3_write( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( WRITE3args, args, a );
+  WRITE3res    r {};
+  WRITE3resok* ok = &r.WRITE3res_u.resok;
+  std::string  path;
+  struct stat  st;
+  int          fd = -1;
+
+  r.status = nfs_server_resolve( srv, &a.file, &path, &st );
+  if ( r.status == NFS3_OK && !S_ISREG( st.st_mode ) ) {
+    r.status = S_ISDIR( st.st_mode ) ? NFS3ERR_ISDIR : NFS3ERR_INVAL;
+  }
+  if ( r.status == NFS3_OK && a.data.data_len < a.count ) {
+    r.status = NFS3ERR_INVAL;
+  }
+  if ( r.status == NFS3_OK && ( fd = open( path.c_str(), O_WRONLY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  if ( r.status != NFS3_OK ) {
+    nfs_server_pre_op( r.status == NFS3ERR_STALE || r.status == NFS3ERR_BADHANDLE ? nullptr : &st,
+                       &r.WRITE3res_u.resfail.file_wcc.before );
+    return NFS_SERVER_ENCODE( WRITE3res, res, r );
+  }
+
+  for ( uint32_t done = 0; done < a.count; ) {
+    ssize_t n = pwrite( fd, a.data.data_val + done, a.count - done, a.offset + done );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      r.status = nfs_server_errno( errno );
+      break;
+    }
+    done += n;
+  }
+  if ( r.status == NFS3_OK && a.stable != UNSTABLE && fdatasync( fd ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  close( fd );
+
+  if ( r.status != NFS3_OK ) {
+    nfs_server_wcc( srv, &st, path, &r.WRITE3res_u.resfail.file_wcc );
+    return NFS_SERVER_ENCODE( WRITE3res, res, r );
+  }
+  nfs_server_wcc( srv, &st, path, &ok->file_wcc );
+  ok->count     = a.count;
+  ok->committed = a.stable == UNSTABLE ? UNSTABLE : FILE_SYNC;
+  memcpy( ok->verf, srv->writeverf, NFS3_WRITEVERFSIZE );
+  return NFS_SERVER_ENCODE( WRITE3res, res, r );
+}
+
+/*
+ * The part CREATE, MKDIR, SYMLINK and LINK have in common: the directory
+ * and name of the new object, and what goes into the reply once it exists.
+ */
+struct nfs_server_newobj {
+  std::string          dir;
+  std::string          path;
+  struct stat          dst;
+  struct nfs_server_fh fh;
+};
+
+static nfsstat3 nfs_server_newobj_begin( struct nfs_server* srv, const diropargs3* where, struct nfs_server_newobj* o ) {
+  nfsstat3 status = nfs_server_resolve_dir( srv, &where->dir, &o->dir, &o->dst );
+  if ( status == NFS3_OK ) {
+    status = nfs_server_check_name( where->name );
+  }
+  if ( status == NFS3_OK ) {
+    o->path = o->dir + '/' + where->name;
+  }
+  return status;
+}
+
+static void nfs_server_newobj_done( struct nfs_server*        srv,
+                                    struct nfs_server_newobj* o,
+                                    const char*               name,
+                                    post_op_fh3*              obj,
+                                    post_op_attr*             attr ) {
+  struct stat st;
+  if ( lstat( o->path.c_str(), &st ) < 0 ) {
+    return;
+  }
+  nfs_server_remember( srv, o->dst.st_ino, name, st.st_ino );
+  nfs_server_make_fh( srv, st.st_ino, &o->fh );
+  obj->handle_follows      = 1;
+  obj->post_op_fh3_u.handle = o->fh.fh;
+  nfs_server_post_op( srv, &st, attr );
+}
+
+/*
+ * EXCLUSIVE creates keep the verifier in the new file's atime and mtime,
+ * as knfsd does, so a retransmitted CREATE can be told from a conflict.
+ */
+static uint32_t nfs3_create( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( CREATE3args, args, a );
+  CREATE3res               r {};
+  CREATE3resok*            ok = &r.CREATE3res_u.resok;
+  struct nfs_server_newobj o;
+  const sattr3*            attr = &a.how.createhow3_u.obj_attributes;
+  uint32_t                 verf[ 2 ];
+
+  r.status = nfs_server_newobj_begin( srv, &a.where, &o );
+  if ( r.status != NFS3_OK ) {
+    nfs_server_pre_op( r.status == NFS3ERR_INVAL || r.status == NFS3ERR_NAMETOOLONG ? &o.dst : nullptr,
+                       &r.CREATE3res_u.resfail.dir_wcc.before );
+    return NFS_SERVER_ENCODE( CREATE3res, res, r );
+  }
+
+  int   flags = O_CREAT | O_WRONLY | O_NOFOLLOW | O_CLOEXEC | ( a.how.mode == UNCHECKED ? 0 : O_EXCL );
+  mode_t mode = a.how.mode != EXCLUSIVE && attr->mode.set_it ? attr->mode.set_mode3_u.mode & 07777 : 0644;
+  int   fd    = open( o.path.c_str(), flags, mode );
+  memcpy( verf, a.how.createhow3_u.verf, sizeof( verf ) );
+
+  if ( fd < 0 && errno == EEXIST && a.how.mode == EXCLUSIVE ) {
+    struct stat st;
+    if ( lstat( o.path.c_str(), &st ) == 0 && (uint32_t) st.st_atim.tv_sec == verf[ 0 ]
+         && (uint32_t) st.st_mtim.tv_sec == verf[ 1 ] ) {
+      fd = open( o.path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC );
+    } else {
+      errno = EEXIST;
+    }
+  } else if ( fd >= 0 && a.how.mode == EXCLUSIVE ) {
+    struct timespec ts[ 2 ] = { { (time_t) verf[ 0 ], 0 }, { (time_t) verf[ 1 ], 0 } };
+    futimens( fd, ts );
+  }
+  if ( fd < 0 ) {
+    r.status = nfs_server_errno( errno );
+  } else {
+    close( fd );
+    if ( a.how.mode != EXCLUSIVE ) {
+      struct stat st;
+      sattr3      rest = *attr;
+      rest.mode.set_it = 0;
+      if ( lstat( o.path.c_str(), &st ) == 0 ) {
+        r.status = nfs_server_setattr_path( o.path, &st, &rest );
+      }
+    }
+    nfs_server_newobj_done( srv, &o, a.where.name, &ok->obj, &ok->obj_attributes );
+  }
+  nfs_server_wcc( srv, &o.dst, o.dir, &ok->dir_wcc );
+  return NFS_SERVER_ENCODE( CREATE3res, res, r );
+}
+
+static uint32_t nfs3_mkdir( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( MKDIR3args, args, a );
+  MKDIR3res                r {};
+  MKDIR3resok*             ok = &r.MKDIR3res_u.resok;
+  struct nfs_server_newobj o;
+
+  r.status = nfs_server_newobj_begin( srv, &a.where, &o );
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( MKDIR3res, res, r );
+  }
+  mode_t mode = a.attributes.mode.set_it ? a.attributes.mode.set_mode3_u.mode & 07777 : 0755;
+  if ( mkdir( o.path.c_str(), mode ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  } else {
+    nfs_server_newobj_done( srv, &o, a.where.name, &ok->obj, &ok->obj_attributes );
+  }
+  nfs_server_wcc( srv, &o.dst, o.dir, &ok->dir_wcc );
+  return NFS_SERVER_ENCODE( MKDIR3res, res, r );
+}
+
+static uint32_t nfs3_symlink( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( SYMLINK3args, args, a );
+  SYMLINK3res              r {};
+  SYMLINK3resok*           ok = &r.SYMLINK3res_u.resok;
+  struct nfs_server_newobj o;
+
+  r.status = nfs_server_newobj_begin( srv, &a.where, &o );
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( SYMLINK3res, res, r );
+  }
+  if ( symlink( a.symlink.symlink_data ? a.symlink.symlink_data : "", o.path.c_str() ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  } else {
+    nfs_server_newobj_done( srv, &o, a.where.name, &ok->obj, &ok->obj_attributes );
+  }
+  nfs_server_wcc( srv, &o.dst, o.dir, &ok->dir_wcc );
+  return NFS_SERVER_ENCODE( SYMLINK3res, res, r );
+}
+
+static uint32_t nfs3_mknod( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  NFS_SERVER_DECODE( MKNOD3args, args, a );
+  MKNOD3res r {};
+  r.status = NFS3ERR_NOTSUPP;
+  return NFS_SERVER_ENCODE( MKNOD3res, res, r );
+}
+
+/* REMOVE and RMDIR */
+static nfsstat3 nfs_server_unlink( struct nfs_server* srv, const diropargs3* what, bool dir, wcc_data* wcc ) {
+  std::string dpath, path;
+  struct stat dst, st;
+  nfsstat3    status = nfs_server_resolve_dir( srv, &what->dir, &dpath, &dst );
+
+  if ( status != NFS3_OK ) {
+    return status;
+  }
+  status = nfs_server_check_name( what->name );
+  if ( status == NFS3_OK ) {
+    path = dpath + '/' + what->name;
+    if ( lstat( path.c_str(), &st ) < 0 ) {
+      status = nfs_server_errno( errno );
+    } else if ( ( dir ? rmdir( path.c_str() ) : unlink( path.c_str() ) ) < 0 ) {
+      status = nfs_server_errno( errno );
+    } else {
+      nfs_server_forget( srv, dst.st_ino, what->name, st.st_ino );
+    }
+  } else if ( dir && what->name && !strcmp( what->name, "." ) ) {
+    status = NFS3ERR_INVAL;
+  } else if ( what->name && !strcmp( what->name, ".." ) ) {
+    status = dir ? NFS3ERR_EXIST : NFS3ERR_ISDIR;
+  }
+  nfs_server_wcc( srv, &dst, dpath, wcc );
+  return status;
+}
+
+static uint32_t nfs3_remove( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  NFS_SERVER_DECODE( REMOVE3args, args, a );
+  REMOVE3res r {};
+  r.status = nfs_server_unlink( (struct nfs_server*) private_data, &a.object, false, &r.REMOVE3res_u.resok.dir_wcc );
+  return NFS_SERVER_ENCODE( REMOVE3res, res, r );
+}
+
+static uint32_t nfs3_rmdir( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  NFS_SERVER_DECODE( RMDIR3args, args, a );
+  RMDIR3res r {};
+  r.status = nfs_server_unlink( (struct nfs_server*) private_data, &a.object, true, &r.RMDIR3res_u.resok.dir_wcc );
+  return NFS_SERVER_ENCODE( RMDIR3res, res, r );
+}
+
+static uint32_t nfs3_rename( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( RENAME3args, args, a );
+  RENAME3res    r {};
+  RENAME3resok* ok = &r.RENAME3res_u.resok;
+  std::string   fdir, tdir, from, to;
+  struct stat   fst, tst, st, old;
+
+  r.status = nfs_server_resolve_dir( srv, &a.from.dir, &fdir, &fst );
+  if ( r.status == NFS3_OK ) {
+    r.status = nfs_server_resolve_dir( srv, &a.to.dir, &tdir, &tst );
+  }
+  if ( r.status == NFS3_OK ) {
+    r.status = nfs_server_check_name( a.from.name );
+  }
+  if ( r.status == NFS3_OK ) {
+    r.status = nfs_server_check_name( a.to.name );
+  }
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( RENAME3res, res, r );
+  }
+
+  from          = fdir + '/' + a.from.name;
+  to            = tdir + '/' + a.to.name;
+  bool replaced = lstat( to.c_str(), &old ) == 0;
+  if ( lstat( from.c_str(), &st ) < 0 || rename( from.c_str(), to.c_str() ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  } else {
+    if ( replaced && old.st_ino != st.st_ino ) {
+      nfs_server_forget( srv, tst.st_ino, a.to.name, old.st_ino );
+    }
+    nfs_server_remember( srv, tst.st_ino, a.to.name, st.st_ino );
+  }
+  nfs_server_wcc( srv, &fst, fdir, &ok->fromdir_wcc );
+  nfs_server_wcc( srv, &tst, tdir, &ok->todir_wcc );
+  return NFS_SERVER_ENCODE( RENAME3res, res, r );
+}
+
+static uint32_t nfs3_link( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( LINK3args, args, a );
+  LINK3res                 r {};
+  LINK3resok*              ok = &r.LINK3res_u.resok;
+  std::string              path;
+  struct stat              st;
+  struct nfs_server_newobj o;
+
+  r.status = nfs_server_resolve( srv, &a.file, &path, &st );
+  if ( r.status == NFS3_OK && S_ISDIR( st.st_mode ) ) {
+    r.status = NFS3ERR_ISDIR;
+  }
+  if ( r.status == NFS3_OK ) {
+    r.status = nfs_server_newobj_begin( srv, &a.link, &o );
+  }
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( LINK3res, res, r );
+  }
+  if ( link( path.c_str(), o.path.c_str() ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  nfs_server_post_op_path( srv, path, &ok->file_attributes );
+  nfs_server_wcc( srv, &o.dst, o.dir, &ok->linkdir_wcc );
+  return NFS_SERVER_ENCODE( LINK3res, res, r );
+}
+
+/*
+ * Directory listings, for READDIR and READDIRPLUS. Cookies are the
+ * telldir() positions, which on Linux are stable across opendir()s of the
+ * same directory; the cookie verifier is not used.
+ */
+struct nfs_server_dirent {
+  std::string name;
+  uint64_t    ino;
+  uint64_t    cookie;
+};
+
+static nfsstat3 nfs_server_list( const std::string& path, uint64_t cookie, std::vector< nfs_server_dirent >* out, size_t max, bool* eof ) {
+  DIR* d = opendir( path.c_str() );
+  if ( !d ) {
+    return nfs_server_errno( errno );
+  }
+  if ( cookie ) {
+    seekdir( d, (long) cookie );
+  }
+  *eof = false;
+  while ( out->size() < max ) {
+    errno            = 0;
+    struct dirent* e = readdir( d );
+    if ( !e ) {
+      *eof = errno == 0;
+      break;
+    }
+    out->push_back( { e->d_name, e->d_ino, (uint64_t) telldir( d ) } );
+  }
+  closedir( d );
+  return NFS3_OK;
+}
+
+/* wire size of an entry3 */
+static uint32_t nfs_server_entry_size( const std::string& name ) {
+  return 4 + 8 + 4 + ZDR_ROUNDUP( name.size() ) + 8;
+}
+
+/* reply overhead besides the entries: status, dir attributes, verifier, eof */
+#define NFS_SERVER_READDIR_OVERHEAD ( 4 + 4 + 84 + 8 + 4 + 4 )
+
+/* post_op_attr and post_op_fh3 of an entryplus3 */
+#define NFS_SERVER_ENTRYPLUS_EXTRA ( 4 + 84 + 4 + 4 + NFS_SERVER_FH_SIZE )
+
+static uint32_t nfs3_readdir( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( READDIR3args, args, a );
+  READDIR3res                       r {};
+  READDIR3resok*                    ok = &r.READDIR3res_u.resok;
+  std::string                       path;
+  struct stat                       st;
+  std::vector< nfs_server_dirent >  ents;
+  bool                              eof;
+
+  r.status = nfs_server_resolve_dir( srv, &a.dir, &path, &st );
+  if ( r.status == NFS3_OK ) {
+    uint32_t count = std::min( a.count, (uint32_t) zdr_remaining( res ) );
+    r.status       = nfs_server_list( path, a.cookie, &ents, count / 24 + 1, &eof );
+  }
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( READDIR3res, res, r );
+  }
+
+  std::vector< entry3 > entries( ents.size() );
+  uint32_t              size = NFS_SERVER_READDIR_OVERHEAD;
+  size_t                n    = 0;
+  for ( ; n < ents.size(); n++ ) {
+    size += nfs_server_entry_size( ents[ n ].name );
+    if ( size > std::min( a.count, (uint32_t) zdr_remaining( res ) ) ) {
+      eof = false;
+      break;
+    }
+    entries[ n ].fileid    = ents[ n ].ino;
+    entries[ n ].name      = (char*) ents[ n ].name.c_str();
+    entries[ n ].cookie    = ents[ n ].cookie;
+    if ( n ) {
+      entries[ n - 1 ].nextentry = &entries[ n ];
+    }
+  }
+  if ( !n && !eof ) {
+    r.status = NFS3ERR_TOOSMALL;
+    return NFS_SERVER_ENCODE( READDIR3res, res, r );
+  }
+  ok->reply.entries = n ? &entries[ 0 ] : nullptr;
+  ok->reply.eof     = eof;
+  nfs_server_post_op( srv, &st, &ok->dir_attributes );
+  return NFS_SERVER_ENCODE( READDIR3res, res, r );
+}
+
+static uint32_t nfs3_readdirplus( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( READDIRPLUS3args, args, a );
+  READDIRPLUS3res                  r {};
+  READDIRPLUS3resok*               ok = &r.READDIRPLUS3res_u.resok;
+  std::string                      path;
+  struct stat                      st;
+  std::vector< nfs_server_dirent > ents;
+  bool                             eof;
+
+  uint32_t maxcount = std::min( a.maxcount, (uint32_t) zdr_remaining( res ) );
+  r.status          = nfs_server_resolve_dir( srv, &a.dir, &path, &st );
+  if ( r.status == NFS3_OK ) {
+    r.status = nfs_server_list( path, a.cookie, &ents, maxcount / ( 24 + NFS_SERVER_ENTRYPLUS_EXTRA ) + 1, &eof );
+  }
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( READDIRPLUS3res, res, r );
+  }
+
+  std::vector< entryplus3 >           entries( ents.size() );
+  std::vector< struct nfs_server_fh > fhs( ents.size() );
+  uint32_t                            size     = NFS_SERVER_READDIR_OVERHEAD;
+  uint32_t                            dirsize  = 0;
+  size_t                              n        = 0;
+  for ( ; n < ents.size(); n++ ) {
+    const nfs_server_dirent& e = ents[ n ];
+    entryplus3*              p = &entries[ n ];
+    struct stat              est;
+
+    dirsize += nfs_server_entry_size( e.name );
+    size += nfs_server_entry_size( e.name ) + NFS_SERVER_ENTRYPLUS_EXTRA;
+    if ( size > maxcount || dirsize > a.dircount ) {
+      eof = false;
+      break;
+    }
+    p->fileid = e.ino;
+    p->name   = (char*) e.name.c_str();
+    p->cookie = e.cookie;
+
+    std::string epath = e.name == "." ? path : e.name == ".." ? path.substr( 0, path.rfind( '/' ) ) : path + '/' + e.name;
+    if ( e.name == ".." && st.st_ino == srv->root_ino ) {
+      epath = path;
+    }
+    if ( lstat( epath.c_str(), &est ) == 0 ) {
+      if ( e.name != "." && e.name != ".." ) {
+        nfs_server_remember( srv, st.st_ino, e.name.c_str(), est.st_ino );
+      }
+      nfs_server_post_op( srv, &est, &p->name_attributes );
+      nfs_server_make_fh( srv, est.st_ino, &fhs[ n ] );
+      p->name_handle.handle_follows       = 1;
+      p->name_handle.post_op_fh3_u.handle = fhs[ n ].fh;
+    }
+    if ( n ) {
+      entries[ n - 1 ].nextentry = p;
+    }
+  }
+  if ( !n && !eof ) {
+    r.status = NFS3ERR_TOOSMALL;
+    return NFS_SERVER_ENCODE( READDIRPLUS3res, res, r );
+  }
+  ok->reply.entries = n ? &entries[ 0 ] : nullptr;
+  ok->reply.eof     = eof;
+  nfs_server_post_op( srv, &st, &ok->dir_attributes );
+  return NFS_SERVER_ENCODE( READDIRPLUS3res, res, r );
+}
+
+static uint32_t nfs3_fsstat( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( FSSTAT3args, args, a );
+  FSSTAT3res     r {};
+  FSSTAT3resok*  ok = &r.FSSTAT3res_u.resok;
+  std::string    path;
+  struct stat    st;
+  struct statvfs vfs;
+
+  r.status = nfs_server_resolve( srv, &a.fsroot, &path, &st );
+  if ( r.status == NFS3_OK && statvfs( path.c_str(), &vfs ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  if ( r.status == NFS3_OK ) {
+    ok->tbytes   = (uint64_t) vfs.f_blocks * vfs.f_frsize;
+    ok->fbytes   = (uint64_t) vfs.f_bfree * vfs.f_frsize;
+    ok->abytes   = (uint64_t) vfs.f_bavail * vfs.f_frsize;
+    ok->tfiles   = vfs.f_files;
+    ok->ffiles   = vfs.f_ffree;
+    ok->afiles   = vfs.f_favail;
+    ok->invarsec = 0;
+    nfs_server_post_op( srv, &st, &ok->obj_attributes );
+  }
+  return NFS_SERVER_ENCODE( FSSTAT3res, res, r );
+}
+
+static uint32_t nfs3_fsinfo( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( FSINFO3args, args, a );
+  FSINFO3res    r {};
+  FSINFO3resok* ok = &r.FSINFO3res_u.resok;
+  std::string   path;
+  struct stat   st;
+
+  r.status = nfs_server_resolve( srv, &a.fsroot, &path, &st );
+  if ( r.status == NFS3_OK ) {
+    ok->rtmax       = call->payload_size;
+    ok->rtpref      = std::min< uint32_t >( call->payload_size, NFS_DEF_XFER_SIZE );
+    ok->rtmult      = 4096;
+    ok->wtmax       = NFS_MAX_XFER_SIZE;
+    ok->wtpref      = NFS_DEF_XFER_SIZE;
+    ok->wtmult      = 4096;
+    ok->dtpref      = 64 * 1024;
+    ok->maxfilesize = INT64_MAX;
+    ok->time_delta  = { 0, 1 };
+    ok->properties  = FSF3_LINK | FSF3_SYMLINK | FSF3_HOMOGENEOUS | FSF3_CANSETTIME;
+    nfs_server_post_op( srv, &st, &ok->obj_attributes );
+  }
+  return NFS_SERVER_ENCODE( FSINFO3res, res, r );
+}
+
+static uint32_t nfs3_pathconf( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( PATHCONF3args, args, a );
+  PATHCONF3res    r {};
+  PATHCONF3resok* ok = &r.PATHCONF3res_u.resok;
+  std::string     path;
+  struct stat     st;
+
+  r.status = nfs_server_resolve( srv, &a.object, &path, &st );
+  if ( r.status == NFS3_OK ) {
+    long linkmax         = pathconf( path.c_str(), _PC_LINK_MAX );
+    ok->linkmax          = linkmax > 0 ? linkmax : 32000;
+    ok->name_max         = NAME_MAX;
+    ok->no_trunc         = 1;
+    ok->chown_restricted = 1;
+    ok->case_insensitive = 0;
+    ok->case_preserving  = 1;
+    nfs_server_post_op( srv, &st, &ok->obj_attributes );
+  }
+  return NFS_SERVER_ENCODE( PATHCONF3res, res, r );
+}
+
+static uint32_t nfs3_commit( struct rpc_call* call, zdr_t* args, zdr_t* res, void* private_data ) {
+  struct nfs_server* srv = (struct nfs_server*) private_data;
+  NFS_SERVER_DECODE( COMMIT3args, args, a );
+  COMMIT3res    r {};
+  COMMIT3resok* ok = &r.COMMIT3res_u.resok;
+  std::string   path;
+  struct stat   st;
+  int           fd = -1;
+
+  r.status = nfs_server_resolve( srv, &a.file, &path, &st );
+  if ( r.status == NFS3_OK && !S_ISREG( st.st_mode ) ) {
+    r.status = S_ISDIR( st.st_mode ) ? NFS3ERR_ISDIR : NFS3ERR_INVAL;
+  }
+  if ( r.status == NFS3_OK && ( fd = open( path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC ) ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  if ( r.status != NFS3_OK ) {
+    return NFS_SERVER_ENCODE( COMMIT3res, res, r );
+  }
+  if ( fsync( fd ) < 0 ) {
+    r.status = nfs_server_errno( errno );
+  }
+  close( fd );
+  nfs_server_wcc( srv, &st, path, &ok->file_wcc );
+  memcpy( ok->verf, srv->writeverf, NFS3_WRITEVERFSIZE );
+  return NFS_SERVER_ENCODE( COMMIT3res, res, r );
+}
+
+static const struct rpc_service_proc nfs3_procs[] = {
+  { NFS3_NULL, nfs3_null },
+  { NFS3_GETATTR, nfs3_getattr },
+  { NFS3_SETATTR, nfs3_setattr },
+  { NFS3_LOOKUP, nfs3_lookup },
+  { NFS3_ACCESS, nfs3_access },
+  { NFS3_READLINK, nfs3_readlink },
+  { NFS3_READ, nfs3_read },
+  { NFS3_WRITE, nfs3_write },
+  { NFS3_CREATE, nfs3_create },
+  { NFS3_MKDIR, nfs3_mkdir },
+  { NFS3_SYMLINK, nfs3_symlink },
+  { NFS3_MKNOD, nfs3_mknod },
+  { NFS3_REMOVE, nfs3_remove },
+  { NFS3_RMDIR, nfs3_rmdir },
+  { NFS3_RENAME, nfs3_rename },
+  { NFS3_LINK, nfs3_link },
+  { NFS3_READDIR, nfs3_readdir },
+  { NFS3_READDIRPLUS, nfs3_readdirplus },
+  { NFS3_FSSTAT, nfs3_fsstat },
+  { NFS3_FSINFO, nfs3_fsinfo },
+  { NFS3_PATHCONF, nfs3_pathconf },
+  { NFS3_COMMIT, nfs3_commit },
+};
+
+struct nfs_server* nfs_server_start( const char* root, int port, int num_workers ) {
+  struct stat st;
+  char        real[ PATH_MAX ];
+
+  if ( !realpath( root, real ) || stat( real, &st ) < 0 || !S_ISDIR( st.st_mode ) ) {
+    return nullptr;
+  }
+  struct nfs_server* srv = new ( std::nothrow ) nfs_server();
+  if ( !srv ) {
+    return nullptr;
+  }
+  srv->root     = real;
+  srv->root_ino = st.st_ino;
+  srv->fsid     = st.st_dev;
+
+  std::random_device rd;
+  srv->cookie = ( (uint64_t) rd() << 32 ) | rd();
+  for ( char& c : srv->writeverf ) {
+    c = (char) rd();
+  }
+
+  struct nfs_server_fh fh;
+  nfs_server_make_fh( srv, srv->root_ino, &fh );
+  srv->exp.path   = srv->root;
+  srv->exp.fh_len = NFS_SERVER_FH_SIZE;
+  memcpy( srv->exp.fh, fh.val, NFS_SERVER_FH_SIZE );
+
+  srv->rpc = rpc_server_create( port, num_workers );
+  if ( !srv->rpc ) {
+    delete srv;
+    return nullptr;
+  }
+  if ( rpc_server_register( srv->rpc, NFS_PROGRAM, NFS_V3, nfs3_procs, sizeof( nfs3_procs ) / sizeof( nfs3_procs[ 0 ] ), srv ) < 0
+       || mount3_server_register( srv->rpc, &srv->exp ) < 0
+       || rpc_server_start( srv->rpc ) < 0 ) {
+    rpc_server_destroy( srv->rpc );
+    delete srv;
+    return nullptr;
+  }
+  return srv;
+}
+
+int nfs_server_get_port( struct nfs_server* srv ) {
+  return rpc_server_get_port( srv->rpc );
+}
+
+const char* nfs_server_get_export( struct nfs_server* srv ) {
+  return srv->root.c_str();
+}
+
+struct rpc_server* nfs_server_get_rpc_server( struct nfs_server* srv ) {
+  return srv->rpc;
+}
+
+void nfs_server_stop( struct nfs_server* srv ) {
+  rpc_server_destroy( srv->rpc );
+  delete srv;
+}
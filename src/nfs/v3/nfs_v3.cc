@@ -1,7 +1,10 @@
+#include <algorithm>
 #include <cassert>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <memory>
+#include <new>
 #include <nfs/v3/nfs_v3.h>
 #include <optional>
 #include <rpc/rpc.h>
@@ -12,8 +15,8 @@ struct nfs_context* nfs_init_context( void ) {
   struct nfs_context*          nfs;
   struct nfs_context_internal* nfsi;
 
-  nfs  = new nfs_context;
-  nfsi = new nfs_context_internal;
+  nfs  = new nfs_context();
+  nfsi = new nfs_context_internal();
   if ( !nfs || !nfsi ) {
     return nullptr;
   }
@@ -42,9 +45,57 @@ struct nfs_context* nfs_init_context( void ) {
   nfs->nfsi->readdir_dircount = 8192;
   nfs->nfsi->readdir_maxcount = 8192;
 
+  nfs->nfsi->read_window   = NFS_DEF_READ_WINDOW;
+  nfs->nfsi->write_window  = NFS_DEF_WRITE_WINDOW;
+  nfs->nfsi->max_dirty     = NFS_DEF_MAX_DIRTY;
+  nfs->nfsi->readahead     = NFS_DEF_READAHEAD;
+  nfs->nfsi->readahead_max = NFS_DEF_READAHEAD_MAX;
+
+  nfs->nfsi->attrcache = nfs_attrcache_create( NFS_DEF_ATTRCACHE_SIZE );
+  nfs->nfsi->acregmin  = NFS_DEF_ACREGMIN;
+  nfs->nfsi->acregmax  = NFS_DEF_ACREGMAX;
+  nfs->nfsi->acdirmin  = NFS_DEF_ACDIRMIN;
+  nfs->nfsi->acdirmax  = NFS_DEF_ACDIRMAX;
+
+  nfs->nfsi->nconnect  = 1;
+  nfs->nfsi->rpcs[ 0 ] = nfs->rpc;
+  rpc_set_autoreconnect( nfs->rpc, nfs->nfsi->auto_reconnect );
+  rpc_set_retrans( nfs->rpc, nfs->nfsi->retrans );
+
+  nfs->nfsi->dentries     = nfs_dentry_cache_create( NFS_DEF_LOOKUPCACHE_SIZE );
+  nfs->nfsi->negative_ttl = NFS_DEF_NEGATIVE_TTL;
+  if ( !nfs->nfsi->dentries ) {
+    nfs_destroy_context( nfs );
+    return nullptr;
+  }
+
   return nfs;
 }
 
+void nfs_destroy_context( struct nfs_context* nfs ) {
+  /*
+   * rpcs[ 0 ] last: completions of the others free into its buffer pool.
+   * Those completions may cork or pick a connection, so a destroyed
+   * context is dropped from nconnect first.
+   */
+  for ( int i = NFS_MAX_NCONNECT - 1; i >= 0; i-- ) {
+    if ( nfs->nfsi->rpcs[ i ] ) {
+      nfs->nfsi->nconnect = std::min( nfs->nfsi->nconnect, i + 1 );
+      rpc_destroy_context( nfs->nfsi->rpcs[ i ] );
+      nfs->nfsi->rpcs[ i ] = nullptr;
+      nfs->nfsi->nconnect  = i;
+    }
+  }
+  nfs_free_dircache( nfs );
+  nfs_attrcache_destroy( nfs->nfsi->attrcache );
+  nfs_dentry_cache_destroy( nfs->nfsi->dentries );
+  free( nfs->nfsi->server );
+  free( nfs->nfsi->cwd );
+  free( nfs->error_string );
+  delete nfs->nfsi;
+  delete nfs;
+}
+
 static int tohex( char ch ) {
   if ( ch >= '0' && ch <= '9' ) {
     return ch - '0';
@@ -80,6 +131,18 @@ static int nfs_set_context_args( struct nfs_context* nfs,
       return -1;
     }
     nfs_set_retrans( nfs, retrans );
+  } else if ( !strcmp( arg, "adaptive-timeo" ) ) {
+    nfs_set_adaptive_timeout( nfs, atoi( val ) );
+  } else if ( !strcmp( arg, "transport" ) ) {
+    if ( !strcmp( val, "uring" ) ) {
+      nfs_set_transport( nfs, RPC_TRANSPORT_URING );
+    } else if ( !strcmp( val, "socket" ) ) {
+      nfs_set_transport( nfs, RPC_TRANSPORT_SOCKET );
+    } else {
+      return -1;
+    }
+  } else if ( !strcmp( arg, "timer-slack" ) ) {
+    nfs_set_timer_slack( nfs, atoi( val ) );
   } else if ( !strcmp( arg, "debug" ) ) {
     rpc_set_debug( nfs_get_rpc_context( nfs ), atoi( val ) );
   } else if ( !strcmp( arg, "auto-traverse-mounts" ) ) {
@@ -101,6 +164,34 @@ static int nfs_set_context_args( struct nfs_context* nfs,
     nfs_set_readmax( nfs, atoi( val ) );
   } else if ( !strcmp( arg, "wsize" ) ) {
     nfs_set_writemax( nfs, atoi( val ) );
+  } else if ( !strcmp( arg, "nconnect" ) ) {
+    nfs_set_nconnect( nfs, atoi( val ) );
+  } else if ( !strcmp( arg, "read-window" ) ) {
+    nfs_set_read_window( nfs, atoi( val ) );
+  } else if ( !strcmp( arg, "write-window" ) ) {
+    nfs_set_write_window( nfs, atoi( val ) );
+  } else if ( !strcmp( arg, "max-dirty" ) ) {
+    nfs_set_max_dirty( nfs, strtoull( val, nullptr, 10 ) );
+  } else if ( !strcmp( arg, "readahead" ) ) {
+    nfs_set_readahead( nfs, strtoull( val, nullptr, 10 ) );
+  } else if ( !strcmp( arg, "readahead-max" ) ) {
+    nfs_set_readahead_max( nfs, strtoull( val, nullptr, 10 ) );
+  } else if ( !strcmp( arg, "attrcache" ) ) {
+    nfs_set_attrcache( nfs, strtoull( val, nullptr, 10 ) );
+  } else if ( !strcmp( arg, "acregmin" ) ) {
+    nfs_set_attrcache_timeouts( nfs, atoi( val ), nfs->nfsi->acregmax, nfs->nfsi->acdirmin, nfs->nfsi->acdirmax );
+  } else if ( !strcmp( arg, "acregmax" ) ) {
+    nfs_set_attrcache_timeouts( nfs, nfs->nfsi->acregmin, atoi( val ), nfs->nfsi->acdirmin, nfs->nfsi->acdirmax );
+  } else if ( !strcmp( arg, "acdirmin" ) ) {
+    nfs_set_attrcache_timeouts( nfs, nfs->nfsi->acregmin, nfs->nfsi->acregmax, atoi( val ), nfs->nfsi->acdirmax );
+  } else if ( !strcmp( arg, "acdirmax" ) ) {
+    nfs_set_attrcache_timeouts( nfs, nfs->nfsi->acregmin, nfs->nfsi->acregmax, nfs->nfsi->acdirmin, atoi( val ) );
+  } else if ( !strcmp( arg, "actimeo" ) ) {
+    nfs_set_attrcache_timeouts( nfs, atoi( val ), atoi( val ), atoi( val ), atoi( val ) );
+  } else if ( !strcmp( arg, "lookupcache" ) ) {
+    nfs_set_lookupcache( nfs, strtoull( val, nullptr, 10 ) );
+  } else if ( !strcmp( arg, "negative-ttl" ) ) {
+    nfs_set_negative_ttl( nfs, atoi( val ) );
   } else if ( !strcmp( arg, "readdir-buffer" ) ) {
     char* strp = (char*) strchr( val, ',' );
     if ( strp ) {
@@ -111,66 +202,98 @@ static int nfs_set_context_args( struct nfs_context* nfs,
       nfs_set_readdir_max_buffer_size( nfs, atoi( val ), atoi( val ) );
     }
   } else {
-    // nfs_set_error( nfs, "Unknown url argument : %s", arg );
-    return -1;
+    /* arguments of other clients are not an error */
+#if ENABLE_LOGGING
+    spdlog::warn( "ignoring unknown url argument: {}", arg );
+#endif
   }
   return 0;
 }
 
+/*
+ * Apply "key=value&key=value..." through nfs_set_context_args(). A key
+ * without a value is passed as "1".
+ */
+static int nfs_parse_url_args( struct nfs_context* nfs, const std::string& args ) {
+  std::string::size_type pos = 0;
+  while ( pos < args.size() ) {
+    std::string::size_type end = args.find( '&', pos );
+    if ( end == std::string::npos ) {
+      end = args.size();
+    }
+    std::string            arg = args.substr( pos, end - pos );
+    std::string::size_type eq  = arg.find( '=' );
+    std::string            key = arg.substr( 0, eq );
+    std::string            val = eq == std::string::npos ? "1" : arg.substr( eq + 1 );
+    if ( !key.empty() && nfs_set_context_args( nfs, key.c_str(), val.c_str() ) < 0 ) {
+      return -1;
+    }
+    pos = end + 1;
+  }
+  return 0;
+}
+
+/*
+ * "nfs://[<user>@]<server>[:<port>]/<path>/<file>[?key=value&...]"
+ *
+ * For a full URL path is the directory and file the last component, with
+ * its leading '/'. For a directory URL path is all of it and file is empty.
+ * An incomplete URL may stop after the server, or have no server at all.
+ */
 static std::optional< nfs_url* > nfs_parse_url( struct nfs_context* nfs,
                                                 const std::string&  url,
                                                 bool                dir,
                                                 bool                incomplete ) {
-  // "nfs://<username>@server_ip:<port>/<path>/file?x=x&y=y...."
   if ( url.compare( 0, 6, "nfs://" ) ) {
     return std::nullopt;
   }
 
-  auto                   urls   = std::make_unique< nfs_url >();
-  std::string::size_type at_pos = 0,// '@'
-    slash_pos                   = 0,// '/'
-    ques_pos                    = 0;// '?'
+  auto                   urls  = std::make_unique< nfs_url >();
+  std::string::size_type ques  = url.find( '?', 6 );
+  std::string            rest  = url.substr( 6, ques == std::string::npos ? std::string::npos : ques - 6 );
+  std::string::size_type slash = rest.find( '/' );
+  std::string            host  = rest.substr( 0, slash );
+  std::string            path  = slash == std::string::npos ? "" : rest.substr( slash );
 
-  if ( at_pos = url.find( '@' ); at_pos != std::string::npos ) {
-    std::string user_name = url.substr( 6, at_pos - 6 );
-    // rpc_set_username( nfs_get_rpc_context( nfs ), user_name );
+  /* a user name is accepted, but the credentials are those of the process */
+  if ( std::string::size_type at = host.rfind( '@' ); at != std::string::npos ) {
+    host.erase( 0, at + 1 );
   }
-
-  if ( slash_pos = url.find_first_of( '/', 6 ); slash_pos != std::string::npos ) {
-    std::string sp = url.substr(
-      at_pos != std::string::npos ? at_pos + 1 : 7,
-      slash_pos - at_pos );
-
-    if ( auto colon_pos = sp.find( ':' ); colon_pos != std::string::npos ) {
-      urls->server = sp.substr( 0, colon_pos );
-      nfs_set_nfsport( nfs, std::stoi( sp.substr( colon_pos + 1 ) ) );
-    } else {
-      urls->server = sp;
+  if ( std::string::size_type colon = host.rfind( ':' ); colon != std::string::npos && host.back() != ']' ) {
+    char* end;
+    errno     = 0;
+    long port = strtol( host.c_str() + colon + 1, &end, 10 );
+    if ( colon + 1 == host.size() || *end || errno || port <= 0 || port > 65535 ) {
+      return std::nullopt;
     }
-  } else {
+    nfs_set_nfsport( nfs, (int) port );
+    host.erase( colon );
+  }
+  urls->server = host;
+  if ( urls->server.empty() && !incomplete ) {
     return std::nullopt;
   }
 
-  std::string file_path;
-  if ( ques_pos = url.find( '?' ); ques_pos != std::string::npos ) {
-    std::string args = url.substr( ques_pos + 1 );
-    file_path        = url.substr( slash_pos, ques_pos - slash_pos );
-  } else {
-    file_path = url.substr( slash_pos );
+  if ( dir ) {
+    urls->path = path;
+  } else if ( std::string::size_type last = path.rfind( '/' ); last != std::string::npos ) {
+    urls->path = path.substr( 0, last );
+    urls->file = path.substr( last );
+  }
+  if ( !incomplete && ( dir ? urls->path.empty() : urls->file.size() <= 1 ) ) {
+    return std::nullopt;
   }
 
-  if ( !file_path.empty() ) {
-
-  } else {
+  if ( ques != std::string::npos && nfs_parse_url_args( nfs, url.substr( ques + 1 ) ) < 0 ) {
     return std::nullopt;
   }
 
 #if ENABLE_LOGGING
-  spdlog::info( "server: {}, port: {}, file: {}",
-                urls->server, nfs->nfsi->nfsport, file_path );
+  spdlog::info( "server: {}, port: {}, path: {}, file: {}",
+                urls->server, nfs->nfsi->nfsport, urls->path, urls->file );
 #endif
 
-  return urls.get();
+  return urls.release();
 }
 
 struct nfs_url* nfs_parse_url_full( struct nfs_context* nfs,
@@ -188,29 +311,464 @@ struct nfs_url* nfs_parse_url_incomplete( struct nfs_context* nfs,
   return nfs_parse_url( nfs, url, false, true ).value_or( nullptr );
 }
 
+void nfs_destroy_url( struct nfs_url* url ) {
+  delete url;
+}
+
 struct rpc_context* nfs_get_rpc_context( struct nfs_context* nfs ) {
   assert( nfs->rpc->magic == RPC_CONTEXT_MAGIC );
   return nfs->rpc;
 }
 
+int nfs_get_fd( struct nfs_context* nfs ) {
+  return rpc_get_fd( nfs->rpc );
+}
+
+int nfs_which_events( struct nfs_context* nfs ) {
+  return rpc_which_events( nfs->rpc );
+}
+
+int nfs_service( struct nfs_context* nfs, int revents ) {
+  return rpc_service( nfs->rpc, revents );
+}
+
+void nfs_cork( struct nfs_context* nfs ) {
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_cork( nfs->nfsi->rpcs[ i ] );
+  }
+}
+
+void nfs_uncork( struct nfs_context* nfs ) {
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_uncork( nfs->nfsi->rpcs[ i ] );
+  }
+}
+
+int nfs_num_connections( struct nfs_context* nfs ) {
+  return nfs->nfsi->nconnect;
+}
+
+struct rpc_context* nfs_get_connection( struct nfs_context* nfs, int i ) {
+  return i >= 0 && i < nfs->nfsi->nconnect ? nfs->nfsi->rpcs[ i ] : nullptr;
+}
+
+/*
+ * The connection with the fewest request and reply bytes outstanding.
+ * Connections that are down (reconnecting) are only used when all are.
+ */
+struct rpc_context* nfs_select_rpc( struct nfs_context* nfs ) {
+  struct rpc_context* best = nullptr;
+  for ( int pass = 0; pass < 2 && !best; pass++ ) {
+    for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+      struct rpc_context* rpc = nfs->nfsi->rpcs[ i ];
+      if ( pass == 0 && !rpc->is_connected ) {
+        continue;
+      }
+      if ( !best || rpc->outstanding_bytes < best->outstanding_bytes ) {
+        best = rpc;
+      }
+    }
+  }
+  return best;
+}
+
+void nfs_get_stats( struct nfs_context* nfs, struct rpc_stats* stats ) {
+  rpc_reset_stats( stats );
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_merge_stats( stats, &nfs->nfsi->rpcs[ i ]->stats );
+  }
+}
+
+static const char* const nfs3_proc_names[ RPC_STATS_NUM_PROCS ] = {
+  "NULL", "GETATTR", "SETATTR", "LOOKUP", "ACCESS", "READLINK", "READ", "WRITE", "CREATE", "MKDIR", "SYMLINK",
+  "MKNOD", "REMOVE", "RMDIR", "RENAME", "LINK", "READDIR", "READDIRPLUS", "FSSTAT", "FSINFO", "PATHCONF", "COMMIT",
+};
+
+/* nfs_get_stats() as text, or JSON, with NFSv3 procedure names */
+std::string nfs_format_stats( struct nfs_context* nfs, bool json ) {
+  std::unique_ptr< struct rpc_stats, void ( * )( struct rpc_stats* ) > stats( rpc_alloc_stats(), rpc_free_stats );
+  if ( !stats ) {
+    return std::string();
+  }
+  nfs_get_stats( nfs, stats.get() );
+  return rpc_format_stats( stats.get(), nfs3_proc_names, json );
+}
+
+int nfs_loop_add( struct rpc_loop* loop, struct nfs_context* nfs ) {
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    if ( rpc_loop_add( loop, nfs->nfsi->rpcs[ i ] ) < 0 ) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* extra connections get whatever was configured on the first one */
+static void nfs_copy_rpc_settings( struct rpc_context* dst, struct rpc_context* src ) {
+  rpc_set_tcp_syncnt( dst, src->tcp_syncnt );
+  rpc_set_uid( dst, src->uid );
+  rpc_set_gid( dst, src->gid );
+  rpc_set_debug( dst, src->debug );
+  rpc_set_timeout( dst, src->timeout );
+  rpc_set_autoreconnect( dst, src->auto_reconnect );
+  rpc_set_retrans( dst, src->retrans );
+  rpc_set_adaptive_timeout( dst, src->adaptive_timeout );
+  rpc_set_transport( dst, src->transport );
+  rpc_set_timer_slack( dst, src->timers.slack );
+  dst->poll_timeout = src->poll_timeout;
+  memcpy( dst->ifname, src->ifname, sizeof( dst->ifname ) );
+}
+
+/* -1 if fh is longer than NFS3_FHSIZE */
+int nfs_fh_inline_set( struct nfs_fh_inline* ifh, const struct nfs_fh* fh ) {
+  if ( fh->len < 0 || fh->len > NFS3_FHSIZE ) {
+    return -1;
+  }
+  memset( ifh->val, 0, NFS3_FHSIZE );
+  memcpy( ifh->val, fh->val, fh->len );
+  ifh->len = fh->len;
+
+  uint64_t h = 0x9e3779b97f4a7c15ull ^ ifh->len;
+  for ( int i = 0; i < NFS3_FHSIZE; i += 8 ) {
+    uint64_t w;
+    memcpy( &w, ifh->val + i, 8 );
+    h = ( h ^ w ) * 0xff51afd7ed558ccdull;
+    h ^= h >> 32;
+  }
+  ifh->hash = (uint32_t) h;
+  return 0;
+}
+
+/* a view of ifh, valid as long as it is */
+struct nfs_fh nfs_fh_inline_get( const struct nfs_fh_inline* ifh ) {
+  return nfs_fh{ (int) ifh->len, (char*) ifh->val };
+}
+
+int nfs_status_to_errno( int status ) {
+  switch ( status ) {
+    case RPC_STATUS_SUCCESS:
+      return 0;
+    case RPC_STATUS_CANCEL:
+      return -EINTR;
+    case RPC_STATUS_TIMEOUT:
+      return -ETIMEDOUT;
+    default:
+      return -EIO;
+  }
+}
+
+/* NFS3ERR_* below 10000 are the errno values of the server */
+int nfsstat3_to_errno( int status ) {
+  switch ( status ) {
+    case NFS3_OK:
+      return 0;
+    case NFS3ERR_BADHANDLE:
+    case NFS3ERR_STALE:
+      return -ESTALE;
+    case NFS3ERR_NOT_SYNC:
+    case NFS3ERR_BAD_COOKIE:
+    case NFS3ERR_BADTYPE:
+      return -EINVAL;
+    case NFS3ERR_NOTSUPP:
+      return -ENOTSUP;
+    case NFS3ERR_TOOSMALL:
+      return -E2BIG;
+    case NFS3ERR_JUKEBOX:
+      return -EAGAIN;
+    case NFS3ERR_REMOTE:
+      return -EREMOTE;
+    case NFS3ERR_SERVERFAULT:
+      return -EIO;
+    default:
+      return status > 0 && status < 10000 ? -status : -EIO;
+  }
+}
+
+const char* nfsstat3_to_str( int status ) {
+  switch ( status ) {
+    case NFS3_OK: return "NFS3_OK";
+    case NFS3ERR_PERM: return "NFS3ERR_PERM";
+    case NFS3ERR_NOENT: return "NFS3ERR_NOENT";
+    case NFS3ERR_IO: return "NFS3ERR_IO";
+    case NFS3ERR_NXIO: return "NFS3ERR_NXIO";
+    case NFS3ERR_ACCES: return "NFS3ERR_ACCES";
+    case NFS3ERR_EXIST: return "NFS3ERR_EXIST";
+    case NFS3ERR_XDEV: return "NFS3ERR_XDEV";
+    case NFS3ERR_NODEV: return "NFS3ERR_NODEV";
+    case NFS3ERR_NOTDIR: return "NFS3ERR_NOTDIR";
+    case NFS3ERR_ISDIR: return "NFS3ERR_ISDIR";
+    case NFS3ERR_INVAL: return "NFS3ERR_INVAL";
+    case NFS3ERR_FBIG: return "NFS3ERR_FBIG";
+    case NFS3ERR_NOSPC: return "NFS3ERR_NOSPC";
+    case NFS3ERR_ROFS: return "NFS3ERR_ROFS";
+    case NFS3ERR_MLINK: return "NFS3ERR_MLINK";
+    case NFS3ERR_NAMETOOLONG: return "NFS3ERR_NAMETOOLONG";
+    case NFS3ERR_NOTEMPTY: return "NFS3ERR_NOTEMPTY";
+    case NFS3ERR_DQUOT: return "NFS3ERR_DQUOT";
+    case NFS3ERR_STALE: return "NFS3ERR_STALE";
+    case NFS3ERR_REMOTE: return "NFS3ERR_REMOTE";
+    case NFS3ERR_BADHANDLE: return "NFS3ERR_BADHANDLE";
+    case NFS3ERR_NOT_SYNC: return "NFS3ERR_NOT_SYNC";
+    case NFS3ERR_BAD_COOKIE: return "NFS3ERR_BAD_COOKIE";
+    case NFS3ERR_NOTSUPP: return "NFS3ERR_NOTSUPP";
+    case NFS3ERR_TOOSMALL: return "NFS3ERR_TOOSMALL";
+    case NFS3ERR_SERVERFAULT: return "NFS3ERR_SERVERFAULT";
+    case NFS3ERR_BADTYPE: return "NFS3ERR_BADTYPE";
+    case NFS3ERR_JUKEBOX: return "NFS3ERR_JUKEBOX";
+    default: return "Unknown NFS3 error";
+  }
+}
+
+static void nfs_connect_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_context*          nfs  = (struct nfs_context*) private_data;
+  struct nfs_context_internal* nfsi = nfs->nfsi;
+
+  if ( status != RPC_STATUS_SUCCESS && !nfsi->connect_err ) {
+    nfsi->connect_err = nfs_status_to_errno( status );
+    free( nfs->error_string );
+    nfs->error_string = strdup( data ? (const char*) data : "connect failed" );
+  }
+  if ( --nfsi->connect_pending > 0 ) {
+    return;
+  }
+
+  /* all or nothing: a half-connected context would only confuse striping */
+  if ( nfsi->connect_err ) {
+    for ( int i = 0; i < nfsi->nconnect; i++ ) {
+      rpc_disconnect( nfsi->rpcs[ i ], nfs->error_string );
+    }
+  }
+  nfsi->connect_cb( nfsi->connect_err, nfs, nfsi->connect_err ? nfs->error_string : nullptr,
+                    nfsi->connect_data );
+}
+
+int nfs_connect_async( struct nfs_context* nfs,
+                       const char*         server,
+                       int                 port,
+                       nfs_cb              cb,
+                       void*               private_data ) {
+  struct nfs_context_internal* nfsi = nfs->nfsi;
+
+  if ( nfsi->connect_pending ) {
+    rpc_set_error_errno( nfs->rpc, EALREADY, "Connect already in progress" );
+    return -1;
+  }
+  if ( port <= 0 ) {
+    port = nfsi->nfsport > 0 ? nfsi->nfsport : 2049;
+  }
+  for ( int i = 1; i < nfsi->nconnect; i++ ) {
+    nfs_copy_rpc_settings( nfsi->rpcs[ i ], nfs->rpc );
+  }
+
+  free( nfsi->server );
+  nfsi->server          = strdup( server );
+  nfsi->connect_cb      = cb;
+  nfsi->connect_data    = private_data;
+  nfsi->connect_err     = 0;
+  nfsi->connect_pending = nfsi->nconnect;
+  for ( int i = 0; i < nfsi->nconnect; i++ ) {
+    if ( rpc_connect_async( nfsi->rpcs[ i ], server, port, nfs_connect_cb, nfs ) < 0 ) {
+      if ( i > 0 ) {
+        rpc_set_error_errno( nfs->rpc, rpc_get_errno( nfsi->rpcs[ i ] ), "%s", rpc_get_error( nfsi->rpcs[ i ] ) );
+      }
+      /* the ones already started are torn down without their callback */
+      for ( int j = 0; j < i; j++ ) {
+        nfsi->rpcs[ j ]->connect_cb = nullptr;
+        rpc_disconnect( nfsi->rpcs[ j ], rpc_get_error( nfs->rpc ) );
+      }
+      nfsi->connect_pending = 0;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+struct nfs_cb_data {
+  struct nfs_context* nfs;
+  nfs_cb              cb;
+  void*               private_data;
+};
+
+static void nfs_null_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_cb_data* d = (struct nfs_cb_data*) private_data;
+  d->cb( nfs_status_to_errno( status ), d->nfs, status == RPC_STATUS_SUCCESS ? nullptr : data, d->private_data );
+  delete d;
+}
+
+int nfs_null_async( struct nfs_context* nfs, nfs_cb cb, void* private_data ) {
+  struct nfs_cb_data* d = new ( std::nothrow ) nfs_cb_data{ nfs, cb, private_data };
+  if ( !d ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate callback data" );
+    return -1;
+  }
+  struct rpc_context* rpc = nfs_select_rpc( nfs );
+  if ( rpc_null_async( rpc, NFS_PROGRAM, NFS_V3, nfs_null_cb, d ) < 0 ) {
+    if ( rpc != nfs->rpc ) {
+      rpc_set_error_errno( nfs->rpc, rpc_get_errno( rpc ), "%s", rpc_get_error( rpc ) );
+    }
+    delete d;
+    return -1;
+  }
+  return 0;
+}
+
+/* encode `args` with `encode` into a call of `proc` and queue it */
+template < typename ARGS >
+static int nfs3_call_async( struct rpc_context* rpc,
+                            uint32_t            proc,
+                            const char*         name,
+                            uint32_t ( *encode )( zdr_t*, ARGS* ),
+                            ARGS*               args,
+                            zdrproc_t           decode,
+                            uint32_t            res_size,
+                            rpc_cb              cb,
+                            void*               private_data ) {
+  struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, NFS_PROGRAM, NFS_V3, proc, cb, private_data, decode, res_size, 0 );
+  if ( !pdu ) {
+    return -1;
+  }
+  if ( !encode( &pdu->zdr, args ) ) {
+    rpc_set_error( rpc, "ZDR error: Failed to encode %s", name );
+    rpc_free_pdu( rpc, pdu );
+    return -1;
+  }
+  if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+    rpc_free_pdu( rpc, pdu );
+    return -1;
+  }
+  return 0;
+}
+
+static bool nfs3_check_fh( struct rpc_context* rpc, const struct nfs_fh* fh ) {
+  if ( fh->len < 0 || fh->len > NFS3_FHSIZE ) {
+    rpc_set_error_errno( rpc, EINVAL, "Invalid file handle length %d", fh->len );
+    return false;
+  }
+  return true;
+}
+
+int nfs3_getattr_async( struct rpc_context* rpc, const struct nfs_fh* fh, rpc_cb cb, void* private_data ) {
+  GETATTR3args args;
+
+  if ( !nfs3_check_fh( rpc, fh ) ) {
+    return -1;
+  }
+  args.object.data.data_len = fh->len;
+  args.object.data.data_val = fh->val;
+  return nfs3_call_async( rpc, NFS3_GETATTR, "GETATTR3args", zdr_GETATTR3args, &args, (zdrproc_t) zdr_GETATTR3res,
+                          sizeof( GETATTR3res ), cb, private_data );
+}
+
+int nfs3_access_async( struct rpc_context* rpc, const struct nfs_fh* fh, uint32_t access, rpc_cb cb, void* private_data ) {
+  ACCESS3args args;
+
+  if ( !nfs3_check_fh( rpc, fh ) ) {
+    return -1;
+  }
+  args.object.data.data_len = fh->len;
+  args.object.data.data_val = fh->val;
+  args.access               = access;
+  return nfs3_call_async( rpc, NFS3_ACCESS, "ACCESS3args", zdr_ACCESS3args, &args, (zdrproc_t) zdr_ACCESS3res,
+                          sizeof( ACCESS3res ), cb, private_data );
+}
+
+int nfs3_lookup_async( struct rpc_context* rpc, const struct nfs_fh* dirfh, const char* name, rpc_cb cb, void* private_data ) {
+  LOOKUP3args args;
+
+  if ( !nfs3_check_fh( rpc, dirfh ) ) {
+    return -1;
+  }
+  args.what.dir.data.data_len = dirfh->len;
+  args.what.dir.data.data_val = dirfh->val;
+  args.what.name              = (char*) name;
+  return nfs3_call_async( rpc, NFS3_LOOKUP, "LOOKUP3args", zdr_LOOKUP3args, &args, (zdrproc_t) zdr_LOOKUP3res,
+                          sizeof( LOOKUP3res ), cb, private_data );
+}
+
 void nfs_set_timeout( struct nfs_context* nfs, int timeout_msecs ) {
   nfs->nfsi->timeout = timeout_msecs;
-  rpc_set_timeout( nfs->rpc, timeout_msecs );
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_set_timeout( nfs->nfsi->rpcs[ i ], timeout_msecs );
+  }
 }
 
 void nfs_set_retrans( struct nfs_context* nfs, int retrans ) {
+  nfs->nfsi->retrans = retrans;
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_set_retrans( nfs->nfsi->rpcs[ i ], retrans );
+  }
+}
+
+/* see rpc_set_adaptive_timeout() */
+void nfs_set_adaptive_timeout( struct nfs_context* nfs, int enable ) {
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_set_adaptive_timeout( nfs->nfsi->rpcs[ i ], enable );
+  }
+}
+
+/* see rpc_set_transport(); takes effect on the next connect */
+void nfs_set_transport( struct nfs_context* nfs, int transport ) {
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_set_transport( nfs->nfsi->rpcs[ i ], transport );
+  }
+}
+
+/* see rpc_set_timer_slack() */
+void nfs_set_timer_slack( struct nfs_context* nfs, int msecs ) {
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_set_timer_slack( nfs->nfsi->rpcs[ i ], msecs );
+  }
 }
 
 void nfs_set_auto_traverse_mounts( struct nfs_context* nfs, int enabled ) {
 }
 
 void nfs_set_dircache( struct nfs_context* nfs, int enabled ) {
+  nfs->nfsi->dircache_enabled = enabled;
+  if ( !enabled ) {
+    nfs_free_dircache( nfs );
+  }
 }
 
 void nfs_set_autoreconnect( struct nfs_context* nfs, int num_retries ) {
+  nfs->nfsi->auto_reconnect = num_retries;
+  for ( int i = 0; i < nfs->nfsi->nconnect; i++ ) {
+    rpc_set_autoreconnect( nfs->nfsi->rpcs[ i ], num_retries );
+  }
+}
+
+/*
+ * Number of connections nfs_connect_async() opens, 1 to NFS_MAX_NCONNECT.
+ * Has no effect on a context that is already connected.
+ */
+void nfs_set_nconnect( struct nfs_context* nfs, int num_connections ) {
+  struct nfs_context_internal* nfsi = nfs->nfsi;
+
+  if ( !nfs->rpc || nfs->rpc->fd != -1 ) {
+    return;
+  }
+  num_connections = std::clamp( num_connections, 1, NFS_MAX_NCONNECT );
+  for ( nfsi->nconnect = 1; nfsi->nconnect < num_connections; nfsi->nconnect++ ) {
+    struct rpc_context*& rpc = nfsi->rpcs[ nfsi->nconnect ];
+    if ( !rpc ) {
+      if ( !( rpc = rpc_init_context() ) ) {
+        break;
+      }
+      rpc_set_max_xfer_size( rpc, std::max( nfsi->readmax, nfsi->writemax ) );
+      if ( nfs->rpc->loop ) {
+        rpc_loop_add( nfs->rpc->loop, rpc );
+      }
+    }
+  }
 }
 
+/* only NFSv3 is spoken */
 int nfs_set_version( struct nfs_context* nfs, int version ) {
+  if ( version != NFS_V3 ) {
+    return -1;
+  }
+  nfs->nfsi->version = version;
+  return 0;
 }
 
 void nfs_set_nfsport( struct nfs_context* nfs, int port ) {
@@ -220,13 +778,71 @@ void nfs_set_nfsport( struct nfs_context* nfs, int port ) {
 void nfs_set_mountport( struct nfs_context* nfs, int port ) {
 }
 
+static void nfs_update_xfer_size( struct nfs_context* nfs ) {
+  for ( int i = 0; i < NFS_MAX_NCONNECT; i++ ) {
+    if ( nfs->nfsi->rpcs[ i ] ) {
+      rpc_set_max_xfer_size( nfs->nfsi->rpcs[ i ], std::max( nfs->nfsi->readmax, nfs->nfsi->writemax ) );
+    }
+  }
+}
+
 void nfs_set_readmax( struct nfs_context* nfs, size_t readmax ) {
+  nfs->nfsi->readmax = readmax;
+  nfs_update_xfer_size( nfs );
 }
 
 void nfs_set_writemax( struct nfs_context* nfs, size_t writemax ) {
+  nfs->nfsi->writemax = writemax;
+  nfs_update_xfer_size( nfs );
+}
+
+/* READ calls one nfs_pread_async() keeps in flight, 1 to NFS_MAX_READ_WINDOW */
+void nfs_set_read_window( struct nfs_context* nfs, int window ) {
+  nfs->nfsi->read_window = std::clamp( window, 1, NFS_MAX_READ_WINDOW );
+}
+
+/* UNSTABLE WRITE calls kept in flight per file, 1 to NFS_MAX_WRITE_WINDOW */
+void nfs_set_write_window( struct nfs_context* nfs, int window ) {
+  nfs->nfsi->write_window = std::clamp( window, 1, NFS_MAX_WRITE_WINDOW );
+}
+
+void nfs_set_max_dirty( struct nfs_context* nfs, uint64_t bytes ) {
+  nfs->nfsi->max_dirty = std::max< uint64_t >( bytes, 1 );
+}
+
+/* bytes nfs_fh_pread_async() reads ahead of a sequential reader, 0 disables */
+void nfs_set_readahead( struct nfs_context* nfs, uint64_t bytes ) {
+  nfs->nfsi->readahead = bytes;
+}
+
+/* bytes all open files together may hold in readahead buffers */
+void nfs_set_readahead_max( struct nfs_context* nfs, uint64_t bytes ) {
+  nfs->nfsi->readahead_max = bytes;
+}
+
+/* entries kept in the attribute cache, 0 disables it */
+void nfs_set_attrcache( struct nfs_context* nfs, size_t max_entries ) {
+  nfs_attrcache_destroy( nfs->nfsi->attrcache );
+  nfs->nfsi->attrcache = max_entries ? nfs_attrcache_create( max_entries ) : nullptr;
+}
+
+/* seconds cached attributes stay valid; a max below its min is raised to it */
+void nfs_set_attrcache_timeouts( struct nfs_context* nfs, int acregmin, int acregmax, int acdirmin, int acdirmax ) {
+  nfs->nfsi->acregmin = std::max( acregmin, 0 );
+  nfs->nfsi->acregmax = std::max( acregmax, nfs->nfsi->acregmin );
+  nfs->nfsi->acdirmin = std::max( acdirmin, 0 );
+  nfs->nfsi->acdirmax = std::max( acdirmax, nfs->nfsi->acdirmin );
+}
+
+/* seconds a lookup that failed with ENOENT is remembered, 0 disables */
+void nfs_set_negative_ttl( struct nfs_context* nfs, int seconds ) {
+  nfs->nfsi->negative_ttl = std::max( seconds, 0 );
 }
 
+/* dircount and maxcount of READDIRPLUS calls, see nfs_opendir_async() */
 void nfs_set_readdir_max_buffer_size( struct nfs_context* nfs,
                                       uint32_t            dircount,
                                       uint32_t            maxcount ) {
+  nfs->nfsi->readdir_dircount = dircount;
+  nfs->nfsi->readdir_maxcount = maxcount;
 }
@@ -0,0 +1,812 @@
+#include <rpcgen_nfs_v3.h>
+#include <zdr/zdr.h>
+
+/*
+ * Hand-written ZDR routines for every type in rpc/nfs_v3.x.
+ *
+ * The prototypes come from the rpcgen header; the bodies replace what
+ * `rpcgen -c` would emit so that payloads and names decode as views into
+ * the receive buffer and fixed-size records are moved with one bounds check.
+ */
+
+#define ZDR_SPECDATA3_SIZE 8
+#define ZDR_NFSTIME3_SIZE  8
+#define ZDR_WCC_ATTR_SIZE  ( 8 + 2 * ZDR_NFSTIME3_SIZE )
+#define ZDR_FATTR3_SIZE    ( 5 * 4 + 5 * 8 + 3 * ZDR_NFSTIME3_SIZE )
+
+/* union <name> switch (bool) { case TRUE: T arm; default: void; } */
+template < typename T >
+static inline uint32_t zdr_optional( zdr_t*    zdrs,
+                                     uint32_t* follows,
+                                     T*        arm,
+                                     uint32_t ( *proc )( zdr_t*, T* ) ) {
+  if ( !zdr_bool( zdrs, follows ) ) {
+    return 0;
+  }
+  return *follows ? proc( zdrs, arm ) : 1;
+}
+
+/* union <name> switch (nfsstat3 status) { case NFS3_OK: OK resok; default: FAIL resfail; } */
+template < typename OK, typename FAIL >
+static inline uint32_t zdr_res3( zdr_t*    zdrs,
+                                 nfsstat3* status,
+                                 OK*       resok,
+                                 uint32_t ( *okproc )( zdr_t*, OK* ),
+                                 FAIL*     resfail,
+                                 uint32_t ( *failproc )( zdr_t*, FAIL* ) ) {
+  if ( !zdr_enum( zdrs, status ) ) {
+    return 0;
+  }
+  if ( *status == NFS3_OK ) {
+    return okproc( zdrs, resok );
+  }
+  return failproc ? failproc( zdrs, resfail ) : 1;
+}
+
+template < typename OK >
+static inline uint32_t zdr_res3( zdr_t*    zdrs,
+                                 nfsstat3* status,
+                                 OK*       resok,
+                                 uint32_t ( *okproc )( zdr_t*, OK* ) ) {
+  return zdr_res3< OK, OK >( zdrs, status, resok, okproc, nullptr, nullptr );
+}
+
+static inline void zdr_move_nfstime3( enum zdr_op op, char*& p, nfstime3* t ) {
+  zdr_move( op, p, &t->seconds );
+  zdr_move( op, p, &t->nseconds );
+}
+
+uint32_t zdr_cookieverf3( zdr_t* zdrs, cookieverf3 objp ) {
+  return zdr_opaque( zdrs, objp, NFS3_COOKIEVERFSIZE );
+}
+
+uint32_t zdr_cookie3( zdr_t* zdrs, cookie3* objp ) {
+  return zdr_uint64_t( zdrs, objp );
+}
+
+uint32_t zdr_nfs_fh3( zdr_t* zdrs, nfs_fh3* objp ) {
+  return zdr_bytes( zdrs, &objp->data.data_val, &objp->data.data_len, NFS3_FHSIZE );
+}
+
+uint32_t zdr_filename3( zdr_t* zdrs, filename3* objp ) {
+  return zdr_string( zdrs, objp, ~0u );
+}
+
+uint32_t zdr_diropargs3( zdr_t* zdrs, diropargs3* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->dir ) && zdr_filename3( zdrs, &objp->name );
+}
+
+uint32_t zdr_ftype3( zdr_t* zdrs, ftype3* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+uint32_t zdr_mode3( zdr_t* zdrs, mode3* objp ) {
+  return zdr_u_int( zdrs, objp );
+}
+
+uint32_t zdr_uid3( zdr_t* zdrs, uid3* objp ) {
+  return zdr_u_int( zdrs, objp );
+}
+
+uint32_t zdr_gid3( zdr_t* zdrs, gid3* objp ) {
+  return zdr_u_int( zdrs, objp );
+}
+
+uint32_t zdr_size3( zdr_t* zdrs, size3* objp ) {
+  return zdr_uint64_t( zdrs, objp );
+}
+
+uint32_t zdr_fileid3( zdr_t* zdrs, fileid3* objp ) {
+  return zdr_uint64_t( zdrs, objp );
+}
+
+uint32_t zdr_specdata3( zdr_t* zdrs, specdata3* objp ) {
+  char* p = zdr_inline( zdrs, ZDR_SPECDATA3_SIZE );
+  if ( !p ) {
+    return 0;
+  }
+  zdr_move( zdrs->x_op, p, &objp->specdata1 );
+  zdr_move( zdrs->x_op, p, &objp->specdata2 );
+  return 1;
+}
+
+uint32_t zdr_nfstime3( zdr_t* zdrs, nfstime3* objp ) {
+  char* p = zdr_inline( zdrs, ZDR_NFSTIME3_SIZE );
+  if ( !p ) {
+    return 0;
+  }
+  zdr_move_nfstime3( zdrs->x_op, p, objp );
+  return 1;
+}
+
+uint32_t zdr_fattr3( zdr_t* zdrs, fattr3* objp ) {
+  char* p = zdr_inline( zdrs, ZDR_FATTR3_SIZE );
+  if ( !p ) {
+    return 0;
+  }
+  const enum zdr_op op = zdrs->x_op;
+  zdr_move( op, p, reinterpret_cast< uint32_t* >( &objp->type ) );
+  zdr_move( op, p, &objp->mode );
+  zdr_move( op, p, &objp->nlink );
+  zdr_move( op, p, &objp->uid );
+  zdr_move( op, p, &objp->gid );
+  zdr_move( op, p, &objp->size );
+  zdr_move( op, p, &objp->used );
+  zdr_move( op, p, &objp->rdev.specdata1 );
+  zdr_move( op, p, &objp->rdev.specdata2 );
+  zdr_move( op, p, &objp->fsid );
+  zdr_move( op, p, &objp->fileid );
+  zdr_move_nfstime3( op, p, &objp->atime );
+  zdr_move_nfstime3( op, p, &objp->mtime );
+  zdr_move_nfstime3( op, p, &objp->ctime );
+  return 1;
+}
+
+uint32_t zdr_post_op_attr( zdr_t* zdrs, post_op_attr* objp ) {
+  return zdr_optional( zdrs, &objp->attributes_follow,
+                       &objp->post_op_attr_u.attributes, zdr_fattr3 );
+}
+
+uint32_t zdr_nfsstat3( zdr_t* zdrs, nfsstat3* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+uint32_t zdr_stable_how( zdr_t* zdrs, stable_how* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+uint32_t zdr_offset3( zdr_t* zdrs, offset3* objp ) {
+  return zdr_uint64_t( zdrs, objp );
+}
+
+uint32_t zdr_count3( zdr_t* zdrs, count3* objp ) {
+  return zdr_u_int( zdrs, objp );
+}
+
+uint32_t zdr_wcc_attr( zdr_t* zdrs, wcc_attr* objp ) {
+  char* p = zdr_inline( zdrs, ZDR_WCC_ATTR_SIZE );
+  if ( !p ) {
+    return 0;
+  }
+  zdr_move( zdrs->x_op, p, &objp->size );
+  zdr_move_nfstime3( zdrs->x_op, p, &objp->mtime );
+  zdr_move_nfstime3( zdrs->x_op, p, &objp->ctime );
+  return 1;
+}
+
+uint32_t zdr_pre_op_attr( zdr_t* zdrs, pre_op_attr* objp ) {
+  return zdr_optional( zdrs, &objp->attributes_follow,
+                       &objp->pre_op_attr_u.attributes, zdr_wcc_attr );
+}
+
+uint32_t zdr_wcc_data( zdr_t* zdrs, wcc_data* objp ) {
+  return zdr_pre_op_attr( zdrs, &objp->before ) && zdr_post_op_attr( zdrs, &objp->after );
+}
+
+uint32_t zdr_WRITE3args( zdr_t* zdrs, WRITE3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->file )
+         && zdr_offset3( zdrs, &objp->offset )
+         && zdr_count3( zdrs, &objp->count )
+         && zdr_stable_how( zdrs, &objp->stable )
+         && zdr_bytes( zdrs, &objp->data.data_val, &objp->data.data_len, ~0u );
+}
+
+uint32_t zdr_writeverf3( zdr_t* zdrs, writeverf3 objp ) {
+  return zdr_opaque( zdrs, objp, NFS3_WRITEVERFSIZE );
+}
+
+uint32_t zdr_WRITE3resok( zdr_t* zdrs, WRITE3resok* objp ) {
+  return zdr_wcc_data( zdrs, &objp->file_wcc )
+         && zdr_count3( zdrs, &objp->count )
+         && zdr_stable_how( zdrs, &objp->committed )
+         && zdr_writeverf3( zdrs, objp->verf );
+}
+
+uint32_t zdr_WRITE3resfail( zdr_t* zdrs, WRITE3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->file_wcc );
+}
+
+uint32_t zdr_WRITE3res( zdr_t* zdrs, WRITE3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->WRITE3res_u.resok, zdr_WRITE3resok,
+                   &objp->WRITE3res_u.resfail, zdr_WRITE3resfail );
+}
+
+uint32_t zdr_LOOKUP3args( zdr_t* zdrs, LOOKUP3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->what );
+}
+
+uint32_t zdr_LOOKUP3resok( zdr_t* zdrs, LOOKUP3resok* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->object )
+         && zdr_post_op_attr( zdrs, &objp->obj_attributes )
+         && zdr_post_op_attr( zdrs, &objp->dir_attributes );
+}
+
+uint32_t zdr_LOOKUP3resfail( zdr_t* zdrs, LOOKUP3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->dir_attributes );
+}
+
+uint32_t zdr_LOOKUP3res( zdr_t* zdrs, LOOKUP3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->LOOKUP3res_u.resok, zdr_LOOKUP3resok,
+                   &objp->LOOKUP3res_u.resfail, zdr_LOOKUP3resfail );
+}
+
+uint32_t zdr_COMMIT3args( zdr_t* zdrs, COMMIT3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->file )
+         && zdr_offset3( zdrs, &objp->offset )
+         && zdr_count3( zdrs, &objp->count );
+}
+
+uint32_t zdr_COMMIT3resok( zdr_t* zdrs, COMMIT3resok* objp ) {
+  return zdr_wcc_data( zdrs, &objp->file_wcc ) && zdr_writeverf3( zdrs, objp->verf );
+}
+
+uint32_t zdr_COMMIT3resfail( zdr_t* zdrs, COMMIT3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->file_wcc );
+}
+
+uint32_t zdr_COMMIT3res( zdr_t* zdrs, COMMIT3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->COMMIT3res_u.resok, zdr_COMMIT3resok,
+                   &objp->COMMIT3res_u.resfail, zdr_COMMIT3resfail );
+}
+
+uint32_t zdr_ACCESS3args( zdr_t* zdrs, ACCESS3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->object ) && zdr_u_int( zdrs, &objp->access );
+}
+
+uint32_t zdr_ACCESS3resok( zdr_t* zdrs, ACCESS3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->obj_attributes ) && zdr_u_int( zdrs, &objp->access );
+}
+
+uint32_t zdr_ACCESS3resfail( zdr_t* zdrs, ACCESS3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->obj_attributes );
+}
+
+uint32_t zdr_ACCESS3res( zdr_t* zdrs, ACCESS3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->ACCESS3res_u.resok, zdr_ACCESS3resok,
+                   &objp->ACCESS3res_u.resfail, zdr_ACCESS3resfail );
+}
+
+uint32_t zdr_GETATTR3args( zdr_t* zdrs, GETATTR3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->object );
+}
+
+uint32_t zdr_GETATTR3resok( zdr_t* zdrs, GETATTR3resok* objp ) {
+  return zdr_fattr3( zdrs, &objp->obj_attributes );
+}
+
+uint32_t zdr_GETATTR3res( zdr_t* zdrs, GETATTR3res* objp ) {
+  return zdr_res3( zdrs, &objp->status, &objp->GETATTR3res_u.resok, zdr_GETATTR3resok );
+}
+
+uint32_t zdr_time_how( zdr_t* zdrs, time_how* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+uint32_t zdr_set_mode3( zdr_t* zdrs, set_mode3* objp ) {
+  return zdr_optional( zdrs, &objp->set_it, &objp->set_mode3_u.mode, zdr_mode3 );
+}
+
+uint32_t zdr_set_uid3( zdr_t* zdrs, set_uid3* objp ) {
+  return zdr_optional( zdrs, &objp->set_it, &objp->set_uid3_u.uid, zdr_uid3 );
+}
+
+uint32_t zdr_set_gid3( zdr_t* zdrs, set_gid3* objp ) {
+  return zdr_optional( zdrs, &objp->set_it, &objp->set_gid3_u.gid, zdr_gid3 );
+}
+
+uint32_t zdr_set_size3( zdr_t* zdrs, set_size3* objp ) {
+  return zdr_optional( zdrs, &objp->set_it, &objp->set_size3_u.size, zdr_size3 );
+}
+
+uint32_t zdr_set_atime( zdr_t* zdrs, set_atime* objp ) {
+  if ( !zdr_time_how( zdrs, &objp->set_it ) ) {
+    return 0;
+  }
+  return objp->set_it == SET_TO_CLIENT_TIME ? zdr_nfstime3( zdrs, &objp->set_atime_u.atime ) : 1;
+}
+
+uint32_t zdr_set_mtime( zdr_t* zdrs, set_mtime* objp ) {
+  if ( !zdr_time_how( zdrs, &objp->set_it ) ) {
+    return 0;
+  }
+  return objp->set_it == SET_TO_CLIENT_TIME ? zdr_nfstime3( zdrs, &objp->set_mtime_u.mtime ) : 1;
+}
+
+uint32_t zdr_sattr3( zdr_t* zdrs, sattr3* objp ) {
+  return zdr_set_mode3( zdrs, &objp->mode )
+         && zdr_set_uid3( zdrs, &objp->uid )
+         && zdr_set_gid3( zdrs, &objp->gid )
+         && zdr_set_size3( zdrs, &objp->size )
+         && zdr_set_atime( zdrs, &objp->atime )
+         && zdr_set_mtime( zdrs, &objp->mtime );
+}
+
+uint32_t zdr_createmode3( zdr_t* zdrs, createmode3* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+uint32_t zdr_createverf3( zdr_t* zdrs, createverf3 objp ) {
+  return zdr_opaque( zdrs, objp, NFS3_CREATEVERFSIZE );
+}
+
+uint32_t zdr_createhow3( zdr_t* zdrs, createhow3* objp ) {
+  if ( !zdr_createmode3( zdrs, &objp->mode ) ) {
+    return 0;
+  }
+  switch ( objp->mode ) {
+    case UNCHECKED: return zdr_sattr3( zdrs, &objp->createhow3_u.obj_attributes );
+    case GUARDED: return zdr_sattr3( zdrs, &objp->createhow3_u.g_obj_attributes );
+    case EXCLUSIVE: return zdr_createverf3( zdrs, objp->createhow3_u.verf );
+  }
+  return 0;
+}
+
+uint32_t zdr_CREATE3args( zdr_t* zdrs, CREATE3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->where ) && zdr_createhow3( zdrs, &objp->how );
+}
+
+uint32_t zdr_post_op_fh3( zdr_t* zdrs, post_op_fh3* objp ) {
+  return zdr_optional( zdrs, &objp->handle_follows, &objp->post_op_fh3_u.handle, zdr_nfs_fh3 );
+}
+
+uint32_t zdr_CREATE3resok( zdr_t* zdrs, CREATE3resok* objp ) {
+  return zdr_post_op_fh3( zdrs, &objp->obj )
+         && zdr_post_op_attr( zdrs, &objp->obj_attributes )
+         && zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_CREATE3resfail( zdr_t* zdrs, CREATE3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_CREATE3res( zdr_t* zdrs, CREATE3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->CREATE3res_u.resok, zdr_CREATE3resok,
+                   &objp->CREATE3res_u.resfail, zdr_CREATE3resfail );
+}
+
+uint32_t zdr_REMOVE3args( zdr_t* zdrs, REMOVE3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->object );
+}
+
+uint32_t zdr_REMOVE3resok( zdr_t* zdrs, REMOVE3resok* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_REMOVE3resfail( zdr_t* zdrs, REMOVE3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_REMOVE3res( zdr_t* zdrs, REMOVE3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->REMOVE3res_u.resok, zdr_REMOVE3resok,
+                   &objp->REMOVE3res_u.resfail, zdr_REMOVE3resfail );
+}
+
+uint32_t zdr_READ3args( zdr_t* zdrs, READ3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->file )
+         && zdr_offset3( zdrs, &objp->offset )
+         && zdr_count3( zdrs, &objp->count );
+}
+
+uint32_t zdr_READ3resok( zdr_t* zdrs, READ3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->file_attributes )
+         && zdr_count3( zdrs, &objp->count )
+         && zdr_bool( zdrs, &objp->eof )
+         && zdr_bytes( zdrs, &objp->data.data_val, &objp->data.data_len, ~0u );
+}
+
+uint32_t zdr_READ3resfail( zdr_t* zdrs, READ3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->file_attributes );
+}
+
+uint32_t zdr_READ3res( zdr_t* zdrs, READ3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->READ3res_u.resok, zdr_READ3resok,
+                   &objp->READ3res_u.resfail, zdr_READ3resfail );
+}
+
+uint32_t zdr_FSINFO3args( zdr_t* zdrs, FSINFO3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->fsroot );
+}
+
+uint32_t zdr_FSINFO3resok( zdr_t* zdrs, FSINFO3resok* objp ) {
+  if ( !zdr_post_op_attr( zdrs, &objp->obj_attributes ) ) {
+    return 0;
+  }
+  char* p = zdr_inline( zdrs, 7 * 4 + 8 + ZDR_NFSTIME3_SIZE + 4 );
+  if ( !p ) {
+    return 0;
+  }
+  const enum zdr_op op = zdrs->x_op;
+  zdr_move( op, p, &objp->rtmax );
+  zdr_move( op, p, &objp->rtpref );
+  zdr_move( op, p, &objp->rtmult );
+  zdr_move( op, p, &objp->wtmax );
+  zdr_move( op, p, &objp->wtpref );
+  zdr_move( op, p, &objp->wtmult );
+  zdr_move( op, p, &objp->dtpref );
+  zdr_move( op, p, &objp->maxfilesize );
+  zdr_move_nfstime3( op, p, &objp->time_delta );
+  zdr_move( op, p, &objp->properties );
+  return 1;
+}
+
+uint32_t zdr_FSINFO3resfail( zdr_t* zdrs, FSINFO3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->obj_attributes );
+}
+
+uint32_t zdr_FSINFO3res( zdr_t* zdrs, FSINFO3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->FSINFO3res_u.resok, zdr_FSINFO3resok,
+                   &objp->FSINFO3res_u.resfail, zdr_FSINFO3resfail );
+}
+
+uint32_t zdr_FSSTAT3args( zdr_t* zdrs, FSSTAT3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->fsroot );
+}
+
+uint32_t zdr_FSSTAT3resok( zdr_t* zdrs, FSSTAT3resok* objp ) {
+  if ( !zdr_post_op_attr( zdrs, &objp->obj_attributes ) ) {
+    return 0;
+  }
+  char* p = zdr_inline( zdrs, 6 * 8 + 4 );
+  if ( !p ) {
+    return 0;
+  }
+  const enum zdr_op op = zdrs->x_op;
+  zdr_move( op, p, &objp->tbytes );
+  zdr_move( op, p, &objp->fbytes );
+  zdr_move( op, p, &objp->abytes );
+  zdr_move( op, p, &objp->tfiles );
+  zdr_move( op, p, &objp->ffiles );
+  zdr_move( op, p, &objp->afiles );
+  zdr_move( op, p, &objp->invarsec );
+  return 1;
+}
+
+uint32_t zdr_FSSTAT3resfail( zdr_t* zdrs, FSSTAT3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->obj_attributes );
+}
+
+uint32_t zdr_FSSTAT3res( zdr_t* zdrs, FSSTAT3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->FSSTAT3res_u.resok, zdr_FSSTAT3resok,
+                   &objp->FSSTAT3res_u.resfail, zdr_FSSTAT3resfail );
+}
+
+uint32_t zdr_PATHCONF3args( zdr_t* zdrs, PATHCONF3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->object );
+}
+
+uint32_t zdr_PATHCONF3resok( zdr_t* zdrs, PATHCONF3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->obj_attributes )
+         && zdr_u_int( zdrs, &objp->linkmax )
+         && zdr_u_int( zdrs, &objp->name_max )
+         && zdr_bool( zdrs, &objp->no_trunc )
+         && zdr_bool( zdrs, &objp->chown_restricted )
+         && zdr_bool( zdrs, &objp->case_insensitive )
+         && zdr_bool( zdrs, &objp->case_preserving );
+}
+
+uint32_t zdr_PATHCONF3resfail( zdr_t* zdrs, PATHCONF3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->obj_attributes );
+}
+
+uint32_t zdr_PATHCONF3res( zdr_t* zdrs, PATHCONF3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->PATHCONF3res_u.resok, zdr_PATHCONF3resok,
+                   &objp->PATHCONF3res_u.resfail, zdr_PATHCONF3resfail );
+}
+
+uint32_t zdr_nfspath3( zdr_t* zdrs, nfspath3* objp ) {
+  return zdr_string( zdrs, objp, ~0u );
+}
+
+uint32_t zdr_symlinkdata3( zdr_t* zdrs, symlinkdata3* objp ) {
+  return zdr_sattr3( zdrs, &objp->symlink_attributes ) && zdr_nfspath3( zdrs, &objp->symlink_data );
+}
+
+uint32_t zdr_SYMLINK3args( zdr_t* zdrs, SYMLINK3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->where ) && zdr_symlinkdata3( zdrs, &objp->symlink );
+}
+
+uint32_t zdr_SYMLINK3resok( zdr_t* zdrs, SYMLINK3resok* objp ) {
+  return zdr_post_op_fh3( zdrs, &objp->obj )
+         && zdr_post_op_attr( zdrs, &objp->obj_attributes )
+         && zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_SYMLINK3resfail( zdr_t* zdrs, SYMLINK3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_SYMLINK3res( zdr_t* zdrs, SYMLINK3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->SYMLINK3res_u.resok, zdr_SYMLINK3resok,
+                   &objp->SYMLINK3res_u.resfail, zdr_SYMLINK3resfail );
+}
+
+uint32_t zdr_READLINK3args( zdr_t* zdrs, READLINK3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->symlink );
+}
+
+uint32_t zdr_READLINK3resok( zdr_t* zdrs, READLINK3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->symlink_attributes ) && zdr_nfspath3( zdrs, &objp->data );
+}
+
+uint32_t zdr_READLINK3resfail( zdr_t* zdrs, READLINK3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->symlink_attributes );
+}
+
+uint32_t zdr_READLINK3res( zdr_t* zdrs, READLINK3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->READLINK3res_u.resok, zdr_READLINK3resok,
+                   &objp->READLINK3res_u.resfail, zdr_READLINK3resfail );
+}
+
+uint32_t zdr_devicedata3( zdr_t* zdrs, devicedata3* objp ) {
+  return zdr_sattr3( zdrs, &objp->dev_attributes ) && zdr_specdata3( zdrs, &objp->spec );
+}
+
+uint32_t zdr_mknoddata3( zdr_t* zdrs, mknoddata3* objp ) {
+  if ( !zdr_ftype3( zdrs, &objp->type ) ) {
+    return 0;
+  }
+  switch ( objp->type ) {
+    case NF3CHR: return zdr_devicedata3( zdrs, &objp->mknoddata3_u.chr_device );
+    case NF3BLK: return zdr_devicedata3( zdrs, &objp->mknoddata3_u.blk_device );
+    case NF3SOCK: return zdr_sattr3( zdrs, &objp->mknoddata3_u.sock_attributes );
+    case NF3FIFO: return zdr_sattr3( zdrs, &objp->mknoddata3_u.pipe_attributes );
+    default: return 1;
+  }
+}
+
+uint32_t zdr_MKNOD3args( zdr_t* zdrs, MKNOD3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->where ) && zdr_mknoddata3( zdrs, &objp->what );
+}
+
+uint32_t zdr_MKNOD3resok( zdr_t* zdrs, MKNOD3resok* objp ) {
+  return zdr_post_op_fh3( zdrs, &objp->obj )
+         && zdr_post_op_attr( zdrs, &objp->obj_attributes )
+         && zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_MKNOD3resfail( zdr_t* zdrs, MKNOD3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_MKNOD3res( zdr_t* zdrs, MKNOD3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->MKNOD3res_u.resok, zdr_MKNOD3resok,
+                   &objp->MKNOD3res_u.resfail, zdr_MKNOD3resfail );
+}
+
+uint32_t zdr_MKDIR3args( zdr_t* zdrs, MKDIR3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->where ) && zdr_sattr3( zdrs, &objp->attributes );
+}
+
+uint32_t zdr_MKDIR3resok( zdr_t* zdrs, MKDIR3resok* objp ) {
+  return zdr_post_op_fh3( zdrs, &objp->obj )
+         && zdr_post_op_attr( zdrs, &objp->obj_attributes )
+         && zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_MKDIR3resfail( zdr_t* zdrs, MKDIR3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_MKDIR3res( zdr_t* zdrs, MKDIR3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->MKDIR3res_u.resok, zdr_MKDIR3resok,
+                   &objp->MKDIR3res_u.resfail, zdr_MKDIR3resfail );
+}
+
+uint32_t zdr_RMDIR3args( zdr_t* zdrs, RMDIR3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->object );
+}
+
+uint32_t zdr_RMDIR3resok( zdr_t* zdrs, RMDIR3resok* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_RMDIR3resfail( zdr_t* zdrs, RMDIR3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->dir_wcc );
+}
+
+uint32_t zdr_RMDIR3res( zdr_t* zdrs, RMDIR3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->RMDIR3res_u.resok, zdr_RMDIR3resok,
+                   &objp->RMDIR3res_u.resfail, zdr_RMDIR3resfail );
+}
+
+uint32_t zdr_RENAME3args( zdr_t* zdrs, RENAME3args* objp ) {
+  return zdr_diropargs3( zdrs, &objp->from ) && zdr_diropargs3( zdrs, &objp->to );
+}
+
+uint32_t zdr_RENAME3resok( zdr_t* zdrs, RENAME3resok* objp ) {
+  return zdr_wcc_data( zdrs, &objp->fromdir_wcc ) && zdr_wcc_data( zdrs, &objp->todir_wcc );
+}
+
+uint32_t zdr_RENAME3resfail( zdr_t* zdrs, RENAME3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->fromdir_wcc ) && zdr_wcc_data( zdrs, &objp->todir_wcc );
+}
+
+uint32_t zdr_RENAME3res( zdr_t* zdrs, RENAME3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->RENAME3res_u.resok, zdr_RENAME3resok,
+                   &objp->RENAME3res_u.resfail, zdr_RENAME3resfail );
+}
+
+uint32_t zdr_READDIRPLUS3args( zdr_t* zdrs, READDIRPLUS3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->dir )
+         && zdr_cookie3( zdrs, &objp->cookie )
+         && zdr_cookieverf3( zdrs, objp->cookieverf )
+         && zdr_count3( zdrs, &objp->dircount )
+         && zdr_count3( zdrs, &objp->maxcount );
+}
+
+static uint32_t zdr_entryplus3_body( zdr_t* zdrs, entryplus3* objp ) {
+  return zdr_fileid3( zdrs, &objp->fileid )
+         && zdr_filename3( zdrs, &objp->name )
+         && zdr_cookie3( zdrs, &objp->cookie )
+         && zdr_post_op_attr( zdrs, &objp->name_attributes )
+         && zdr_post_op_fh3( zdrs, &objp->name_handle );
+}
+
+uint32_t zdr_entryplus3( zdr_t* zdrs, entryplus3* objp ) {
+  return zdr_entryplus3_body( zdrs, objp )
+         && zdr_list( zdrs, &objp->nextentry, &entryplus3::nextentry, zdr_entryplus3_body );
+}
+
+uint32_t zdr_dirlistplus3( zdr_t* zdrs, dirlistplus3* objp ) {
+  return zdr_list( zdrs, &objp->entries, &entryplus3::nextentry, zdr_entryplus3_body )
+         && zdr_bool( zdrs, &objp->eof );
+}
+
+uint32_t zdr_READDIRPLUS3resok( zdr_t* zdrs, READDIRPLUS3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->dir_attributes )
+         && zdr_cookieverf3( zdrs, objp->cookieverf )
+         && zdr_dirlistplus3( zdrs, &objp->reply );
+}
+
+uint32_t zdr_READDIRPLUS3resfail( zdr_t* zdrs, READDIRPLUS3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->dir_attributes );
+}
+
+uint32_t zdr_READDIRPLUS3res( zdr_t* zdrs, READDIRPLUS3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->READDIRPLUS3res_u.resok, zdr_READDIRPLUS3resok,
+                   &objp->READDIRPLUS3res_u.resfail, zdr_READDIRPLUS3resfail );
+}
+
+uint32_t zdr_READDIR3args( zdr_t* zdrs, READDIR3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->dir )
+         && zdr_cookie3( zdrs, &objp->cookie )
+         && zdr_cookieverf3( zdrs, objp->cookieverf )
+         && zdr_count3( zdrs, &objp->count );
+}
+
+static uint32_t zdr_entry3_body( zdr_t* zdrs, entry3* objp ) {
+  return zdr_fileid3( zdrs, &objp->fileid )
+         && zdr_filename3( zdrs, &objp->name )
+         && zdr_cookie3( zdrs, &objp->cookie );
+}
+
+uint32_t zdr_entry3( zdr_t* zdrs, entry3* objp ) {
+  return zdr_entry3_body( zdrs, objp )
+         && zdr_list( zdrs, &objp->nextentry, &entry3::nextentry, zdr_entry3_body );
+}
+
+uint32_t zdr_dirlist3( zdr_t* zdrs, dirlist3* objp ) {
+  return zdr_list( zdrs, &objp->entries, &entry3::nextentry, zdr_entry3_body )
+         && zdr_bool( zdrs, &objp->eof );
+}
+
+uint32_t zdr_READDIR3resok( zdr_t* zdrs, READDIR3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->dir_attributes )
+         && zdr_cookieverf3( zdrs, objp->cookieverf )
+         && zdr_dirlist3( zdrs, &objp->reply );
+}
+
+uint32_t zdr_READDIR3resfail( zdr_t* zdrs, READDIR3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->dir_attributes );
+}
+
+uint32_t zdr_READDIR3res( zdr_t* zdrs, READDIR3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->READDIR3res_u.resok, zdr_READDIR3resok,
+                   &objp->READDIR3res_u.resfail, zdr_READDIR3resfail );
+}
+
+uint32_t zdr_LINK3args( zdr_t* zdrs, LINK3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->file ) && zdr_diropargs3( zdrs, &objp->link );
+}
+
+uint32_t zdr_LINK3resok( zdr_t* zdrs, LINK3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->file_attributes ) && zdr_wcc_data( zdrs, &objp->linkdir_wcc );
+}
+
+uint32_t zdr_LINK3resfail( zdr_t* zdrs, LINK3resfail* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->file_attributes ) && zdr_wcc_data( zdrs, &objp->linkdir_wcc );
+}
+
+uint32_t zdr_LINK3res( zdr_t* zdrs, LINK3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->LINK3res_u.resok, zdr_LINK3resok,
+                   &objp->LINK3res_u.resfail, zdr_LINK3resfail );
+}
+
+uint32_t zdr_sattrguard3( zdr_t* zdrs, sattrguard3* objp ) {
+  return zdr_optional( zdrs, &objp->check, &objp->sattrguard3_u.obj_ctime, zdr_nfstime3 );
+}
+
+uint32_t zdr_SETATTR3args( zdr_t* zdrs, SETATTR3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->object )
+         && zdr_sattr3( zdrs, &objp->new_attributes )
+         && zdr_sattrguard3( zdrs, &objp->guard );
+}
+
+uint32_t zdr_SETATTR3resok( zdr_t* zdrs, SETATTR3resok* objp ) {
+  return zdr_wcc_data( zdrs, &objp->obj_wcc );
+}
+
+uint32_t zdr_SETATTR3resfail( zdr_t* zdrs, SETATTR3resfail* objp ) {
+  return zdr_wcc_data( zdrs, &objp->obj_wcc );
+}
+
+uint32_t zdr_SETATTR3res( zdr_t* zdrs, SETATTR3res* objp ) {
+  return zdr_res3( zdrs, &objp->status,
+                   &objp->SETATTR3res_u.resok, zdr_SETATTR3resok,
+                   &objp->SETATTR3res_u.resfail, zdr_SETATTR3resfail );
+}
+
+uint32_t zdr_nfsacl_type( zdr_t* zdrs, nfsacl_type* objp ) {
+  return zdr_enum( zdrs, objp );
+}
+
+uint32_t zdr_nfsacl_ace( zdr_t* zdrs, nfsacl_ace* objp ) {
+  return zdr_nfsacl_type( zdrs, &objp->type )
+         && zdr_u_int( zdrs, &objp->id )
+         && zdr_u_int( zdrs, &objp->perm );
+}
+
+uint32_t zdr_GETACL3args( zdr_t* zdrs, GETACL3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->dir ) && zdr_u_int( zdrs, &objp->mask );
+}
+
+uint32_t zdr_GETACL3resok( zdr_t* zdrs, GETACL3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->attr )
+         && zdr_u_int( zdrs, &objp->mask )
+         && zdr_u_int( zdrs, &objp->ace_count )
+         && zdr_array( zdrs, &objp->ace.ace_val, &objp->ace.ace_len, ~0u, zdr_nfsacl_ace )
+         && zdr_u_int( zdrs, &objp->default_ace_count )
+         && zdr_array( zdrs, &objp->default_ace.default_ace_val,
+                       &objp->default_ace.default_ace_len, ~0u, zdr_nfsacl_ace );
+}
+
+uint32_t zdr_GETACL3res( zdr_t* zdrs, GETACL3res* objp ) {
+  return zdr_res3( zdrs, &objp->status, &objp->GETACL3res_u.resok, zdr_GETACL3resok );
+}
+
+uint32_t zdr_SETACL3args( zdr_t* zdrs, SETACL3args* objp ) {
+  return zdr_nfs_fh3( zdrs, &objp->dir )
+         && zdr_u_int( zdrs, &objp->mask )
+         && zdr_u_int( zdrs, &objp->ace_count )
+         && zdr_array( zdrs, &objp->ace.ace_val, &objp->ace.ace_len, ~0u, zdr_nfsacl_ace )
+         && zdr_u_int( zdrs, &objp->default_ace_count )
+         && zdr_array( zdrs, &objp->default_ace.default_ace_val,
+                       &objp->default_ace.default_ace_len, ~0u, zdr_nfsacl_ace );
+}
+
+uint32_t zdr_SETACL3resok( zdr_t* zdrs, SETACL3resok* objp ) {
+  return zdr_post_op_attr( zdrs, &objp->attr );
+}
+
+uint32_t zdr_SETACL3res( zdr_t* zdrs, SETACL3res* objp ) {
+  return zdr_res3( zdrs, &objp->status, &objp->SETACL3res_u.resok, zdr_SETACL3resok );
+}
@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <new>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+#include <vector>
+
+/*
+ * Write-behind.
+ *
+ * Written data is copied into ranges of at most writemax bytes, kept in the
+ * order they were created. A write that touches the newest range it can
+ * legally join (one still DIRTY, with nothing newer overlapping the new
+ * bytes) is coalesced into it, so sequential writes fill one range after
+ * the other. Full ranges go out as UNSTABLE WRITEs straight from their
+ * buffer; everything goes out on fsync/close or once max_dirty bytes are
+ * buffered, and a COMMIT follows when nothing is left to write.
+ *
+ * A range stays around after its WRITE until a COMMIT returns the verifier
+ * the WRITE did. A different verifier means the server restarted and may
+ * have lost the data, so the range is written again. A DIRTY range is never
+ * sent while an older overlapping one is still DIRTY or on the wire, which
+ * keeps overlapping writes (and their replays) in order.
+ *
+ * Reads through the nfsfh that overlap a range that is DIRTY or WRITING
+ * would miss its bytes on the server: they wait in `reads`, which flushes
+ * like fsync does, and go out once the ranges they overlap are written.
+ */
+enum nfs_wb_state {
+  NFS_WB_DIRTY    = 0,
+  NFS_WB_WRITING  = 1,
+  NFS_WB_UNSTABLE = 2,
+};
+
+struct nfs_wb_range {
+  uint64_t          offset;
+  uint32_t          len;
+  uint32_t          capacity;
+  char*             buf;
+  enum nfs_wb_state state;
+  bool              in_commit; /* UNSTABLE when the current COMMIT was sent */
+  char              verf[ NFS3_WRITEVERFSIZE ];
+};
+
+struct nfs_wb_waiter {
+  nfs_cb cb;
+  void*  private_data;
+  int    result;
+};
+
+struct nfs_wb_read {
+  uint64_t offset;
+  uint64_t count;
+  void*    buf;
+  nfs_cb   cb;
+  void*    private_data;
+};
+
+struct nfs_wb {
+  std::list< nfs_wb_range* > ranges; /* oldest first */
+  uint64_t                   dirty_bytes;
+  int                        writing;
+  bool                       committing;
+  bool                       have_verf;
+  char                       verf[ NFS3_WRITEVERFSIZE ];
+  int                        err; /* first error, reported by fsync/close */
+
+  std::vector< nfs_wb_waiter > blocked; /* writes over max_dirty */
+  std::vector< nfs_wb_waiter > syncs;   /* fsync and close */
+  std::vector< nfs_wb_read >   reads;   /* waiting for overlapping writes */
+  bool                         closing;
+
+  int  busy;
+  bool again;
+};
+
+struct nfs_wb_call {
+  struct nfs_context*  nfs;
+  struct nfsfh*        nfsfh;
+  struct nfs_wb_range* range;
+};
+
+static void nfs_wb_kick( struct nfs_context* nfs, struct nfsfh* nfsfh );
+
+struct nfsfh* nfs_open_fh( struct nfs_context* nfs, const struct nfs_fh* fh ) {
+  struct nfsfh* nfsfh;
+
+  if ( fh->len < 0 || fh->len > NFS3_FHSIZE ) {
+    rpc_set_error_errno( nfs->rpc, EINVAL, "Invalid file handle length %d", fh->len );
+    return nullptr;
+  }
+  if ( !( nfsfh = new ( std::nothrow ) struct nfsfh() ) ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate nfsfh" );
+    return nullptr;
+  }
+  nfsfh->fh.len = fh->len;
+  nfsfh->fh.val = (char*) malloc( fh->len ? fh->len : 1 );
+  nfsfh->wb     = new ( std::nothrow ) nfs_wb();
+  if ( !nfsfh->fh.val || !nfsfh->wb ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to allocate nfsfh" );
+    free( nfsfh->fh.val );
+    delete nfsfh->wb;
+    delete nfsfh;
+    return nullptr;
+  }
+  memcpy( nfsfh->fh.val, fh->val, fh->len );
+  return nfsfh;
+}
+
+static void nfs_wb_free_range( struct nfs_context* nfs, struct nfs_wb* wb, struct nfs_wb_range* r ) {
+  wb->dirty_bytes -= r->len;
+  rpc_pool_free( &nfs->rpc->pool, r->buf, r->capacity );
+  delete r;
+}
+
+static void nfs_wb_fail( struct nfs_context* nfs, struct nfs_wb* wb, int err, const char* msg ) {
+  if ( !wb->err ) {
+    wb->err = err;
+    free( nfs->error_string );
+    nfs->error_string = strdup( msg );
+  }
+}
+
+static bool nfs_wb_overlaps( const struct nfs_wb_range* r, uint64_t offset, uint64_t len ) {
+  return r->offset < offset + len && offset < r->offset + r->len;
+}
+
+/* is any of [offset, offset + count) buffered but not on the server yet */
+bool nfs_wb_pending( struct nfsfh* nfsfh, uint64_t offset, uint64_t count ) {
+  for ( struct nfs_wb_range* r : nfsfh->wb->ranges ) {
+    if ( r->state != NFS_WB_UNSTABLE && nfs_wb_overlaps( r, offset, count ) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* make room for `len` bytes in `r`, keeping what is there */
+static bool nfs_wb_reserve( struct nfs_context* nfs, struct nfs_wb_range* r, uint32_t len ) {
+  if ( len <= r->capacity ) {
+    return true;
+  }
+  uint32_t cap;
+  char*    buf = rpc_pool_alloc( &nfs->rpc->pool, std::max( len, 2 * r->capacity ), &cap );
+  if ( !buf ) {
+    return false;
+  }
+  memcpy( buf, r->buf, r->len );
+  rpc_pool_free( &nfs->rpc->pool, r->buf, r->capacity );
+  r->buf      = buf;
+  r->capacity = cap;
+  return true;
+}
+
+/*
+ * The newest DIRTY range that [offset, offset + len) overlaps or touches,
+ * unless a newer range overlaps it: the new bytes must end up newer than
+ * anything they overwrite.
+ */
+static struct nfs_wb_range* nfs_wb_find( struct nfs_wb* wb, uint64_t offset, uint64_t len ) {
+  for ( auto it = wb->ranges.rbegin(); it != wb->ranges.rend(); ++it ) {
+    struct nfs_wb_range* r = *it;
+    if ( r->offset > offset + len || offset > r->offset + r->len ) {
+      continue;
+    }
+    if ( r->state == NFS_WB_DIRTY ) {
+      return r;
+    }
+    if ( nfs_wb_overlaps( r, offset, len ) ) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+static int nfs_wb_add( struct nfs_context* nfs, struct nfs_wb* wb, uint64_t offset, const char* data, uint64_t count ) {
+  uint32_t writemax = (uint32_t) std::max< size_t >( nfs->nfsi->writemax, NFS_MIN_XFER_SIZE );
+
+  while ( count ) {
+    uint32_t             len = (uint32_t) std::min< uint64_t >( count, writemax );
+    struct nfs_wb_range* r   = nfs_wb_find( wb, offset, len );
+
+    if ( r ) {
+      uint64_t lo = std::min( r->offset, offset );
+      uint64_t hi = std::max( r->offset + r->len, offset + len );
+      if ( hi - lo > writemax ) {
+        /* only an append can be split to fill the range up */
+        if ( offset != r->offset + r->len || r->len >= writemax ) {
+          r = nullptr;
+        } else {
+          len = writemax - r->len;
+          hi  = offset + len;
+        }
+      }
+      if ( r ) {
+        if ( !nfs_wb_reserve( nfs, r, hi - lo ) ) {
+          return -1;
+        }
+        if ( lo < r->offset ) {
+          memmove( r->buf + ( r->offset - lo ), r->buf, r->len );
+        }
+        memcpy( r->buf + ( offset - lo ), data, len );
+        wb->dirty_bytes += ( hi - lo ) - r->len;
+        r->offset = lo;
+        r->len    = hi - lo;
+      }
+    }
+    if ( !r ) {
+      if ( !( r = new ( std::nothrow ) nfs_wb_range() ) ) {
+        return -1;
+      }
+      if ( !( r->buf = rpc_pool_alloc( &nfs->rpc->pool, len, &r->capacity ) ) ) {
+        delete r;
+        return -1;
+      }
+      memcpy( r->buf, data, len );
+      r->offset = offset;
+      r->len    = len;
+      wb->ranges.push_back( r );
+      wb->dirty_bytes += len;
+    }
+    offset += len;
+    data += len;
+    count -= len;
+  }
+  return 0;
+}
+
+/* a server restart lost every UNSTABLE write made under another verifier */
+static void nfs_wb_replay( struct nfs_wb* wb, const char* verf ) {
+  for ( struct nfs_wb_range* r : wb->ranges ) {
+    if ( r->state == NFS_WB_UNSTABLE && memcmp( r->verf, verf, NFS3_WRITEVERFSIZE ) ) {
+      r->state     = NFS_WB_DIRTY;
+      r->in_commit = false;
+    }
+  }
+}
+
+static void nfs_wb_set_verf( struct nfs_wb* wb, const char* verf ) {
+  if ( wb->have_verf && memcmp( wb->verf, verf, NFS3_WRITEVERFSIZE ) ) {
+    nfs_wb_replay( wb, verf );
+  }
+  memcpy( wb->verf, verf, NFS3_WRITEVERFSIZE );
+  wb->have_verf = true;
+}
+
+static void nfs_wb_write_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_wb_call*  call = (struct nfs_wb_call*) private_data;
+  struct nfs_context*  nfs  = call->nfs;
+  struct nfsfh*        fh   = call->nfsfh;
+  struct nfs_wb*       wb   = fh->wb;
+  struct nfs_wb_range* r    = call->range;
+  WRITE3res*           res  = (WRITE3res*) data;
+  delete call;
+
+  wb->writing--;
+  auto it = std::find( wb->ranges.begin(), wb->ranges.end(), r );
+  if ( status != RPC_STATUS_SUCCESS || res->status != NFS3_OK ) {
+    if ( status != RPC_STATUS_SUCCESS ) {
+      nfs_wb_fail( nfs, wb, nfs_status_to_errno( status ), (const char*) data );
+    } else {
+      nfs_wb_fail( nfs, wb, nfsstat3_to_errno( res->status ), nfsstat3_to_str( res->status ) );
+    }
+    wb->ranges.erase( it );
+    nfs_wb_free_range( nfs, wb, r );
+    nfs_wb_kick( nfs, fh );
+    return;
+  }
+
+  WRITE3resok* ok = &res->WRITE3res_u.resok;
+  uint32_t     n  = std::min( ok->count, r->len );
+  nfs_attrcache_update_wcc( nfs, &fh->fh, &ok->file_wcc );
+  if ( n < r->len ) {
+    /* short write: the rest becomes a DIRTY range of the same age */
+    struct nfs_wb_range* tail = new ( std::nothrow ) nfs_wb_range();
+    if ( !tail || !( tail->buf = rpc_pool_alloc( &nfs->rpc->pool, r->len - n, &tail->capacity ) ) ) {
+      delete tail;
+      nfs_wb_fail( nfs, wb, -ENOMEM, "Out of memory: Failed to split short write" );
+    } else {
+      memcpy( tail->buf, r->buf + n, r->len - n );
+      tail->offset = r->offset + n;
+      tail->len    = r->len - n;
+      wb->ranges.insert( std::next( it ), tail );
+      r->len = n;
+    }
+  }
+
+  if ( ok->committed != UNSTABLE || n == 0 ) {
+    wb->ranges.erase( it );
+    nfs_wb_free_range( nfs, wb, r );
+  } else {
+    r->state = NFS_WB_UNSTABLE;
+    memcpy( r->verf, ok->verf, NFS3_WRITEVERFSIZE );
+  }
+  nfs_wb_set_verf( wb, ok->verf );
+  nfs_wb_kick( nfs, fh );
+}
+
+static void nfs_wb_commit_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  struct nfs_wb_call* call = (struct nfs_wb_call*) private_data;
+  struct nfs_context* nfs  = call->nfs;
+  struct nfsfh*       fh   = call->nfsfh;
+  struct nfs_wb*      wb   = fh->wb;
+  COMMIT3res*         res  = (COMMIT3res*) data;
+  delete call;
+
+  wb->committing = false;
+  bool ok        = status == RPC_STATUS_SUCCESS && res->status == NFS3_OK;
+  if ( status != RPC_STATUS_SUCCESS ) {
+    nfs_wb_fail( nfs, wb, nfs_status_to_errno( status ), (const char*) data );
+  } else if ( !ok ) {
+    nfs_wb_fail( nfs, wb, nfsstat3_to_errno( res->status ), nfsstat3_to_str( res->status ) );
+  }
+  if ( ok ) {
+    nfs_attrcache_update_wcc( nfs, &fh->fh, &res->COMMIT3res_u.resok.file_wcc );
+    nfs_wb_set_verf( wb, res->COMMIT3res_u.resok.verf );
+  }
+
+  for ( auto it = wb->ranges.begin(); it != wb->ranges.end(); ) {
+    struct nfs_wb_range* r = *it;
+    if ( !r->in_commit ) {
+      ++it;
+      continue;
+    }
+    r->in_commit = false;
+    /* with a failed COMMIT the data is lost either way, don't retry forever */
+    if ( !ok || !memcmp( r->verf, res->COMMIT3res_u.resok.verf, NFS3_WRITEVERFSIZE ) ) {
+      it = wb->ranges.erase( it );
+      nfs_wb_free_range( nfs, wb, r );
+    } else {
+      r->state = NFS_WB_DIRTY;
+      ++it;
+    }
+  }
+  nfs_wb_kick( nfs, fh );
+}
+
+static int nfs_wb_send_write( struct nfs_context* nfs, struct nfsfh* fh, struct nfs_wb_range* r ) {
+  struct rpc_context* rpc  = nfs_select_rpc( nfs );
+  struct nfs_wb_call* call = new ( std::nothrow ) nfs_wb_call{ nfs, fh, r };
+  struct rpc_pdu*     pdu  = nullptr;
+
+  if ( !call ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate write call" );
+    goto fail;
+  }
+
+  WRITE3args args;
+  args.file.data.data_len = fh->fh.len;
+  args.file.data.data_val = fh->fh.val;
+  args.offset             = r->offset;
+  args.count              = r->len;
+  args.stable             = UNSTABLE;
+  args.data.data_len      = r->len;
+  args.data.data_val      = r->buf;
+
+  pdu = rpc_allocate_pdu( rpc, NFS_PROGRAM, NFS_V3, NFS3_WRITE, nfs_wb_write_cb, call,
+                          (zdrproc_t) zdr_WRITE3res, sizeof( WRITE3res ), 0 );
+  if ( !pdu ) {
+    goto fail;
+  }
+  pdu->rtt_class = RPC_RTT_WRITE;
+  rpc_pdu_set_payload( pdu, r->buf, r->len );
+  if ( !zdr_WRITE3args( &pdu->zdr, &args ) ) {
+    rpc_set_error( rpc, "ZDR error: Failed to encode WRITE3args" );
+    goto fail;
+  }
+
+  fh->wb->writing++;
+  if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+    fh->wb->writing--;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  if ( pdu ) {
+    rpc_free_pdu( rpc, pdu );
+  }
+  delete call;
+  nfs_wb_fail( nfs, fh->wb, -rpc_get_errno( rpc ), rpc_get_error( rpc ) );
+  return -1;
+}
+
+static int nfs_wb_send_commit( struct nfs_context* nfs, struct nfsfh* fh ) {
+  struct rpc_context* rpc  = nfs_select_rpc( nfs );
+  struct nfs_wb_call* call = new ( std::nothrow ) nfs_wb_call{ nfs, fh, nullptr };
+  struct rpc_pdu*     pdu  = nullptr;
+
+  if ( !call ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate commit call" );
+    goto fail;
+  }
+
+  COMMIT3args args;
+  args.file.data.data_len = fh->fh.len;
+  args.file.data.data_val = fh->fh.val;
+  args.offset             = 0;
+  args.count              = 0; /* the whole file */
+
+  pdu = rpc_allocate_pdu( rpc, NFS_PROGRAM, NFS_V3, NFS3_COMMIT, nfs_wb_commit_cb, call,
+                          (zdrproc_t) zdr_COMMIT3res, sizeof( COMMIT3res ), 0 );
+  if ( !pdu ) {
+    goto fail;
+  }
+  pdu->rtt_class = RPC_RTT_COMMIT;
+  if ( !zdr_COMMIT3args( &pdu->zdr, &args ) ) {
+    rpc_set_error( rpc, "ZDR error: Failed to encode COMMIT3args" );
+    goto fail;
+  }
+
+  for ( struct nfs_wb_range* r : fh->wb->ranges ) {
+    r->in_commit = r->state == NFS_WB_UNSTABLE;
+  }
+  fh->wb->committing = true;
+  if ( rpc_queue_pdu( rpc, pdu ) < 0 ) {
+    fh->wb->committing = false;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  if ( pdu ) {
+    rpc_free_pdu( rpc, pdu );
+  }
+  delete call;
+  nfs_wb_fail( nfs, fh->wb, -rpc_get_errno( rpc ), rpc_get_error( rpc ) );
+  return -1;
+}
+
+/* send what can be sent, then collect the completions and reads that became due */
+static bool nfs_wb_progress( struct nfs_context* nfs,
+                             struct nfsfh*       fh,
+                             std::vector< nfs_wb_waiter >& done,
+                             std::vector< nfs_wb_read >&   reads ) {
+  struct nfs_wb* wb       = fh->wb;
+  uint32_t       writemax = (uint32_t) std::max< size_t >( nfs->nfsi->writemax, NFS_MIN_XFER_SIZE );
+  bool           commit   = !wb->syncs.empty() || wb->dirty_bytes >= nfs->nfsi->max_dirty;
+  bool           flush    = commit || !wb->reads.empty();
+  bool           dirty    = false;
+
+  /*
+   * Pick first, send after: a send can fail synchronously and run callbacks
+   * that change the list. Picked ranges are WRITING already, so a newer
+   * overlapping range waits for them, as it does for an older one that is
+   * still DIRTY: that one holds bytes the newer range overwrites.
+   */
+  std::vector< nfs_wb_range* > picked;
+  for ( auto it = wb->ranges.begin(); it != wb->ranges.end(); ++it ) {
+    struct nfs_wb_range* r = *it;
+    if ( r->state != NFS_WB_DIRTY ) {
+      continue;
+    }
+    dirty = true;
+    if ( wb->writing + (int) picked.size() >= nfs->nfsi->write_window || ( !flush && r->len < writemax ) ) {
+      continue;
+    }
+    bool blocked = false;
+    for ( auto older = wb->ranges.begin(); older != it && !blocked; ++older ) {
+      blocked = ( *older )->state != NFS_WB_UNSTABLE && nfs_wb_overlaps( *older, r->offset, r->len );
+    }
+    if ( !blocked ) {
+      r->state = NFS_WB_WRITING;
+      picked.push_back( r );
+    }
+  }
+
+  nfs_cork( nfs );
+  for ( size_t i = 0; i < picked.size(); i++ ) {
+    if ( nfs_wb_send_write( nfs, fh, picked[ i ] ) < 0 ) {
+      for ( ; i < picked.size(); i++ ) {
+        picked[ i ]->state = NFS_WB_DIRTY;
+      }
+    }
+  }
+  nfs_uncork( nfs );
+
+  if ( commit && !dirty && !wb->writing && !wb->committing && !wb->ranges.empty() ) {
+    nfs_wb_send_commit( nfs, fh );
+  }
+
+  /* nothing can move any more after an error that left ranges behind */
+  bool stuck = wb->err && !wb->writing && !wb->committing;
+  if ( stuck ) {
+    while ( !wb->ranges.empty() ) {
+      nfs_wb_free_range( nfs, wb, wb->ranges.front() );
+      wb->ranges.pop_front();
+    }
+  }
+
+  if ( wb->dirty_bytes < nfs->nfsi->max_dirty || stuck ) {
+    done.insert( done.end(), wb->blocked.begin(), wb->blocked.end() );
+    wb->blocked.clear();
+  }
+  for ( auto it = wb->reads.begin(); it != wb->reads.end(); ) {
+    if ( nfs_wb_pending( fh, it->offset, it->count ) ) {
+      ++it;
+    } else {
+      reads.push_back( *it );
+      it = wb->reads.erase( it );
+    }
+  }
+  if ( wb->ranges.empty() && !wb->writing && !wb->committing && !wb->syncs.empty() ) {
+    for ( nfs_wb_waiter& w : wb->syncs ) {
+      w.result = wb->err;
+    }
+    done.insert( done.end(), wb->syncs.begin(), wb->syncs.end() );
+    wb->syncs.clear();
+    wb->err = 0;
+    return wb->closing;
+  }
+  return false;
+}
+
+static void nfs_wb_kick( struct nfs_context* nfs, struct nfsfh* fh ) {
+  struct nfs_wb* wb = fh->wb;
+
+  if ( wb->busy ) {
+    wb->again = true;
+    return;
+  }
+  wb->busy++;
+  do {
+    std::vector< nfs_wb_waiter > done;
+    std::vector< nfs_wb_read >   reads;
+    wb->again   = false;
+    bool closed = nfs_wb_progress( nfs, fh, done, reads );
+    for ( nfs_wb_read& r : reads ) {
+      if ( nfs_fh_pread_async( nfs, fh, r.offset, r.count, r.buf, r.cb, r.private_data ) < 0 ) {
+        r.cb( -EIO, nfs, (void*) rpc_get_error( nfs->rpc ), r.private_data );
+      }
+    }
+    for ( nfs_wb_waiter& w : done ) {
+      w.cb( w.result, nfs, w.result < 0 ? nfs->error_string : nullptr, w.private_data );
+    }
+    if ( closed ) {
+      nfs_ra_release( nfs, fh );
+      free( fh->fh.val );
+      delete wb;
+      delete fh;
+      return;
+    }
+  } while ( wb->again );
+  wb->busy--;
+}
+
+int nfs_pwrite_async( struct nfs_context* nfs,
+                      struct nfsfh*       nfsfh,
+                      uint64_t            offset,
+                      uint64_t            count,
+                      const void*         buf,
+                      nfs_cb              cb,
+                      void*               private_data ) {
+  struct nfs_wb* wb = nfsfh->wb;
+
+  if ( wb->closing ) {
+    rpc_set_error_errno( nfs->rpc, EBADF, "Write to a file that is being closed" );
+    return -1;
+  }
+  if ( count > INT32_MAX ) {
+    rpc_set_error_errno( nfs->rpc, EFBIG, "Write of %llu bytes is too large", (unsigned long long) count );
+    return -1;
+  }
+  nfs_ra_invalidate( nfs, nfsfh, offset, count );
+  if ( nfs_wb_add( nfs, wb, offset, (const char*) buf, count ) < 0 ) {
+    rpc_set_error_errno( nfs->rpc, ENOMEM, "Out of memory: Failed to buffer write" );
+    return -1;
+  }
+  wb->blocked.push_back( { cb, private_data, (int) count } );
+  nfs_wb_kick( nfs, nfsfh );
+  return 0;
+}
+
+/* queue a read until the writes it overlaps are on the server */
+int nfs_wb_wait_read( struct nfs_context* nfs,
+                      struct nfsfh*       nfsfh,
+                      uint64_t            offset,
+                      uint64_t            count,
+                      void*               buf,
+                      nfs_cb              cb,
+                      void*               private_data ) {
+  nfsfh->wb->reads.push_back( { offset, count, buf, cb, private_data } );
+  nfs_wb_kick( nfs, nfsfh );
+  return 0;
+}
+
+int nfs_fsync_async( struct nfs_context* nfs, struct nfsfh* nfsfh, nfs_cb cb, void* private_data ) {
+  if ( nfsfh->wb->closing ) {
+    rpc_set_error_errno( nfs->rpc, EBADF, "fsync of a file that is being closed" );
+    return -1;
+  }
+  nfsfh->wb->syncs.push_back( { cb, private_data, 0 } );
+  nfs_wb_kick( nfs, nfsfh );
+  return 0;
+}
+
+/* flush and commit everything, then free nfsfh */
+int nfs_close_async( struct nfs_context* nfs, struct nfsfh* nfsfh, nfs_cb cb, void* private_data ) {
+  if ( nfsfh->wb->closing ) {
+    rpc_set_error_errno( nfs->rpc, EBADF, "File is already being closed" );
+    return -1;
+  }
+  nfsfh->wb->closing = true;
+  nfsfh->wb->syncs.push_back( { cb, private_data, 0 } );
+  nfs_wb_kick( nfs, nfsfh );
+  return 0;
+}
@@ -52,3 +52,73 @@ struct auth* authunix_create_default( void ) {
   return authunix_create(
     "nfs_v3", getuid(), getgid(), 0, nullptr );
 }
+
+void auth_destroy( struct auth* auth ) {
+  if ( !auth ) {
+    return;
+  }
+  delete[] auth->ah_cred.oa_base;
+  delete[] auth->ah_verf.oa_base;
+  delete auth;
+}
+
+/*
+ * Drop the call templates built for `auth`, before it is freed and its
+ * address can come back for a different credential.
+ */
+static void rpc_forget_templates( struct rpc_context* rpc, const struct auth* auth ) {
+  for ( struct rpc_call_template& t : rpc->templates ) {
+    if ( t.auth == auth ) {
+      t.size = 0;
+      t.auth = nullptr;
+    }
+  }
+}
+
+/*
+ * The credential for rpc->uid/rpc->gid, from the cache or newly built.
+ * Returns nullptr if it could not be built.
+ */
+struct auth* rpc_get_auth( struct rpc_context* rpc ) {
+  struct rpc_cred* victim = &rpc->creds[ 0 ];
+
+  if ( rpc->auth ) {
+    return rpc->auth;
+  }
+  for ( struct rpc_cred& c : rpc->creds ) {
+    if ( c.auth && c.uid == rpc->uid && c.gid == rpc->gid ) {
+      c.last_used = ++rpc->cred_clock;
+      return rpc->auth = c.auth;
+    }
+    if ( !c.auth || ( victim->auth && c.last_used < victim->last_used ) ) {
+      victim = &c;
+    }
+  }
+
+  struct auth* auth = authunix_create( "nfs_v3", rpc->uid, rpc->gid, 0, nullptr );
+  if ( !auth ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to create credential" );
+    return nullptr;
+  }
+  if ( victim->auth ) {
+    rpc_forget_templates( rpc, victim->auth );
+    auth_destroy( victim->auth );
+  }
+  victim->auth      = auth;
+  victim->uid       = rpc->uid;
+  victim->gid       = rpc->gid;
+  victim->last_used = ++rpc->cred_clock;
+  return rpc->auth = auth;
+}
+
+void rpc_free_creds( struct rpc_context* rpc ) {
+  for ( struct rpc_cred& c : rpc->creds ) {
+    auth_destroy( c.auth );
+    c.auth = nullptr;
+  }
+  for ( struct rpc_call_template& t : rpc->templates ) {
+    t.size = 0;
+    t.auth = nullptr;
+  }
+  rpc->auth = nullptr;
+}
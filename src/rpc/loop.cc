@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <rpc.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+#define RPC_LOOP_MAX_EVENTS 64
+
+/*
+ * Tasks posted from other threads, see rpc_loop_post(). A bounded ring of
+ * slots with sequence numbers: producers claim a position with a CAS on
+ * tail, fill the slot and publish it by bumping its sequence; the loop
+ * thread is the only consumer and needs no atomics on head.
+ */
+struct rpc_loop_slot {
+  std::atomic< uint64_t > seq;
+  rpc_loop_fn             fn;
+  void*                   arg;
+};
+
+struct rpc_loop {
+  int                                epfd;
+  int                                wakefd; /* eventfd, data.ptr the loop itself in epoll */
+  std::atomic< bool >                stop { false };
+  std::vector< struct rpc_context* > contexts;
+
+  /* the contexts' wheels nest in this one, see rpc_loop_run_once() */
+  struct rpc_timer_wheel timers;
+
+  /* being dispatched, so that rpc_loop_remove() can forget the context */
+  struct epoll_event* events;
+  int                 nevents;
+  int                 cur;
+  struct rpc_context* servicing;
+
+  rpc_loop_slot                          ring[ RPC_LOOP_RING_SIZE ];
+  alignas( 64 ) std::atomic< uint64_t > tail { 0 };
+  alignas( 64 ) uint64_t                 head = 0;
+  std::atomic< bool >                    wake_pending { false }; /* wakefd written, not yet drained */
+};
+
+struct rpc_loop* rpc_loop_create( void ) {
+  struct rpc_loop* loop = new ( std::nothrow ) rpc_loop();
+  if ( !loop ) {
+    return nullptr;
+  }
+  for ( uint64_t i = 0; i < RPC_LOOP_RING_SIZE; i++ ) {
+    loop->ring[ i ].seq.store( i, std::memory_order_relaxed );
+  }
+  rpc_timer_init( &loop->timers, rpc_current_time() );
+  loop->timers.slack = 1;
+  loop->epfd         = epoll_create1( EPOLL_CLOEXEC );
+  loop->wakefd       = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  struct epoll_event ev {};
+  ev.events   = EPOLLIN;
+  ev.data.ptr = loop;
+  if ( loop->epfd < 0 || loop->wakefd < 0 || epoll_ctl( loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev ) < 0 ) {
+    if ( loop->epfd >= 0 ) {
+      close( loop->epfd );
+    }
+    if ( loop->wakefd >= 0 ) {
+      close( loop->wakefd );
+    }
+    delete loop;
+    return nullptr;
+  }
+  return loop;
+}
+
+void rpc_loop_destroy( struct rpc_loop* loop ) {
+  for ( struct rpc_context* rpc : loop->contexts ) {
+    rpc->loop          = nullptr;
+    rpc->timers.parent = nullptr;
+    rpc->timers.proxy  = {};
+  }
+  close( loop->epfd );
+  close( loop->wakefd );
+  delete loop;
+}
+
+/* Make a concurrent or the next epoll_wait() return. Thread-safe. */
+void rpc_loop_wakeup( struct rpc_loop* loop ) {
+  if ( !loop->wake_pending.exchange( true, std::memory_order_acq_rel ) ) {
+    uint64_t one = 1;
+    if ( write( loop->wakefd, &one, sizeof( one ) ) < 0 ) {
+      /* EAGAIN only if the counter is about to overflow: it is readable anyway */
+    }
+  }
+}
+
+/*
+ * Have `fn( arg )` run on the thread driving the loop, from its next
+ * rpc_loop_run_once(). Thread-safe and lock-free; returns -1 if the ring
+ * is full, in which case the caller should back off and retry.
+ */
+int rpc_loop_post( struct rpc_loop* loop, rpc_loop_fn fn, void* arg ) {
+  uint64_t       pos = loop->tail.load( std::memory_order_relaxed );
+  rpc_loop_slot* slot;
+
+  for ( ;; ) {
+    slot          = &loop->ring[ pos & ( RPC_LOOP_RING_SIZE - 1 ) ];
+    uint64_t seq  = slot->seq.load( std::memory_order_acquire );
+    int64_t  diff = (int64_t) ( seq - pos );
+    if ( diff == 0 ) {
+      if ( loop->tail.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+        break;
+      }
+    } else if ( diff < 0 ) {
+      return -1;
+    } else {
+      pos = loop->tail.load( std::memory_order_relaxed );
+    }
+  }
+  slot->fn  = fn;
+  slot->arg = arg;
+  slot->seq.store( pos + 1, std::memory_order_release );
+  rpc_loop_wakeup( loop );
+  return 0;
+}
+
+/* Run what has been posted so far, in order. Loop thread only. */
+static int rpc_loop_run_posted( struct rpc_loop* loop ) {
+  int n = 0;
+
+  for ( ;; ) {
+    rpc_loop_slot* slot = &loop->ring[ loop->head & ( RPC_LOOP_RING_SIZE - 1 ) ];
+    if ( slot->seq.load( std::memory_order_acquire ) != loop->head + 1 ) {
+      return n;
+    }
+    rpc_loop_fn fn  = slot->fn;
+    void*       arg = slot->arg;
+    slot->seq.store( loop->head + RPC_LOOP_RING_SIZE, std::memory_order_release );
+    loop->head++;
+    fn( arg );
+    n++;
+  }
+}
+
+static void rpc_loop_drain_wakeup( struct rpc_loop* loop ) {
+  uint64_t count;
+  /* an exchange, to see the slots of posters who found the flag still set */
+  loop->wake_pending.exchange( false, std::memory_order_acq_rel );
+  if ( read( loop->wakefd, &count, sizeof( count ) ) < 0 ) {
+    /* EAGAIN: a wakeup that raced with this one, nothing to do */
+  }
+}
+
+/*
+ * Sockets are registered once, edge-triggered, for both directions. Nothing
+ * has to be re-armed when the outqueue changes: writes go out directly from
+ * rpc_queue_pdu() and only an EAGAIN leaves work for the next EPOLLOUT edge.
+ */
+static int rpc_loop_register( struct rpc_loop* loop, struct rpc_context* rpc ) {
+  struct epoll_event ev {};
+  ev.events   = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = rpc;
+  return epoll_ctl( loop->epfd, EPOLL_CTL_ADD, rpc_get_fd( rpc ), &ev );
+}
+
+int rpc_loop_add( struct rpc_loop* loop, struct rpc_context* rpc ) {
+  if ( rpc->loop ) {
+    rpc_set_error_errno( rpc, EBUSY, "Context is already attached to a loop" );
+    return -1;
+  }
+  if ( rpc->fd != -1 && rpc_loop_register( loop, rpc ) < 0 ) {
+    rpc_set_error_errno( rpc, errno, "epoll_ctl() failed: %s", strerror( errno ) );
+    return -1;
+  }
+  rpc->loop              = loop;
+  rpc->timers.parent     = &loop->timers;
+  rpc->timers.proxy.data = rpc;
+  loop->contexts.push_back( rpc );
+  /* whatever is already armed, or a reconnect in progress */
+  rpc_loop_service_by( rpc, rpc_current_time() );
+  return 0;
+}
+
+void rpc_loop_remove( struct rpc_loop* loop, struct rpc_context* rpc ) {
+  if ( rpc->fd != -1 ) {
+    epoll_ctl( loop->epfd, EPOLL_CTL_DEL, rpc_get_fd( rpc ), nullptr );
+  }
+  loop->contexts.erase( std::remove( loop->contexts.begin(), loop->contexts.end(), rpc ),
+                        loop->contexts.end() );
+  rpc_timer_cancel( &loop->timers, &rpc->timers.proxy );
+  rpc->timers.parent = nullptr;
+  rpc->loop          = nullptr;
+
+  /* removed, maybe destroyed, by a callback: events not dispatched yet go */
+  for ( int i = loop->cur + 1; i < loop->nevents; i++ ) {
+    if ( loop->events[ i ].data.ptr == rpc ) {
+      loop->events[ i ].data.ptr = nullptr;
+    }
+  }
+  if ( loop->servicing == rpc ) {
+    loop->servicing = nullptr;
+  }
+}
+
+/* have the loop service `rpc` by `deadline` at the latest, even without events */
+void rpc_loop_service_by( struct rpc_context* rpc, uint64_t deadline ) {
+  struct rpc_timer* proxy = &rpc->timers.proxy;
+  if ( rpc->loop && ( !proxy->pprev || deadline < proxy->expires ) ) {
+    rpc_timer_arm( &rpc->loop->timers, proxy, deadline );
+  }
+}
+
+/* service `rpc` and keep its proxy armed for its next timer, unless it went away */
+static void rpc_loop_service( struct rpc_loop* loop, struct rpc_context* rpc, int revents ) {
+  loop->servicing = rpc;
+  rpc_service( rpc, revents );
+  if ( loop->servicing == rpc ) {
+    uint64_t next = rpc_timer_next( &rpc->timers );
+    if ( next != UINT64_MAX ) {
+      rpc_loop_service_by( rpc, next );
+    }
+  }
+  loop->servicing = nullptr;
+}
+
+int rpc_loop_update_fd( struct rpc_context* rpc, int old_fd ) {
+  struct rpc_loop* loop = rpc->loop;
+  if ( !loop ) {
+    return 0;
+  }
+  if ( old_fd != -1 ) {
+    epoll_ctl( loop->epfd, EPOLL_CTL_DEL, old_fd, nullptr );
+  }
+  if ( rpc->fd != -1 && rpc_loop_register( loop, rpc ) < 0 ) {
+    rpc_set_error_errno( rpc, errno, "epoll_ctl() failed: %s", strerror( errno ) );
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Wait for events, or until the earliest timer of any context is due, then
+ * service the contexts that have events and those whose timers are due;
+ * the others are not touched.
+ */
+int rpc_loop_run_once( struct rpc_loop* loop, int timeout_msecs ) {
+  struct epoll_event events[ RPC_LOOP_MAX_EVENTS ];
+
+  uint64_t now  = rpc_current_time();
+  uint64_t next = rpc_timer_next( &loop->timers );
+  if ( next <= now ) {
+    timeout_msecs = 0;
+  } else if ( next != UINT64_MAX && ( timeout_msecs < 0 || next - now < (uint64_t) timeout_msecs ) ) {
+    timeout_msecs = (int) std::min< uint64_t >( next - now, INT32_MAX );
+  }
+
+  int n = epoll_wait( loop->epfd, events, RPC_LOOP_MAX_EVENTS, timeout_msecs );
+  if ( n < 0 ) {
+    return errno == EINTR ? 0 : -1;
+  }
+  loop->events  = events;
+  loop->nevents = n;
+  for ( loop->cur = 0; loop->cur < n; loop->cur++ ) {
+    void* ptr = events[ loop->cur ].data.ptr;
+    if ( ptr == loop ) {
+      rpc_loop_drain_wakeup( loop );
+    } else if ( ptr ) {
+      rpc_loop_service( loop, (struct rpc_context*) ptr, events[ loop->cur ].events );
+    }
+  }
+  loop->events  = nullptr;
+  loop->nevents = 0;
+  rpc_loop_run_posted( loop );
+
+  /* timeouts, reconnects, and io_uring work queued outside the loop */
+  struct rpc_timer* t;
+  now = rpc_current_time();
+  while ( ( t = rpc_timer_expire( &loop->timers, now ) ) ) {
+    rpc_loop_service( loop, (struct rpc_context*) t->data, 0 );
+  }
+  return n;
+}
+
+int rpc_loop_run( struct rpc_loop* loop ) {
+  while ( !loop->stop ) {
+    if ( rpc_loop_run_once( loop, -1 ) < 0 ) {
+      return -1;
+    }
+  }
+  loop->stop = false;
+  return 0;
+}
+
+/* Thread-safe: rpc_loop_run() returns once its current iteration is done. */
+void rpc_loop_stop( struct rpc_loop* loop ) {
+  loop->stop = true;
+  rpc_loop_wakeup( loop );
+}
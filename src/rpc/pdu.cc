@@ -0,0 +1,783 @@
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <rpc.h>
+#include <string>
+
+#define RPC_HASH_MIN_SIZE 16
+
+/*
+ * xids are handed out sequentially, so a plain mask would put every
+ * in-flight PDU into one contiguous run. Fibonacci hashing spreads them.
+ */
+static inline uint32_t rpc_hash_slot_of( const struct rpc_hash_table* t,
+                                         uint32_t                     xid ) {
+  return ( xid * 0x9e3779b1u ) & t->mask;
+}
+
+static inline uint32_t rpc_hash_roundup( uint32_t size ) {
+  uint32_t n = RPC_HASH_MIN_SIZE;
+  while ( n < size && n < ( 1u << 31 ) ) {
+    n <<= 1;
+  }
+  return n;
+}
+
+bool rpc_hash_init( struct rpc_hash_table* t, uint32_t size ) {
+  uint32_t n = rpc_hash_roundup( size );
+
+  t->slots = new ( std::nothrow ) rpc_hash_slot[ n ]();
+  if ( !t->slots ) {
+    return false;
+  }
+  t->mask  = n - 1;
+  t->count = 0;
+  return true;
+}
+
+void rpc_hash_destroy( struct rpc_hash_table* t ) {
+  delete[] t->slots;
+  t->slots = nullptr;
+  t->mask  = 0;
+  t->count = 0;
+}
+
+static void rpc_hash_place( struct rpc_hash_table* t,
+                            uint32_t               xid,
+                            struct rpc_pdu*        pdu ) {
+  uint32_t i = rpc_hash_slot_of( t, xid );
+  while ( t->slots[ i ].pdu ) {
+    i = ( i + 1 ) & t->mask;
+  }
+  t->slots[ i ].xid = xid;
+  t->slots[ i ].pdu = pdu;
+}
+
+static bool rpc_hash_grow( struct rpc_hash_table* t ) {
+  struct rpc_hash_slot* old  = t->slots;
+  uint32_t              size = t->mask + 1;
+
+  t->slots = new ( std::nothrow ) rpc_hash_slot[ size * 2 ]();
+  if ( !t->slots ) {
+    t->slots = old;
+    return false;
+  }
+  t->mask = size * 2 - 1;
+  for ( uint32_t i = 0; i < size; i++ ) {
+    if ( old[ i ].pdu ) {
+      rpc_hash_place( t, old[ i ].xid, old[ i ].pdu );
+    }
+  }
+  delete[] old;
+  return true;
+}
+
+bool rpc_hash_insert( struct rpc_hash_table* t, struct rpc_pdu* pdu ) {
+  if ( ( t->count + 1 ) * 2 > t->mask + 1 && !rpc_hash_grow( t ) ) {
+    return false;
+  }
+  rpc_hash_place( t, pdu->xid, pdu );
+  t->count++;
+  return true;
+}
+
+struct rpc_pdu* rpc_hash_lookup( const struct rpc_hash_table* t, uint32_t xid ) {
+  uint32_t i = rpc_hash_slot_of( t, xid );
+  while ( t->slots[ i ].pdu ) {
+    if ( t->slots[ i ].xid == xid ) {
+      return t->slots[ i ].pdu;
+    }
+    i = ( i + 1 ) & t->mask;
+  }
+  return nullptr;
+}
+
+struct rpc_pdu* rpc_hash_remove( struct rpc_hash_table* t, uint32_t xid ) {
+  uint32_t i = rpc_hash_slot_of( t, xid );
+  while ( t->slots[ i ].pdu && t->slots[ i ].xid != xid ) {
+    i = ( i + 1 ) & t->mask;
+  }
+
+  struct rpc_pdu* pdu = t->slots[ i ].pdu;
+  if ( !pdu ) {
+    return nullptr;
+  }
+
+  /*
+   * Backward-shift deletion: pull every later member of the cluster whose
+   * home slot is at or before the hole into it, so no tombstones are left.
+   */
+  uint32_t j = i;
+  for ( ;; ) {
+    j = ( j + 1 ) & t->mask;
+    if ( !t->slots[ j ].pdu ) {
+      break;
+    }
+    uint32_t home = rpc_hash_slot_of( t, t->slots[ j ].xid );
+    if ( ( ( j - home ) & t->mask ) >= ( ( j - i ) & t->mask ) ) {
+      t->slots[ i ] = t->slots[ j ];
+      i             = j;
+    }
+  }
+  t->slots[ i ].pdu = nullptr;
+  t->count--;
+  return pdu;
+}
+
+bool rpc_add_waitpdu( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  if ( !rpc_hash_insert( &rpc->waitpdu, pdu ) ) {
+    return false;
+  }
+  rpc->waitpdu_len = rpc->waitpdu.count;
+  if ( rpc->waitpdu_len > rpc->max_waitpdu_len ) {
+    rpc->max_waitpdu_len = rpc->waitpdu_len;
+  }
+  return true;
+}
+
+struct rpc_pdu* rpc_find_waitpdu( struct rpc_context* rpc, uint32_t xid ) {
+  return rpc_hash_lookup( &rpc->waitpdu, xid );
+}
+
+struct rpc_pdu* rpc_remove_waitpdu( struct rpc_context* rpc, uint32_t xid ) {
+  struct rpc_pdu* pdu = rpc_hash_remove( &rpc->waitpdu, xid );
+  rpc->waitpdu_len    = rpc->waitpdu.count;
+  return pdu;
+}
+
+static void rpc_enqueue( struct rpc_queue* q, struct rpc_pdu* pdu ) {
+  pdu->next = nullptr;
+  if ( q->tail ) {
+    q->tail->next = pdu;
+  } else {
+    q->head = pdu;
+  }
+  q->tail = pdu;
+}
+
+/*
+ * The call header template for program/version with the current
+ * credential, encoded into a free (or the oldest) slot on a miss.
+ */
+static const struct rpc_call_template* rpc_get_call_template( struct rpc_context* rpc, uint32_t program, uint32_t version ) {
+  struct auth* auth = rpc_get_auth( rpc );
+  if ( !auth ) {
+    return nullptr;
+  }
+  for ( const struct rpc_call_template& t : rpc->templates ) {
+    if ( t.size && t.auth == auth && t.program == program && t.version == version ) {
+      return &t;
+    }
+  }
+
+  if ( auth->ah_cred.oa_length > RPC_MAX_AUTH_SIZE || auth->ah_verf.oa_length > RPC_MAX_AUTH_SIZE ) {
+    rpc_set_error_errno( rpc, EINVAL, "Credential of %u bytes is too large", auth->ah_cred.oa_length );
+    return nullptr;
+  }
+  struct rpc_call_template* t = &rpc->templates[ rpc->next_template++ % RPC_CALL_TEMPLATES ];
+  zdr_t                     zdrs;
+  uint32_t                  msg[] = { 0, RPC_MSG_CALL, RPC_MSG_VERSION, program, version, 0 };
+
+  zdrmem_create( &zdrs, t->data, sizeof( t->data ), ZDR_ENCODE );
+  for ( uint32_t& v : msg ) {
+    zdr_u_int( &zdrs, &v );
+  }
+  zdr_u_int( &zdrs, &auth->ah_cred.oa_flavor );
+  zdr_bytes( &zdrs, &auth->ah_cred.oa_base, &auth->ah_cred.oa_length, RPC_MAX_AUTH_SIZE );
+  zdr_u_int( &zdrs, &auth->ah_verf.oa_flavor );
+  zdr_bytes( &zdrs, &auth->ah_verf.oa_base, &auth->ah_verf.oa_length, RPC_MAX_AUTH_SIZE );
+
+  t->auth    = auth;
+  t->program = program;
+  t->version = version;
+  t->size    = zdr_getpos( &zdrs );
+  return t;
+}
+
+struct rpc_pdu* rpc_allocate_pdu( struct rpc_context* rpc,
+                                  uint32_t            program,
+                                  uint32_t            version,
+                                  uint32_t            procedure,
+                                  rpc_cb              cb,
+                                  void*               private_data,
+                                  zdrproc_t           zdr_decode_fn,
+                                  uint32_t            zdr_decode_bufsize,
+                                  uint32_t            args_size ) {
+  const struct rpc_call_template* tmpl;
+  struct rpc_pdu*                 pdu;
+  uint32_t                        size;
+
+  if ( zdr_decode_bufsize > RPC_DECODE_BUF_SIZE ) {
+    rpc_set_error_errno( rpc, EINVAL, "Decode buffer of %u bytes is too large", zdr_decode_bufsize );
+    return nullptr;
+  }
+
+  tmpl = rpc_get_call_template( rpc, program, version );
+  if ( !tmpl ) {
+    return nullptr;
+  }
+  size = 4 /* record marker */ + tmpl->size + ( args_size ? args_size : RPC_DEF_ARGS_SIZE );
+
+  pdu = rpc_pool_get_pdu( &rpc->pool );
+  if ( !pdu ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate pdu structure" );
+    return nullptr;
+  }
+  /* the buffer may be larger than asked for, the arguments can use it all */
+  pdu->outdata.data = rpc_pool_alloc( &rpc->pool, size, &size );
+  if ( !pdu->outdata.data ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate pdu buffer" );
+    rpc_pool_put_pdu( &rpc->pool, pdu );
+    return nullptr;
+  }
+
+  pdu->xid                = rpc->xid++;
+  pdu->procedure          = procedure;
+  pdu->cb                 = cb;
+  pdu->private_data       = private_data;
+  pdu->zdr_decode_fn      = zdr_decode_fn;
+  pdu->zdr_decode_bufsize = zdr_decode_bufsize;
+
+  char* hdr = pdu->outdata.data + 4;
+  memcpy( hdr, tmpl->data, tmpl->size );
+  zdr_put_u32( hdr + RPC_CALL_XID_OFFSET, pdu->xid );
+  zdr_put_u32( hdr + RPC_CALL_PROC_OFFSET, procedure );
+  zdrmem_create( &pdu->zdr, pdu->outdata.data, size, ZDR_ENCODE );
+  zdr_setpos( &pdu->zdr, 4 + tmpl->size );
+
+  return pdu;
+}
+
+void rpc_free_pdu( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  rpc_timer_cancel( &rpc->timers, &pdu->timer );
+  rpc->outstanding_bytes -= pdu->cost;
+  /* zdr.size is the capacity of outdata */
+  rpc_pool_free( &rpc->pool, pdu->outdata.data, pdu->zdr.size );
+  rpc_pool_put_pdu( &rpc->pool, pdu );
+}
+
+/*
+ * Send `len` bytes at `data` as the last opaque of the arguments without
+ * copying them into outdata. Call before encoding the arguments; `data` must
+ * stay valid until the callback has run.
+ */
+void rpc_pdu_set_payload( struct rpc_pdu* pdu, char* data, uint32_t len ) {
+  pdu->outpayload.data = data;
+  pdu->outpayload.size = len;
+  zdr_set_payload( &pdu->zdr, data, len );
+}
+
+int rpc_queue_pdu( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  uint32_t size = zdr_getpos( &pdu->zdr );
+
+  if ( rpc->is_udp ) {
+    if ( !rpc->udp_dest.ss_family ) {
+      rpc_set_error_errno( rpc, EDESTADDRREQ, "No UDP destination, see rpc_set_udp_destination()" );
+      return -1;
+    }
+    /* replies are collected until the timeout, so there has to be one */
+    if ( rpc->is_broadcast && rpc->timeout <= 0 ) {
+      rpc_set_error_errno( rpc, EINVAL, "A broadcast call needs a timeout" );
+      return -1;
+    }
+    memcpy( &pdu->udp_dest, &rpc->udp_dest, sizeof( pdu->udp_dest ) );
+    if ( rpc->is_broadcast ) {
+      pdu->flags |= PDU_BROADCAST;
+    }
+  }
+
+  if ( pdu->outpayload.data ) {
+    if ( pdu->zdr.ext ) {
+      rpc_set_error_errno( rpc, EINVAL, "Payload was not consumed by the arguments" );
+      return -1;
+    }
+    pdu->outpayload.size = pdu->zdr.ext_len;
+  }
+
+  /* single-fragment record */
+  zdr_put_u32( pdu->outdata.data, 0x80000000u | ( size - 4 + ZDR_ROUNDUP( pdu->outpayload.size ) ) );
+  pdu->outdata.size = size;
+  pdu->written      = 0;
+  pdu->timeout      = rpc->timeout > 0 ? rpc_current_time() + rpc->timeout : 0;
+  pdu->queued_at    = rpc_current_time_us();
+  pdu->cost         = size + ZDR_ROUNDUP( pdu->outpayload.size ) + pdu->indata.size;
+  rpc->outstanding_bytes += pdu->cost;
+  if ( pdu->timeout ) {
+    pdu->timer.data = pdu;
+    rpc_timer_arm( &rpc->timers, &pdu->timer, pdu->timeout );
+  }
+
+  rpc_enqueue( &rpc->outqueue, pdu );
+
+  /*
+   * Nothing else is ahead of us: try to get it on the wire right away. With
+   * io_uring it waits to be submitted with whatever else gets queued before
+   * the context is next serviced, which a loop does on its next run.
+   */
+  if ( rpc->is_connected && !rpc->corked && rpc->outqueue.head == pdu ) {
+    if ( rpc->uring ) {
+      rpc_loop_service_by( rpc, rpc_current_time() );
+    } else if ( rpc_write_to_socket( rpc ) < 0 ) {
+      rpc_socket_error( rpc, rpc_get_error( rpc ) );
+    }
+  }
+  return 0;
+}
+
+/*
+ * msecs to wait for a reply to `pdu` before sending it again: the estimate
+ * for its class, backed off exponentially, never more than rpc->timeout.
+ * The backoff is this call's own; the class estimate only moves on replies,
+ * so that many calls timing out at once do not compound it.
+ */
+static uint64_t rpc_pdu_rto( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  const struct rpc_rtt_stats* rtt = &rpc->stats.rtt[ pdu->rtt_class ];
+  uint64_t                    rto = rtt->samples ? rtt->rto : (uint64_t) rpc->timeout;
+
+  if ( pdu->retransmits < 32 ) {
+    rto <<= pdu->retransmits;
+  }
+  return rto < (uint64_t) rpc->timeout ? rto : (uint64_t) rpc->timeout;
+}
+
+/*
+ * Called once a PDU has been fully written out.
+ */
+void rpc_pdu_sent( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  rpc_stat_add( &rpc->stats.num_req_sent, 1 );
+  if ( !rpc_add_waitpdu( rpc, pdu ) ) {
+    pdu->cb( rpc, RPC_STATUS_ERROR, (void*) "Out of memory: Failed to track pdu", pdu->private_data );
+    rpc_free_pdu( rpc, pdu );
+    return;
+  }
+  pdu->sent_at = rpc_current_time_us();
+  rpc_stats_sent( rpc, pdu );
+  if ( pdu->timeout && rpc->adaptive_timeout && pdu->retransmits < (uint32_t) rpc->retrans
+       && !( pdu->flags & PDU_BROADCAST ) ) {
+    uint64_t deadline = rpc_current_time() + rpc_pdu_rto( rpc, pdu );
+    if ( deadline < pdu->timeout ) {
+      rpc_timer_arm( &rpc->timers, &pdu->timer, deadline );
+    }
+  }
+}
+
+/*
+ * The reply to `pdu` is in: fold its round-trip time into the estimate for
+ * its class, as in RFC 6298. Not for retransmitted calls, as it is not known
+ * which of the transmissions this answers.
+ */
+void rpc_pdu_replied( struct rpc_context* rpc, struct rpc_pdu* pdu, uint32_t size ) {
+  struct rpc_rtt_stats* rtt = &rpc->stats.rtt[ pdu->rtt_class ];
+  uint64_t              now = rpc_current_time_us();
+  int64_t               r;
+
+  rpc_stat_add( &rpc->stats.num_resp_rcvd, 1 );
+  rpc->last_successful_rpc_response = rpc_current_time();
+  rpc_stats_replied( rpc, pdu, size, now );
+  if ( pdu->retransmits || !pdu->sent_at ) {
+    return;
+  }
+
+  r = (int64_t) ( now - pdu->sent_at );
+  uint32_t srtt, rttvar;
+  if ( !rtt->samples ) {
+    srtt   = r;
+    rttvar = r / 2;
+  } else {
+    int64_t err = r - rtt->srtt;
+    srtt        = rtt->srtt + err / 8;
+    rttvar      = rtt->rttvar + ( ( err < 0 ? -err : err ) - (int64_t) rtt->rttvar ) / 4;
+  }
+  uint32_t rto = ( srtt + 4 * (uint64_t) rttvar + 999 ) / 1000;
+  rpc_stat_set( &rtt->srtt, srtt );
+  rpc_stat_set( &rtt->rttvar, rttvar );
+  rpc_stat_set( &rtt->rto, rto < RPC_MIN_RTO ? RPC_MIN_RTO : rto );
+  rpc_stat_add( &rtt->samples, 1 );
+}
+
+static void rpc_pdu_error( struct rpc_context* rpc, struct rpc_pdu* pdu, const char* fmt, ... )
+  __attribute__( ( format( printf, 3, 4 ) ) );
+
+static void rpc_pdu_error( struct rpc_context* rpc, struct rpc_pdu* pdu, const char* fmt, ... ) {
+  char    msg[ 256 ];
+  va_list ap;
+
+  va_start( ap, fmt );
+  vsnprintf( msg, sizeof( msg ), fmt, ap );
+  va_end( ap );
+
+  rpc_set_error( rpc, "%s", msg );
+  pdu->cb( rpc, RPC_STATUS_ERROR, (void*) rpc_get_error( rpc ), pdu->private_data );
+}
+
+static void* rpc_decode_reply( struct rpc_context* rpc, struct rpc_pdu* pdu, zdr_t* zdrs ) {
+  if ( !pdu->zdr_decode_fn ) {
+    return nullptr;
+  }
+
+  /* a chained record may gather items that straddle two segments in there too */
+  if ( ( pdu->flags & PDU_DECODE_LISTS ) || zdrs->seg ) {
+    uint64_t want = 64;
+    if ( pdu->flags & PDU_DECODE_LISTS ) {
+      want += (uint64_t) zdr_remaining( zdrs ) * RPC_DECODE_SCRATCH_RATIO;
+    }
+    if ( zdrs->seg ) {
+      want += zdr_remaining( zdrs );
+      for ( struct zdr_seg* s = zdrs->seg; s; s = s->next ) {
+        want += ZDR_UNIT + 8;
+      }
+    }
+    if ( want > rpc->decode_scratch_size ) {
+      delete[] rpc->decode_scratch;
+      rpc->decode_scratch      = new ( std::nothrow ) char[ want ];
+      rpc->decode_scratch_size = rpc->decode_scratch ? (uint32_t) want : 0;
+    }
+    zdr_set_scratch( zdrs, rpc->decode_scratch, rpc->decode_scratch_size );
+  }
+  if ( pdu->indata.data ) {
+    zdr_set_payload( zdrs, pdu->indata.data, pdu->indata.size );
+  }
+
+  memset( rpc->decode_buf, 0, pdu->zdr_decode_bufsize );
+  if ( !pdu->zdr_decode_fn( zdrs, rpc->decode_buf ) ) {
+    return nullptr;
+  }
+  return rpc->decode_buf;
+}
+
+/*
+ * Decode a reply header up to and including the accept_stat. Returns true
+ * for MSG_ACCEPTED/SUCCESS, otherwise sets the error and returns false.
+ */
+static bool rpc_decode_reply_header( struct rpc_context* rpc, zdr_t* zdrs, uint32_t* xid ) {
+  uint32_t type, stat, flavor, low, high;
+  char*    verf;
+  uint32_t verf_len;
+
+  if ( !zdr_u_int( zdrs, xid ) || !zdr_u_int( zdrs, &type ) || !zdr_u_int( zdrs, &stat ) ) {
+    rpc_set_error( rpc, "Short RPC record of %u bytes", zdrs->size );
+    return false;
+  }
+  if ( type != RPC_MSG_REPLY ) {
+    rpc_set_error( rpc, "Unexpected RPC message type %u", type );
+    return false;
+  }
+  if ( stat == RPC_MSG_DENIED ) {
+    if ( zdr_u_int( zdrs, &stat ) && stat == RPC_MISMATCH
+         && zdr_u_int( zdrs, &low ) && zdr_u_int( zdrs, &high ) ) {
+      rpc_set_error( rpc, "RPC version mismatch, server supports %u-%u", low, high );
+    } else {
+      rpc_set_error( rpc, "RPC call denied (auth error)" );
+    }
+    return false;
+  }
+  if ( !zdr_u_int( zdrs, &flavor )
+       || !zdr_bytes( zdrs, &verf, &verf_len, RPC_MAX_AUTH_SIZE )
+       || !zdr_u_int( zdrs, &stat ) ) {
+    rpc_set_error( rpc, "Truncated RPC reply for xid 0x%08x", *xid );
+    return false;
+  }
+  if ( stat == RPC_SUCCESS ) {
+    return true;
+  }
+  if ( stat == RPC_PROG_MISMATCH && zdr_u_int( zdrs, &low ) && zdr_u_int( zdrs, &high ) ) {
+    rpc_set_error( rpc, "RPC program version mismatch, server supports %u-%u", low, high );
+  } else {
+    rpc_set_error( rpc, "RPC call failed with accept_stat %u", stat );
+  }
+  return false;
+}
+
+/*
+ * Dispatch one record, flat in buf or chained in zdrs. Only a flat record
+ * can be a call.
+ */
+static int rpc_process_record( struct rpc_context* rpc, zdr_t* zdrs, char* buf, uint32_t size ) {
+  zdr_t           head = *zdrs;
+  uint32_t        xid, type;
+  struct rpc_pdu* pdu;
+
+  if ( !zdr_u_int( zdrs, &xid ) || !zdr_u_int( zdrs, &type ) ) {
+    rpc_set_error( rpc, "Short RPC record of %u bytes", size );
+    return -1;
+  }
+  if ( type == RPC_MSG_CALL && rpc->is_server_context && buf ) {
+    return rpc_process_call( rpc, buf, size );
+  }
+  if ( type != RPC_MSG_REPLY ) {
+    rpc_set_error( rpc, "Unexpected RPC message type %u", type );
+    return -1;
+  }
+
+  /* a broadcast call stays pending for more replies until it times out */
+  pdu = rpc->is_udp ? rpc_find_waitpdu( rpc, xid ) : rpc_remove_waitpdu( rpc, xid );
+  if ( !pdu ) {
+    /* most likely the reply to a call that already timed out */
+    return 0;
+  }
+  bool broadcast = pdu->flags & PDU_BROADCAST;
+  if ( broadcast ) {
+    rpc_stat_add( &rpc->stats.num_resp_rcvd, 1 );
+  } else {
+    if ( rpc->is_udp ) {
+      rpc_remove_waitpdu( rpc, xid );
+    }
+    rpc_pdu_replied( rpc, pdu, size );
+  }
+
+  uint64_t start = rpc_current_time_us();
+  *zdrs          = head;
+  if ( !rpc_decode_reply_header( rpc, zdrs, &xid ) ) {
+    rpc_stats_decoded( rpc, pdu, rpc_current_time_us() - start, false );
+    pdu->cb( rpc, RPC_STATUS_ERROR, (void*) rpc_get_error( rpc ), pdu->private_data );
+  } else {
+    void* data = rpc_decode_reply( rpc, pdu, zdrs );
+    bool  ok   = !pdu->zdr_decode_fn || ( data && zdrs->ext_have >= zdrs->ext_len );
+    rpc_stats_decoded( rpc, pdu, rpc_current_time_us() - start, ok );
+    if ( !ok ) {
+      rpc_pdu_error( rpc, pdu, "Failed to decode reply for procedure %u", pdu->procedure );
+    } else {
+      pdu->cb( rpc, RPC_STATUS_SUCCESS, data, pdu->private_data );
+    }
+  }
+
+  if ( !broadcast ) {
+    rpc_free_pdu( rpc, pdu );
+  }
+  return 0;
+}
+
+int rpc_process_pdu( struct rpc_context* rpc, char* buf, uint32_t size ) {
+  zdr_t zdrs;
+
+  zdrmem_create( &zdrs, buf, size, ZDR_DECODE );
+  return rpc_process_record( rpc, &zdrs, buf, size );
+}
+
+/*
+ * Decode a reply where its fragments were received, without flattening
+ * them. The header is read before the PDU, and with it the decode scratch,
+ * is known, so anything straddling a segment boundary there is gathered on
+ * the stack. Decoded views point into the chain: a callback that keeps
+ * them takes a reference, see rpc_get_reply_iobuf().
+ */
+int rpc_process_iobuf( struct rpc_context* rpc, struct rpc_iobuf* chain ) {
+  zdr_t zdrs;
+  char  head[ RPC_MAX_AUTH_SIZE + 64 ];
+
+  zdr_chain_create( &zdrs, &chain->seg );
+  zdr_set_scratch( &zdrs, head, sizeof( head ) );
+  rpc->reply_iobuf = chain;
+  int ret          = rpc_process_record( rpc, &zdrs, nullptr, zdr_remaining( &zdrs ) );
+  rpc->reply_iobuf = nullptr;
+  return ret;
+}
+
+/* the chain the reply being handed to a callback was decoded from, if any */
+struct rpc_iobuf* rpc_get_reply_iobuf( struct rpc_context* rpc ) {
+  return rpc->reply_iobuf;
+}
+
+/*
+ * Decode the first `size` bytes of a reply to a PDU with an indata buffer.
+ * Succeeds only if the payload starts in there but does not end in there;
+ * *len is the payload length and *have how much of it was already copied
+ * to indata. The decoded result
+ * is left in decode_buf for when the rest has been received.
+ */
+bool rpc_decode_iovec_reply( struct rpc_context* rpc,
+                             struct rpc_pdu*     pdu,
+                             char*               buf,
+                             uint32_t            size,
+                             uint32_t*           len,
+                             uint32_t*           have ) {
+  zdr_t    zdrs;
+  uint32_t xid;
+
+  zdrmem_create( &zdrs, buf, size, ZDR_DECODE );
+  if ( !rpc_decode_reply_header( rpc, &zdrs, &xid ) || !rpc_decode_reply( rpc, pdu, &zdrs ) ) {
+    return false;
+  }
+  *len  = zdrs.ext_len;
+  *have = zdrs.ext_have;
+  return zdrs.ext_have < zdrs.ext_len;
+}
+
+/*
+ * Unlink every PDU that was sent and still awaits its reply, including one
+ * whose reply was being received, and return them as a list.
+ */
+static struct rpc_pdu* rpc_detach_pending( struct rpc_context* rpc ) {
+  struct rpc_pdu* pending { nullptr };
+  struct rpc_pdu* pdu;
+
+  if ( ( pdu = rpc->pdu ) ) {
+    rpc->pdu  = nullptr;
+    pdu->next = pending;
+    pending   = pdu;
+  }
+  for ( uint32_t i = 0; rpc->waitpdu.slots && i <= rpc->waitpdu.mask; i++ ) {
+    if ( ( pdu = rpc->waitpdu.slots[ i ].pdu ) ) {
+      rpc->waitpdu.slots[ i ].pdu = nullptr;
+      pdu->next                   = pending;
+      pending                     = pdu;
+    }
+  }
+  rpc->waitpdu.count = 0;
+  rpc->waitpdu_len   = 0;
+  return pending;
+}
+
+void rpc_error_all_pdus( struct rpc_context* rpc, int status, const char* error ) {
+  struct rpc_pdu* head    = rpc->outqueue.head;
+  struct rpc_pdu* pending = rpc_detach_pending( rpc );
+  struct rpc_pdu* pdu;
+
+  rpc_reset_queue( &rpc->outqueue );
+
+  /* callbacks may queue new requests, so only walk the detached lists */
+  std::string msg = error;
+  for ( struct rpc_pdu* list : { head, pending } ) {
+    while ( ( pdu = list ) ) {
+      list = pdu->next;
+      pdu->cb( rpc, status, (void*) msg.c_str(), pdu->private_data );
+      rpc_free_pdu( rpc, pdu );
+    }
+  }
+}
+
+/*
+ * The connection was lost: put everything that went out without an answer
+ * back in front of the outqueue, to be sent again once reconnected. A PDU
+ * that was only partly written starts over as well.
+ */
+void rpc_requeue_pending_pdus( struct rpc_context* rpc ) {
+  struct rpc_pdu* pending = rpc_detach_pending( rpc );
+  struct rpc_pdu* pdu;
+
+  if ( rpc->outqueue.head ) {
+    rpc->outqueue.head->written = 0;
+  }
+  while ( ( pdu = pending ) ) {
+    pending      = pdu->next;
+    pdu->written = 0;
+    pdu->next    = rpc->outqueue.head;
+    if ( !rpc->outqueue.head ) {
+      rpc->outqueue.tail = pdu;
+    }
+    rpc->outqueue.head = pdu;
+    rpc_stat_add( &rpc->stats.num_retransmitted, 1 );
+  }
+}
+
+static void rpc_timeout_pdu( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  if ( rpc->is_udp ) {
+    memcpy( &rpc->udp_src, &pdu->udp_dest, sizeof( rpc->udp_src ) );
+  }
+  rpc_stats_failed( rpc, pdu );
+  rpc_set_error( rpc, "RPC call timed out (xid 0x%08x)", pdu->xid );
+  pdu->cb( rpc, RPC_STATUS_TIMEOUT, (void*) rpc_get_error( rpc ), pdu->private_data );
+  rpc_free_pdu( rpc, pdu );
+}
+
+/* take a PDU that has not gone out yet off the outqueue */
+static void rpc_unqueue( struct rpc_queue* q, struct rpc_pdu* pdu ) {
+  struct rpc_pdu* prev = nullptr;
+  for ( struct rpc_pdu* p = q->head; p; prev = p, p = p->next ) {
+    if ( p == pdu ) {
+      if ( prev ) {
+        prev->next = p->next;
+      } else {
+        q->head = p->next;
+      }
+      if ( q->tail == p ) {
+        q->tail = prev;
+      }
+      return;
+    }
+  }
+}
+
+/*
+ * No reply to `pdu` within the timeout: a minor timeout sends it again, at
+ * the back of the outqueue, until rpc->retrans of them make a major one.
+ * True if it was queued again.
+ */
+static bool rpc_expire_pdu( struct rpc_context* rpc, struct rpc_pdu* pdu, uint64_t now ) {
+  if ( rpc_find_waitpdu( rpc, pdu->xid ) == pdu ) {
+    rpc_remove_waitpdu( rpc, pdu->xid );
+    if ( pdu->flags & PDU_BROADCAST ) {
+      /* the end of the collection, not a failure */
+      memcpy( &rpc->udp_src, &pdu->udp_dest, sizeof( rpc->udp_src ) );
+      rpc_set_error( rpc, "Broadcast call done (xid 0x%08x)", pdu->xid );
+      pdu->cb( rpc, RPC_STATUS_TIMEOUT, (void*) rpc_get_error( rpc ), pdu->private_data );
+      rpc_free_pdu( rpc, pdu );
+      return false;
+    }
+    rpc_stat_add( &rpc->stats.num_timedout, 1 );
+    if ( pdu->retransmits < (uint32_t) rpc->retrans ) {
+      pdu->retransmits++;
+      pdu->written = 0;
+      pdu->timeout = now + rpc->timeout;
+      rpc_timer_arm( &rpc->timers, &pdu->timer, pdu->timeout );
+      rpc_enqueue( &rpc->outqueue, pdu );
+      rpc_stat_add( &rpc->stats.num_retransmitted, 1 );
+      return true;
+    }
+    rpc_stat_add( &rpc->stats.num_major_timedout, 1 );
+    rpc_timeout_pdu( rpc, pdu );
+    return false;
+  }
+
+  /* a reply is being received into it, or it is partly on the wire */
+  if ( pdu == rpc->pdu || pdu->written || ( pdu->flags & PDU_SENDING ) ) {
+    rpc_timer_arm( &rpc->timers, &pdu->timer, now + 1 );
+    return false;
+  }
+
+  rpc_unqueue( &rpc->outqueue, pdu );
+  rpc_stat_add( &rpc->stats.num_timedout_in_outqueue, 1 );
+  rpc_stat_add( &rpc->stats.num_timedout, 1 );
+  rpc_timeout_pdu( rpc, pdu );
+  return false;
+}
+
+void rpc_timeout_scan( struct rpc_context* rpc ) {
+  uint64_t          now    = rpc_current_time();
+  bool              resend = false;
+  struct rpc_timer* t;
+
+  rpc->last_timeout_scan = now;
+  if ( now - rpc->pool.last_trim >= RPC_POOL_TRIM_INTERVAL ) {
+    rpc->pool.last_trim = now;
+    rpc_pool_trim( &rpc->pool, false );
+  }
+
+  while ( ( t = rpc_timer_expire( &rpc->timers, now ) ) ) {
+    if ( t->cb ) {
+      t->cb( rpc, t );
+    } else {
+      resend |= rpc_expire_pdu( rpc, (struct rpc_pdu*) t->data, now );
+    }
+  }
+
+  if ( resend && rpc->is_connected && !rpc->corked ) {
+    if ( rpc_write_to_socket( rpc ) < 0 ) {
+      rpc_socket_error( rpc, rpc_get_error( rpc ) );
+    }
+  }
+}
+
+int rpc_null_async( struct rpc_context* rpc,
+                    uint32_t            program,
+                    uint32_t            version,
+                    rpc_cb              cb,
+                    void*               private_data ) {
+  struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, program, version, 0, cb, private_data, nullptr, 0, 0 );
+  if ( !pdu ) {
+    return -1;
+  }
+  return rpc_queue_pdu( rpc, pdu );
+}
@@ -0,0 +1,248 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <rpc.h>
+
+/*
+ * Size classes: 256 bytes, then four per power of two (2^k + q * 2^(k-2),
+ * q = 1..4), so a buffer never wastes more than a fifth of its size.
+ */
+static inline uint32_t rpc_pool_class_of( uint32_t size ) {
+  if ( size <= RPC_POOL_MIN_SIZE ) {
+    return 0;
+  }
+  uint32_t k = 31 - __builtin_clz( size - 1 );
+  uint32_t q = ( size - ( 1u << k ) + ( 1u << ( k - 2 ) ) - 1 ) >> ( k - 2 );
+  return ( k - 8 ) * 4 + q;
+}
+
+static inline uint32_t rpc_pool_class_size( uint32_t idx ) {
+  if ( idx == 0 ) {
+    return RPC_POOL_MIN_SIZE;
+  }
+  uint32_t k = 8 + ( idx - 1 ) / 4;
+  uint32_t q = ( idx - 1 ) % 4 + 1;
+  return ( 1u << k ) + q * ( 1u << ( k - 2 ) );
+}
+
+static inline void* rpc_pool_list_pop( struct rpc_pool_list* l ) {
+  void* p = l->head;
+  if ( p ) {
+    memcpy( &l->head, p, sizeof( void* ) );
+    l->num_free--;
+  }
+  return p;
+}
+
+static inline void rpc_pool_list_push( struct rpc_pool_list* l, void* p ) {
+  memcpy( p, &l->head, sizeof( void* ) );
+  l->head = p;
+  l->num_free++;
+}
+
+static inline void rpc_pool_list_used( struct rpc_pool_list* l ) {
+  if ( ++l->in_use > l->hiwat ) {
+    l->hiwat = l->in_use;
+  }
+}
+
+/*
+ * The class list a buffer of `capacity` bytes is accounted to, or nullptr if
+ * that is not a class size. An oversize buffer that happens to be one counts
+ * as in use too, so that rpc_pool_free() need not tell the two apart.
+ */
+static inline struct rpc_pool_list* rpc_pool_list_of( struct rpc_pool* pool, uint32_t capacity ) {
+  uint32_t idx = rpc_pool_class_of( capacity );
+  if ( idx >= RPC_POOL_NUM_CLASSES || rpc_pool_class_size( idx ) != capacity ) {
+    return nullptr;
+  }
+  return &pool->classes[ idx ];
+}
+
+void rpc_pool_init( struct rpc_pool* pool, uint32_t max_size ) {
+  memset( pool, 0, sizeof( *pool ) );
+  pool->max_cached = RPC_POOL_MAX_CACHED;
+  rpc_pool_set_max_size( pool, max_size );
+}
+
+void rpc_pool_set_max_size( struct rpc_pool* pool, uint32_t max_size ) {
+  uint32_t idx = rpc_pool_class_of( max_size );
+  if ( idx >= RPC_POOL_NUM_CLASSES ) {
+    idx = RPC_POOL_NUM_CLASSES - 1;
+  }
+  /* anything cached above the new limit is of no further use */
+  for ( uint32_t i = idx + 1; i < RPC_POOL_NUM_CLASSES; i++ ) {
+    void* p;
+    while ( ( p = rpc_pool_list_pop( &pool->classes[ i ] ) ) ) {
+      pool->stats.bytes_cached -= rpc_pool_class_size( i );
+      pool->stats.num_trimmed++;
+      free( p );
+    }
+  }
+  pool->max_class = idx;
+}
+
+char* rpc_pool_alloc( struct rpc_pool* pool, uint32_t size, uint32_t* capacity ) {
+  uint32_t idx = rpc_pool_class_of( size );
+  char*    p;
+
+  pool->stats.num_allocs++;
+  if ( ZDR_UNLIKELY( idx > pool->max_class ) ) {
+    pool->stats.num_oversize++;
+    p = (char*) malloc( size );
+    if ( p ) {
+      struct rpc_pool_list* l = rpc_pool_list_of( pool, size );
+      if ( l ) {
+        rpc_pool_list_used( l );
+      }
+      pool->stats.bytes_in_use += size;
+      *capacity = size;
+    }
+    return p;
+  }
+
+  struct rpc_pool_list* l   = &pool->classes[ idx ];
+  uint32_t              csz = rpc_pool_class_size( idx );
+  if ( ( p = (char*) rpc_pool_list_pop( l ) ) ) {
+    pool->stats.num_hits++;
+    pool->stats.bytes_cached -= csz;
+  } else if ( !( p = (char*) malloc( csz ) ) ) {
+    return nullptr;
+  }
+  rpc_pool_list_used( l );
+  pool->stats.bytes_in_use += csz;
+  *capacity = csz;
+  return p;
+}
+
+/*
+ * `capacity` is what rpc_pool_alloc() returned for this buffer.
+ */
+void rpc_pool_free( struct rpc_pool* pool, char* p, uint32_t capacity ) {
+  if ( !p ) {
+    return;
+  }
+  struct rpc_pool_list* l = rpc_pool_list_of( pool, capacity );
+
+  pool->stats.bytes_in_use -= capacity;
+  if ( l && l->in_use ) {
+    l->in_use--;
+  }
+  /* not a class size, or above a max_class that has shrunk since */
+  if ( !l || rpc_pool_class_of( capacity ) > pool->max_class ) {
+    free( p );
+    return;
+  }
+  if ( pool->stats.bytes_cached + capacity > pool->max_cached ) {
+    pool->stats.num_trimmed++;
+    free( p );
+    return;
+  }
+  rpc_pool_list_push( l, p );
+  pool->stats.bytes_cached += capacity;
+}
+
+struct rpc_pdu* rpc_pool_get_pdu( struct rpc_pool* pool ) {
+  void* p = rpc_pool_list_pop( &pool->pdus );
+  pool->stats.num_allocs++;
+  if ( p ) {
+    pool->stats.num_hits++;
+  } else if ( !( p = malloc( sizeof( struct rpc_pdu ) ) ) ) {
+    return nullptr;
+  }
+  rpc_pool_list_used( &pool->pdus );
+  return new ( p ) rpc_pdu();
+}
+
+void rpc_pool_put_pdu( struct rpc_pool* pool, struct rpc_pdu* pdu ) {
+  pool->pdus.in_use--;
+  rpc_pool_list_push( &pool->pdus, pdu );
+}
+
+struct rpc_iobuf* rpc_iobuf_alloc( struct rpc_pool* pool, uint32_t size ) {
+  void* p = rpc_pool_list_pop( &pool->iobufs );
+  pool->stats.num_allocs++;
+  if ( p ) {
+    pool->stats.num_hits++;
+  } else if ( !( p = malloc( sizeof( struct rpc_iobuf ) ) ) ) {
+    return nullptr;
+  }
+  rpc_pool_list_used( &pool->iobufs );
+
+  struct rpc_iobuf* iob = new ( p ) rpc_iobuf();
+  iob->mem              = rpc_pool_alloc( pool, ZDR_UNIT + size, &iob->capacity );
+  if ( !iob->mem ) {
+    pool->iobufs.in_use--;
+    rpc_pool_list_push( &pool->iobufs, iob );
+    return nullptr;
+  }
+  iob->seg.data = iob->mem + ZDR_UNIT;
+  iob->seg.size = size;
+  iob->refs     = 1;
+  return iob;
+}
+
+void rpc_iobuf_get( struct rpc_iobuf* chain ) {
+  for ( struct rpc_iobuf* iob = chain; iob; iob = rpc_iobuf_next( iob ) ) {
+    iob->refs++;
+  }
+}
+
+void rpc_iobuf_put( struct rpc_pool* pool, struct rpc_iobuf* chain ) {
+  while ( chain ) {
+    struct rpc_iobuf* iob = chain;
+    chain                 = rpc_iobuf_next( iob );
+    if ( --iob->refs == 0 ) {
+      rpc_pool_free( pool, iob->mem, iob->capacity );
+      pool->iobufs.in_use--;
+      rpc_pool_list_push( &pool->iobufs, iob );
+    }
+  }
+}
+
+uint32_t rpc_iobuf_length( const struct rpc_iobuf* chain ) {
+  uint32_t len = 0;
+  for ( const struct rpc_iobuf* iob = chain; iob; iob = rpc_iobuf_next( iob ) ) {
+    len += iob->seg.size;
+  }
+  return len;
+}
+
+/*
+ * Keep no more cached objects than were needed on top of the current use
+ * at the high-water mark since the previous trim, and start a new period.
+ */
+static void rpc_pool_trim_list( struct rpc_pool* pool, struct rpc_pool_list* l, uint32_t size, bool all ) {
+  uint32_t keep = all ? 0 : l->hiwat - l->in_use;
+  void*    p;
+
+  while ( l->num_free > keep && ( p = rpc_pool_list_pop( l ) ) ) {
+    if ( size ) {
+      pool->stats.bytes_cached -= size;
+    }
+    pool->stats.num_trimmed++;
+    free( p );
+  }
+  l->hiwat = l->in_use;
+}
+
+void rpc_pool_trim( struct rpc_pool* pool, bool all ) {
+  for ( uint32_t i = 0; i < RPC_POOL_NUM_CLASSES; i++ ) {
+    rpc_pool_trim_list( pool, &pool->classes[ i ], rpc_pool_class_size( i ), all );
+  }
+  rpc_pool_trim_list( pool, &pool->pdus, 0, all );
+  rpc_pool_trim_list( pool, &pool->iobufs, 0, all );
+}
+
+void rpc_pool_destroy( struct rpc_pool* pool ) {
+  rpc_pool_trim( pool, true );
+}
+
+void rpc_set_max_xfer_size( struct rpc_context* rpc, uint32_t size ) {
+  rpc_pool_set_max_size( &rpc->pool, size + RPC_PDU_HEADER_ROOM );
+}
+
+void rpc_get_pool_stats( struct rpc_context* rpc, struct rpc_pool_stats* stats ) {
+  *stats = rpc->pool.stats;
+}
@@ -1,8 +1,14 @@
+#include <cerrno>
+#include <cstdarg>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <rpc.h>
 #include <rpc/auth.h>
 #include <string>
+#include <unistd.h>
 
 struct rpc_context* rpc_init_context( void ) {
   struct rpc_context* rpc;
@@ -14,18 +20,15 @@ struct rpc_context* rpc_init_context( void ) {
   }
 
   if ( !rpc_set_hash_size( rpc, DEFAULT_HASHES ) ) {
+    delete rpc;
     return nullptr;
   }
 
+  rpc_pool_init( &rpc->pool, NFS_DEF_XFER_SIZE + RPC_PDU_HEADER_ROOM );
+
   rpc->magic = RPC_CONTEXT_MAGIC;
   rpc->inpos = 0;
   rpc->state = READ_RM;
-  rpc->auth  = authunix_create_default();
-  if ( rpc->auth == nullptr ) {
-    delete rpc->waitpdu;
-    delete rpc;
-    return nullptr;
-  }
 
   rpc->xid =
     salt + (uint32_t) rpc_current_time() + ( (uint32_t) getpid() << 16 );
@@ -34,30 +37,36 @@ struct rpc_context* rpc_init_context( void ) {
   rpc->tcp_syncnt = RPC_PARAM_UNDEFINED;
   rpc->uid        = getuid();
   rpc->gid        = getgid();
+  if ( !rpc_get_auth( rpc ) ) {
+    rpc_pool_destroy( &rpc->pool );
+    rpc_hash_destroy( &rpc->waitpdu );
+    delete rpc;
+    return nullptr;
+  }
 
   rpc_reset_queue( &rpc->outqueue );
-  rpc->max_waitpdu_len = 0;
-  rpc->timeout         = 60 * 1000;
-  rpc->retrans         = 0;
-  rpc->poll_timeout    = 100;
+  rpc->max_waitpdu_len  = 0;
+  rpc->timeout          = 60 * 1000;
+  rpc->retrans          = 0;
+  rpc->adaptive_timeout = 1;
+  rpc->poll_timeout     = 100;
+  rpc_timer_init( &rpc->timers, rpc_current_time() );
 
   return rpc;
 }
 
+/*
+ * Size the pending-PDU table for roughly `hashes` requests in flight. The
+ * table grows on its own past that, this only avoids the early rehashes.
+ */
 bool rpc_set_hash_size( struct rpc_context* rpc, int hashes ) {
-  rpc->num_hashes = hashes;
-
-  delete rpc->waitpdu;
-  rpc->waitpdu = new rpc_queue[ rpc->num_hashes ]();
-  if ( !rpc->waitpdu ) {
+  if ( rpc->waitpdu_len ) {
     return false;
   }
+  rpc->num_hashes = hashes;
 
-  for ( uint32_t i = 0; i < rpc->num_hashes; i++ ) {
-    rpc_reset_queue( &rpc->waitpdu[ i ] );
-  }
-
-  return true;
+  rpc_hash_destroy( &rpc->waitpdu );
+  return rpc_hash_init( &rpc->waitpdu, 2 * rpc->num_hashes );
 }
 
 uint64_t rpc_current_time( void ) {
@@ -66,6 +75,13 @@ uint64_t rpc_current_time( void ) {
   return (uint64_t) tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
 }
 
+/* finer than rpc_current_time(), for round-trip times */
+uint64_t rpc_current_time_us( void ) {
+  struct timespec tp;
+  clock_gettime( CLOCK_MONOTONIC, &tp );
+  return (uint64_t) tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
+
 void rpc_reset_queue( struct rpc_queue* q ) {
   q->head = q->tail = nullptr;
 }
@@ -75,17 +91,134 @@ bool rpc_set_username( struct rpc_context* rpc, const std::string& username ) {
   return true;
 }
 
+void rpc_destroy_context( struct rpc_context* rpc ) {
+  if ( rpc->loop ) {
+    rpc_loop_remove( rpc->loop, rpc );
+  }
+  /* the kernel must be done with queued PDUs before they are freed */
+  rpc_uring_destroy( rpc );
+  rpc_error_all_pdus( rpc, RPC_STATUS_CANCEL, "Command was cancelled" );
+  if ( rpc->fd != -1 ) {
+    close( rpc->fd );
+    rpc->fd = -1;
+  }
+  rpc_free_fragments( rpc );
+  rpc_pool_destroy( &rpc->pool );
+
+  rpc_hash_destroy( &rpc->waitpdu );
+  rpc_free_creds( rpc );
+  rpc_reset_stats( &rpc->stats );
+  free( rpc->error_string );
+  free( rpc->server );
+  delete[] rpc->inbuf;
+  delete[] rpc->decode_scratch;
+  delete[] rpc->udp_buf;
+  rpc->magic = 0;
+  delete rpc;
+}
+
+static void rpc_vset_error( struct rpc_context* rpc, int err, const char* fmt, va_list ap ) {
+  char* str = nullptr;
+
+  if ( vasprintf( &str, fmt, ap ) < 0 ) {
+    str = nullptr;
+  }
+  free( rpc->error_string );
+  rpc->error_string = str;
+  rpc->error_errno  = err;
+}
+
+void rpc_set_error( struct rpc_context* rpc, const char* fmt, ... ) {
+  va_list ap;
+
+  va_start( ap, fmt );
+  rpc_vset_error( rpc, EIO, fmt, ap );
+  va_end( ap );
+}
+
+void rpc_set_error_errno( struct rpc_context* rpc, int err, const char* fmt, ... ) {
+  va_list ap;
+
+  va_start( ap, fmt );
+  rpc_vset_error( rpc, err, fmt, ap );
+  va_end( ap );
+}
+
+const char* rpc_get_error( struct rpc_context* rpc ) {
+  return rpc->error_string ? rpc->error_string : "";
+}
+
+/*
+ * The errno of the last error set, EIO unless rpc_set_error_errno() said
+ * better: a failed call returns -1 and this tells the caller why.
+ */
+int rpc_get_errno( struct rpc_context* rpc ) {
+  return rpc->error_errno ? rpc->error_errno : EIO;
+}
+
 void rpc_set_tcp_syncnt( struct rpc_context* rpc, int v ) {
+  rpc->tcp_syncnt = v;
 }
 
 void rpc_set_uid( struct rpc_context* rpc, int uid ) {
+  if ( rpc->uid != uid ) {
+    rpc->uid  = uid;
+    rpc->auth = nullptr; /* see rpc_get_auth() */
+  }
 }
 
 void rpc_set_gid( struct rpc_context* rpc, int gid ) {
+  if ( rpc->gid != gid ) {
+    rpc->gid  = gid;
+    rpc->auth = nullptr;
+  }
 }
 
 void rpc_set_debug( struct rpc_context* rpc, int level ) {
+  rpc->debug = level;
 }
 
 void rpc_set_timeout( struct rpc_context* rpc, int timeout_msecs ) {
+  rpc->timeout = timeout_msecs;
+}
+
+/*
+ * Times a call that got no reply within the timeout is sent again before it
+ * fails with RPC_STATUS_TIMEOUT, each time with a fresh timeout.
+ */
+void rpc_set_retrans( struct rpc_context* rpc, int retrans ) {
+  rpc->retrans = retrans > 0 ? retrans : 0;
+}
+
+/*
+ * With this on (the default), a call that may still be retransmitted waits
+ * for the estimated round-trip time of its rpc_rtt_class, see
+ * rpc_stats::rtt, doubled for every retransmit so far, instead of the full
+ * timeout. The last attempt always gets the full timeout.
+ */
+void rpc_set_adaptive_timeout( struct rpc_context* rpc, int enable ) {
+  rpc->adaptive_timeout = enable;
+}
+
+/*
+ * RPC_TRANSPORT_URING moves the socket I/O of the next connection onto
+ * io_uring, or leaves it on plain sockets if io_uring is not available;
+ * rpc_get_transport() tells which one the current connection uses.
+ */
+void rpc_set_transport( struct rpc_context* rpc, int transport ) {
+  rpc->transport = transport;
+}
+
+int rpc_get_transport( struct rpc_context* rpc ) {
+  return rpc->uring ? RPC_TRANSPORT_URING : RPC_TRANSPORT_SOCKET;
+}
+
+/*
+ * What to do when an established connection is lost: 0 fails every pending
+ * request (the default), -1 reconnects for as long as it takes and N gives
+ * up after N failed attempts. Unanswered requests are sent again once the
+ * connection is back.
+ */
+void rpc_set_autoreconnect( struct rpc_context* rpc, int num_retries ) {
+  rpc->auto_reconnect = num_retries;
 }
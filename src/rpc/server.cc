@@ -0,0 +1,621 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <poll.h>
+#include <queue>
+#include <random>
+#include <rpc.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/* record marker, xid, REPLY, MSG_ACCEPTED, AUTH_NONE verifier, accept_stat */
+#define RPC_REPLY_HEADER_SIZE 28
+
+/* uid and gid of calls without AUTH_UNIX credentials */
+#define RPC_NOBODY 65534
+
+/*
+ * One accepted connection. Its server context owns the socket and is only
+ * touched by the reader thread. Replies are sent by the workers and the
+ * delay thread through wfd, a dup() of that socket, so it stays valid for
+ * as long as a call still holds a reference to the connection.
+ */
+struct rpc_server_conn : std::enable_shared_from_this< rpc_server_conn > {
+  struct rpc_server*  srv;
+  struct rpc_context* rpc;
+  int                 wfd = -1;
+  std::mutex          write_mtx;
+  std::atomic< bool > done { false };
+  std::thread         reader;
+
+  ~rpc_server_conn() {
+    if ( wfd != -1 ) {
+      close( wfd );
+    }
+  }
+};
+
+/* A call waiting for a worker; record holds its arguments. */
+struct rpc_server_job {
+  std::shared_ptr< rpc_server_conn > conn;
+  struct rpc_call                    call;
+  rpc_service_fn                     fn;
+  void*                              private_data;
+  std::vector< char >                record;
+};
+
+/* A reply held back by rpc_server_set_latency() until due. */
+struct rpc_server_delayed {
+  uint64_t                           due;
+  std::shared_ptr< rpc_server_conn > conn;
+  std::vector< char >                data;
+};
+
+struct rpc_server_delayed_later {
+  bool operator()( const rpc_server_delayed* a, const rpc_server_delayed* b ) const { return a->due > b->due; }
+};
+
+typedef std::priority_queue< rpc_server_delayed*, std::vector< rpc_server_delayed* >, rpc_server_delayed_later >
+  rpc_server_delay_queue;
+
+/* Reply buffers of a worker thread. */
+struct rpc_server_worker {
+  std::unique_ptr< char[] > out;
+  std::unique_ptr< char[] > payload;
+  std::thread               th;
+};
+
+struct rpc_server {
+  int                  lfd;
+  int                  port;
+  int                  num_workers;
+  bool                 started;
+  struct rpc_endpoint* endpoints;
+  std::atomic< bool >  stop { false };
+
+  std::thread                                       acceptor;
+  std::mutex                                        conns_mtx;
+  std::vector< std::shared_ptr< rpc_server_conn > > conns;
+
+  std::vector< rpc_server_worker >     workers;
+  std::mutex                           jobs_mtx;
+  std::condition_variable              jobs_cv;
+  std::deque< struct rpc_server_job* > jobs;
+
+  /* fault injection */
+  std::atomic< uint32_t > latency_us { 0 };
+  std::atomic< uint32_t > jitter_us { 0 };
+  std::atomic< double >   loss { 0 };
+
+  std::thread             delayer;
+  std::mutex              delay_mtx;
+  std::condition_variable delay_cv;
+  rpc_server_delay_queue  delayed;
+
+  std::atomic< uint64_t > num_calls { 0 };
+  std::atomic< uint64_t > num_replies { 0 };
+  std::atomic< uint64_t > num_dropped { 0 };
+  std::atomic< uint64_t > num_rejected { 0 };
+  std::atomic< uint64_t > num_conns { 0 };
+};
+
+struct rpc_server* rpc_server_create( int port, int num_workers ) {
+  struct rpc_server* srv = new ( std::nothrow ) rpc_server();
+  if ( !srv ) {
+    return nullptr;
+  }
+  srv->num_workers = num_workers > 0 ? num_workers : RPC_SERVER_DEF_WORKERS;
+
+  struct sockaddr_in sin {};
+  socklen_t          len = sizeof( sin );
+  int                one = 1;
+  sin.sin_family         = AF_INET;
+  sin.sin_port           = htons( port );
+  sin.sin_addr.s_addr    = htonl( INADDR_LOOPBACK );
+
+  srv->lfd = socket( AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+  if ( srv->lfd < 0 ) {
+    delete srv;
+    return nullptr;
+  }
+  setsockopt( srv->lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof( one ) );
+  if ( bind( srv->lfd, (struct sockaddr*) &sin, sizeof( sin ) ) < 0
+       || listen( srv->lfd, 128 ) < 0
+       || getsockname( srv->lfd, (struct sockaddr*) &sin, &len ) < 0 ) {
+    close( srv->lfd );
+    delete srv;
+    return nullptr;
+  }
+  srv->port = ntohs( sin.sin_port );
+  return srv;
+}
+
+/*
+ * Serve procedures of program/version, procs[ i ] being looked up by its
+ * procedure number. Only before rpc_server_start().
+ */
+int rpc_server_register( struct rpc_server*             srv,
+                         uint32_t                       program,
+                         uint32_t                       version,
+                         const struct rpc_service_proc* procs,
+                         uint32_t                       num_procs,
+                         void*                          private_data ) {
+  if ( srv->started ) {
+    return -1;
+  }
+  struct rpc_endpoint* ep = new ( std::nothrow ) rpc_endpoint();
+  if ( !ep ) {
+    return -1;
+  }
+  ep->program      = program;
+  ep->version      = version;
+  ep->procs        = procs;
+  ep->num_procs    = num_procs;
+  ep->private_data = private_data;
+  ep->next         = srv->endpoints;
+  srv->endpoints   = ep;
+  return 0;
+}
+
+int rpc_server_get_port( struct rpc_server* srv ) {
+  return srv->port;
+}
+
+/*
+ * Hold every reply back for usecs plus up to jitter_usecs, chosen at
+ * random. Delayed replies wait on a separate thread, not on the workers, so
+ * the latency does not cap the throughput.
+ */
+void rpc_server_set_latency( struct rpc_server* srv, uint32_t usecs, uint32_t jitter_usecs ) {
+  srv->latency_us = usecs;
+  srv->jitter_us  = jitter_usecs;
+}
+
+/* Throw replies away with this probability, as if the network lost them. */
+void rpc_server_set_loss( struct rpc_server* srv, double probability ) {
+  srv->loss = probability;
+}
+
+void rpc_server_get_stats( struct rpc_server* srv, struct rpc_server_stats* stats ) {
+  stats->num_calls    = srv->num_calls;
+  stats->num_replies  = srv->num_replies;
+  stats->num_dropped  = srv->num_dropped;
+  stats->num_rejected = srv->num_rejected;
+  stats->num_conns    = srv->num_conns;
+}
+
+static std::minstd_rand& rpc_server_rng( void ) {
+  thread_local std::minstd_rand rng( std::random_device {}() );
+  return rng;
+}
+
+/*
+ * Blocking write on the non-blocking socket; replies from different
+ * threads must not interleave. Fails once the peer is gone, which the
+ * reader thread notices on its own.
+ */
+static bool rpc_server_write( struct rpc_server_conn* conn, struct iovec* iov, int iovcnt ) {
+  std::lock_guard< std::mutex > lock( conn->write_mtx );
+  struct msghdr                 msg {};
+  msg.msg_iov    = iov;
+  msg.msg_iovlen = iovcnt;
+
+  while ( msg.msg_iovlen ) {
+    ssize_t n = sendmsg( conn->wfd, &msg, MSG_NOSIGNAL );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+        struct pollfd pfd = { conn->wfd, POLLOUT, 0 };
+        poll( &pfd, 1, 1000 );
+        continue;
+      }
+      return false;
+    }
+    while ( msg.msg_iovlen && (size_t) n >= msg.msg_iov->iov_len ) {
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if ( msg.msg_iovlen ) {
+      msg.msg_iov->iov_base = (char*) msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+  return true;
+}
+
+/*
+ * Send a reply record: `len` bytes at buf, starting with the record marker,
+ * then an optional payload and its XDR padding. Loss and latency are
+ * applied here.
+ */
+static void rpc_server_send( struct rpc_server*                        srv,
+                             const std::shared_ptr< rpc_server_conn >& conn,
+                             char*                                     buf,
+                             uint32_t                                  len,
+                             const char*                               payload,
+                             uint32_t                                  payload_len ) {
+  static const char pad[ ZDR_UNIT ] = {};
+  uint32_t          padding         = ZDR_ROUNDUP( payload_len ) - payload_len;
+  std::minstd_rand& rng             = rpc_server_rng();
+  double            loss            = srv->loss.load( std::memory_order_relaxed );
+  uint32_t          delay           = srv->latency_us.load( std::memory_order_relaxed );
+  uint32_t          jitter          = srv->jitter_us.load( std::memory_order_relaxed );
+
+  zdr_put_u32( buf, 0x80000000u | ( len - 4 + payload_len + padding ) );
+  if ( loss > 0 && rng() < loss * std::minstd_rand::max() ) {
+    srv->num_dropped++;
+    return;
+  }
+  if ( jitter ) {
+    delay += rng() % ( jitter + 1 );
+  }
+
+  if ( delay ) {
+    rpc_server_delayed* d = new ( std::nothrow ) rpc_server_delayed();
+    if ( !d ) {
+      return;
+    }
+    d->due  = rpc_current_time_us() + delay;
+    d->conn = conn;
+    d->data.reserve( len + payload_len + padding );
+    d->data.insert( d->data.end(), buf, buf + len );
+    d->data.insert( d->data.end(), payload, payload + payload_len );
+    d->data.insert( d->data.end(), pad, pad + padding );
+    {
+      std::lock_guard< std::mutex > lock( srv->delay_mtx );
+      srv->delayed.push( d );
+    }
+    srv->delay_cv.notify_one();
+    return;
+  }
+
+  struct iovec iov[ 3 ] = { { buf, len }, { (char*) payload, payload_len }, { (char*) pad, padding } };
+  if ( rpc_server_write( conn.get(), iov, payload_len ? 3 : 1 ) ) {
+    srv->num_replies++;
+  }
+}
+
+/* A reply consisting of the header only, e.g. for an error accept_stat. */
+static void rpc_server_reject( struct rpc_server_conn* conn, uint32_t xid, const uint32_t* words, int num_words ) {
+  char     buf[ 64 ];
+  uint32_t len = 8;
+
+  zdr_put_u32( buf + 4, xid );
+  for ( int i = 0; i < num_words; i++, len += 4 ) {
+    zdr_put_u32( buf + len, words[ i ] );
+  }
+  conn->srv->num_rejected++;
+  rpc_server_send( conn->srv, conn->shared_from_this(), buf, len, nullptr, 0 );
+}
+
+static void rpc_server_reject_accepted( struct rpc_server_conn* conn, uint32_t xid, uint32_t stat, uint32_t low, uint32_t high ) {
+  uint32_t words[] = { RPC_MSG_REPLY, RPC_MSG_ACCEPTED, AUTH_NONE, 0, stat, low, high };
+  rpc_server_reject( conn, xid, words, stat == RPC_PROG_MISMATCH ? 7 : 5 );
+}
+
+/* Pick uid and gid out of AUTH_UNIX credentials. */
+static bool rpc_server_decode_authunix( struct rpc_call* call, char* cred, uint32_t len ) {
+  zdr_t    zdrs;
+  uint32_t stamp;
+  char*    machine;
+
+  zdrmem_create( &zdrs, cred, len, ZDR_DECODE );
+  return zdr_u_int( &zdrs, &stamp )
+         && zdr_string( &zdrs, &machine, 255 )
+         && zdr_u_int( &zdrs, &call->uid )
+         && zdr_u_int( &zdrs, &call->gid );
+}
+
+/*
+ * A call has been received on a server context: answer it right away if
+ * nothing serves it, else queue it for the workers. The arguments are copied,
+ * as inbuf is reused for the next record.
+ */
+int rpc_process_call( struct rpc_context* rpc, char* buf, uint32_t size ) {
+  struct rpc_server_conn* conn = rpc->server_conn;
+  struct rpc_server*      srv  = conn->srv;
+  struct rpc_call         call {};
+  zdr_t                   zdrs;
+  uint32_t                type, rpcvers, verf_flavor, cred_len, verf_len;
+  char *                  cred, *verf;
+
+  srv->num_calls++;
+  zdrmem_create( &zdrs, buf, size, ZDR_DECODE );
+  if ( !zdr_u_int( &zdrs, &call.xid ) || !zdr_u_int( &zdrs, &type )
+       || !zdr_u_int( &zdrs, &rpcvers ) || !zdr_u_int( &zdrs, &call.program )
+       || !zdr_u_int( &zdrs, &call.version ) || !zdr_u_int( &zdrs, &call.procedure )
+       || !zdr_u_int( &zdrs, &call.flavor ) || !zdr_bytes( &zdrs, &cred, &cred_len, RPC_MAX_AUTH_SIZE )
+       || !zdr_u_int( &zdrs, &verf_flavor ) || !zdr_bytes( &zdrs, &verf, &verf_len, RPC_MAX_AUTH_SIZE ) ) {
+    rpc_set_error( rpc, "Malformed RPC call of %u bytes", size );
+    return -1;
+  }
+
+  if ( rpcvers != RPC_MSG_VERSION ) {
+    uint32_t words[] = { RPC_MSG_REPLY, RPC_MSG_DENIED, RPC_MISMATCH, RPC_MSG_VERSION, RPC_MSG_VERSION };
+    rpc_server_reject( conn, call.xid, words, 5 );
+    return 0;
+  }
+  call.uid = call.gid = RPC_NOBODY;
+  if ( call.flavor == AUTH_UNIX && !rpc_server_decode_authunix( &call, cred, cred_len ) ) {
+    uint32_t words[] = { RPC_MSG_REPLY, RPC_MSG_DENIED, RPC_AUTH_ERROR, 1 /* AUTH_BADCRED */ };
+    rpc_server_reject( conn, call.xid, words, 4 );
+    return 0;
+  }
+
+  struct rpc_endpoint* ep;
+  uint32_t             low = UINT32_MAX, high = 0;
+  for ( ep = rpc->endpoints; ep; ep = ep->next ) {
+    if ( ep->program == call.program ) {
+      low  = std::min( low, ep->version );
+      high = std::max( high, ep->version );
+      if ( ep->version == call.version ) {
+        break;
+      }
+    }
+  }
+  if ( !ep ) {
+    uint32_t stat = low <= high ? RPC_PROG_MISMATCH : RPC_PROG_UNAVAIL;
+    rpc_server_reject_accepted( conn, call.xid, stat, low, high );
+    return 0;
+  }
+
+  /* tables are usually indexed by procedure number already */
+  const struct rpc_service_proc* proc = nullptr;
+  if ( call.procedure < ep->num_procs && ep->procs[ call.procedure ].procedure == call.procedure ) {
+    proc = &ep->procs[ call.procedure ];
+  } else {
+    for ( uint32_t i = 0; i < ep->num_procs && !proc; i++ ) {
+      if ( ep->procs[ i ].procedure == call.procedure ) {
+        proc = &ep->procs[ i ];
+      }
+    }
+  }
+  if ( !proc || !proc->fn ) {
+    rpc_server_reject_accepted( conn, call.xid, RPC_PROC_UNAVAIL, 0, 0 );
+    return 0;
+  }
+
+  struct rpc_server_job* job = new ( std::nothrow ) rpc_server_job();
+  if ( !job ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to queue call" );
+    return -1;
+  }
+  job->conn         = conn->shared_from_this();
+  job->call         = call;
+  job->fn           = proc->fn;
+  job->private_data = ep->private_data;
+  job->record.assign( buf + zdr_getpos( &zdrs ), buf + size );
+  {
+    std::lock_guard< std::mutex > lock( srv->jobs_mtx );
+    srv->jobs.push_back( job );
+  }
+  srv->jobs_cv.notify_one();
+  return 0;
+}
+
+static void rpc_server_run( struct rpc_server* srv, struct rpc_server_worker* w, struct rpc_server_job* job ) {
+  struct rpc_call* call = &job->call;
+  char*            out  = w->out.get();
+  zdr_t            args, res;
+
+  call->payload      = w->payload.get();
+  call->payload_size = NFS_MAX_XFER_SIZE;
+  zdrmem_create( &args, job->record.data(), job->record.size(), ZDR_DECODE );
+  zdrmem_create( &res, out + RPC_REPLY_HEADER_SIZE, RPC_MAX_PDU_SIZE - RPC_REPLY_HEADER_SIZE, ZDR_ENCODE );
+
+  uint32_t stat = job->fn( call, &args, &res, job->private_data );
+  if ( stat == RPC_SUCCESS && res.ext ) {
+    /* a payload was set but not encoded */
+    stat = RPC_SYSTEM_ERR;
+  }
+  if ( stat != RPC_SUCCESS ) {
+    rpc_server_reject_accepted( job->conn.get(), call->xid, stat, 0, 0 );
+    return;
+  }
+
+  uint32_t header[] = { call->xid, RPC_MSG_REPLY, RPC_MSG_ACCEPTED, AUTH_NONE, 0, RPC_SUCCESS };
+  for ( int i = 0; i < 6; i++ ) {
+    zdr_put_u32( out + 4 + i * 4, header[ i ] );
+  }
+  rpc_server_send( srv, job->conn, out, RPC_REPLY_HEADER_SIZE + zdr_getpos( &res ), call->payload, res.ext_len );
+}
+
+static void rpc_server_work( struct rpc_server* srv, struct rpc_server_worker* w ) {
+  for ( ;; ) {
+    struct rpc_server_job* job;
+    {
+      std::unique_lock< std::mutex > lock( srv->jobs_mtx );
+      srv->jobs_cv.wait( lock, [ srv ] { return srv->stop || !srv->jobs.empty(); } );
+      if ( srv->stop ) {
+        return;
+      }
+      job = srv->jobs.front();
+      srv->jobs.pop_front();
+    }
+    rpc_server_run( srv, w, job );
+    delete job;
+  }
+}
+
+static void rpc_server_delay( struct rpc_server* srv ) {
+  std::unique_lock< std::mutex > lock( srv->delay_mtx );
+  while ( !srv->stop ) {
+    if ( srv->delayed.empty() ) {
+      srv->delay_cv.wait( lock );
+      continue;
+    }
+    uint64_t now = rpc_current_time_us();
+    if ( srv->delayed.top()->due > now ) {
+      srv->delay_cv.wait_for( lock, std::chrono::microseconds( srv->delayed.top()->due - now ) );
+      continue;
+    }
+    rpc_server_delayed* d = srv->delayed.top();
+    srv->delayed.pop();
+    lock.unlock();
+
+    struct iovec iov = { d->data.data(), d->data.size() };
+    if ( rpc_server_write( d->conn.get(), &iov, 1 ) ) {
+      srv->num_replies++;
+    }
+    delete d;
+    lock.lock();
+  }
+}
+
+static void rpc_server_read( struct rpc_server_conn* conn ) {
+  struct rpc_server*  srv = conn->srv;
+  struct rpc_context* rpc = conn->rpc;
+
+  while ( !srv->stop && rpc->fd != -1 ) {
+    struct pollfd pfd = { rpc->fd, POLLIN, 0 };
+    if ( poll( &pfd, 1, rpc->poll_timeout ) > 0 ) {
+      rpc_service( rpc, pfd.revents );
+    }
+  }
+  conn->rpc = nullptr;
+  rpc_destroy_context( rpc );
+  conn->done = true;
+}
+
+/* join the reader threads of closed connections; conns_mtx is held */
+static void rpc_server_reap( struct rpc_server* srv ) {
+  for ( size_t i = 0; i < srv->conns.size(); ) {
+    if ( srv->conns[ i ]->done ) {
+      srv->conns[ i ]->reader.join();
+      srv->conns[ i ] = std::move( srv->conns.back() );
+      srv->conns.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+static void rpc_server_add_conn( struct rpc_server* srv, int fd ) {
+  std::shared_ptr< rpc_server_conn > conn( new ( std::nothrow ) rpc_server_conn() );
+  struct rpc_context*                rpc = rpc_init_context();
+  int                                one = 1;
+
+  if ( !conn || !rpc || ( conn->wfd = dup( fd ) ) < 0 ) {
+    if ( rpc ) {
+      rpc_destroy_context( rpc );
+    }
+    close( fd );
+    return;
+  }
+  setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+  rpc->fd                = fd;
+  rpc->is_connected      = 1;
+  rpc->is_nonblocking    = 1;
+  rpc->is_server_context = 1;
+  rpc->endpoints         = srv->endpoints;
+  rpc->server_conn       = conn.get();
+  conn->srv              = srv;
+  conn->rpc              = rpc;
+  conn->reader           = std::thread( rpc_server_read, conn.get() );
+  srv->num_conns++;
+
+  std::lock_guard< std::mutex > lock( srv->conns_mtx );
+  rpc_server_reap( srv );
+  srv->conns.push_back( std::move( conn ) );
+}
+
+static void rpc_server_accept( struct rpc_server* srv ) {
+  for ( ;; ) {
+    int fd = accept4( srv->lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+    if ( fd < 0 ) {
+      if ( errno == EINTR || errno == ECONNABORTED ) {
+        continue;
+      }
+      return;
+    }
+    if ( srv->stop ) {
+      close( fd );
+      return;
+    }
+    rpc_server_add_conn( srv, fd );
+  }
+}
+
+int rpc_server_start( struct rpc_server* srv ) {
+  if ( srv->started ) {
+    return -1;
+  }
+  srv->workers.resize( srv->num_workers );
+  for ( rpc_server_worker& w : srv->workers ) {
+    w.out.reset( new ( std::nothrow ) char[ RPC_MAX_PDU_SIZE ] );
+    w.payload.reset( new ( std::nothrow ) char[ NFS_MAX_XFER_SIZE ] );
+    if ( !w.out || !w.payload ) {
+      srv->workers.clear();
+      return -1;
+    }
+  }
+  srv->started = true;
+  for ( rpc_server_worker& w : srv->workers ) {
+    w.th = std::thread( rpc_server_work, srv, &w );
+  }
+  srv->delayer  = std::thread( rpc_server_delay, srv );
+  srv->acceptor = std::thread( rpc_server_accept, srv );
+  return 0;
+}
+
+void rpc_server_destroy( struct rpc_server* srv ) {
+  srv->stop = true;
+  if ( srv->started ) {
+    shutdown( srv->lfd, SHUT_RDWR );
+    srv->acceptor.join();
+
+    /* wakes the readers, and any worker blocked on a full socket */
+    for ( std::shared_ptr< rpc_server_conn >& conn : srv->conns ) {
+      shutdown( conn->wfd, SHUT_RDWR );
+    }
+    for ( std::shared_ptr< rpc_server_conn >& conn : srv->conns ) {
+      conn->reader.join();
+    }
+    srv->conns.clear();
+
+    {
+      std::lock_guard< std::mutex > lock( srv->jobs_mtx );
+    }
+    srv->jobs_cv.notify_all();
+    for ( rpc_server_worker& w : srv->workers ) {
+      w.th.join();
+    }
+    {
+      std::lock_guard< std::mutex > lock( srv->delay_mtx );
+    }
+    srv->delay_cv.notify_all();
+    srv->delayer.join();
+  }
+
+  for ( struct rpc_server_job* job : srv->jobs ) {
+    delete job;
+  }
+  while ( !srv->delayed.empty() ) {
+    delete srv->delayed.top();
+    srv->delayed.pop();
+  }
+  while ( srv->endpoints ) {
+    struct rpc_endpoint* ep = srv->endpoints;
+    srv->endpoints          = ep->next;
+    delete ep;
+  }
+  close( srv->lfd );
+  delete srv;
+}
@@ -0,0 +1,664 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <poll.h>
+#include <rpc.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+socklen_t rpc_sockaddr_len( const struct sockaddr_storage* s ) {
+  return s->ss_family == AF_INET6 ? sizeof( struct sockaddr_in6 ) : sizeof( struct sockaddr_in );
+}
+
+void rpc_free_fragments( struct rpc_context* rpc ) {
+  rpc_iobuf_put( &rpc->pool, rpc->fragments );
+  rpc->fragments     = nullptr;
+  rpc->last_fragment = nullptr;
+}
+
+/*
+ * Make inbuf at least `size` bytes, preserving its first `keep` bytes.
+ */
+static bool rpc_reserve_inbuf( struct rpc_context* rpc, uint32_t size, uint32_t keep = 0 ) {
+  if ( size <= rpc->inbuf_size ) {
+    return true;
+  }
+  char* buf = new ( std::nothrow ) char[ size ];
+  if ( !buf ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate %u byte input buffer", size );
+    return false;
+  }
+  if ( keep ) {
+    memcpy( buf, rpc->inbuf, keep );
+  }
+  delete[] rpc->inbuf;
+  rpc->inbuf      = buf;
+  rpc->inbuf_size = size;
+  return true;
+}
+
+/*
+ * Append an iobuf for the fragment whose marker has just been read, for
+ * rpc_read_from_socket() to receive it into.
+ */
+static int rpc_begin_fragment( struct rpc_context* rpc ) {
+  uint32_t total = rpc_iobuf_length( rpc->fragments );
+
+  if ( total + rpc->pdu_size > RPC_MAX_PDU_SIZE ) {
+    rpc_set_error( rpc, "RPC record of more than %u bytes", RPC_MAX_PDU_SIZE );
+    return -1;
+  }
+  struct rpc_iobuf* iob = rpc_iobuf_alloc( &rpc->pool, rpc->pdu_size );
+  if ( !iob ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate fragment" );
+    return -1;
+  }
+  if ( rpc->last_fragment ) {
+    rpc->last_fragment->seg.next = &iob->seg;
+  } else {
+    rpc->fragments = iob;
+  }
+  rpc->last_fragment = iob;
+  rpc->buf           = iob->seg.data;
+  rpc->inpos         = 0;
+  return 0;
+}
+
+/*
+ * The last fragment is in: hand the chain to the decoder, or for a server
+ * gather it into inbuf, as the arguments of a call are copied out anyway.
+ */
+static int rpc_finish_fragments( struct rpc_context* rpc ) {
+  struct rpc_iobuf* chain = rpc->fragments;
+  int               ret;
+
+  rpc->fragments     = nullptr;
+  rpc->last_fragment = nullptr;
+  if ( rpc->is_server_context ) {
+    uint32_t size = rpc_iobuf_length( chain );
+    zdr_t    zdrs;
+    ret = -1;
+    if ( rpc_reserve_inbuf( rpc, size ) ) {
+      zdr_chain_create( &zdrs, &chain->seg );
+      zdr_gather( &zdrs, rpc->inbuf, size );
+      ret = rpc_process_pdu( rpc, rpc->inbuf, size );
+    }
+  } else {
+    ret = rpc_process_iobuf( rpc, chain );
+  }
+  rpc_iobuf_put( &rpc->pool, chain );
+  return ret;
+}
+
+/*
+ * The record marker has been read, plus the xid if this is a single-fragment
+ * record. A reply whose PDU wants its payload in indata is taken out of the
+ * waitpdu table (so a timeout cannot free it from under the receive) and
+ * only its header is read into inbuf for now.
+ */
+static int rpc_begin_record( struct rpc_context* rpc ) {
+  struct rpc_pdu* pdu = nullptr;
+  uint32_t        want;
+
+  if ( rpc->inpos == 8 ) {
+    pdu = rpc_find_waitpdu( rpc, ntohl( rpc->rm_xid[ 1 ] ) );
+  }
+  if ( pdu && pdu->indata.data && rpc->pdu_size > RPC_IOVEC_HEADER_SIZE ) {
+    rpc->pdu = rpc_remove_waitpdu( rpc, pdu->xid );
+    want     = RPC_IOVEC_HEADER_SIZE;
+  } else {
+    want = rpc->pdu_size;
+  }
+  if ( !rpc_reserve_inbuf( rpc, want ) ) {
+    return -1;
+  }
+  if ( rpc->inpos == 8 ) {
+    memcpy( rpc->inbuf, &rpc->rm_xid[ 1 ], 4 );
+  }
+  rpc->inpos = rpc->inpos - 4;
+  return 0;
+}
+
+/*
+ * The header of a reply to rpc->pdu is in inbuf. If the payload can be
+ * located, switch to READ_IOVEC so the rest of it is received directly into
+ * indata; otherwise put the PDU back and read the record as usual.
+ */
+static int rpc_begin_iovec( struct rpc_context* rpc ) {
+  struct rpc_pdu* pdu   = rpc->pdu;
+  uint64_t        start = rpc_current_time_us();
+  uint32_t        len, have;
+
+  if ( rpc_decode_iovec_reply( rpc, pdu, rpc->inbuf, rpc->inpos, &len, &have )
+       && len - have <= rpc->pdu_size - rpc->inpos ) {
+    pdu->decode_us  = rpc_current_time_us() - start;
+    pdu->reply_size = rpc->pdu_size;
+    rpc->buf        = pdu->indata.data + have;
+    rpc->iov_len    = len - have;
+    rpc->pdu_size   = rpc->pdu_size - rpc->iov_len;
+    rpc->state      = READ_IOVEC;
+    return rpc_reserve_inbuf( rpc, rpc->pdu_size, rpc->inpos ) ? 0 : -1;
+  }
+
+  rpc->pdu = nullptr;
+  if ( !rpc_add_waitpdu( rpc, pdu ) ) {
+    rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to track pdu" );
+    rpc_free_pdu( rpc, pdu );
+    return -1;
+  }
+  return rpc_reserve_inbuf( rpc, rpc->pdu_size, rpc->inpos ) ? 0 : -1;
+}
+
+static void rpc_finish_iovec( struct rpc_context* rpc ) {
+  struct rpc_pdu* pdu = rpc->pdu;
+
+  rpc->pdu = nullptr;
+  rpc_pdu_replied( rpc, pdu, pdu->reply_size );
+  rpc_stats_decoded( rpc, pdu, pdu->decode_us, true );
+  pdu->cb( rpc, RPC_STATUS_SUCCESS, rpc->decode_buf, pdu->private_data );
+  rpc_free_pdu( rpc, pdu );
+}
+
+/*
+ * Drain the socket. The edge-triggered loop only reports readiness once, so
+ * this keeps going until the kernel says EAGAIN.
+ */
+int rpc_read_from_socket( struct rpc_context* rpc ) {
+  if ( rpc->is_udp ) {
+    return rpc_read_from_udp( rpc );
+  }
+  for ( ;; ) {
+    struct iovec iov[ 2 ];
+    int          iovcnt = 1;
+    uint32_t     limit;
+
+    switch ( rpc->state ) {
+      case READ_RM:
+        limit    = rpc->inpos < 4 ? 4 : 8;
+        iov[ 0 ] = { (char*) rpc->rm_xid + rpc->inpos, limit - rpc->inpos };
+        break;
+      case READ_FRAGMENT:
+        limit    = rpc->pdu_size;
+        iov[ 0 ] = { rpc->buf + rpc->inpos, limit - rpc->inpos };
+        break;
+      case READ_IOVEC:
+        /* the payload, then whatever follows it (XDR padding) */
+        limit    = rpc->pdu_size;
+        iov[ 0 ] = { rpc->buf, rpc->iov_len };
+        iov[ 1 ] = { rpc->inbuf + rpc->inpos, limit - rpc->inpos };
+        iovcnt   = 2;
+        break;
+      default:
+        limit    = rpc->pdu && rpc->inpos < RPC_IOVEC_HEADER_SIZE ? RPC_IOVEC_HEADER_SIZE : rpc->pdu_size;
+        iov[ 0 ] = { rpc->inbuf + rpc->inpos, limit - rpc->inpos };
+        break;
+    }
+
+    size_t  want = iov[ 0 ].iov_len + ( iovcnt > 1 ? iov[ 1 ].iov_len : 0 );
+    ssize_t n    = 0;
+    if ( want && rpc->uring ) {
+      n = rpc_uring_readv( rpc, iov, iovcnt );
+    } else if ( want ) {
+      rpc_stat_add( &rpc->stats.num_syscalls, 1 );
+      n = readv( rpc->fd, iov, iovcnt );
+    }
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+        return 0;
+      }
+      rpc_set_error_errno( rpc, errno, "Read from socket failed: %s", strerror( errno ) );
+      return -1;
+    }
+    if ( n == 0 && want ) {
+      rpc_set_error( rpc, "Peer closed connection" );
+      return -1;
+    }
+    if ( rpc->state == READ_IOVEC ) {
+      uint32_t k = (uint32_t) n < rpc->iov_len ? (uint32_t) n : rpc->iov_len;
+      rpc->buf += k;
+      rpc->iov_len -= k;
+      n -= k;
+    }
+    rpc->inpos += n;
+    if ( rpc->inpos < limit || rpc->iov_len ) {
+      continue;
+    }
+
+    if ( rpc->state == READ_RM ) {
+      if ( rpc->inpos == 4 ) {
+        uint32_t rm   = ntohl( rpc->rm_xid[ 0 ] );
+        bool     last = rm & 0x80000000;
+        rpc->pdu_size = rm & 0x7fffffff;
+        if ( rpc->pdu_size > RPC_MAX_PDU_SIZE ) {
+          rpc_set_error( rpc, "RPC record of %u bytes is too large", rpc->pdu_size );
+          return -1;
+        }
+        rpc->state = last && !rpc->fragments ? READ_PAYLOAD : READ_FRAGMENT;
+        /* peek at the xid of a complete record before reading its body */
+        if ( rpc->state == READ_PAYLOAD && rpc->pdu_size >= 4 ) {
+          rpc->state = READ_RM;
+          continue;
+        }
+      } else {
+        rpc->state = READ_PAYLOAD;
+      }
+      if ( ( rpc->state == READ_FRAGMENT ? rpc_begin_fragment( rpc ) : rpc_begin_record( rpc ) ) < 0 ) {
+        return -1;
+      }
+      continue;
+    }
+
+    if ( rpc->state == READ_PAYLOAD && rpc->pdu && rpc->inpos == RPC_IOVEC_HEADER_SIZE ) {
+      if ( rpc_begin_iovec( rpc ) < 0 ) {
+        return -1;
+      }
+      continue;
+    }
+
+    if ( rpc->state == READ_FRAGMENT ) {
+      rpc->state = READ_RM;
+      rpc->inpos = 0;
+      if ( !( ntohl( rpc->rm_xid[ 0 ] ) & 0x80000000 ) ) {
+        continue;
+      }
+      if ( rpc_finish_fragments( rpc ) < 0 ) {
+        return -1;
+      }
+      if ( rpc->fd == -1 ) {
+        return 0;
+      }
+      continue;
+    }
+
+    bool iovec = rpc->state == READ_IOVEC;
+    rpc->state = READ_RM;
+    rpc->inpos = 0;
+    if ( iovec ) {
+      rpc_finish_iovec( rpc );
+    } else if ( rpc_process_pdu( rpc, rpc->inbuf, rpc->pdu_size ) < 0 ) {
+      return -1;
+    }
+    /* the callback may have torn the connection down */
+    if ( rpc->fd == -1 ) {
+      return 0;
+    }
+  }
+}
+
+static inline uint32_t rpc_pdu_wire_size( const struct rpc_pdu* pdu ) {
+  return pdu->outdata.size + ZDR_ROUNDUP( pdu->outpayload.size );
+}
+
+/*
+ * Append what is left of `pdu` to iov: the unsent part of outdata, then the
+ * payload and its padding. Returns the number of entries used.
+ */
+int rpc_pdu_iov( const struct rpc_pdu* pdu, struct iovec* iov ) {
+  static const char zeroes[ ZDR_UNIT ] {};
+  uint32_t          off    = pdu->written;
+  uint32_t          len    = pdu->outpayload.size;
+  uint32_t          pad    = ZDR_ROUNDUP( len ) - len;
+  int               iovcnt = 0;
+
+  if ( off < (uint32_t) pdu->outdata.size ) {
+    iov[ iovcnt++ ] = { pdu->outdata.data + off, pdu->outdata.size - off };
+    off             = 0;
+  } else {
+    off -= pdu->outdata.size;
+  }
+  if ( off < len ) {
+    iov[ iovcnt++ ] = { pdu->outpayload.data + off, len - off };
+    off             = 0;
+  } else {
+    off -= len;
+  }
+  if ( off < pad ) {
+    iov[ iovcnt++ ] = { (char*) zeroes + off, pad - off };
+  }
+  return iovcnt;
+}
+
+/* retire every PDU at the head of the outqueue that `n` more bytes complete */
+void rpc_retire_written( struct rpc_context* rpc, size_t n ) {
+  struct rpc_pdu* pdu;
+
+  while ( ( pdu = rpc->outqueue.head ) ) {
+    uint32_t left = rpc_pdu_wire_size( pdu ) - pdu->written;
+    if ( n < left ) {
+      pdu->written += n;
+      return;
+    }
+    n -= left;
+    pdu->flags &= ~PDU_SENDING;
+    rpc->outqueue.head = pdu->next;
+    if ( !rpc->outqueue.head ) {
+      rpc->outqueue.tail = nullptr;
+    }
+    rpc_pdu_sent( rpc, pdu );
+  }
+}
+
+/*
+ * Flush the outqueue, gathering as many PDUs as fit in RPC_MAX_IOVECS into
+ * each sendmsg() so a burst of small requests costs one system call. With
+ * io_uring the sends are only prepared, see rpc_uring_submit().
+ */
+int rpc_write_to_socket( struct rpc_context* rpc ) {
+  struct iovec iov[ RPC_MAX_IOVECS ];
+
+  if ( rpc->uring ) {
+    return rpc_uring_write( rpc );
+  }
+  if ( rpc->is_udp ) {
+    return rpc_write_to_udp( rpc );
+  }
+  while ( rpc->outqueue.head && !rpc->write_blocked ) {
+    struct msghdr msg {};
+    int           iovcnt = 0;
+
+    for ( struct rpc_pdu* pdu = rpc->outqueue.head; pdu && iovcnt + 3 <= RPC_MAX_IOVECS; pdu = pdu->next ) {
+      iovcnt += rpc_pdu_iov( pdu, iov + iovcnt );
+    }
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = iovcnt;
+
+    rpc_stat_add( &rpc->stats.num_syscalls, 1 );
+    ssize_t n = sendmsg( rpc->fd, &msg, MSG_NOSIGNAL );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+        rpc->write_blocked = true;
+        return 0;
+      }
+      rpc_set_error_errno( rpc, errno, "Write to socket failed: %s", strerror( errno ) );
+      return -1;
+    }
+    rpc_retire_written( rpc, n );
+  }
+  return 0;
+}
+
+static int rpc_connect_sockaddr( struct rpc_context* rpc ) {
+  int fd = socket( rpc->s.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  if ( fd < 0 ) {
+    rpc_set_error_errno( rpc, errno, "Failed to open socket: %s", strerror( errno ) );
+    return -1;
+  }
+
+  int one = 1;
+  setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+  if ( rpc->tcp_syncnt != RPC_PARAM_UNDEFINED ) {
+    setsockopt( fd, IPPROTO_TCP, TCP_SYNCNT, &rpc->tcp_syncnt, sizeof( rpc->tcp_syncnt ) );
+  }
+  if ( rpc->ifname[ 0 ] ) {
+    setsockopt( fd, SOL_SOCKET, SO_BINDTODEVICE, rpc->ifname, strlen( rpc->ifname ) );
+  }
+
+  if ( connect( fd, (struct sockaddr*) &rpc->s, rpc_sockaddr_len( &rpc->s ) ) < 0
+       && errno != EINPROGRESS ) {
+    rpc_set_error_errno( rpc, errno, "connect() to server %s failed: %s", rpc->server, strerror( errno ) );
+    close( fd );
+    return -1;
+  }
+
+  int old_fd          = rpc_get_fd( rpc );
+  rpc->fd             = fd;
+  rpc->is_nonblocking = 1;
+  rpc->state          = READ_RM;
+  rpc->inpos          = 0;
+
+  /* without io_uring support this quietly stays a plain socket */
+  if ( rpc->transport == RPC_TRANSPORT_URING && rpc_uring_create( rpc ) == 0 && rpc_uring_poll_connect( rpc ) < 0 ) {
+    rpc_uring_destroy( rpc );
+  }
+  return rpc_loop_update_fd( rpc, old_fd );
+}
+
+int rpc_connect_async( struct rpc_context* rpc,
+                       const char*         server,
+                       int                 port,
+                       rpc_cb              cb,
+                       void*               private_data ) {
+  struct addrinfo  hints {};
+  struct addrinfo* ai;
+  std::string      service = std::to_string( port );
+
+  if ( rpc->fd != -1 ) {
+    rpc_set_error_errno( rpc, EISCONN, "Trying to connect while already connected" );
+    return -1;
+  }
+
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int err           = getaddrinfo( server, service.c_str(), &hints, &ai );
+  if ( err ) {
+    rpc_set_error_errno( rpc, EINVAL, "Invalid address:%s. Can not resolve into IPv4/v6: %s", server, gai_strerror( err ) );
+    return -1;
+  }
+  memset( &rpc->s, 0, sizeof( rpc->s ) );
+  memcpy( &rpc->s, ai->ai_addr, ai->ai_addrlen );
+  freeaddrinfo( ai );
+
+  free( rpc->server );
+  rpc->server       = strdup( server );
+  rpc->connect_cb   = cb;
+  rpc->connect_data = private_data;
+
+  return rpc_connect_sockaddr( rpc );
+}
+
+static void rpc_close_socket( struct rpc_context* rpc ) {
+  if ( rpc->fd != -1 ) {
+    int old_fd = rpc_get_fd( rpc );
+    int fd     = rpc->fd;
+    rpc_uring_destroy( rpc );
+    rpc->fd = -1;
+    rpc_loop_update_fd( rpc, old_fd );
+    close( fd );
+  }
+  rpc->is_connected  = 0;
+  rpc->write_blocked = false;
+  rpc->state         = READ_RM;
+  rpc->inpos        = 0;
+  rpc->iov_len      = 0;
+  rpc_free_fragments( rpc );
+}
+
+void rpc_disconnect( struct rpc_context* rpc, const char* error ) {
+  std::string msg = error ? error : "Disconnected";
+
+  rpc_close_socket( rpc );
+  rpc->is_reconnecting = 0;
+  rpc_error_all_pdus( rpc, RPC_STATUS_ERROR, msg.c_str() );
+}
+
+/*
+ * Start the next reconnect attempt, or give up and fail everything once
+ * auto_reconnect attempts have been made. A failed attempt is retried from
+ * rpc_service() after an exponential back-off.
+ */
+static void rpc_try_reconnect( struct rpc_context* rpc ) {
+  if ( rpc->auto_reconnect > 0 && rpc->reconnect_attempts >= rpc->auto_reconnect ) {
+    std::string msg = std::string( "Reconnect failed: " ) + rpc_get_error( rpc );
+    rpc_disconnect( rpc, msg.c_str() );
+    return;
+  }
+
+  int shift         = std::min( rpc->reconnect_attempts++, 6 );
+  rpc->reconnect_at = rpc_current_time()
+                    + std::min( RPC_RECONNECT_MIN_DELAY << shift, RPC_RECONNECT_MAX_DELAY );
+  if ( rpc_connect_sockaddr( rpc ) < 0 ) {
+    rpc_close_socket( rpc );
+    /* without a socket nothing else wakes the loop for the next attempt */
+    rpc_loop_service_by( rpc, rpc->reconnect_at );
+  }
+}
+
+/*
+ * The connection failed under us. With auto_reconnect set, unanswered
+ * requests are kept and sent again on a new connection; otherwise they
+ * all fail with `error`.
+ */
+void rpc_socket_error( struct rpc_context* rpc, const char* error ) {
+  if ( !rpc->auto_reconnect || !rpc->server ) {
+    rpc_disconnect( rpc, error );
+    return;
+  }
+
+  rpc_set_error( rpc, "%s", error );
+  rpc_close_socket( rpc );
+  if ( !rpc->is_reconnecting ) {
+    rpc->is_reconnecting    = 1;
+    rpc->reconnect_attempts = 0;
+    rpc->reconnect_at       = 0;
+    rpc_stat_add( &rpc->stats.num_reconnects, 1 );
+  }
+  rpc_requeue_pending_pdus( rpc );
+  if ( rpc_current_time() >= rpc->reconnect_at ) {
+    rpc_try_reconnect( rpc );
+  } else {
+    rpc_loop_service_by( rpc, rpc->reconnect_at );
+  }
+}
+
+/* the fd to wait on: the socket, or with io_uring the ring */
+int rpc_get_fd( struct rpc_context* rpc ) {
+  return rpc->uring ? rpc_uring_fd( rpc ) : rpc->fd;
+}
+
+int rpc_which_events( struct rpc_context* rpc ) {
+  if ( rpc->fd == -1 ) {
+    return 0;
+  }
+  /* completions are POLLIN on the ring, POLLOUT when there is work to submit */
+  if ( rpc->uring ) {
+    return POLLIN | ( rpc_uring_pending( rpc ) ? POLLOUT : 0 );
+  }
+  /* a pending connect completes with POLLOUT */
+  return POLLIN | ( !rpc->is_connected || ( rpc->outqueue.head && !rpc->corked ) ? POLLOUT : 0 );
+}
+
+static int rpc_finish_connect( struct rpc_context* rpc ) {
+  int       err = 0;
+  socklen_t len = sizeof( err );
+
+  if ( getsockopt( rpc->fd, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 ) {
+    err = errno;
+  }
+  if ( err ) {
+    rpc_set_error_errno( rpc, err, "connect() to server %s failed: %s", rpc->server, strerror( err ) );
+    if ( rpc->is_reconnecting ) {
+      rpc_socket_error( rpc, rpc_get_error( rpc ) );
+      return -1;
+    }
+    std::string msg = rpc_get_error( rpc );
+    if ( rpc->connect_cb ) {
+      rpc->connect_cb( rpc, RPC_STATUS_ERROR, (void*) msg.c_str(), rpc->connect_data );
+    }
+    rpc_disconnect( rpc, msg.c_str() );
+    return -1;
+  }
+
+  rpc->is_connected = 1;
+  if ( rpc->is_reconnecting ) {
+    /* the requeued PDUs go out below, nobody is waiting for the connect */
+    rpc->is_reconnecting = 0;
+    return 0;
+  }
+  if ( rpc->connect_cb ) {
+    rpc->connect_cb( rpc, RPC_STATUS_SUCCESS, nullptr, rpc->connect_data );
+  }
+  return 0;
+}
+
+/*
+ * Process `revents` (POLLIN/POLLOUT/POLLERR/POLLHUP, as returned by poll()
+ * or epoll) for this context, then run the timeout scan. Calling it with
+ * revents == 0 only does the latter, and starts a due reconnect attempt;
+ * event loops must keep doing so while rpc_get_fd() is -1.
+ */
+int rpc_service( struct rpc_context* rpc, int revents ) {
+  if ( rpc->fd == -1 && rpc->is_reconnecting && rpc_current_time() >= rpc->reconnect_at ) {
+    rpc_try_reconnect( rpc );
+  }
+
+  /* with io_uring, completions stand in for readiness */
+  if ( rpc->uring ) {
+    revents = rpc_uring_reap( rpc );
+  }
+
+  if ( rpc->fd != -1 && !rpc->is_connected && ( revents & ( POLLOUT | POLLERR | POLLHUP ) ) ) {
+    if ( rpc_finish_connect( rpc ) < 0 ) {
+      return -1;
+    }
+  }
+
+  if ( rpc->fd != -1 && rpc->is_connected && ( revents & POLLIN ) ) {
+    if ( rpc_read_from_socket( rpc ) < 0 ) {
+      rpc_socket_error( rpc, rpc_get_error( rpc ) );
+      return -1;
+    }
+  }
+
+  /* a UDP socket has no peer to lose */
+  if ( rpc->fd != -1 && rpc->is_connected && !rpc->is_udp && ( revents & ( POLLERR | POLLHUP ) ) ) {
+    rpc_socket_error( rpc, revents & POLLERR ? "Socket error" : "Peer closed connection" );
+    return -1;
+  }
+
+  if ( revents & POLLOUT ) {
+    rpc->write_blocked = false;
+  }
+  if ( rpc->fd != -1 && rpc->is_connected && !rpc->corked && rpc->outqueue.head && !rpc->write_blocked ) {
+    if ( rpc_write_to_socket( rpc ) < 0 ) {
+      rpc_socket_error( rpc, rpc_get_error( rpc ) );
+      return -1;
+    }
+  }
+
+  rpc_timeout_scan( rpc );
+  if ( rpc->uring && rpc_uring_submit( rpc ) < 0 ) {
+    rpc_socket_error( rpc, rpc_get_error( rpc ) );
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Hold queued PDUs back until the matching rpc_uncork(), so a burst of
+ * requests leaves in as few sendmsg() calls as possible. Nests.
+ */
+void rpc_cork( struct rpc_context* rpc ) {
+  rpc->corked++;
+}
+
+void rpc_uncork( struct rpc_context* rpc ) {
+  if ( rpc->corked > 0 && --rpc->corked == 0 && rpc->is_connected ) {
+    if ( rpc_write_to_socket( rpc ) < 0 || ( rpc->uring && rpc_uring_submit( rpc ) < 0 ) ) {
+      rpc_socket_error( rpc, rpc_get_error( rpc ) );
+    }
+  }
+}
+
+int rpc_queue_length( struct rpc_context* rpc ) {
+  int n = rpc->waitpdu.count;
+  for ( struct rpc_pdu* pdu = rpc->outqueue.head; pdu; pdu = pdu->next ) {
+    n++;
+  }
+  return n;
+}
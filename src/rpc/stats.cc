@@ -0,0 +1,298 @@
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <rpc/rpc.h>
+#include <string>
+
+/*
+ * Per-procedure counters and latency histograms.
+ *
+ * Only the thread servicing a context records into its stats, so an update
+ * (rpc_stat_add() and rpc_stat_set(), for every word of struct rpc_stats)
+ * is a plain read-modify-write whose store is a relaxed atomic: no lock
+ * prefix, no retry loop. Readers on other threads load each word relaxed and
+ * may see a call counted in one histogram and not yet in the next, which is
+ * fine for monitoring. At about 4 KB a procedure, histograms are allocated
+ * on its first reply and published with a release store, so that a context
+ * only pays for the procedures it uses.
+ */
+
+static inline uint64_t rpc_stat_load( const uint64_t* v ) {
+  return __atomic_load_n( v, __ATOMIC_RELAXED );
+}
+
+static uint32_t rpc_histogram_bucket( uint64_t v ) {
+  if ( v < RPC_HIST_SUB ) {
+    return (uint32_t) v;
+  }
+  int      msb = 63 - __builtin_clzll( v );
+  uint32_t idx = ( ( msb - RPC_HIST_SUB_BITS + 1 ) << RPC_HIST_SUB_BITS ) + ( ( v >> ( msb - RPC_HIST_SUB_BITS ) ) & ( RPC_HIST_SUB - 1 ) );
+  return idx < RPC_HIST_BUCKETS ? idx : RPC_HIST_BUCKETS - 1;
+}
+
+/* smallest value that goes to bucket `idx` */
+static uint64_t rpc_histogram_lower( uint32_t idx ) {
+  if ( idx < RPC_HIST_SUB ) {
+    return idx;
+  }
+  return (uint64_t) ( RPC_HIST_SUB + ( idx & ( RPC_HIST_SUB - 1 ) ) ) << ( ( idx >> RPC_HIST_SUB_BITS ) - 1 );
+}
+
+static void rpc_histogram_add( struct rpc_histogram* h, uint64_t v ) {
+  rpc_stat_add( &h->count, 1 );
+  rpc_stat_add( &h->sum, v );
+  rpc_stat_add( &h->buckets[ rpc_histogram_bucket( v ) ], 1 );
+  if ( v > h->max ) {
+    __atomic_store_n( &h->max, v, __ATOMIC_RELAXED );
+  }
+}
+
+uint64_t rpc_histogram_percentile( const struct rpc_histogram* h, double p ) {
+  uint64_t count = rpc_stat_load( &h->count );
+  uint64_t max   = rpc_stat_load( &h->max );
+  uint64_t want  = (uint64_t) ( p * count + 0.999999 );
+  uint64_t seen  = 0;
+
+  if ( !count ) {
+    return 0;
+  }
+  for ( uint32_t i = 0; i < RPC_HIST_BUCKETS - 1; i++ ) {
+    seen += rpc_stat_load( &h->buckets[ i ] );
+    if ( seen >= want ) {
+      uint64_t upper = rpc_histogram_lower( i + 1 ) - 1;
+      return upper < max ? upper : max;
+    }
+  }
+  return max;
+}
+
+static struct rpc_proc_stats* rpc_proc_stats( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  return pdu->procedure < RPC_STATS_NUM_PROCS ? &rpc->stats.procs[ pdu->procedure ] : nullptr;
+}
+
+static const struct rpc_histogram* rpc_proc_latency( const struct rpc_proc_stats* ps ) {
+  return __atomic_load_n( &ps->latency, __ATOMIC_ACQUIRE );
+}
+
+/* latencies go unrecorded if the histograms can not be allocated */
+static struct rpc_histogram* rpc_proc_latency_alloc( struct rpc_proc_stats* ps ) {
+  struct rpc_histogram* h = ps->latency;
+  if ( !h && ( h = new ( std::nothrow ) rpc_histogram[ RPC_LAT_NUM ]() ) ) {
+    __atomic_store_n( &ps->latency, h, __ATOMIC_RELEASE );
+  }
+  return h;
+}
+
+/* each time `pdu` has been written out */
+void rpc_stats_sent( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  struct rpc_proc_stats* ps = rpc_proc_stats( rpc, pdu );
+  if ( ps ) {
+    rpc_stat_add( &ps->bytes_sent, pdu->outdata.size + ZDR_ROUNDUP( pdu->outpayload.size ) );
+  }
+}
+
+/* its reply of `size` bytes has been received at `now` */
+void rpc_stats_replied( struct rpc_context* rpc, struct rpc_pdu* pdu, uint32_t size, uint64_t now ) {
+  struct rpc_proc_stats* ps = rpc_proc_stats( rpc, pdu );
+  if ( ps ) {
+    rpc_stat_add( &ps->bytes_rcvd, size );
+    struct rpc_histogram* h = rpc_proc_latency_alloc( ps );
+    if ( h ) {
+      rpc_histogram_add( &h[ RPC_LAT_QUEUE ], pdu->sent_at - pdu->queued_at );
+      rpc_histogram_add( &h[ RPC_LAT_WIRE ], now - pdu->sent_at );
+    }
+  }
+}
+
+/* and decoded, in `decode_us`, just before its callback runs */
+void rpc_stats_decoded( struct rpc_context* rpc, struct rpc_pdu* pdu, uint32_t decode_us, bool ok ) {
+  struct rpc_proc_stats* ps = rpc_proc_stats( rpc, pdu );
+  if ( ps ) {
+    rpc_stat_add( ok ? &ps->ops : &ps->errors, 1 );
+    struct rpc_histogram* h = rpc_proc_latency_alloc( ps );
+    if ( h ) {
+      rpc_histogram_add( &h[ RPC_LAT_DECODE ], decode_us );
+      rpc_histogram_add( &h[ RPC_LAT_TOTAL ], rpc_current_time_us() - pdu->queued_at );
+    }
+  }
+}
+
+/* `pdu` timed out */
+void rpc_stats_failed( struct rpc_context* rpc, struct rpc_pdu* pdu ) {
+  struct rpc_proc_stats* ps = rpc_proc_stats( rpc, pdu );
+  if ( ps ) {
+    rpc_stat_add( &ps->errors, 1 );
+  }
+}
+
+static void rpc_merge_histogram( struct rpc_histogram* dst, const struct rpc_histogram* src ) {
+  uint64_t max = rpc_stat_load( &src->max );
+
+  dst->count += rpc_stat_load( &src->count );
+  dst->sum += rpc_stat_load( &src->sum );
+  dst->max = max > dst->max ? max : dst->max;
+  for ( uint32_t i = 0; i < RPC_HIST_BUCKETS; i++ ) {
+    dst->buckets[ i ] += rpc_stat_load( &src->buckets[ i ] );
+  }
+}
+
+void rpc_merge_stats( struct rpc_stats* dst, const struct rpc_stats* src ) {
+  dst->num_req_sent += rpc_stat_load( &src->num_req_sent );
+  dst->num_resp_rcvd += rpc_stat_load( &src->num_resp_rcvd );
+  dst->num_timedout += rpc_stat_load( &src->num_timedout );
+  dst->num_timedout_in_outqueue += rpc_stat_load( &src->num_timedout_in_outqueue );
+  dst->num_major_timedout += rpc_stat_load( &src->num_major_timedout );
+  dst->num_retransmitted += rpc_stat_load( &src->num_retransmitted );
+  dst->num_reconnects += rpc_stat_load( &src->num_reconnects );
+  dst->num_syscalls += rpc_stat_load( &src->num_syscalls );
+
+  /* estimates are averaged, weighted by samples */
+  for ( int c = 0; c < RPC_RTT_NUM_CLASSES; c++ ) {
+    struct rpc_rtt_stats*       sum     = &dst->rtt[ c ];
+    const struct rpc_rtt_stats* rtt     = &src->rtt[ c ];
+    uint64_t                    samples = rpc_stat_load( &rtt->samples );
+    if ( !samples ) {
+      continue;
+    }
+    uint32_t srtt   = __atomic_load_n( &rtt->srtt, __ATOMIC_RELAXED );
+    uint32_t rttvar = __atomic_load_n( &rtt->rttvar, __ATOMIC_RELAXED );
+    uint32_t rto    = __atomic_load_n( &rtt->rto, __ATOMIC_RELAXED );
+    sum->srtt       = ( sum->srtt * sum->samples + srtt * samples ) / ( sum->samples + samples );
+    sum->rttvar     = ( sum->rttvar * sum->samples + rttvar * samples ) / ( sum->samples + samples );
+    sum->rto        = rto > sum->rto ? rto : sum->rto;
+    sum->samples    = sum->samples + samples;
+  }
+
+  for ( int i = 0; i < RPC_STATS_NUM_PROCS; i++ ) {
+    struct rpc_proc_stats*       d = &dst->procs[ i ];
+    const struct rpc_proc_stats* s = &src->procs[ i ];
+    d->ops += rpc_stat_load( &s->ops );
+    d->errors += rpc_stat_load( &s->errors );
+    d->bytes_sent += rpc_stat_load( &s->bytes_sent );
+    d->bytes_rcvd += rpc_stat_load( &s->bytes_rcvd );
+    const struct rpc_histogram* sh = rpc_proc_latency( s );
+    struct rpc_histogram*       dh = sh ? rpc_proc_latency_alloc( d ) : nullptr;
+    for ( int l = 0; dh && l < RPC_LAT_NUM; l++ ) {
+      rpc_merge_histogram( &dh[ l ], &sh[ l ] );
+    }
+  }
+}
+
+struct rpc_stats* rpc_alloc_stats( void ) {
+  return new ( std::nothrow ) rpc_stats();
+}
+
+/* drop the histograms of `stats` and zero it */
+void rpc_reset_stats( struct rpc_stats* stats ) {
+  for ( int i = 0; i < RPC_STATS_NUM_PROCS; i++ ) {
+    delete[] stats->procs[ i ].latency;
+  }
+  *stats = {};
+}
+
+void rpc_free_stats( struct rpc_stats* stats ) {
+  if ( stats ) {
+    rpc_reset_stats( stats );
+    delete stats;
+  }
+}
+
+void rpc_get_stats( struct rpc_context* rpc, struct rpc_stats* stats ) {
+  rpc_reset_stats( stats );
+  rpc_merge_stats( stats, &rpc->stats );
+}
+
+static void rpc_appendf( std::string& out, const char* fmt, ... ) __attribute__( ( format( printf, 2, 3 ) ) );
+
+static void rpc_appendf( std::string& out, const char* fmt, ... ) {
+  char    buf[ 512 ];
+  va_list ap;
+
+  va_start( ap, fmt );
+  int n = vsnprintf( buf, sizeof( buf ), fmt, ap );
+  va_end( ap );
+  out.append( buf, n < (int) sizeof( buf ) ? n : sizeof( buf ) - 1 );
+}
+
+static const char* const rpc_rtt_class_names[ RPC_RTT_NUM_CLASSES ] = { "metadata", "read", "write", "commit" };
+static const char* const rpc_latency_names[ RPC_LAT_NUM ]           = { "queue", "wire", "decode", "total" };
+
+static void rpc_format_histogram( std::string& out, const char* name, const struct rpc_histogram* h, bool json ) {
+  uint64_t avg = h->count ? h->sum / h->count : 0;
+  uint64_t p50 = rpc_histogram_percentile( h, 0.5 );
+  uint64_t p99 = rpc_histogram_percentile( h, 0.99 );
+  uint64_t p3  = rpc_histogram_percentile( h, 0.999 );
+
+  if ( json ) {
+    rpc_appendf( out, "\"%s\":{\"count\":%" PRIu64 ",\"avg\":%" PRIu64 ",\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}", name,
+                 h->count, avg, p50, p99, p3, h->max );
+  } else {
+    rpc_appendf( out, "  %-7s avg %" PRIu64 " p50 %" PRIu64 " p99 %" PRIu64 " p999 %" PRIu64 " max %" PRIu64 " usecs\n", name, avg, p50, p99, p3, h->max );
+  }
+}
+
+std::string rpc_format_stats( const struct rpc_stats* stats, const char* const* proc_names, bool json ) {
+  std::string out;
+  const char* sep = "";
+
+  rpc_appendf( out, json ? "{\"num_req_sent\":%" PRIu64 ",\"num_resp_rcvd\":%" PRIu64 ",\"num_timedout\":%" PRIu64 ","
+                           "\"num_timedout_in_outqueue\":%" PRIu64 ",\"num_major_timedout\":%" PRIu64 ","
+                           "\"num_retransmitted\":%" PRIu64 ",\"num_reconnects\":%" PRIu64 ",\"num_syscalls\":%" PRIu64 ",\"rtt\":{"
+                         : "sent %" PRIu64 " rcvd %" PRIu64 " timedout %" PRIu64 " timedout_in_outqueue %" PRIu64 " major_timedout %" PRIu64 " "
+                           "retransmitted %" PRIu64 " reconnects %" PRIu64 " syscalls %" PRIu64 "\n",
+               stats->num_req_sent, stats->num_resp_rcvd, stats->num_timedout, stats->num_timedout_in_outqueue,
+               stats->num_major_timedout, stats->num_retransmitted, stats->num_reconnects, stats->num_syscalls );
+
+  for ( int c = 0; c < RPC_RTT_NUM_CLASSES; c++ ) {
+    const struct rpc_rtt_stats* rtt = &stats->rtt[ c ];
+    if ( json ) {
+      rpc_appendf( out, "%s\"%s\":{\"samples\":%" PRIu64 ",\"srtt\":%u,\"rttvar\":%u,\"rto\":%u}", sep,
+                   rpc_rtt_class_names[ c ], rtt->samples, rtt->srtt, rtt->rttvar, rtt->rto );
+      sep = ",";
+    } else if ( rtt->samples ) {
+      rpc_appendf( out, "rtt %s: samples %" PRIu64 " srtt %u rttvar %u usecs rto %u msecs\n", rpc_rtt_class_names[ c ],
+                   rtt->samples, rtt->srtt, rtt->rttvar, rtt->rto );
+    }
+  }
+  if ( json ) {
+    out += "},\"procs\":{";
+  }
+
+  sep = "";
+  for ( int i = 0; i < RPC_STATS_NUM_PROCS; i++ ) {
+    const struct rpc_proc_stats* ps = &stats->procs[ i ];
+    const struct rpc_histogram*  h  = rpc_proc_latency( ps );
+    char                         num[ 16 ];
+    const char*                  name = proc_names ? proc_names[ i ] : nullptr;
+
+    if ( !ps->ops && !ps->errors ) {
+      continue;
+    }
+    if ( !name ) {
+      snprintf( num, sizeof( num ), "proc%d", i );
+      name = num;
+    }
+    if ( json ) {
+      rpc_appendf( out, "%s\"%s\":{\"ops\":%" PRIu64 ",\"errors\":%" PRIu64 ",\"bytes_sent\":%" PRIu64 ",\"bytes_rcvd\":%" PRIu64 "", sep, name,
+                   ps->ops, ps->errors, ps->bytes_sent, ps->bytes_rcvd );
+      for ( int l = 0; h && l < RPC_LAT_NUM; l++ ) {
+        out += ',';
+        rpc_format_histogram( out, rpc_latency_names[ l ], &h[ l ], true );
+      }
+      out += '}';
+      sep = ",";
+    } else {
+      rpc_appendf( out, "%s: ops %" PRIu64 " errors %" PRIu64 " bytes_sent %" PRIu64 " bytes_rcvd %" PRIu64 "\n", name, ps->ops, ps->errors,
+                   ps->bytes_sent, ps->bytes_rcvd );
+      for ( int l = 0; h && l < RPC_LAT_NUM; l++ ) {
+        rpc_format_histogram( out, rpc_latency_names[ l ], &h[ l ], false );
+      }
+    }
+  }
+  if ( json ) {
+    out += "}}";
+  }
+  return out;
+}
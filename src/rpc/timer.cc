@@ -0,0 +1,152 @@
+#include <cstdint>
+#include <cstring>
+#include <rpc/rpc.h>
+
+/*
+ * Hierarchical timer wheel, one tick per millisecond.
+ *
+ * Level L has RPC_TIMER_SLOTS slots of RPC_TIMER_SLOTS^L ticks each. A timer
+ * goes to the lowest level whose span covers its distance from `now`; each
+ * time level 0 wraps around, the current slot of the level above is spilled
+ * back into the wheel, one level down. Arming and cancelling touch a single
+ * doubly linked slot list; expiring costs one step per elapsed tick, or per
+ * RPC_TIMER_SLOTS ticks while level 0 is empty.
+ *
+ * Deadlines are rounded up to a multiple of `slack` msecs, so that timers
+ * armed close together expire together.
+ *
+ * A wheel can be nested in a parent wheel, as those of the contexts on a
+ * loop are in the loop's: arming a timer earlier than the proxy moves the
+ * proxy up, so that the parent alone tells when any nested wheel is due.
+ * Cancelling leaves the proxy alone; it may fire early, never late.
+ */
+#define RPC_TIMER_MASK ( RPC_TIMER_SLOTS - 1 )
+
+void rpc_timer_init( struct rpc_timer_wheel* w, uint64_t now ) {
+  memset( w->slots, 0, sizeof( w->slots ) );
+  memset( w->count, 0, sizeof( w->count ) );
+  w->now    = now;
+  w->slack  = RPC_DEF_TIMER_SLACK;
+  w->parent = nullptr;
+  w->proxy  = {};
+}
+
+static void rpc_timer_place( struct rpc_timer_wheel* w, struct rpc_timer* t ) {
+  uint64_t delta = t->expires > w->now ? t->expires - w->now : 0;
+  uint64_t when  = t->expires > w->now ? t->expires : w->now;
+  int      level = 0;
+
+  while ( level < RPC_TIMER_LEVELS - 1 && delta >> ( RPC_TIMER_BITS * ( level + 1 ) ) ) {
+    level++;
+  }
+  /* beyond the wheel: park in the farthest slot, to be placed again later */
+  if ( delta >> ( RPC_TIMER_BITS * RPC_TIMER_LEVELS ) ) {
+    when = w->now + ( (uint64_t) 1 << ( RPC_TIMER_BITS * RPC_TIMER_LEVELS ) ) - 1;
+  }
+
+  struct rpc_timer** slot = &w->slots[ level ][ ( when >> ( RPC_TIMER_BITS * level ) ) & RPC_TIMER_MASK ];
+  t->level                = level;
+  t->next                 = *slot;
+  t->pprev                = slot;
+  if ( *slot ) {
+    ( *slot )->pprev = &t->next;
+  }
+  *slot = t;
+  w->count[ level ]++;
+}
+
+static void rpc_timer_unlink( struct rpc_timer_wheel* w, struct rpc_timer* t ) {
+  *t->pprev = t->next;
+  if ( t->next ) {
+    t->next->pprev = t->pprev;
+  }
+  t->next  = nullptr;
+  t->pprev = nullptr;
+  w->count[ t->level ]--;
+}
+
+/* (re)arm `t` to expire at `deadline`, in rpc_current_time() units */
+void rpc_timer_arm( struct rpc_timer_wheel* w, struct rpc_timer* t, uint64_t deadline ) {
+  if ( t->pprev ) {
+    rpc_timer_unlink( w, t );
+  }
+  if ( w->slack > 1 ) {
+    deadline = ( deadline + w->slack - 1 ) / w->slack * w->slack;
+  }
+  t->expires = deadline;
+  rpc_timer_place( w, t );
+  if ( w->parent && ( !w->proxy.pprev || deadline < w->proxy.expires ) ) {
+    rpc_timer_arm( w->parent, &w->proxy, deadline );
+  }
+}
+
+void rpc_timer_cancel( struct rpc_timer_wheel* w, struct rpc_timer* t ) {
+  if ( t->pprev ) {
+    rpc_timer_unlink( w, t );
+  }
+}
+
+/* spill the current slot of `level` into the levels below */
+static void rpc_timer_cascade( struct rpc_timer_wheel* w, int level ) {
+  int               idx = ( w->now >> ( RPC_TIMER_BITS * level ) ) & RPC_TIMER_MASK;
+  struct rpc_timer* t   = w->slots[ level ][ idx ];
+
+  w->slots[ level ][ idx ] = nullptr;
+  while ( t ) {
+    struct rpc_timer* next = t->next;
+    w->count[ level ]--;
+    rpc_timer_place( w, t );
+    t = next;
+  }
+}
+
+/*
+ * One timer due at `now`, disarmed, or nullptr once there are none. Taken
+ * one at a time so that whatever runs for it may arm and cancel others.
+ */
+struct rpc_timer* rpc_timer_expire( struct rpc_timer_wheel* w, uint64_t now ) {
+  while ( w->now <= now ) {
+    struct rpc_timer* t = w->slots[ 0 ][ w->now & RPC_TIMER_MASK ];
+    if ( t ) {
+      rpc_timer_unlink( w, t );
+      return t;
+    }
+    if ( !w->count[ 0 ] ) {
+      uint64_t wrap = ( w->now | RPC_TIMER_MASK ) + 1;
+      w->now        = wrap <= now ? wrap : now + 1;
+    } else {
+      w->now++;
+    }
+    for ( int level = 1; level < RPC_TIMER_LEVELS && !( w->now & ( ( (uint64_t) 1 << ( RPC_TIMER_BITS * level ) ) - 1 ) ); level++ ) {
+      rpc_timer_cascade( w, level );
+    }
+  }
+  return nullptr;
+}
+
+/*
+ * A time by which rpc_timer_expire() should be called again: the next
+ * deadline on level 0, or when level 0 next takes timers from above.
+ */
+uint64_t rpc_timer_next( const struct rpc_timer_wheel* w ) {
+  int armed = 0;
+  for ( int level = 0; level < RPC_TIMER_LEVELS; level++ ) {
+    armed += w->count[ level ];
+  }
+  if ( !armed ) {
+    return UINT64_MAX;
+  }
+  if ( w->count[ 0 ] ) {
+    for ( uint64_t tick = w->now; tick & RPC_TIMER_MASK || tick == w->now; tick++ ) {
+      if ( w->slots[ 0 ][ tick & RPC_TIMER_MASK ] ) {
+        return tick;
+      }
+    }
+  }
+  return ( w->now | RPC_TIMER_MASK ) + 1;
+}
+
+/* msecs deadlines are rounded up to, so that nearby ones expire together */
+void rpc_set_timer_slack( struct rpc_context* rpc, uint32_t msecs ) {
+  rpc->timers.slack = msecs ? msecs : 1;
+}
@@ -0,0 +1,255 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <new>
+#include <rpc.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * UDP transport.
+ *
+ * One unconnected socket talks to any number of servers: every PDU carries
+ * its own destination, and a reply is matched to its call by xid alone, so
+ * a scan over many servers is a single context, a single fd and one pending
+ * table. The outqueue goes out as one datagram per PDU, without the record
+ * marker, up to RPC_UDP_BATCH of them per sendmmsg(); replies are read
+ * RPC_UDP_RECV_BATCH at a time with recvmmsg() and decoded in place. Lost
+ * datagrams are covered by the usual timeout and retransmit machinery.
+ */
+
+static void rpc_udp_unqueue_head( struct rpc_context* rpc ) {
+  rpc->outqueue.head = rpc->outqueue.head->next;
+  if ( !rpc->outqueue.head ) {
+    rpc->outqueue.tail = nullptr;
+  }
+}
+
+/*
+ * Fail one call, and free it unless `keep`: a broadcast stays pending for
+ * the replies of other servers. The callback can look up the server with
+ * rpc_get_udp_src().
+ */
+static void rpc_udp_fail( struct rpc_context* rpc, struct rpc_pdu* pdu, const char* error, bool keep ) {
+  rpc_stats_failed( rpc, pdu );
+  rpc_set_error( rpc, "%s", error );
+  pdu->cb( rpc, RPC_STATUS_ERROR, (void*) rpc_get_error( rpc ), pdu->private_data );
+  if ( !keep ) {
+    rpc_free_pdu( rpc, pdu );
+  }
+}
+
+int rpc_bind_udp( struct rpc_context* rpc, const char* addr, int port ) {
+  struct addrinfo  hints {};
+  struct addrinfo* ai;
+  std::string      service = std::to_string( port );
+
+  if ( rpc->fd != -1 ) {
+    rpc_set_error_errno( rpc, EISCONN, "Trying to bind while already connected" );
+    return -1;
+  }
+
+  /* the wildcard address is IPv4 unless asked otherwise, "::" for IPv6 */
+  hints.ai_family   = addr ? AF_UNSPEC : AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags    = AI_PASSIVE;
+  int err           = getaddrinfo( addr, service.c_str(), &hints, &ai );
+  if ( err ) {
+    rpc_set_error_errno( rpc, EINVAL, "Invalid address:%s. Can not resolve into IPv4/v6: %s", addr, gai_strerror( err ) );
+    return -1;
+  }
+  memset( &rpc->s, 0, sizeof( rpc->s ) );
+  memcpy( &rpc->s, ai->ai_addr, ai->ai_addrlen );
+  freeaddrinfo( ai );
+
+  if ( !rpc->udp_buf ) {
+    rpc->udp_buf = new ( std::nothrow ) char[ RPC_UDP_RECV_BATCH * RPC_UDP_BUF_SIZE ];
+    if ( !rpc->udp_buf ) {
+      rpc_set_error_errno( rpc, ENOMEM, "Out of memory: Failed to allocate UDP buffers" );
+      return -1;
+    }
+  }
+
+  int fd = socket( rpc->s.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  if ( fd < 0 ) {
+    rpc_set_error_errno( rpc, errno, "Failed to open socket: %s", strerror( errno ) );
+    return -1;
+  }
+  if ( rpc->ifname[ 0 ] ) {
+    setsockopt( fd, SOL_SOCKET, SO_BINDTODEVICE, rpc->ifname, strlen( rpc->ifname ) );
+  }
+  if ( bind( fd, (struct sockaddr*) &rpc->s, rpc_sockaddr_len( &rpc->s ) ) < 0 ) {
+    rpc_set_error_errno( rpc, errno, "bind() to UDP port %d failed: %s", port, strerror( errno ) );
+    close( fd );
+    return -1;
+  }
+
+  rpc->fd             = fd;
+  rpc->is_udp         = 1;
+  rpc->is_connected   = 1;
+  rpc->is_nonblocking = 1;
+  rpc->is_broadcast   = 0;
+  memset( &rpc->udp_dest, 0, sizeof( rpc->udp_dest ) );
+  return rpc_loop_update_fd( rpc, -1 );
+}
+
+/*
+ * Where calls queued from now on go. With `is_broadcast`, `addr` is a
+ * broadcast address and each call collects replies until it times out.
+ */
+int rpc_set_udp_destination( struct rpc_context* rpc, const char* addr, int port, int is_broadcast ) {
+  struct addrinfo  hints {};
+  struct addrinfo* ai;
+  std::string      service = std::to_string( port );
+
+  if ( !rpc->is_udp || rpc->fd == -1 ) {
+    rpc_set_error_errno( rpc, EINVAL, "Not a UDP context, see rpc_bind_udp()" );
+    return -1;
+  }
+
+  hints.ai_family   = rpc->s.ss_family;
+  hints.ai_socktype = SOCK_DGRAM;
+  int err           = getaddrinfo( addr, service.c_str(), &hints, &ai );
+  if ( err ) {
+    rpc_set_error_errno( rpc, EINVAL, "Invalid address:%s. Can not resolve into IPv4/v6: %s", addr, gai_strerror( err ) );
+    return -1;
+  }
+  memset( &rpc->udp_dest, 0, sizeof( rpc->udp_dest ) );
+  memcpy( &rpc->udp_dest, ai->ai_addr, ai->ai_addrlen );
+  freeaddrinfo( ai );
+
+  int one = 1;
+  if ( is_broadcast && setsockopt( rpc->fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof( one ) ) < 0 ) {
+    rpc_set_error_errno( rpc, errno, "Failed to enable broadcast: %s", strerror( errno ) );
+    return -1;
+  }
+  rpc->is_broadcast = is_broadcast;
+  return 0;
+}
+
+/* the server the reply, or the failure, being handled came from */
+const struct sockaddr* rpc_get_udp_src( struct rpc_context* rpc ) {
+  return (const struct sockaddr*) &rpc->udp_src;
+}
+
+/*
+ * Send the outqueue, one datagram per PDU. A datagram the kernel refuses
+ * fails only its own call: the destination is to blame, not the socket.
+ */
+int rpc_write_to_udp( struct rpc_context* rpc ) {
+  struct mmsghdr  msgs[ RPC_UDP_BATCH ];
+  struct iovec    iov[ RPC_UDP_BATCH ][ 3 ];
+  struct rpc_pdu* sent[ RPC_UDP_BATCH ];
+
+  while ( rpc->outqueue.head ) {
+    int count = 0;
+    for ( struct rpc_pdu* pdu = rpc->outqueue.head; pdu && count < RPC_UDP_BATCH; pdu = pdu->next ) {
+      struct msghdr* msg = &msgs[ count ].msg_hdr;
+      int            n   = rpc_pdu_iov( pdu, iov[ count ] );
+
+      /* no record marker on a datagram */
+      iov[ count ][ 0 ].iov_base = (char*) iov[ count ][ 0 ].iov_base + 4;
+      iov[ count ][ 0 ].iov_len -= 4;
+
+      *msg             = {};
+      msg->msg_name    = &pdu->udp_dest;
+      msg->msg_namelen = rpc_sockaddr_len( &pdu->udp_dest );
+      msg->msg_iov     = iov[ count ];
+      msg->msg_iovlen  = n;
+      sent[ count++ ]  = pdu;
+    }
+
+    rpc_stat_add( &rpc->stats.num_syscalls, 1 );
+    int n = sendmmsg( rpc->fd, msgs, count, MSG_NOSIGNAL );
+    if ( n < 0 ) {
+      if ( errno == EINTR ) {
+        continue;
+      }
+      if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS ) {
+        return 0;
+      }
+      struct rpc_pdu* pdu = rpc->outqueue.head;
+      std::string     msg = std::string( "sendmmsg() failed: " ) + strerror( errno );
+      rpc_udp_unqueue_head( rpc );
+      memcpy( &rpc->udp_src, &pdu->udp_dest, sizeof( rpc->udp_src ) );
+      rpc_udp_fail( rpc, pdu, msg.c_str(), false );
+      continue;
+    }
+
+    /* off the queue first, callbacks may queue more */
+    for ( int i = 0; i < n; i++ ) {
+      rpc_udp_unqueue_head( rpc );
+    }
+    for ( int i = 0; i < n; i++ ) {
+      rpc_pdu_sent( rpc, sent[ i ] );
+    }
+  }
+  return 0;
+}
+
+/* a reply that did not fit in RPC_UDP_BUF_SIZE fails its call */
+static void rpc_udp_truncated( struct rpc_context* rpc, const char* buf, uint32_t size ) {
+  struct rpc_pdu* pdu = size >= 4 ? rpc_find_waitpdu( rpc, zdr_get_u32( buf ) ) : nullptr;
+  char            msg[ 128 ];
+
+  if ( !pdu ) {
+    return;
+  }
+  bool broadcast = pdu->flags & PDU_BROADCAST;
+  if ( !broadcast ) {
+    rpc_remove_waitpdu( rpc, pdu->xid );
+  }
+  snprintf( msg, sizeof( msg ), "Reply to xid 0x%08x is larger than %u bytes, too large for UDP", pdu->xid,
+            RPC_UDP_BUF_SIZE );
+  rpc_udp_fail( rpc, pdu, msg, broadcast );
+}
+
+int rpc_read_from_udp( struct rpc_context* rpc ) {
+  struct mmsghdr          msgs[ RPC_UDP_RECV_BATCH ];
+  struct iovec            iov[ RPC_UDP_RECV_BATCH ];
+  struct sockaddr_storage from[ RPC_UDP_RECV_BATCH ];
+
+  while ( rpc->fd != -1 ) {
+    for ( int i = 0; i < RPC_UDP_RECV_BATCH; i++ ) {
+      struct msghdr* msg = &msgs[ i ].msg_hdr;
+      iov[ i ]           = { rpc->udp_buf + i * RPC_UDP_BUF_SIZE, RPC_UDP_BUF_SIZE };
+      *msg               = {};
+      msg->msg_name      = &from[ i ];
+      msg->msg_namelen   = sizeof( from[ i ] );
+      msg->msg_iov       = &iov[ i ];
+      msg->msg_iovlen    = 1;
+    }
+
+    rpc_stat_add( &rpc->stats.num_syscalls, 1 );
+    int n = recvmmsg( rpc->fd, msgs, RPC_UDP_RECV_BATCH, MSG_DONTWAIT, nullptr );
+    if ( n < 0 ) {
+      if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+        return 0;
+      }
+      /* or an ICMP error for some earlier datagram, nothing wrong with the socket */
+      if ( errno == EINTR || errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH ) {
+        continue;
+      }
+      rpc_set_error_errno( rpc, errno, "Read from UDP socket failed: %s", strerror( errno ) );
+      return -1;
+    }
+
+    for ( int i = 0; i < n && rpc->fd != -1; i++ ) {
+      memcpy( &rpc->udp_src, &from[ i ], sizeof( rpc->udp_src ) );
+      if ( msgs[ i ].msg_hdr.msg_flags & MSG_TRUNC ) {
+        rpc_udp_truncated( rpc, (const char*) iov[ i ].iov_base, msgs[ i ].msg_len );
+        continue;
+      }
+      /* anything that does not decode is a stray datagram, not a broken stream */
+      rpc_process_pdu( rpc, (char*) iov[ i ].iov_base, msgs[ i ].msg_len );
+    }
+    if ( n < RPC_UDP_RECV_BATCH ) {
+      return 0;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,543 @@
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <poll.h>
+#include <rpc.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if ENABLE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+/*
+ * io_uring transport.
+ *
+ * Each connection gets its own ring, and its fd is what event loops wait
+ * on instead of the socket's. Replies come in through one multishot recv
+ * into provided buffers, re-armed only when the kernel runs out of them;
+ * the parser copies out of those buffers (rpc_uring_readv()) exactly as it
+ * would read from the socket, and hands each one back once consumed, with
+ * an IORING_OP_PROVIDE_BUFFERS that goes out with the next submission.
+ * The outqueue goes out as a chain of linked sendmsg()s, so they cannot be
+ * reordered, and the next chain is only built once the previous one has
+ * completed. Everything prepared while servicing the connection is
+ * submitted with a single io_uring_enter(), and completions are read from
+ * shared memory, so at any queue depth a loop iteration costs one system
+ * call however many requests and replies it moves.
+ *
+ * Multishot recv needs Linux 6.0. Kernels without it are detected by
+ * probing for IORING_OP_SEND_ZC, which came with the same release.
+ */
+#if ENABLE_IO_URING && defined( IORING_RECV_MULTISHOT )
+
+enum rpc_uring_op {
+  RPC_URING_RECV = 1,
+  RPC_URING_SEND,
+  RPC_URING_POLL,
+  RPC_URING_CANCEL,
+  RPC_URING_PROVIDE,
+};
+
+/* part of a provided buffer the parser has not consumed yet */
+struct rpc_uring_chunk {
+  uint16_t bid;
+  uint32_t off;
+  uint32_t len;
+};
+
+struct rpc_uring {
+  int ring_fd;
+  int sock;
+
+  void*                sq_ptr;
+  size_t               sq_len;
+  void*                cq_ptr;
+  size_t               cq_len;
+  struct io_uring_sqe* sqes;
+  size_t               sqes_len;
+  unsigned*            sq_head;
+  unsigned*            sq_tail;
+  unsigned*            sq_array;
+  unsigned             sq_mask;
+  unsigned*            cq_head;
+  unsigned*            cq_tail;
+  unsigned             cq_mask;
+  struct io_uring_cqe* cqes;
+
+  unsigned sqe_tail; /* next SQE to prepare; from *sq_head on not yet submitted */
+  unsigned inflight; /* submitted SQEs that will still post a CQE */
+
+  /* provided buffers, the received data waiting in them, and the consumed ones to give back */
+  char*                  bufs;
+  struct rpc_uring_chunk chunks[ RPC_URING_BUFS ];
+  unsigned               chunk_head;
+  unsigned               num_chunks;
+  uint16_t               consumed[ RPC_URING_BUFS ];
+  unsigned               num_consumed;
+  bool                   recv_armed;
+  bool                   recv_eof;
+  int                    recv_err;
+
+  /* the send chain in flight */
+  int           sends;
+  int           send_err;
+  struct msghdr msgs[ RPC_URING_SENDS ];
+  struct iovec  iov[ RPC_URING_SENDS ][ RPC_MAX_IOVECS ];
+};
+
+static int rpc_uring_enter( int fd, unsigned to_submit, unsigned min_complete, unsigned flags ) {
+  return (int) syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0 );
+}
+
+static int rpc_uring_register( int fd, unsigned opcode, void* arg, unsigned nr_args ) {
+  return (int) syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+static bool rpc_uring_supported( int ring_fd ) {
+  const unsigned nops = IORING_OP_SEND_ZC + 1;
+  char           buf[ sizeof( struct io_uring_probe ) + nops * sizeof( struct io_uring_probe_op ) ] {};
+  auto*          probe = (struct io_uring_probe*) buf;
+
+  if ( rpc_uring_register( ring_fd, IORING_REGISTER_PROBE, probe, nops ) < 0 ) {
+    return false;
+  }
+  return probe->last_op >= IORING_OP_SEND_ZC && ( probe->ops[ IORING_OP_SEND_ZC ].flags & IO_URING_OP_SUPPORTED );
+}
+
+static void rpc_uring_free( struct rpc_uring* u ) {
+  delete[] u->bufs;
+  if ( u->sqes ) {
+    munmap( u->sqes, u->sqes_len );
+  }
+  if ( u->cq_ptr && u->cq_ptr != u->sq_ptr ) {
+    munmap( u->cq_ptr, u->cq_len );
+  }
+  if ( u->sq_ptr ) {
+    munmap( u->sq_ptr, u->sq_len );
+  }
+  if ( u->ring_fd >= 0 ) {
+    close( u->ring_fd );
+  }
+  delete u;
+}
+
+static unsigned rpc_uring_unsubmitted( struct rpc_uring* u ) {
+  return u->sqe_tail - __atomic_load_n( u->sq_head, __ATOMIC_ACQUIRE );
+}
+
+static struct io_uring_sqe* rpc_uring_get_sqe( struct rpc_uring* u, unsigned op ) {
+  if ( rpc_uring_unsubmitted( u ) > u->sq_mask ) {
+    return nullptr;
+  }
+  unsigned             i   = u->sqe_tail++ & u->sq_mask;
+  struct io_uring_sqe* sqe = &u->sqes[ i ];
+  memset( sqe, 0, sizeof( *sqe ) );
+  sqe->user_data   = op;
+  u->sq_array[ i ] = i;
+  return sqe;
+}
+
+/*
+ * Give consumed buffers back to the kernel, one PROVIDE_BUFFERS for each
+ * run of consecutive ids. Whatever does not fit waits for the next call.
+ */
+static void rpc_uring_provide( struct rpc_uring* u ) {
+  unsigned i = 0;
+
+  while ( i < u->num_consumed ) {
+    unsigned n = 1;
+    while ( i + n < u->num_consumed && u->consumed[ i + n ] == u->consumed[ i ] + n ) {
+      n++;
+    }
+    struct io_uring_sqe* sqe = rpc_uring_get_sqe( u, RPC_URING_PROVIDE );
+    if ( !sqe ) {
+      break;
+    }
+    sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd        = n;
+    sqe->addr      = (uint64_t) ( u->bufs + (size_t) u->consumed[ i ] * RPC_URING_BUF_SIZE );
+    sqe->len       = RPC_URING_BUF_SIZE;
+    sqe->off       = u->consumed[ i ];
+    sqe->buf_group = 0;
+    i += n;
+  }
+  u->num_consumed -= i;
+  memmove( u->consumed, u->consumed + i, u->num_consumed * sizeof( u->consumed[ 0 ] ) );
+}
+
+/*
+ * A ring for the connected (or connecting) socket rpc->fd, with all the
+ * receive buffers provided. Returns -1 if io_uring cannot be used.
+ */
+int rpc_uring_create( struct rpc_context* rpc ) {
+  struct io_uring_params p {};
+  struct rpc_uring*      u = new ( std::nothrow ) rpc_uring();
+
+  if ( !u ) {
+    return -1;
+  }
+  u->ring_fd = -1;
+  u->sock    = rpc->fd;
+
+  /* multishot receives can post many completions per submission */
+  p.flags      = IORING_SETUP_CQSIZE;
+  p.cq_entries = RPC_URING_ENTRIES * 16;
+  u->ring_fd   = (int) syscall( __NR_io_uring_setup, RPC_URING_ENTRIES, &p );
+  if ( u->ring_fd < 0 || !rpc_uring_supported( u->ring_fd ) ) {
+    rpc_uring_free( u );
+    return -1;
+  }
+
+  u->sq_len   = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+  u->cq_len   = p.cq_off.cqes + p.cq_entries * sizeof( struct io_uring_cqe );
+  u->sqes_len = p.sq_entries * sizeof( struct io_uring_sqe );
+  if ( p.features & IORING_FEAT_SINGLE_MMAP ) {
+    u->sq_len = u->cq_len = u->sq_len > u->cq_len ? u->sq_len : u->cq_len;
+  }
+  u->sq_ptr = mmap( nullptr, u->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQ_RING );
+  if ( u->sq_ptr == MAP_FAILED ) {
+    u->sq_ptr = nullptr;
+    rpc_uring_free( u );
+    return -1;
+  }
+  u->cq_ptr = u->sq_ptr;
+  if ( !( p.features & IORING_FEAT_SINGLE_MMAP ) ) {
+    u->cq_ptr = mmap( nullptr, u->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_CQ_RING );
+    if ( u->cq_ptr == MAP_FAILED ) {
+      u->cq_ptr = nullptr;
+      rpc_uring_free( u );
+      return -1;
+    }
+  }
+  u->sqes = (struct io_uring_sqe*) mmap( nullptr, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ring_fd, IORING_OFF_SQES );
+  if ( u->sqes == MAP_FAILED ) {
+    u->sqes = nullptr;
+    rpc_uring_free( u );
+    return -1;
+  }
+  char* sq    = (char*) u->sq_ptr;
+  char* cq    = (char*) u->cq_ptr;
+  u->sq_head  = (unsigned*) ( sq + p.sq_off.head );
+  u->sq_tail  = (unsigned*) ( sq + p.sq_off.tail );
+  u->sq_array = (unsigned*) ( sq + p.sq_off.array );
+  u->sq_mask  = *(unsigned*) ( sq + p.sq_off.ring_mask );
+  u->cq_head  = (unsigned*) ( cq + p.cq_off.head );
+  u->cq_tail  = (unsigned*) ( cq + p.cq_off.tail );
+  u->cq_mask  = *(unsigned*) ( cq + p.cq_off.ring_mask );
+  u->cqes     = (struct io_uring_cqe*) ( cq + p.cq_off.cqes );
+  u->sqe_tail = *u->sq_tail;
+
+  /* all of them, submitted with the first recv */
+  u->bufs = new ( std::nothrow ) char[ (size_t) RPC_URING_BUFS * RPC_URING_BUF_SIZE ];
+  if ( !u->bufs ) {
+    rpc_uring_free( u );
+    return -1;
+  }
+  for ( uint16_t bid = 0; bid < RPC_URING_BUFS; bid++ ) {
+    u->consumed[ u->num_consumed++ ] = bid;
+  }
+
+  rpc->uring = u;
+  return 0;
+}
+
+/*
+ * Submit what has been prepared, and wait for `min_complete` completions.
+ * Whatever the kernel did not take (EINTR, EBUSY, or an SQE it rejected,
+ * which still posts its CQE) stays in the ring for the next call.
+ */
+static int rpc_uring_enter_all( struct rpc_context* rpc, unsigned min_complete ) {
+  struct rpc_uring* u = rpc->uring;
+
+  __atomic_store_n( u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE );
+  rpc_stat_add( &rpc->stats.num_syscalls, 1 );
+  int n = rpc_uring_enter( u->ring_fd, rpc_uring_unsubmitted( u ), min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0 );
+  if ( n < 0 ) {
+    if ( errno == EINTR || errno == EBUSY || errno == EAGAIN ) {
+      return 0;
+    }
+    rpc_set_error_errno( rpc, errno, "io_uring_enter() failed: %s", strerror( errno ) );
+    return -1;
+  }
+  u->inflight += n;
+  return 0;
+}
+
+/*
+ * Cancel everything, wait until the kernel is done with our memory, then
+ * unmap the ring. The socket itself is closed by the caller.
+ */
+void rpc_uring_destroy( struct rpc_context* rpc ) {
+  struct rpc_uring* u = rpc->uring;
+
+  if ( !u ) {
+    return;
+  }
+  struct io_uring_sqe* sqe = rpc_uring_get_sqe( u, RPC_URING_CANCEL );
+  if ( sqe ) {
+    sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+    sqe->fd           = u->sock;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  }
+  shutdown( u->sock, SHUT_RDWR );
+  for ( int tries = 0; ( u->inflight || rpc_uring_unsubmitted( u ) ) && tries < 100; tries++ ) {
+    if ( rpc_uring_enter_all( rpc, rpc_uring_unsubmitted( u ) ? 0 : 1 ) < 0 ) {
+      break;
+    }
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n( u->cq_tail, __ATOMIC_ACQUIRE );
+    for ( ; head != tail; head++ ) {
+      if ( !( u->cqes[ head & u->cq_mask ].flags & IORING_CQE_F_MORE ) ) {
+        u->inflight--;
+      }
+    }
+    __atomic_store_n( u->cq_head, head, __ATOMIC_RELEASE );
+  }
+
+  /* sends that did not complete leave their PDUs to be sent again */
+  for ( struct rpc_pdu* pdu = rpc->outqueue.head; pdu && ( pdu->flags & PDU_SENDING ); pdu = pdu->next ) {
+    pdu->flags &= ~PDU_SENDING;
+  }
+  rpc->uring = nullptr;
+  rpc_uring_free( u );
+}
+
+int rpc_uring_fd( struct rpc_context* rpc ) {
+  return rpc->uring->ring_fd;
+}
+
+/* the non-blocking connect is done once the socket is writable */
+int rpc_uring_poll_connect( struct rpc_context* rpc ) {
+  struct io_uring_sqe* sqe = rpc_uring_get_sqe( rpc->uring, RPC_URING_POLL );
+  if ( !sqe ) {
+    rpc_set_error_errno( rpc, EAGAIN, "io_uring submission queue is full" );
+    return -1;
+  }
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = rpc->uring->sock;
+  sqe->poll32_events = POLLOUT;
+  return rpc_uring_enter_all( rpc, 0 );
+}
+
+static void rpc_uring_send_done( struct rpc_context* rpc, int res ) {
+  struct rpc_uring* u = rpc->uring;
+
+  u->sends--;
+  if ( res >= 0 ) {
+    rpc_retire_written( rpc, res );
+  } else if ( res != -ECANCELED && !u->send_err ) {
+    /* the rest of the chain is cancelled: report the first failure */
+    u->send_err = -res;
+  }
+  if ( !u->sends ) {
+    for ( struct rpc_pdu* pdu = rpc->outqueue.head; pdu && ( pdu->flags & PDU_SENDING ); pdu = pdu->next ) {
+      pdu->flags &= ~PDU_SENDING;
+    }
+  }
+}
+
+/*
+ * Read the completion queue. Returns what readiness they amount to: POLLOUT
+ * once a connect is done, POLLIN while there is received data (or an end of
+ * it) for rpc_read_from_socket().
+ */
+int rpc_uring_reap( struct rpc_context* rpc ) {
+  struct rpc_uring* u       = rpc->uring;
+  int               revents = 0;
+  unsigned          head    = *u->cq_head;
+  unsigned          tail    = __atomic_load_n( u->cq_tail, __ATOMIC_ACQUIRE );
+
+  for ( ; head != tail; head++ ) {
+    struct io_uring_cqe* cqe = &u->cqes[ head & u->cq_mask ];
+    if ( !( cqe->flags & IORING_CQE_F_MORE ) ) {
+      u->inflight--;
+    }
+    switch ( cqe->user_data ) {
+      case RPC_URING_RECV:
+        if ( !( cqe->flags & IORING_CQE_F_MORE ) ) {
+          u->recv_armed = false;
+        }
+        if ( cqe->res > 0 && ( cqe->flags & IORING_CQE_F_BUFFER ) ) {
+          struct rpc_uring_chunk* c = &u->chunks[ ( u->chunk_head + u->num_chunks++ ) & ( RPC_URING_BUFS - 1 ) ];
+          c->bid                    = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+          c->off                    = 0;
+          c->len                    = cqe->res;
+        } else if ( cqe->res == 0 ) {
+          u->recv_eof = true;
+        } else if ( cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED ) {
+          u->recv_err = -cqe->res;
+        }
+        break;
+      case RPC_URING_SEND:
+        rpc_uring_send_done( rpc, cqe->res );
+        break;
+      case RPC_URING_POLL:
+        revents |= POLLOUT;
+        break;
+      default:
+        break;
+    }
+  }
+  __atomic_store_n( u->cq_head, head, __ATOMIC_RELEASE );
+
+  if ( u->num_chunks || u->recv_eof || u->recv_err ) {
+    revents |= POLLIN;
+  }
+  return revents;
+}
+
+/* readv() for the parser, out of the received buffers */
+ssize_t rpc_uring_readv( struct rpc_context* rpc, const struct iovec* iov, int iovcnt ) {
+  struct rpc_uring* u = rpc->uring;
+  ssize_t           n = 0;
+
+  for ( int i = 0; i < iovcnt && u->num_chunks; i++ ) {
+    size_t off = 0;
+    while ( off < iov[ i ].iov_len && u->num_chunks ) {
+      struct rpc_uring_chunk* c   = &u->chunks[ u->chunk_head & ( RPC_URING_BUFS - 1 ) ];
+      size_t                  len = iov[ i ].iov_len - off < c->len ? iov[ i ].iov_len - off : c->len;
+      memcpy( (char*) iov[ i ].iov_base + off, u->bufs + (size_t) c->bid * RPC_URING_BUF_SIZE + c->off, len );
+      off    += len;
+      c->off += len;
+      c->len -= len;
+      if ( !c->len ) {
+        u->consumed[ u->num_consumed++ ] = c->bid;
+        u->chunk_head++;
+        u->num_chunks--;
+      }
+    }
+    n += off;
+  }
+  if ( n ) {
+    return n;
+  }
+  if ( u->recv_err ) {
+    errno = u->recv_err;
+    return -1;
+  }
+  if ( u->recv_eof ) {
+    return 0;
+  }
+  errno = EAGAIN;
+  return -1;
+}
+
+/*
+ * Prepare the outqueue as a chain of linked sendmsg()s, unless one is still
+ * in flight. MSG_WAITALL makes the kernel retry short sends itself, so a
+ * chain only breaks on an error.
+ */
+int rpc_uring_write( struct rpc_context* rpc ) {
+  struct rpc_uring* u = rpc->uring;
+
+  if ( u->send_err ) {
+    rpc_set_error_errno( rpc, u->send_err, "Write to socket failed: %s", strerror( u->send_err ) );
+    return -1;
+  }
+  if ( u->sends ) {
+    return 0;
+  }
+
+  struct rpc_pdu*      pdu  = rpc->outqueue.head;
+  struct io_uring_sqe* prev = nullptr;
+  while ( pdu && u->sends < RPC_URING_SENDS ) {
+    struct io_uring_sqe* sqe = rpc_uring_get_sqe( u, RPC_URING_SEND );
+    if ( !sqe ) {
+      break; /* the rest goes with the next chain */
+    }
+    struct iovec* iov    = u->iov[ u->sends ];
+    int           iovcnt = 0;
+    for ( ; pdu && iovcnt + 3 <= RPC_MAX_IOVECS; pdu = pdu->next ) {
+      iovcnt += rpc_pdu_iov( pdu, iov + iovcnt );
+      pdu->flags |= PDU_SENDING;
+    }
+    struct msghdr* msg = &u->msgs[ u->sends++ ];
+    *msg               = {};
+    msg->msg_iov       = iov;
+    msg->msg_iovlen    = iovcnt;
+    sqe->opcode        = IORING_OP_SENDMSG;
+    sqe->fd            = u->sock;
+    sqe->addr          = (uint64_t) msg;
+    sqe->len           = 1;
+    sqe->msg_flags     = MSG_NOSIGNAL | MSG_WAITALL;
+    if ( prev ) {
+      prev->flags |= IOSQE_IO_LINK;
+    }
+    prev = sqe;
+  }
+  return 0;
+}
+
+/* anything to hand to the kernel, see rpc_which_events() */
+bool rpc_uring_pending( struct rpc_context* rpc ) {
+  struct rpc_uring* u = rpc->uring;
+  return rpc_uring_unsubmitted( u ) || u->num_consumed || ( !u->sends && rpc->outqueue.head && !rpc->corked && rpc->is_connected );
+}
+
+/*
+ * Give back consumed buffers, re-arm the receive if it has stopped, and
+ * submit. Received data is always parsed before this, so the buffers the
+ * receive stopped for are provided again ahead of it.
+ */
+int rpc_uring_submit( struct rpc_context* rpc ) {
+  struct rpc_uring* u = rpc->uring;
+
+  rpc_uring_provide( u );
+  if ( rpc->is_connected && !u->recv_armed && !u->recv_eof && !u->recv_err ) {
+    struct io_uring_sqe* sqe = rpc_uring_get_sqe( u, RPC_URING_RECV );
+    if ( sqe ) {
+      sqe->opcode    = IORING_OP_RECV;
+      sqe->fd        = u->sock;
+      sqe->ioprio    = IORING_RECV_MULTISHOT;
+      sqe->flags     = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = 0;
+      u->recv_armed  = true;
+    }
+  }
+  return rpc_uring_unsubmitted( u ) ? rpc_uring_enter_all( rpc, 0 ) : 0;
+}
+
+#else
+
+int rpc_uring_create( struct rpc_context* rpc ) {
+  return -1;
+}
+
+void rpc_uring_destroy( struct rpc_context* rpc ) {
+}
+
+int rpc_uring_fd( struct rpc_context* rpc ) {
+  return -1;
+}
+
+int rpc_uring_poll_connect( struct rpc_context* rpc ) {
+  return -1;
+}
+
+int rpc_uring_reap( struct rpc_context* rpc ) {
+  return 0;
+}
+
+ssize_t rpc_uring_readv( struct rpc_context* rpc, const struct iovec* iov, int iovcnt ) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int rpc_uring_write( struct rpc_context* rpc ) {
+  return -1;
+}
+
+bool rpc_uring_pending( struct rpc_context* rpc ) {
+  return false;
+}
+
+int rpc_uring_submit( struct rpc_context* rpc ) {
+  return -1;
+}
+
+#endif
@@ -0,0 +1,252 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../rpc/fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * Files on the fake server are 4 KiB, their mtime is `mtime`. GETATTR and
+ * READ are answered, both with attributes.
+ */
+struct fake_attrs {
+  std::mutex mtx;
+  uint32_t   mtime    = 100;
+  int        getattrs = 0;
+  int        reads    = 0;
+
+  static uint32_t get_u32( const char*& p ) {
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    p += 4;
+    return ntohl( v );
+  }
+
+  void put_fattr3( std::string& r, uint32_t fileid ) {
+    uint32_t words[] = { NF3REG, 0644, 1, 0, 0, 0, 4096, 0, 4096, 0, 0, 0, 1, 0, fileid, mtime, 0, mtime, 0, mtime, 0 };
+    for ( uint32_t w : words ) {
+      fake_server::put_u32( r, w );
+    }
+  }
+
+  std::string results( const std::vector< char >& call ) {
+    std::lock_guard< std::mutex > lock( mtx );
+    const char* p    = call.data() + 20;
+    uint32_t    proc = get_u32( p );
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* cred */
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* verf */
+    uint32_t fhlen = get_u32( p );
+    uint32_t fileid;
+    memcpy( &fileid, p, 4 );
+
+    std::string r;
+    fake_server::put_u32( r, NFS3_OK );
+    if ( proc == NFS3_GETATTR ) {
+      getattrs++;
+      put_fattr3( r, fileid );
+    } else if ( proc == NFS3_READ ) {
+      reads++;
+      p += ZDR_ROUNDUP( fhlen );
+      fake_server::put_u32( r, 1 );
+      put_fattr3( r, fileid );
+      fake_server::put_u32( r, 0 );
+      fake_server::put_u32( r, 1 );
+      fake_server::put_u32( r, 0 );
+    }
+    return r;
+  }
+};
+
+struct ac_state {
+  int             done;
+  int             result;
+  struct nfs_attr attr;
+};
+
+static void ac_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  ac_state* s = (ac_state*) private_data;
+  s->result   = err;
+  if ( err == 0 && data ) {
+    s->attr = *(struct nfs_attr*) data;
+  }
+  s->done++;
+}
+
+struct ac_fixture {
+  fake_attrs          files;
+  fake_server         srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+
+  ac_fixture() : srv( fake_server::REPLY, [ this ]( const std::vector< char >& c ) { return files.results( c ); } ) {
+    loop = rpc_loop_create();
+    nfs  = nfs_init_context();
+    nfs_loop_add( loop, nfs );
+    ac_state conn {};
+    nfs_connect_async( nfs, "127.0.0.1", srv.port, ac_cb, &conn );
+    run( [ & ] { return conn.done > 0; } );
+  }
+
+  ~ac_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+  }
+
+  void run( const std::function< bool() >& done ) {
+    for ( int i = 0; i < 3000 && !done(); i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  int count( int fake_attrs::*field ) {
+    std::lock_guard< std::mutex > lock( files.mtx );
+    return files.*field;
+  }
+
+  ac_state getattr( uint32_t id ) {
+    char          val[ 4 ];
+    struct nfs_fh fh { sizeof( val ), val };
+    memcpy( val, &id, 4 );
+    ac_state s {};
+    EXPECT_EQ( nfs_getattr_async( nfs, &fh, ac_cb, &s ), 0 );
+    run( [ & ] { return s.done > 0; } );
+    EXPECT_EQ( s.result, 0 );
+    return s;
+  }
+};
+
+TEST( nfs_v3_attrcache, hits_and_adaptive_timeout ) {
+  ac_fixture f;
+  nfs_set_attrcache_timeouts( f.nfs, 1, 4, 1, 4 );
+
+  ac_state s = f.getattr( 1 );
+  EXPECT_EQ( s.attr.size, 4096u );
+  EXPECT_EQ( s.attr.mtime.seconds, 100u );
+  for ( int i = 0; i < 10; i++ ) {
+    f.getattr( 1 );
+  }
+  EXPECT_EQ( f.count( &fake_attrs::getattrs ), 1 );
+
+  /* unchanged for decades: good for acregmax, not just acregmin */
+  std::this_thread::sleep_for( std::chrono::milliseconds( 1100 ) );
+  f.getattr( 1 );
+  EXPECT_EQ( f.count( &fake_attrs::getattrs ), 1 );
+
+  struct nfs_attrcache_stats stats;
+  nfs_get_attrcache_stats( f.nfs, &stats );
+  EXPECT_EQ( stats.hits, 11u );
+  EXPECT_EQ( stats.misses, 1u );
+  EXPECT_EQ( stats.entries, 1u );
+}
+
+TEST( nfs_v3_attrcache, recently_changed_stays_short ) {
+  ac_fixture f;
+  nfs_set_attrcache_timeouts( f.nfs, 1, 4, 1, 4 );
+  {
+    std::lock_guard< std::mutex > lock( f.files.mtx );
+    f.files.mtime = (uint32_t) time( nullptr );
+  }
+  uint32_t      id = 3;
+  char          buf[ 16 ];
+  struct nfs_fh fh { 4, (char*) &id };
+
+  /* however many replies refresh it, a file changed just now keeps acregmin */
+  for ( int i = 0; i < 5; i++ ) {
+    ac_state s {};
+    ASSERT_EQ( nfs_pread_async( f.nfs, &fh, 0, sizeof( buf ), buf, ac_cb, &s ), 0 );
+    f.run( [ & ] { return s.done > 0; } );
+  }
+  std::this_thread::sleep_for( std::chrono::milliseconds( 1100 ) );
+  f.getattr( 3 );
+  EXPECT_EQ( f.count( &fake_attrs::getattrs ), 1 );
+}
+
+TEST( nfs_v3_attrcache, older_attributes_ignored ) {
+  ac_fixture    f;
+  uint32_t      id = 5;
+  struct nfs_fh fh { 4, (char*) &id };
+
+  fattr3 newer {};
+  newer.type          = NF3REG;
+  newer.size          = 8192;
+  newer.ctime.seconds = 200;
+  fattr3 older        = newer;
+  older.size          = 4096;
+  older.ctime.seconds = 150;
+
+  /* a reply that went out first but came back last over another connection */
+  nfs_attrcache_put( f.nfs, &fh, &newer );
+  nfs_attrcache_put( f.nfs, &fh, &older );
+  struct nfs_attr attr;
+  ASSERT_EQ( nfs_attrcache_get( f.nfs, &fh, &attr ), 0 );
+  EXPECT_EQ( attr.size, 8192u );
+  EXPECT_EQ( attr.ctime.seconds, 200u );
+
+  older.ctime.seconds = 250;
+  nfs_attrcache_put( f.nfs, &fh, &older );
+  ASSERT_EQ( nfs_attrcache_get( f.nfs, &fh, &attr ), 0 );
+  EXPECT_EQ( attr.size, 4096u );
+}
+
+TEST( nfs_v3_attrcache, refreshed_by_read_replies ) {
+  ac_fixture    f;
+  uint32_t      id = 7;
+  char          buf[ 16 ];
+  struct nfs_fh fh { 4, (char*) &id };
+
+  ac_state s {};
+  ASSERT_EQ( nfs_pread_async( f.nfs, &fh, 0, sizeof( buf ), buf, ac_cb, &s ), 0 );
+  f.run( [ & ] { return s.done > 0; } );
+  EXPECT_EQ( f.count( &fake_attrs::reads ), 1 );
+
+  s = f.getattr( 7 );
+  EXPECT_EQ( s.attr.mtime.seconds, 100u );
+  EXPECT_EQ( f.count( &fake_attrs::getattrs ), 0 );
+
+  /* a changed file comes back with its new attributes */
+  {
+    std::lock_guard< std::mutex > lock( f.files.mtx );
+    f.files.mtime = 200;
+  }
+  s = {};
+  ASSERT_EQ( nfs_pread_async( f.nfs, &fh, 0, sizeof( buf ), buf, ac_cb, &s ), 0 );
+  f.run( [ & ] { return s.done > 0; } );
+  EXPECT_EQ( f.getattr( 7 ).attr.mtime.seconds, 200u );
+  EXPECT_EQ( f.count( &fake_attrs::getattrs ), 0 );
+}
+
+TEST( nfs_v3_attrcache, bounded_lru ) {
+  ac_fixture f;
+  nfs_set_attrcache( f.nfs, 4 * NFS_ATTRCACHE_SHARDS );
+
+  for ( uint32_t id = 0; id < 1000; id++ ) {
+    f.getattr( id );
+  }
+  struct nfs_attrcache_stats stats;
+  nfs_get_attrcache_stats( f.nfs, &stats );
+  EXPECT_LE( stats.entries, 4u * NFS_ATTRCACHE_SHARDS );
+  EXPECT_EQ( stats.evictions, 1000 - stats.entries );
+
+  /* the most recent ones are still there */
+  int before = f.count( &fake_attrs::getattrs );
+  f.getattr( 999 );
+  EXPECT_EQ( f.count( &fake_attrs::getattrs ), before );
+
+  /* and without a cache every call goes out */
+  nfs_set_attrcache( f.nfs, 0 );
+  f.getattr( 999 );
+  EXPECT_EQ( f.count( &fake_attrs::getattrs ), before + 1 );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
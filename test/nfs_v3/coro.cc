@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+
+#if defined( __cpp_impl_coroutine )
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <mount/v3/mount_v3.h>
+#include <nfs/v3/nfs_coro.h>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+struct coro_fixture {
+  std::string         dir;
+  struct nfs_server*  srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+
+  coro_fixture() {
+    char tmpl[] = "/tmp/nfs_coro_test.XXXXXX";
+    dir         = mkdtemp( tmpl );
+    srv         = nfs_server_start( dir.c_str(), 0, 2 );
+    loop        = rpc_loop_create();
+    nfs         = nfs_init_context();
+    nfs_loop_add( loop, nfs );
+  }
+
+  ~coro_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+    nfs_server_stop( srv );
+    std::filesystem::remove_all( dir );
+  }
+
+  void write_file( const char* name, const std::string& data ) {
+    int fd = open( ( dir + "/" + name ).c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644 );
+    ASSERT_GE( fd, 0 );
+    ASSERT_EQ( write( fd, data.data(), data.size() ), (ssize_t) data.size() );
+    close( fd );
+  }
+};
+
+/* MNT through a raw call, as the client has no MOUNT support of its own */
+static nfs_coro::task< int > mount( struct nfs_context* nfs, const char* path ) {
+  std::string fh;
+  int         fhs_status = -1;
+  int         status     = co_await nfs_coro::rpc_call(
+    nfs_get_rpc_context( nfs ), MOUNT_PROGRAM, MOUNT_V3, MOUNT3_MNT, (zdrproc_t) zdr_mountres3, sizeof( mountres3 ),
+    [ & ]( zdr_t* zdrs ) {
+      dirpath p = (dirpath) path;
+      return zdr_dirpath( zdrs, &p ) != 0;
+    },
+    [ & ]( int status, void* data ) {
+      mountres3* res = (mountres3*) data;
+      if ( status == RPC_STATUS_SUCCESS && ( fhs_status = res->fhs_status ) == MNT3_OK ) {
+        fh.assign( res->mountres3_u.mountinfo.fhandle.fhandle3_val, res->mountres3_u.mountinfo.fhandle.fhandle3_len );
+      }
+    } );
+  if ( status != RPC_STATUS_SUCCESS || fhs_status != MNT3_OK ) {
+    co_return -EIO;
+  }
+  struct nfs_fh root { (int) fh.size(), &fh[ 0 ] };
+  co_return nfs_fh_inline_set( &nfs->nfsi->rootfh, &root ) == 0 ? 0 : -EINVAL;
+}
+
+/* connect, mount, lookup, read: the whole chain as straight-line code */
+static nfs_coro::task< std::string > read_file( struct nfs_context* nfs, int port, const char* exp, const char* path ) {
+  if ( co_await nfs_coro::connect( nfs, "127.0.0.1", port ) < 0 || co_await mount( nfs, exp ) < 0 ) {
+    co_return "no mount";
+  }
+  nfs_coro::lookup_result f = co_await nfs_coro::lookup( nfs, path );
+  if ( f.err ) {
+    co_return "no file";
+  }
+  EXPECT_TRUE( f.has_attr );
+  std::string   data( f.attr.size, '\0' );
+  struct nfs_fh fh = nfs_fh_inline_get( &f.fh );
+  int           n  = co_await nfs_coro::pread( nfs, &fh, 0, data.size(), &data[ 0 ] );
+  co_return n == (int) data.size() ? data : "short read";
+}
+
+TEST( nfs_v3_coro, mount_lookup_read ) {
+  coro_fixture f;
+  f.write_file( "motd", "hello from the loopback server" );
+  std::string data = nfs_coro::run( f.loop, read_file( f.nfs, nfs_server_get_port( f.srv ), nfs_server_get_export( f.srv ), "/motd" ) );
+  EXPECT_EQ( data, "hello from the loopback server" );
+
+  /* errors come back as values */
+  nfs_coro::lookup_result missing = nfs_coro::run( f.loop, []( struct nfs_context* nfs ) -> nfs_coro::task< nfs_coro::lookup_result > {
+    co_return co_await nfs_coro::lookup( nfs, "/missing" );
+  }( f.nfs ) );
+  EXPECT_EQ( missing.err, -ENOENT );
+}
+
+static nfs_coro::task< nfs_coro::attr_result > stat_one( struct nfs_context* nfs, std::string path ) {
+  nfs_coro::lookup_result f = co_await nfs_coro::lookup( nfs, path.c_str() );
+  if ( f.err ) {
+    co_return nfs_coro::attr_result { f.err, {} };
+  }
+  struct nfs_fh fh = nfs_fh_inline_get( &f.fh );
+  co_return co_await nfs_coro::getattr( nfs, &fh );
+}
+
+/* hundreds of independent lookups and GETATTRs in flight at once */
+TEST( nfs_v3_coro, when_all_fan_out ) {
+  coro_fixture f;
+  const int    files = 300;
+  for ( int i = 0; i < files; i++ ) {
+    f.write_file( ( "f" + std::to_string( i ) ).c_str(), std::string( i, 'x' ) );
+  }
+  nfs_set_attrcache( f.nfs, 0 );
+  nfs_set_lookupcache( f.nfs, 0 );
+  ASSERT_EQ( nfs_coro::run( f.loop, []( coro_fixture* f ) -> nfs_coro::task< int > {
+               if ( int err = co_await nfs_coro::connect( f->nfs, "127.0.0.1", nfs_server_get_port( f->srv ) ) ) {
+                 co_return err;
+               }
+               co_return co_await mount( f->nfs, nfs_server_get_export( f->srv ) );
+             }( &f ) ),
+             0 );
+
+  std::vector< nfs_coro::task< nfs_coro::attr_result > > tasks;
+  for ( int i = 0; i < files; i++ ) {
+    tasks.push_back( stat_one( f.nfs, "/f" + std::to_string( i ) ) );
+  }
+  tasks.push_back( stat_one( f.nfs, "/not-there" ) );
+
+  std::vector< nfs_coro::attr_result > results =
+    nfs_coro::run( f.loop, []( auto tasks ) -> nfs_coro::task< std::vector< nfs_coro::attr_result > > {
+      co_return co_await nfs_coro::when_all( std::move( tasks ) );
+    }( std::move( tasks ) ) );
+
+  ASSERT_EQ( results.size(), (size_t) files + 1 );
+  for ( int i = 0; i < files; i++ ) {
+    EXPECT_EQ( results[ i ].err, 0 );
+    EXPECT_EQ( results[ i ].attr.size, (uint64_t) i );
+  }
+  EXPECT_EQ( results[ files ].err, -ENOENT );
+
+  /* task< void > and an empty fan-out */
+  int count = 0;
+  nfs_coro::run( f.loop, []( struct nfs_context* nfs, int* count ) -> nfs_coro::task< void > {
+    std::vector< nfs_coro::task< void > > pings;
+    for ( int i = 0; i < 50; i++ ) {
+      pings.push_back( []( struct nfs_context* nfs, int* count ) -> nfs_coro::task< void > {
+        *count += co_await nfs_coro::null( nfs ) == 0;
+      }( nfs, count ) );
+    }
+    co_await nfs_coro::when_all( std::move( pings ) );
+    co_await nfs_coro::when_all( std::vector< nfs_coro::task< void > >() );
+  }( f.nfs, &count ) );
+  EXPECT_EQ( count, 50 );
+}
+
+/* calls answered from a cache complete without suspending */
+TEST( nfs_v3_coro, completes_inline ) {
+  coro_fixture f;
+  f.write_file( "a", "abc" );
+  int suspended = nfs_coro::run( f.loop, []( coro_fixture* f ) -> nfs_coro::task< int > {
+    co_await nfs_coro::connect( f->nfs, "127.0.0.1", nfs_server_get_port( f->srv ) );
+    co_await mount( f->nfs, nfs_server_get_export( f->srv ) );
+    nfs_coro::lookup_result r  = co_await nfs_coro::lookup( f->nfs, "/a" );
+    struct nfs_fh           fh = nfs_fh_inline_get( &r.fh );
+    co_await nfs_coro::getattr( f->nfs, &fh );
+
+    /* cached now: no reply to wait for, so the loop never runs */
+    uint64_t before = nfs_get_rpc_context( f->nfs )->stats.num_resp_rcvd;
+    for ( int i = 0; i < 1000; i++ ) {
+      nfs_coro::attr_result a = co_await nfs_coro::getattr( f->nfs, &fh );
+      EXPECT_EQ( a.attr.size, 3u );
+    }
+    co_return (int) ( nfs_get_rpc_context( f->nfs )->stats.num_resp_rcvd - before );
+  }( &f ) );
+  EXPECT_EQ( suspended, 0 );
+}
+
+/* a call that cannot be started completes at once with its own errno */
+TEST( nfs_v3_coro, start_failure_errno ) {
+  coro_fixture f;
+  struct nfs_fh bad { NFS3_FHSIZE + 1, (char*) "" };
+  nfs_coro::run( f.loop, []( coro_fixture* f, struct nfs_fh* fh ) -> nfs_coro::task< void > {
+    nfs_coro::attr_result a = co_await nfs_coro::getattr( f->nfs, fh );
+    EXPECT_EQ( a.err, -EINVAL );
+    nfs_coro::lookup_result r = co_await nfs_coro::lookup( f->nfs, "/a" );
+    EXPECT_EQ( r.err, -ENOTCONN );
+  }( &f, &bad ) );
+}
+
+#ifndef NDEBUG
+TEST( nfs_v3_coro, empty_task_asserts ) {
+  EXPECT_DEATH( nfs_coro::run( nullptr, nfs_coro::task< int >() ), "empty task" );
+  EXPECT_DEATH( nfs_coro::run( nullptr, []() -> nfs_coro::task< int > {
+                  nfs_coro::task< int > t = []() -> nfs_coro::task< int > { co_return 1; }();
+                  nfs_coro::task< int > u = std::move( t );
+                  co_return co_await t;
+                }() ),
+                "empty task" );
+}
+#endif
+#else
+TEST( nfs_v3_coro, unsupported ) {
+  GTEST_SKIP() << "built without C++20 coroutines";
+}
+#endif
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,302 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../rpc/fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * One directory on the fake server, handle 0, holding files f0..f<n-1> with
+ * handles 1..n. Its mtime and cookie verifier are `gen`; READDIRPLUS
+ * returns `page` entries per call and bumps gen once after the first page
+ * if `change_while_listing` is set.
+ */
+struct fake_dir {
+  std::mutex mtx;
+  uint32_t   gen                  = 1;
+  int        n                    = 25;
+  int        page                 = 10;
+  bool       change_while_listing = false;
+  int        readdirs             = 0;
+  int        getattrs             = 0;
+  int        lookups              = 0;
+
+  static uint32_t get_u32( const char*& p ) {
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    p += 4;
+    return ntohl( v );
+  }
+
+  static void put_fattr3( std::string& r, uint32_t type, uint32_t id, uint32_t mtime ) {
+    uint32_t words[] = { type, 0755, 1, 0, 0, 0, 100 + id, 0, 4096, 0, 0, 0, 1, 0, id, mtime, 0, mtime, 0, mtime, 0 };
+    for ( uint32_t w : words ) {
+      fake_server::put_u32( r, w );
+    }
+  }
+
+  static void put_fh( std::string& r, uint32_t id ) {
+    fake_server::put_u32( r, 4 );
+    r.append( (const char*) &id, 4 );
+  }
+
+  void put_attrs( std::string& r, uint32_t id ) {
+    if ( id == 0 ) {
+      put_fattr3( r, NF3DIR, 0, gen );
+    } else {
+      put_fattr3( r, NF3REG, id, 7 );
+    }
+  }
+
+  std::string results( const std::vector< char >& call ) {
+    std::lock_guard< std::mutex > lock( mtx );
+    const char* p    = call.data() + 20;
+    uint32_t    proc = get_u32( p );
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* cred */
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* verf */
+    p += 4;                            /* fh length, always 4 */
+    uint32_t id;
+    memcpy( &id, p, 4 );
+    p += 4;
+
+    std::string r;
+    if ( proc == NFS3_GETATTR ) {
+      getattrs++;
+      fake_server::put_u32( r, NFS3_OK );
+      put_attrs( r, id );
+    } else if ( proc == NFS3_LOOKUP ) {
+      lookups++;
+      uint32_t    len = get_u32( p );
+      std::string name( p, len );
+      int         i   = name[ 0 ] == 'f' ? atoi( name.c_str() + 1 ) : -1;
+      if ( i < 0 || i >= n ) {
+        fake_server::put_u32( r, NFS3ERR_NOENT );
+        fake_server::put_u32( r, 0 );
+        return r;
+      }
+      fake_server::put_u32( r, NFS3_OK );
+      put_fh( r, i + 1 );
+      fake_server::put_u32( r, 1 );
+      put_attrs( r, i + 1 );
+      fake_server::put_u32( r, 1 );
+      put_attrs( r, 0 );
+    } else if ( proc == NFS3_READDIRPLUS ) {
+      readdirs++;
+      uint64_t cookie = (uint64_t) get_u32( p ) << 32;
+      cookie |= get_u32( p );
+      uint32_t verf = get_u32( p );
+      get_u32( p );
+      if ( cookie && verf != gen ) {
+        fake_server::put_u32( r, NFS3ERR_BAD_COOKIE );
+        fake_server::put_u32( r, 0 );
+        return r;
+      }
+      fake_server::put_u32( r, NFS3_OK );
+      fake_server::put_u32( r, 1 );
+      put_attrs( r, 0 );
+      fake_server::put_u32( r, gen );
+      fake_server::put_u32( r, 0 );
+      int i = (int) cookie;
+      for ( int end = std::min( i + page, n ); i < end; i++ ) {
+        std::string name = "f" + std::to_string( i );
+        fake_server::put_u32( r, 1 );
+        fake_server::put_u32( r, 0 );
+        fake_server::put_u32( r, i + 1 );
+        fake_server::put_u32( r, name.size() );
+        r += name;
+        r.append( ZDR_ROUNDUP( name.size() ) - name.size(), '\0' );
+        fake_server::put_u32( r, 0 );
+        fake_server::put_u32( r, i + 1 );
+        fake_server::put_u32( r, 1 );
+        put_attrs( r, i + 1 );
+        fake_server::put_u32( r, 1 );
+        put_fh( r, i + 1 );
+      }
+      fake_server::put_u32( r, 0 );
+      fake_server::put_u32( r, i == n );
+      if ( change_while_listing ) {
+        change_while_listing = false;
+        gen++;
+      }
+    }
+    return r;
+  }
+};
+
+struct dir_state {
+  int            done;
+  int            result;
+  struct nfsdir* dir;
+  std::string    name;
+  uint64_t       inode;
+};
+
+static void dir_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  dir_state* s = (dir_state*) private_data;
+  s->result    = err;
+  s->done++;
+  if ( err == 0 ) {
+    s->dir = (struct nfsdir*) data;
+  }
+}
+
+static void lookup_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  dir_state* s = (dir_state*) private_data;
+  s->result    = err;
+  s->done++;
+  if ( err == 0 ) {
+    struct nfsdirent* ent = (struct nfsdirent*) data;
+    s->name               = ent->name;
+    memcpy( &s->inode, ent->fh.val, 4 );
+  }
+}
+
+struct dir_fixture {
+  fake_dir            files;
+  fake_server         srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+  uint32_t            root = 0;
+  struct nfs_fh       rootfh { 4, (char*) &root };
+
+  dir_fixture() : srv( fake_server::REPLY, [ this ]( const std::vector< char >& c ) { return files.results( c ); } ) {
+    loop = rpc_loop_create();
+    nfs  = nfs_init_context();
+    nfs_loop_add( loop, nfs );
+    dir_state conn {};
+    nfs_connect_async( nfs, "127.0.0.1", srv.port, dir_cb, &conn );
+    run( [ & ] { return conn.done > 0; } );
+  }
+
+  ~dir_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+  }
+
+  void run( const std::function< bool() >& done ) {
+    for ( int i = 0; i < 3000 && !done(); i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  int count( int fake_dir::*field ) {
+    std::lock_guard< std::mutex > lock( files.mtx );
+    return files.*field;
+  }
+
+  /* open, list and close the directory; returns the names */
+  std::vector< std::string > list() {
+    dir_state s {};
+    EXPECT_EQ( nfs_opendir_async( nfs, &rootfh, dir_cb, &s ), 0 );
+    run( [ & ] { return s.done > 0; } );
+    EXPECT_EQ( s.result, 0 );
+    std::vector< std::string > names;
+    if ( s.result == 0 ) {
+      while ( struct nfsdirent* ent = nfs_readdir( nfs, s.dir ) ) {
+        names.push_back( ent->name );
+      }
+      nfs_closedir( nfs, s.dir );
+    }
+    return names;
+  }
+
+  dir_state lookup( const char* name ) {
+    dir_state s {};
+    EXPECT_EQ( nfs_lookup_async( nfs, &rootfh, name, lookup_cb, &s ), 0 );
+    run( [ & ] { return s.done > 0; } );
+    return s;
+  }
+};
+
+static void getattr_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  dir_state* s = (dir_state*) private_data;
+  s->result    = err;
+  s->done++;
+  if ( err == 0 ) {
+    s->inode = ( (struct nfs_attr*) data )->size;
+  }
+}
+
+TEST( nfs_v3_dircache, listing_answers_stat_and_lookup ) {
+  dir_fixture f;
+
+  std::vector< std::string > names = f.list();
+  ASSERT_EQ( names.size(), 25u );
+  EXPECT_EQ( names[ 0 ], "f0" );
+  EXPECT_EQ( names[ 24 ], "f24" );
+  EXPECT_EQ( f.count( &fake_dir::readdirs ), 3 );
+
+  /* every entry's attributes came with the listing */
+  for ( uint32_t id = 1; id <= 25; id++ ) {
+    struct nfs_fh fh { 4, (char*) &id };
+    dir_state     s {};
+    ASSERT_EQ( nfs_getattr_async( f.nfs, &fh, getattr_cb, &s ), 0 );
+    ASSERT_EQ( s.done, 1 );
+    EXPECT_EQ( s.inode, 100u + id );
+  }
+
+  /* and so did the handles, and what is not there */
+  dir_state s = f.lookup( "f7" );
+  EXPECT_EQ( s.result, 0 );
+  EXPECT_EQ( s.inode, 8u );
+  EXPECT_EQ( f.lookup( "nope" ).result, -ENOENT );
+  EXPECT_EQ( f.count( &fake_dir::getattrs ), 0 );
+  EXPECT_EQ( f.count( &fake_dir::lookups ), 0 );
+
+  /* without the dircache and the lookup cache it is a LOOKUP */
+  nfs_set_dircache( f.nfs, 0 );
+  nfs_set_lookupcache( f.nfs, 0 );
+  EXPECT_EQ( f.lookup( "f3" ).inode, 4u );
+  EXPECT_EQ( f.count( &fake_dir::lookups ), 1 );
+}
+
+TEST( nfs_v3_dircache, revalidated_by_mtime ) {
+  dir_fixture f;
+
+  /* while the directory attributes are cached, reopening costs nothing */
+  f.list();
+  EXPECT_EQ( f.list().size(), 25u );
+  EXPECT_EQ( f.count( &fake_dir::readdirs ), 3 );
+  EXPECT_EQ( f.count( &fake_dir::getattrs ), 0 );
+
+  /* without them it takes a GETATTR, but no new listing */
+  nfs_set_dircache( f.nfs, 0 );
+  nfs_set_dircache( f.nfs, 1 );
+  nfs_set_attrcache_timeouts( f.nfs, 0, 0, 0, 0 );
+  f.list();
+  EXPECT_EQ( f.list().size(), 25u );
+  EXPECT_EQ( f.count( &fake_dir::getattrs ), 1 );
+  EXPECT_EQ( f.count( &fake_dir::readdirs ), 6 );
+
+  /* a new mtime means a new listing */
+  {
+    std::lock_guard< std::mutex > lock( f.files.mtx );
+    f.files.gen++;
+    f.files.n++;
+  }
+  EXPECT_EQ( f.list().size(), 26u );
+  EXPECT_EQ( f.count( &fake_dir::getattrs ), 2 );
+  EXPECT_EQ( f.count( &fake_dir::readdirs ), 9 );
+}
+
+TEST( nfs_v3_dircache, verifier_change_restarts_listing ) {
+  dir_fixture f;
+  f.files.change_while_listing = true;
+
+  std::vector< std::string > names = f.list();
+  ASSERT_EQ( names.size(), 25u );
+  EXPECT_EQ( names[ 10 ], "f10" );
+  /* page one, rejected page two, then all three again */
+  EXPECT_EQ( f.count( &fake_dir::readdirs ), 5 );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
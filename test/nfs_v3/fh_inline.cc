@@ -0,0 +1,54 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <unordered_set>
+
+#include <nfs/v3/nfs_v3.h>
+
+TEST( nfs_v3_fh_inline, set_compare_and_view ) {
+  char                 a[ NFS3_FHSIZE ], b[ NFS3_FHSIZE ];
+  struct nfs_fh_inline x, y;
+  memset( a, 0xab, sizeof( a ) );
+  memcpy( b, a, sizeof( b ) );
+
+  struct nfs_fh fa { 32, a }, fb { 32, b };
+  ASSERT_EQ( nfs_fh_inline_set( &x, &fa ), 0 );
+  ASSERT_EQ( nfs_fh_inline_set( &y, &fb ), 0 );
+  EXPECT_TRUE( nfs_fh_inline_equal( &x, &y ) );
+  EXPECT_EQ( x.hash, y.hash );
+
+  /* the bytes past len do not count, the length does */
+  b[ 40 ] = 0;
+  ASSERT_EQ( nfs_fh_inline_set( &y, &fb ), 0 );
+  EXPECT_TRUE( nfs_fh_inline_equal( &x, &y ) );
+  fb.len = 33;
+  ASSERT_EQ( nfs_fh_inline_set( &y, &fb ), 0 );
+  EXPECT_FALSE( nfs_fh_inline_equal( &x, &y ) );
+  fb.len  = 32;
+  b[ 31 ] = 0;
+  ASSERT_EQ( nfs_fh_inline_set( &y, &fb ), 0 );
+  EXPECT_FALSE( nfs_fh_inline_equal( &x, &y ) );
+
+  struct nfs_fh view = nfs_fh_inline_get( &x );
+  EXPECT_EQ( view.len, 32 );
+  EXPECT_EQ( memcmp( view.val, a, 32 ), 0 );
+
+  struct nfs_fh too_long { NFS3_FHSIZE + 1, a };
+  EXPECT_EQ( nfs_fh_inline_set( &x, &too_long ), -1 );
+}
+
+TEST( nfs_v3_fh_inline, hash_spreads_small_handles ) {
+  std::unordered_set< uint32_t > hashes;
+  for ( uint32_t id = 0; id < 10000; id++ ) {
+    struct nfs_fh        fh { 4, (char*) &id };
+    struct nfs_fh_inline ifh;
+    nfs_fh_inline_set( &ifh, &fh );
+    hashes.insert( ifh.hash );
+  }
+  EXPECT_EQ( hashes.size(), 10000u );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
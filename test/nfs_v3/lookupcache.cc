@@ -0,0 +1,219 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../rpc/fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * An endless tree on the fake server: the root has handle 0, and every
+ * directory holds subdirectories d0..d9, the handle of dN in directory p
+ * being p * 16 + N + 1. Other names are not there.
+ */
+struct fake_tree {
+  std::mutex              mtx;
+  int                     lookups = 0;
+  std::vector< uint32_t > parents; /* of each LOOKUP */
+
+  static uint32_t get_u32( const char*& p ) {
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    p += 4;
+    return ntohl( v );
+  }
+
+  static void put_fattr3( std::string& r, uint32_t id ) {
+    uint32_t words[] = { NF3DIR, 0755, 2, 0, 0, 0, 4096, 0, 4096, 0, 0, 0, 1, 0, id, 1, 0, 1, 0, 1, 0 };
+    for ( uint32_t w : words ) {
+      fake_server::put_u32( r, w );
+    }
+  }
+
+  std::string results( const std::vector< char >& call ) {
+    std::lock_guard< std::mutex > lock( mtx );
+    const char* p = call.data() + 24;
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* cred */
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* verf */
+    p += 4;                            /* fh length, always 4 */
+    uint32_t dir;
+    memcpy( &dir, p, 4 );
+    p += 4;
+    uint32_t    len = get_u32( p );
+    std::string name( p, len );
+
+    lookups++;
+    parents.push_back( dir );
+    std::string r;
+    if ( name.size() != 2 || name[ 0 ] != 'd' || name[ 1 ] < '0' || name[ 1 ] > '9' ) {
+      fake_server::put_u32( r, NFS3ERR_NOENT );
+      fake_server::put_u32( r, 0 );
+      return r;
+    }
+    uint32_t id = dir * 16 + ( name[ 1 ] - '0' ) + 1;
+    fake_server::put_u32( r, NFS3_OK );
+    fake_server::put_u32( r, 4 );
+    r.append( (const char*) &id, 4 );
+    fake_server::put_u32( r, 1 );
+    put_fattr3( r, id );
+    fake_server::put_u32( r, 1 );
+    put_fattr3( r, dir );
+    return r;
+  }
+};
+
+struct walk_state {
+  int      done;
+  int      result;
+  uint32_t id;
+};
+
+static void walk_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  walk_state* s = (walk_state*) private_data;
+  s->result     = err;
+  s->done++;
+  if ( err == 0 && data ) {
+    memcpy( &s->id, ( (struct nfsdirent*) data )->fh.val, 4 );
+  }
+}
+
+struct walk_fixture {
+  fake_tree           tree;
+  fake_server         srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+
+  walk_fixture() : srv( fake_server::REPLY, [ this ]( const std::vector< char >& c ) { return tree.results( c ); } ) {
+    loop = rpc_loop_create();
+    nfs  = nfs_init_context();
+    nfs_loop_add( loop, nfs );
+    walk_state conn {};
+    nfs_connect_async( nfs, "127.0.0.1", srv.port, walk_cb, &conn );
+    run( [ & ] { return conn.done > 0; } );
+
+    uint32_t      root = 0;
+    struct nfs_fh fh { 4, (char*) &root };
+    nfs_fh_inline_set( &nfs->nfsi->rootfh, &fh );
+  }
+
+  ~walk_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+  }
+
+  void run( const std::function< bool() >& done ) {
+    for ( int i = 0; i < 3000 && !done(); i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  int lookups() {
+    std::lock_guard< std::mutex > lock( tree.mtx );
+    return tree.lookups;
+  }
+
+  walk_state walk( const char* path ) {
+    walk_state s {};
+    EXPECT_EQ( nfs_lookup_path_async( nfs, path, walk_cb, &s ), 0 );
+    run( [ & ] { return s.done > 0; } );
+    EXPECT_EQ( s.done, 1 );
+    return s;
+  }
+};
+
+static uint32_t tree_id( std::vector< int > path ) {
+  uint32_t id = 0;
+  for ( int n : path ) {
+    id = id * 16 + n + 1;
+  }
+  return id;
+}
+
+TEST( nfs_v3_lookupcache, cached_prefix_and_siblings ) {
+  walk_fixture f;
+
+  walk_state s = f.walk( "/d1/d2/d3/d4/d5/d6/d7/d8/d9" );
+  EXPECT_EQ( s.result, 0 );
+  EXPECT_EQ( s.id, tree_id( { 1, 2, 3, 4, 5, 6, 7, 8, 9 } ) );
+  EXPECT_EQ( f.lookups(), 9 );
+
+  /* all of it cached, then only what is new */
+  EXPECT_EQ( f.walk( "/d1/d2/d3/d4/d5/d6/d7/d8/d9" ).id, s.id );
+  EXPECT_EQ( f.lookups(), 9 );
+  EXPECT_EQ( f.walk( "//d1/./d2/d3/d4/d5/d6/d7/d8/../d8/d0" ).id, tree_id( { 1, 2, 3, 4, 5, 6, 7, 8, 0 } ) );
+  EXPECT_EQ( f.lookups(), 10 );
+  EXPECT_EQ( f.walk( "/d1/d2/d5/d6" ).id, tree_id( { 1, 2, 5, 6 } ) );
+  EXPECT_EQ( f.lookups(), 12 );
+
+  /* relative to cwd */
+  free( f.nfs->nfsi->cwd );
+  f.nfs->nfsi->cwd = strdup( "/d1/d2" );
+  EXPECT_EQ( f.walk( "d3/d4" ).id, tree_id( { 1, 2, 3, 4 } ) );
+  EXPECT_EQ( f.walk( "/" ).id, 0u );
+  EXPECT_EQ( f.lookups(), 12 );
+
+  /* without the cache every component is a LOOKUP */
+  nfs_set_lookupcache( f.nfs, 0 );
+  EXPECT_EQ( f.walk( "/d1/d2/d3" ).result, 0 );
+  EXPECT_EQ( f.lookups(), 15 );
+}
+
+TEST( nfs_v3_lookupcache, negative_entries_expire ) {
+  walk_fixture f;
+  nfs_set_negative_ttl( f.nfs, 1 );
+
+  EXPECT_EQ( f.walk( "/d1/nope" ).result, -ENOENT );
+  EXPECT_EQ( f.lookups(), 2 );
+  EXPECT_EQ( f.walk( "/d1/nope" ).result, -ENOENT );
+  EXPECT_EQ( f.walk( "/d1/nope/d2" ).result, -ENOENT );
+  EXPECT_EQ( f.lookups(), 2 );
+
+  std::this_thread::sleep_for( std::chrono::milliseconds( 1100 ) );
+  EXPECT_EQ( f.walk( "/d1/nope" ).result, -ENOENT );
+  EXPECT_EQ( f.lookups(), 3 );
+
+  /* and without a negative cache ENOENT is asked again */
+  nfs_set_negative_ttl( f.nfs, 0 );
+  EXPECT_EQ( f.walk( "/d1/gone" ).result, -ENOENT );
+  EXPECT_EQ( f.walk( "/d1/gone" ).result, -ENOENT );
+  EXPECT_EQ( f.lookups(), 5 );
+}
+
+TEST( nfs_v3_lookupcache, concurrent_walks_share_lookups ) {
+  walk_fixture f;
+
+  walk_state s[ 5 ] {};
+  for ( walk_state& w : s ) {
+    ASSERT_EQ( nfs_lookup_path_async( f.nfs, "/d3/d1/d4/d1/d5", walk_cb, &w ), 0 );
+  }
+  f.run( [ & ] {
+    for ( walk_state& w : s ) {
+      if ( !w.done ) {
+        return false;
+      }
+    }
+    return true;
+  } );
+  for ( walk_state& w : s ) {
+    EXPECT_EQ( w.result, 0 );
+    EXPECT_EQ( w.id, tree_id( { 3, 1, 4, 1, 5 } ) );
+  }
+  EXPECT_EQ( f.lookups(), 5 );
+
+  /* each asked for under the handle the one before returned */
+  std::lock_guard< std::mutex > lock( f.tree.mtx );
+  EXPECT_EQ( f.tree.parents, ( std::vector< uint32_t >{ 0, tree_id( { 3 } ), tree_id( { 3, 1 } ), tree_id( { 3, 1, 4 } ), tree_id( { 3, 1, 4, 1 } ) } ) );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,359 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <mount/v3/mount_v3.h>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * Multi-threaded mode against the loopback server: application threads
+ * submit concurrently, each draining its own completion queue.
+ */
+struct op_state {
+  int             done;
+  int             err;
+  std::thread::id thread;
+  struct nfs_attr attr;
+};
+
+static void op_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  op_state* s = (op_state*) private_data;
+  s->err      = err;
+  s->thread   = std::this_thread::get_id();
+  if ( err == 0 && data ) {
+    s->attr = *(struct nfs_attr*) data;
+  }
+  s->done++;
+}
+
+/* run completions until `n` have come in, or for at most 10s */
+static int drain( struct nfs_mt_cq* cq, int n ) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds( 10 );
+  int  done     = 0;
+  while ( done < n && std::chrono::steady_clock::now() < deadline ) {
+    int k = nfs_mt_cq_run( cq, 10 );
+    done += k > 0 ? k : 0;
+  }
+  return done;
+}
+
+struct mt_fixture {
+  std::string         dir;
+  struct nfs_server*  srv;
+  struct nfs_context* nfs;
+  struct nfs_mt*      mt;
+  struct nfs_mt_cq*   cq;
+
+  std::atomic< int > mounted { 0 };
+
+  mt_fixture( int nconnect ) {
+    char tmpl[] = "/tmp/nfs_mt_test.XXXXXX";
+    dir         = mkdtemp( tmpl );
+    srv         = nfs_server_start( dir.c_str(), 0, 4 );
+    nfs         = nfs_init_context();
+    nfs_set_nconnect( nfs, nconnect );
+    nfs_set_attrcache( nfs, 0 );
+    mt = nfs_mt_start( nfs );
+    cq = nfs_mt_cq_create();
+  }
+
+  ~mt_fixture() {
+    nfs_mt_stop( mt );
+    nfs_destroy_context( nfs );
+    nfs_mt_cq_destroy( cq );
+    nfs_server_stop( srv );
+    std::filesystem::remove_all( dir );
+  }
+
+  static void mnt_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    mt_fixture* f   = (mt_fixture*) private_data;
+    mountres3*  res = (mountres3*) data;
+    int         ok  = -1;
+    if ( status == RPC_STATUS_SUCCESS && res->fhs_status == MNT3_OK ) {
+      struct nfs_fh fh { (int) res->mountres3_u.mountinfo.fhandle.fhandle3_len, res->mountres3_u.mountinfo.fhandle.fhandle3_val };
+      ok = nfs_fh_inline_set( &f->nfs->nfsi->rootfh, &fh ) == 0 ? 1 : -1;
+    }
+    f->mounted = ok;
+  }
+
+  /* connect through the queue, MNT as a raw call on the I/O thread */
+  bool mount() {
+    op_state s {};
+    if ( nfs_mt_connect( mt, "127.0.0.1", nfs_server_get_port( srv ), cq, op_cb, &s ) < 0 ) {
+      return false;
+    }
+    drain( cq, 1 );
+    if ( s.done != 1 || s.err != 0 ) {
+      return false;
+    }
+    nfs_mt_exec(
+      mt,
+      []( struct nfs_context* nfs, void* arg ) {
+        mt_fixture*     f    = (mt_fixture*) arg;
+        dirpath         path = (dirpath) nfs_server_get_export( f->srv );
+        struct rpc_pdu* pdu  = rpc_allocate_pdu( nfs_get_rpc_context( nfs ), MOUNT_PROGRAM, MOUNT_V3, MOUNT3_MNT, mnt_cb, f,
+                                                 (zdrproc_t) zdr_mountres3, sizeof( mountres3 ), 0 );
+        if ( !pdu || !zdr_dirpath( &pdu->zdr, &path ) || rpc_queue_pdu( nfs_get_rpc_context( nfs ), pdu ) < 0 ) {
+          f->mounted = -1;
+        }
+      },
+      this );
+    for ( int i = 0; mounted == 0 && i < 10000; i++ ) {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+    return mounted == 1;
+  }
+
+  void write_file( const char* name, const std::string& data ) {
+    int fd = open( ( dir + "/" + name ).c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644 );
+    ASSERT_GE( fd, 0 );
+    ASSERT_EQ( write( fd, data.data(), data.size() ), (ssize_t) data.size() );
+    close( fd );
+  }
+};
+
+/* every completion comes back once, on the thread that submitted it */
+TEST( nfs_v3_mt, concurrent_submitters ) {
+  mt_fixture f( 2 );
+  const int  threads = 8;
+  const int  ops     = 200;
+  for ( int t = 0; t < threads; t++ ) {
+    f.write_file( ( "f" + std::to_string( t ) ).c_str(), std::string( 1000 + t, 'a' + t ) );
+  }
+  ASSERT_TRUE( f.mount() );
+
+  std::atomic< int > failures { 0 };
+  auto               worker = [ & ]( int t ) {
+    struct nfs_mt_cq* cq   = nfs_mt_cq_create();
+    std::string       path = "/f" + std::to_string( t );
+
+    /* the name, then its handle for everything else */
+    struct lookup_state {
+      int                  done;
+      int                  err;
+      struct nfs_fh_inline fh;
+    } l {};
+    nfs_mt_lookup_path(
+      f.mt, path.c_str(), cq,
+      []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+        lookup_state* l = (lookup_state*) private_data;
+        l->err          = err;
+        if ( err == 0 ) {
+          l->fh = ( (struct nfsdirent*) data )->fh;
+        }
+        l->done++;
+      },
+      &l );
+    drain( cq, 1 );
+    if ( l.done != 1 || l.err != 0 ) {
+      failures++;
+      nfs_mt_cq_destroy( cq );
+      return;
+    }
+    struct nfs_fh fh = nfs_fh_inline_get( &l.fh );
+
+    std::vector< op_state > getattrs( ops );
+    std::vector< op_state > nulls( ops );
+    std::string             buf( 1000 + t, '\0' );
+    op_state                read {};
+    for ( int i = 0; i < ops; i++ ) {
+      nfs_mt_getattr( f.mt, &fh, cq, op_cb, &getattrs[ i ] );
+      nfs_mt_null( f.mt, cq, op_cb, &nulls[ i ] );
+    }
+    nfs_mt_pread( f.mt, &fh, 0, buf.size(), &buf[ 0 ], cq, op_cb, &read );
+
+    bool ok = drain( cq, 2 * ops + 1 ) == 2 * ops + 1;
+    ok      = ok && read.done == 1 && read.err == (int) buf.size() && read.thread == std::this_thread::get_id() &&
+         buf == std::string( 1000 + t, 'a' + t );
+    for ( int i = 0; i < ops; i++ ) {
+      ok = ok && getattrs[ i ].done == 1 && getattrs[ i ].err == 0 && getattrs[ i ].attr.size == buf.size() &&
+           getattrs[ i ].thread == std::this_thread::get_id();
+      ok = ok && nulls[ i ].done == 1 && nulls[ i ].err == 0 && nulls[ i ].thread == std::this_thread::get_id();
+    }
+    failures += !ok;
+    /* everything has run, so nothing holds the queue any more */
+    failures += nfs_mt_cq_destroy( cq ) < 0;
+  };
+
+  std::vector< std::thread > workers;
+  for ( int t = 0; t < threads; t++ ) {
+    workers.emplace_back( worker, t );
+  }
+  for ( std::thread& w : workers ) {
+    w.join();
+  }
+  EXPECT_EQ( failures, 0 );
+
+  /* requests were spread over both connections, all by the one I/O thread */
+  std::unique_ptr< struct rpc_stats, void ( * )( struct rpc_stats* ) > stats( rpc_alloc_stats(), rpc_free_stats );
+  nfs_get_stats( f.nfs, stats.get() );
+  EXPECT_GE( stats->num_req_sent, (uint64_t) threads * ( 2 * ops + 2 ) );
+  EXPECT_GT( nfs_get_connection( f.nfs, 1 )->stats.num_req_sent, 0u );
+}
+
+/* without a queue, callbacks run on the I/O thread, like nfs_mt_exec() */
+TEST( nfs_v3_mt, io_thread_callbacks ) {
+  mt_fixture f( 1 );
+  ASSERT_TRUE( f.mount() );
+
+  struct thread_state {
+    std::atomic< int > done { 0 };
+    std::thread::id    thread;
+  } exec, null;
+  nfs_mt_exec(
+    f.mt,
+    []( struct nfs_context* nfs, void* arg ) {
+      thread_state* s = (thread_state*) arg;
+      s->thread       = std::this_thread::get_id();
+      s->done         = 1;
+    },
+    &exec );
+  nfs_mt_null(
+    f.mt, nullptr,
+    []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+      thread_state* s = (thread_state*) private_data;
+      s->thread       = std::this_thread::get_id();
+      s->done         = err == 0 ? 1 : -1;
+    },
+    &null );
+  for ( int i = 0; ( !exec.done || !null.done ) && i < 10000; i++ ) {
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+  }
+  ASSERT_EQ( exec.done, 1 );
+  ASSERT_EQ( null.done, 1 );
+  EXPECT_NE( exec.thread, std::this_thread::get_id() );
+  EXPECT_EQ( null.thread, exec.thread );
+}
+
+/* more submissions than the ring holds wait for room instead of failing */
+TEST( nfs_v3_mt, ring_backpressure ) {
+  mt_fixture f( 1 );
+  ASSERT_TRUE( f.mount() );
+
+  const int               n = 3 * RPC_LOOP_RING_SIZE;
+  std::vector< op_state > nulls( n );
+  for ( int i = 0; i < n; i++ ) {
+    ASSERT_EQ( nfs_mt_null( f.mt, f.cq, op_cb, &nulls[ i ] ), 0 );
+  }
+  EXPECT_EQ( drain( f.cq, n ), n );
+  for ( int i = 0; i < n; i++ ) {
+    ASSERT_EQ( nulls[ i ].done, 1 );
+    ASSERT_EQ( nulls[ i ].err, 0 );
+  }
+}
+
+/* an open file is written, synced and closed through the queue */
+TEST( nfs_v3_mt, write_fsync_close ) {
+  mt_fixture f( 1 );
+  f.write_file( "w", "" );
+  ASSERT_TRUE( f.mount() );
+
+  struct lookup_state {
+    int                  done;
+    int                  err;
+    struct nfs_fh_inline fh;
+  } l {};
+  nfs_mt_lookup_path(
+    f.mt, "/w", f.cq,
+    []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+      lookup_state* l = (lookup_state*) private_data;
+      l->err          = err;
+      if ( err == 0 ) {
+        l->fh = ( (struct nfsdirent*) data )->fh;
+      }
+      l->done++;
+    },
+    &l );
+  ASSERT_EQ( drain( f.cq, 1 ), 1 );
+  ASSERT_EQ( l.err, 0 );
+  struct nfs_fh fh    = nfs_fh_inline_get( &l.fh );
+  struct nfsfh* nfsfh = nfs_open_fh( f.nfs, &fh );
+  ASSERT_NE( nfsfh, nullptr );
+
+  std::string a( 3000, 'a' ), b( 2000, 'b' );
+  op_state    wa {}, wb {}, sync {}, close {};
+  ASSERT_EQ( nfs_mt_pwrite( f.mt, nfsfh, 0, a.size(), a.data(), f.cq, op_cb, &wa ), 0 );
+  ASSERT_EQ( nfs_mt_pwrite( f.mt, nfsfh, a.size(), b.size(), b.data(), f.cq, op_cb, &wb ), 0 );
+  ASSERT_EQ( nfs_mt_fsync( f.mt, nfsfh, f.cq, op_cb, &sync ), 0 );
+  ASSERT_EQ( drain( f.cq, 3 ), 3 );
+  EXPECT_EQ( wa.err, (int) a.size() );
+  EXPECT_EQ( wb.err, (int) b.size() );
+  EXPECT_EQ( sync.err, 0 );
+  EXPECT_EQ( std::filesystem::file_size( f.dir + "/w" ), a.size() + b.size() );
+
+  ASSERT_EQ( nfs_mt_close( f.mt, nfsfh, f.cq, op_cb, &close ), 0 );
+  ASSERT_EQ( drain( f.cq, 1 ), 1 );
+  EXPECT_EQ( close.err, 0 );
+}
+
+/* a call failing on the I/O thread completes with its own errno and message */
+TEST( nfs_v3_mt, real_errors ) {
+  mt_fixture f( 1 );
+  f.write_file( "r", "data" );
+  ASSERT_TRUE( f.mount() );
+
+  struct err_state {
+    int         done;
+    int         err;
+    std::string msg;
+  } s {};
+  struct nfs_fh fh { 4, (char*) "\0\0\0\0" };
+  char          buf[ 1 ];
+  ASSERT_EQ( nfs_mt_pread(
+               f.mt, &fh, 0, 1ULL << 32, buf, f.cq,
+               []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+                 err_state* s = (err_state*) private_data;
+                 s->err       = err;
+                 s->msg       = data ? (const char*) data : "";
+                 s->done++;
+               },
+               &s ),
+             0 );
+  ASSERT_EQ( drain( f.cq, 1 ), 1 );
+  EXPECT_EQ( s.err, -EINVAL );
+  EXPECT_EQ( s.msg.rfind( "Read of", 0 ), 0u ) << s.msg;
+}
+
+/* a queue with calls in flight is not freed under them */
+TEST( nfs_v3_mt, cq_destroy_refused_while_busy ) {
+  mt_fixture f( 1 );
+  ASSERT_TRUE( f.mount() );
+
+  /* hold the I/O thread so that the call stays in flight */
+  std::atomic< bool > release { false };
+  nfs_mt_exec(
+    f.mt,
+    []( struct nfs_context* nfs, void* arg ) {
+      while ( !( (std::atomic< bool >*) arg )->load() ) {
+        std::this_thread::yield();
+      }
+    },
+    &release );
+  struct nfs_mt_cq* cq = nfs_mt_cq_create();
+  op_state          null {};
+  ASSERT_EQ( nfs_mt_null( f.mt, cq, op_cb, &null ), 0 );
+  errno = 0;
+  EXPECT_EQ( nfs_mt_cq_destroy( cq ), -1 );
+  EXPECT_EQ( errno, EBUSY );
+
+  release = true;
+  ASSERT_EQ( drain( cq, 1 ), 1 );
+  EXPECT_EQ( null.err, 0 );
+  EXPECT_EQ( nfs_mt_cq_destroy( cq ), 0 );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
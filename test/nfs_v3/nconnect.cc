@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+#include "../rpc/fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+struct nfs_state {
+  int done;
+  int ok;
+  int err;
+};
+
+static void nfs_count_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  nfs_state* s = (nfs_state*) private_data;
+  ( err ? s->err : s->ok )++;
+  s->done++;
+}
+
+static void run_until( struct rpc_loop* loop, const std::function< bool() >& done ) {
+  for ( int i = 0; i < 1000 && !done(); i++ ) {
+    ASSERT_GE( rpc_loop_run_once( loop, 10 ), 0 );
+  }
+}
+
+static struct nfs_context* connect_nfs( fake_server& srv, struct rpc_loop* loop, int nconnect ) {
+  struct nfs_context* nfs = nfs_init_context();
+  nfs_set_nconnect( nfs, nconnect );
+  EXPECT_EQ( nfs_loop_add( loop, nfs ), 0 );
+
+  nfs_state conn {};
+  EXPECT_EQ( nfs_connect_async( nfs, "127.0.0.1", srv.port, nfs_count_cb, &conn ), 0 );
+  run_until( loop, [ & ] { return conn.done > 0; } );
+  EXPECT_EQ( conn.ok, 1 );
+  return nfs;
+}
+
+TEST( nfs_v3_nconnect, url_arguments ) {
+  struct nfs_context* nfs = nfs_init_context();
+
+  struct nfs_url* url = nfs_parse_url_full( nfs, "nfs://127.0.0.1:2049/export/f?nconnect=4&uid=7&x=1" );
+  ASSERT_NE( url, nullptr );
+  EXPECT_EQ( nfs_num_connections( nfs ), 4 );
+  EXPECT_EQ( nfs_get_rpc_context( nfs )->uid, 7 );
+  nfs_destroy_url( url );
+
+  url = nfs_parse_url_full( nfs, "nfs://127.0.0.1/export/f?nconnect=100" );
+  ASSERT_NE( url, nullptr );
+  EXPECT_EQ( nfs_num_connections( nfs ), NFS_MAX_NCONNECT );
+  nfs_destroy_url( url );
+
+  nfs_destroy_context( nfs );
+}
+
+TEST( nfs_v3_nconnect, stripes_by_outstanding_bytes ) {
+  fake_server         srv;
+  struct rpc_loop*    loop = rpc_loop_create();
+  struct nfs_context* nfs  = connect_nfs( srv, loop, 4 );
+  run_until( loop, [ & ] { return srv.num_connections() == 4; } );
+  EXPECT_EQ( srv.num_connections(), 4 );
+
+  /* nothing completes while corked, so every call goes to the emptiest */
+  nfs_state calls {};
+  nfs_cork( nfs );
+  for ( int i = 0; i < 40; i++ ) {
+    ASSERT_EQ( nfs_null_async( nfs, nfs_count_cb, &calls ), 0 );
+  }
+  for ( int i = 0; i < 4; i++ ) {
+    EXPECT_EQ( rpc_queue_length( nfs_get_connection( nfs, i ) ), 10 );
+  }
+  nfs_uncork( nfs );
+  run_until( loop, [ & ] { return calls.done == 40; } );
+  EXPECT_EQ( calls.ok, 40 );
+
+  std::unique_ptr< struct rpc_stats, void ( * )( struct rpc_stats* ) > stats( rpc_alloc_stats(), rpc_free_stats );
+  nfs_get_stats( nfs, stats.get() );
+  EXPECT_EQ( stats->num_req_sent, 40u );
+  EXPECT_EQ( stats->num_resp_rcvd, 40u );
+  for ( int i = 0; i < 4; i++ ) {
+    EXPECT_EQ( nfs_get_connection( nfs, i )->outstanding_bytes, 0u );
+  }
+
+  nfs_destroy_context( nfs );
+  rpc_loop_destroy( loop );
+}
+
+TEST( nfs_v3_nconnect, reconnect_resends_pending ) {
+  fake_server         srv( fake_server::SILENT );
+  struct rpc_loop*    loop = rpc_loop_create();
+  struct nfs_context* nfs  = connect_nfs( srv, loop, 2 );
+
+  nfs_state calls {};
+  for ( int i = 0; i < 4; i++ ) {
+    ASSERT_EQ( nfs_null_async( nfs, nfs_count_cb, &calls ), 0 );
+  }
+  run_until( loop, [ & ] { return srv.num_calls == 4; } );
+
+  srv.drop();
+  std::unique_ptr< struct rpc_stats, void ( * )( struct rpc_stats* ) > stats( rpc_alloc_stats(), rpc_free_stats );
+  run_until( loop, [ & ] {
+    nfs_get_stats( nfs, stats.get() );
+    return stats->num_reconnects == 2 && srv.num_calls == 8;
+  } );
+  EXPECT_EQ( stats->num_reconnects, 2u );
+  EXPECT_EQ( stats->num_retransmitted, 4u );
+  EXPECT_EQ( srv.num_connections(), 4 );
+  EXPECT_EQ( calls.done, 0 );
+
+  nfs_destroy_context( nfs );
+  EXPECT_EQ( calls.err, 4 );
+  rpc_loop_destroy( loop );
+}
+
+TEST( nfs_v3_nconnect, no_reconnect_fails_pending ) {
+  fake_server         srv( fake_server::SILENT );
+  struct rpc_loop*    loop = rpc_loop_create();
+  struct nfs_context* nfs  = connect_nfs( srv, loop, 2 );
+  nfs_set_autoreconnect( nfs, 0 );
+
+  nfs_state calls {};
+  for ( int i = 0; i < 4; i++ ) {
+    ASSERT_EQ( nfs_null_async( nfs, nfs_count_cb, &calls ), 0 );
+  }
+  run_until( loop, [ & ] { return srv.num_calls == 4; } );
+  srv.drop();
+  run_until( loop, [ & ] { return calls.done == 4; } );
+  EXPECT_EQ( calls.err, 4 );
+  EXPECT_EQ( srv.num_connections(), 2 );
+
+  nfs_destroy_context( nfs );
+  rpc_loop_destroy( loop );
+}
+
+/* completions while tearing down must not touch connections already gone */
+TEST( nfs_v3_nconnect, destroy_with_reads_in_flight ) {
+  fake_server         srv( fake_server::SILENT );
+  struct rpc_loop*    loop = rpc_loop_create();
+  struct nfs_context* nfs  = connect_nfs( srv, loop, 2 );
+  run_until( loop, [ & ] { return srv.num_connections() == 2; } );
+
+  std::vector< char > buf( 8 << 20 );
+  struct nfs_fh       fh { 4, (char*) "\0\0\0\1" };
+  nfs_state           read {};
+  ASSERT_EQ( nfs_pread_async( nfs, &fh, 0, buf.size(), buf.data(), nfs_count_cb, &read ), 0 );
+  run_until( loop, [ & ] { return srv.num_calls >= 2; } );
+  EXPECT_GT( nfs_get_connection( nfs, 0 )->outstanding_bytes, 0u );
+  EXPECT_GT( nfs_get_connection( nfs, 1 )->outstanding_bytes, 0u );
+
+  nfs_destroy_context( nfs );
+  EXPECT_EQ( read.err, 1 );
+  rpc_loop_destroy( loop );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
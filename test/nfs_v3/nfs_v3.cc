@@ -5,7 +5,9 @@
 
 TEST( nfs_v3_url, parse_full ) {
   std::unique_ptr< nfs_context > nfs = std::make_unique< nfs_context >();
-  nfs->nfsi                          = new nfs_context_internal;
+  nfs->nfsi                          = new nfs_context_internal();
+  /* already configured: a URL without a port keeps it */
+  nfs->nfsi->nfsport = 7890;
 
   auto url = nfs_parse_url_full(
     nfs.get(),
@@ -51,6 +53,30 @@ TEST( nfs_v3_url, parse_full ) {
   EXPECT_EQ( nfs->nfsi->nfsport, 7890 );
   EXPECT_EQ( url4->path, "/test/test_path" );
   EXPECT_EQ( url4->file, "/t.txt" );
+
+  /* no file, a bad port, an unsupported version */
+  EXPECT_EQ( nfs_parse_url_full( nfs.get(), "nfs://localhost/" ), nullptr );
+  EXPECT_EQ( nfs_parse_url_full( nfs.get(), "nfs://localhost:70000/a/b" ), nullptr );
+  EXPECT_EQ( nfs_parse_url_full( nfs.get(), "nfs://localhost/a/b?version=4" ), nullptr );
+  auto url5 = nfs_parse_url_full( nfs.get(), "nfs://localhost/a/b?version=3" );
+  ASSERT_NE( url5, nullptr );
+  EXPECT_EQ( url5->path, "/a" );
+  EXPECT_EQ( nfs->nfsi->version, 3 );
+
+  auto dir = nfs_parse_url_dir( nfs.get(), "nfs://localhost/test/test_path" );
+  ASSERT_NE( dir, nullptr );
+  EXPECT_EQ( dir->path, "/test/test_path" );
+  EXPECT_EQ( dir->file, "" );
+
+  auto inc = nfs_parse_url_incomplete( nfs.get(), "nfs://localhost" );
+  ASSERT_NE( inc, nullptr );
+  EXPECT_EQ( inc->server, "localhost" );
+  EXPECT_EQ( inc->path, "" );
+
+  for ( nfs_url* u : { url, url1, url2, url3, url4, url5, dir, inc } ) {
+    nfs_destroy_url( u );
+  }
+  delete nfs->nfsi;
 }
 
 int main( int argc, char* argv[] ) {
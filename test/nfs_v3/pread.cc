@@ -0,0 +1,161 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+#include "../rpc/fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+static const uint64_t file_size = ( 5 << 20 ) + 123;
+
+static char pattern( uint64_t off ) {
+  return (char) ( off * 7 + ( off >> 13 ) );
+}
+
+/*
+ * READ3 results from a file of file_size patterned bytes, at most `cap`
+ * bytes per reply, the EOF flag only when the reply reaches the end.
+ */
+static fake_server::results_fn file_results( uint32_t cap ) {
+  return [ cap ]( const std::vector< char >& call ) {
+    uint32_t count, hi, lo;
+    memcpy( &count, call.data() + call.size() - 4, 4 );
+    memcpy( &lo, call.data() + call.size() - 8, 4 );
+    memcpy( &hi, call.data() + call.size() - 12, 4 );
+    uint64_t offset = (uint64_t) ntohl( hi ) << 32 | ntohl( lo );
+    uint32_t n      = offset >= file_size ? 0 : std::min< uint64_t >( file_size - offset, ntohl( count ) );
+    n               = std::min( n, cap );
+
+    std::string r;
+    fake_server::put_u32( r, NFS3_OK );
+    fake_server::put_u32( r, 0 );
+    fake_server::put_u32( r, n );
+    fake_server::put_u32( r, offset + n >= file_size );
+    fake_server::put_u32( r, n );
+    for ( uint32_t i = 0; i < n; i++ ) {
+      r += pattern( offset + i );
+    }
+    r.append( ZDR_ROUNDUP( n ) - n, '\0' );
+    return r;
+  };
+}
+
+struct pread_state {
+  int done;
+  int result;
+};
+
+static void pread_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  pread_state* s = (pread_state*) private_data;
+  s->result      = err;
+  s->done++;
+}
+
+static void connect_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  *(int*) private_data = err == 0 ? 1 : -1;
+}
+
+struct pread_fixture {
+  fake_server         srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+  char                fhdata[ 12 ] { 1, 2, 3 };
+  struct nfs_fh       fh { sizeof( fhdata ), fhdata };
+
+  pread_fixture( uint32_t cap, int nconnect ) : srv( fake_server::REPLY, file_results( cap ) ) {
+    loop = rpc_loop_create();
+    nfs  = nfs_init_context();
+    nfs_set_nconnect( nfs, nconnect );
+    nfs_set_readmax( nfs, 256 * 1024 );
+    nfs_loop_add( loop, nfs );
+    int connected = 0;
+    nfs_connect_async( nfs, "127.0.0.1", srv.port, connect_cb, &connected );
+    for ( int i = 0; i < 1000 && !connected; i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  ~pread_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+  }
+
+  int outstanding() {
+    int n = 0;
+    for ( int i = 0; i < nfs_num_connections( nfs ); i++ ) {
+      n += rpc_queue_length( nfs_get_connection( nfs, i ) );
+    }
+    return n;
+  }
+
+  pread_state read( uint64_t offset, uint64_t count, std::vector< char >& buf ) {
+    pread_state s {};
+    buf.assign( count, 0 );
+    EXPECT_EQ( nfs_pread_async( nfs, &fh, offset, count, buf.data(), pread_cb, &s ), 0 );
+    for ( int i = 0; i < 3000 && !s.done; i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+    return s;
+  }
+};
+
+static void check_pattern( const std::vector< char >& buf, uint64_t offset, uint64_t len ) {
+  for ( uint64_t i = 0; i < len; i++ ) {
+    if ( buf[ i ] != pattern( offset + i ) ) {
+      ADD_FAILURE() << "mismatch at " << offset + i;
+      return;
+    }
+  }
+}
+
+TEST( nfs_v3_pread, window_and_out_of_order ) {
+  pread_fixture       f( ~0u, 4 );
+  std::vector< char > buf( 4 << 20 );
+  pread_state         s {};
+
+  nfs_set_read_window( f.nfs, 6 );
+  ASSERT_EQ( nfs_pread_async( f.nfs, &f.fh, 1000, buf.size(), buf.data(), pread_cb, &s ), 0 );
+  EXPECT_EQ( f.outstanding(), 6 );
+  for ( int i = 0; i < 3000 && !s.done; i++ ) {
+    ASSERT_GE( rpc_loop_run_once( f.loop, 10 ), 0 );
+    EXPECT_LE( f.outstanding(), 6 );
+  }
+  ASSERT_EQ( s.done, 1 );
+  EXPECT_EQ( s.result, (int) buf.size() );
+  check_pattern( buf, 1000, buf.size() );
+
+  std::unique_ptr< struct rpc_stats, void ( * )( struct rpc_stats* ) > stats( rpc_alloc_stats(), rpc_free_stats );
+  nfs_get_stats( f.nfs, stats.get() );
+  EXPECT_EQ( stats->num_resp_rcvd, 16u );
+}
+
+TEST( nfs_v3_pread, eof_and_short_reads ) {
+  pread_fixture       f( 100000, 2 );
+  std::vector< char > buf;
+
+  /* across EOF: the result is capped, nothing past it is reported */
+  uint64_t    offset = file_size - 700000;
+  pread_state s      = f.read( offset, 2 << 20, buf );
+  ASSERT_EQ( s.done, 1 );
+  EXPECT_EQ( s.result, 700000 );
+  check_pattern( buf, offset, 700000 );
+
+  /* every READ comes back short and is continued */
+  s = f.read( 4096, 1 << 20, buf );
+  ASSERT_EQ( s.done, 1 );
+  EXPECT_EQ( s.result, 1 << 20 );
+  check_pattern( buf, 4096, 1 << 20 );
+
+  /* at and past EOF, and empty */
+  EXPECT_EQ( f.read( file_size, 4096, buf ).result, 0 );
+  EXPECT_EQ( f.read( file_size + 1, 4096, buf ).result, 0 );
+  EXPECT_EQ( f.read( 0, 0, buf ).result, 0 );
+  EXPECT_EQ( f.outstanding(), 0 );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,215 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "../rpc/fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+static const uint64_t file_size = ( 8 << 20 ) + 777;
+
+static char pattern( uint64_t off ) {
+  return (char) ( off * 11 + ( off >> 12 ) );
+}
+
+/* READ3 results from a file of file_size patterned bytes */
+static std::string file_results( const std::vector< char >& call ) {
+  uint32_t count, hi, lo;
+  memcpy( &count, call.data() + call.size() - 4, 4 );
+  memcpy( &lo, call.data() + call.size() - 8, 4 );
+  memcpy( &hi, call.data() + call.size() - 12, 4 );
+  uint64_t offset = (uint64_t) ntohl( hi ) << 32 | ntohl( lo );
+  uint32_t n      = offset >= file_size ? 0 : std::min< uint64_t >( file_size - offset, ntohl( count ) );
+
+  std::string r;
+  fake_server::put_u32( r, NFS3_OK );
+  fake_server::put_u32( r, 0 );
+  fake_server::put_u32( r, n );
+  fake_server::put_u32( r, offset + n >= file_size );
+  fake_server::put_u32( r, n );
+  for ( uint32_t i = 0; i < n; i++ ) {
+    r += pattern( offset + i );
+  }
+  r.append( ZDR_ROUNDUP( n ) - n, '\0' );
+  return r;
+}
+
+struct ra_state {
+  int done;
+  int result;
+};
+
+static void ra_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  ra_state* s = (ra_state*) private_data;
+  s->result   = err;
+  s->done++;
+}
+
+struct ra_fixture {
+  fake_server         srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+  char                fhdata[ 8 ] { 7, 7 };
+  struct nfs_fh       fh { sizeof( fhdata ), fhdata };
+  struct nfsfh*       file;
+
+  ra_fixture() : srv( fake_server::REPLY, file_results ) {
+    loop = rpc_loop_create();
+    nfs  = nfs_init_context();
+    nfs_set_nconnect( nfs, 2 );
+    nfs_set_readmax( nfs, 256 * 1024 );
+    nfs_set_readahead( nfs, 2 << 20 );
+    /* the tests count READs, which a slow build must not retransmit */
+    nfs_set_adaptive_timeout( nfs, 0 );
+    nfs_loop_add( loop, nfs );
+    ra_state conn {};
+    nfs_connect_async( nfs, "127.0.0.1", srv.port, ra_cb, &conn );
+    run( [ & ] { return conn.done > 0; } );
+    file = nfs_open_fh( nfs, &fh );
+  }
+
+  ~ra_fixture() {
+    ra_state closed {};
+    nfs_close_async( nfs, file, ra_cb, &closed );
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+  }
+
+  void run( const std::function< bool() >& done ) {
+    for ( int i = 0; i < 3000 && !done(); i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  int outstanding() {
+    int n = 0;
+    for ( int i = 0; i < nfs_num_connections( nfs ); i++ ) {
+      n += rpc_queue_length( nfs_get_connection( nfs, i ) );
+    }
+    return n;
+  }
+
+  void idle() {
+    run( [ & ] { return outstanding() == 0; } );
+  }
+
+  /* read and check; returns whether the read completed without a round trip */
+  bool read( uint64_t offset, uint32_t count, struct nfsfh* from = nullptr ) {
+    std::vector< char > buf( count );
+    ra_state            s {};
+    EXPECT_EQ( nfs_fh_pread_async( nfs, from ? from : file, offset, count, buf.data(), ra_cb, &s ), 0 );
+    bool at_once = s.done > 0;
+    run( [ & ] { return s.done > 0; } );
+    EXPECT_EQ( s.done, 1 );
+    uint64_t expect = offset >= file_size ? 0 : std::min< uint64_t >( count, file_size - offset );
+    EXPECT_EQ( s.result, (int) expect );
+    for ( uint64_t i = 0; i < expect; i++ ) {
+      if ( buf[ i ] != pattern( offset + i ) ) {
+        ADD_FAILURE() << "mismatch at " << offset + i;
+        break;
+      }
+    }
+    return at_once;
+  }
+};
+
+TEST( nfs_v3_readahead, sequential_reads_ahead ) {
+  ra_fixture f;
+
+  /* one read at the start of the file says nothing about the next */
+  EXPECT_FALSE( f.read( 0, 65536 ) );
+  f.idle();
+  EXPECT_EQ( f.srv.num_calls, 1 );
+
+  /* 64 KiB steps: after the first few, every read is already there */
+  int hits = 0;
+  for ( uint64_t off = 65536; off < file_size; off += 65536 ) {
+    hits += f.read( off, 65536 );
+    f.idle();
+  }
+  EXPECT_GE( hits, 120 );
+
+  /* 129 reads, but only about one READ per readmax */
+  EXPECT_LE( f.srv.num_calls, 40 );
+  EXPECT_GE( f.srv.num_calls, 33 );
+}
+
+TEST( nfs_v3_readahead, strided_reads_ahead ) {
+  ra_fixture f;
+
+  int hits = 0;
+  for ( uint64_t off = 0; off < ( 4 << 20 ); off += 100000 ) {
+    hits += f.read( off, 4096 );
+    f.idle();
+  }
+  EXPECT_GE( hits, 35 );
+}
+
+TEST( nfs_v3_readahead, random_drops_buffers ) {
+  ra_fixture       f;
+  struct rpc_pool* pool = &nfs_get_rpc_context( f.nfs )->pool;
+  uint64_t         base = pool->stats.bytes_in_use;
+
+  for ( uint64_t off = 0; off < ( 1 << 20 ); off += 65536 ) {
+    f.read( off, 65536 );
+  }
+  f.idle();
+  EXPECT_GT( pool->stats.bytes_in_use, base );
+
+  /* a jump elsewhere throws everything read ahead away */
+  int calls = f.srv.num_calls;
+  EXPECT_FALSE( f.read( 5 << 20, 65536 ) );
+  f.idle();
+  EXPECT_EQ( pool->stats.bytes_in_use, base );
+  EXPECT_EQ( f.srv.num_calls, calls + 1 );
+
+  /* and past EOF nothing is read ahead */
+  f.read( file_size - 1000, 4096 );
+  f.read( file_size + 3096, 4096 );
+  f.idle();
+  EXPECT_EQ( pool->stats.bytes_in_use, base );
+}
+
+TEST( nfs_v3_readahead, idle_buffers_expire ) {
+  ra_fixture       f;
+  struct rpc_pool* pool = &nfs_get_rpc_context( f.nfs )->pool;
+  uint64_t         base = pool->stats.bytes_in_use;
+
+  for ( uint64_t off = 0; off < ( 1 << 20 ); off += 65536 ) {
+    f.read( off, 65536 );
+  }
+  f.idle();
+  EXPECT_GT( f.nfs->nfsi->readahead_bytes, 0u );
+
+  /* nobody reads the file again: the buffers go after NFS_RA_TIMEOUT anyway */
+  f.run( [ & ] { return f.nfs->nfsi->readahead_bytes == 0; } );
+  EXPECT_EQ( f.nfs->nfsi->readahead_bytes, 0u );
+  EXPECT_EQ( pool->stats.bytes_in_use, base );
+}
+
+TEST( nfs_v3_readahead, bounded_across_files ) {
+  ra_fixture f;
+  nfs_set_readahead_max( f.nfs, 1 << 20 );
+  char          other_data[ 8 ] { 8, 8 };
+  struct nfs_fh other_fh { sizeof( other_data ), other_data };
+  struct nfsfh* other = nfs_open_fh( f.nfs, &other_fh );
+
+  /* two sequential readers, each allowed 2 MiB, share 1 MiB of buffers */
+  for ( uint64_t off = 0; off < ( 4 << 20 ); off += 65536 ) {
+    f.read( off, 65536 );
+    f.read( off, 65536, other );
+    EXPECT_LE( f.nfs->nfsi->readahead_bytes, 1u << 20 );
+  }
+  f.idle();
+  EXPECT_GT( f.nfs->nfsi->readahead_bytes, 0u );
+
+  ra_state closed {};
+  nfs_close_async( f.nfs, other, ra_cb, &closed );
+  f.run( [ & ] { return closed.done > 0; } );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
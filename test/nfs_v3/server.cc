@@ -0,0 +1,346 @@
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <gtest/gtest.h>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mount/v3/mount_v3.h>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * The client against the loopback server, on a scratch directory: MNT goes
+ * out as a raw call since the client has no MOUNT support of its own.
+ */
+struct op_state {
+  int done;
+  int err;
+};
+
+static void op_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  op_state* s = (op_state*) private_data;
+  s->err      = err;
+  s->done++;
+}
+
+struct mnt_state {
+  int         done;
+  int         status;
+  mountstat3  fhs_status;
+  std::string fh;
+};
+
+static void mnt_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  mnt_state* s = (mnt_state*) private_data;
+  s->status    = status;
+  if ( status == RPC_STATUS_SUCCESS ) {
+    mountres3* res = (mountres3*) data;
+    s->fhs_status  = res->fhs_status;
+    if ( res->fhs_status == MNT3_OK ) {
+      const fhandle3& fh = res->mountres3_u.mountinfo.fhandle;
+      s->fh.assign( fh.fhandle3_val, fh.fhandle3_len );
+    }
+  }
+  s->done++;
+}
+
+static void write_file( const std::string& path, const std::string& data ) {
+  int fd = open( path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644 );
+  ASSERT_GE( fd, 0 );
+  ASSERT_EQ( write( fd, data.data(), data.size() ), (ssize_t) data.size() );
+  close( fd );
+}
+
+static std::string read_file( const std::string& path ) {
+  std::string data( 1 << 20, '\0' );
+  int         fd = open( path.c_str(), O_RDONLY );
+  ssize_t     n  = fd < 0 ? 0 : read( fd, &data[ 0 ], data.size() );
+  data.resize( n > 0 ? n : 0 );
+  if ( fd >= 0 ) {
+    close( fd );
+  }
+  return data;
+}
+
+struct server_fixture {
+  std::string         dir;
+  struct nfs_server*  srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+
+  server_fixture() {
+    char tmpl[] = "/tmp/nfs_server_test.XXXXXX";
+    dir         = mkdtemp( tmpl );
+    srv         = nfs_server_start( dir.c_str(), 0, 2 );
+    loop        = rpc_loop_create();
+    nfs         = nfs_init_context();
+    nfs_loop_add( loop, nfs );
+    op_state conn {};
+    nfs_connect_async( nfs, "127.0.0.1", nfs_server_get_port( srv ), op_cb, &conn );
+    run( [ & ] { return conn.done > 0; } );
+  }
+
+  ~server_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+    nfs_server_stop( srv );
+    std::filesystem::remove_all( dir );
+  }
+
+  void run( const std::function< bool() >& done ) {
+    for ( int i = 0; i < 3000 && !done(); i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  mnt_state mnt( const char* path ) {
+    mnt_state       s {};
+    dirpath         p   = (dirpath) path;
+    struct rpc_pdu* pdu = rpc_allocate_pdu( nfs_get_rpc_context( nfs ), MOUNT_PROGRAM, MOUNT_V3, MOUNT3_MNT, mnt_cb, &s,
+                                            (zdrproc_t) zdr_mountres3, sizeof( mountres3 ), 0 );
+    EXPECT_NE( pdu, nullptr );
+    EXPECT_TRUE( zdr_dirpath( &pdu->zdr, &p ) );
+    EXPECT_EQ( rpc_queue_pdu( nfs_get_rpc_context( nfs ), pdu ), 0 );
+    run( [ & ] { return s.done > 0; } );
+    return s;
+  }
+
+  void mount() {
+    mnt_state s = mnt( nfs_server_get_export( srv ) );
+    ASSERT_EQ( s.fhs_status, MNT3_OK );
+    struct nfs_fh fh { (int) s.fh.size(), &s.fh[ 0 ] };
+    ASSERT_EQ( nfs_fh_inline_set( &nfs->nfsi->rootfh, &fh ), 0 );
+  }
+
+  /* a LOOKUP of `name` in the root as is, without the client's own path handling */
+  nfsstat3 raw_lookup( const char* name ) {
+    struct raw_state {
+      int      done;
+      nfsstat3 status;
+    } s { 0, NFS3ERR_SERVERFAULT };
+    struct nfs_fh   root = nfs_fh_inline_get( &nfs->nfsi->rootfh );
+    LOOKUP3args     a {};
+    struct rpc_pdu* pdu  = rpc_allocate_pdu(
+      nfs_get_rpc_context( nfs ), NFS_PROGRAM, NFS_V3, NFS3_LOOKUP,
+      []( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+        raw_state* s = (raw_state*) private_data;
+        if ( status == RPC_STATUS_SUCCESS ) {
+          s->status = ( (LOOKUP3res*) data )->status;
+        }
+        s->done++;
+      },
+      &s, (zdrproc_t) zdr_LOOKUP3res, sizeof( LOOKUP3res ), 0 );
+    a.what.dir.data.data_len = root.len;
+    a.what.dir.data.data_val = root.val;
+    a.what.name              = (char*) name;
+    EXPECT_NE( pdu, nullptr );
+    EXPECT_TRUE( zdr_LOOKUP3args( &pdu->zdr, &a ) );
+    EXPECT_EQ( rpc_queue_pdu( nfs_get_rpc_context( nfs ), pdu ), 0 );
+    run( [ & ] { return s.done > 0; } );
+    return s.status;
+  }
+
+  struct nfs_fh_inline lookup( const char* path, int* err ) {
+    struct lookup_state : op_state {
+      struct nfs_fh_inline fh;
+    } s {};
+    nfs_lookup_path_async(
+      nfs, path,
+      []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+        lookup_state* s = (lookup_state*) private_data;
+        if ( err == 0 ) {
+          s->fh = ( (struct nfsdirent*) data )->fh;
+        }
+        op_cb( err, nfs, data, private_data );
+      },
+      &s );
+    run( [ & ] { return s.done > 0; } );
+    *err = s.err;
+    return s.fh;
+  }
+};
+
+TEST( nfs_v3_server, mount_lookup_getattr ) {
+  server_fixture f;
+  ASSERT_NE( f.srv, nullptr );
+  write_file( f.dir + "/hello", "hello, world" );
+  mkdir( ( f.dir + "/sub" ).c_str(), 0755 );
+
+  EXPECT_EQ( f.mnt( "/no/such/export" ).fhs_status, MNT3ERR_NOENT );
+  f.mount();
+
+  int                  err;
+  struct nfs_fh_inline fh = f.lookup( "/hello", &err );
+  ASSERT_EQ( err, 0 );
+  struct nfs_fh   h = nfs_fh_inline_get( &fh );
+  struct nfs_attr attr {};
+  struct attr_state : op_state {
+    struct nfs_attr* attr;
+  } s {};
+  s.attr = &attr;
+  nfs_getattr_async(
+    f.nfs, &h,
+    []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+      if ( err == 0 ) {
+        *( (attr_state*) private_data )->attr = *(struct nfs_attr*) data;
+      }
+      op_cb( err, nfs, data, private_data );
+    },
+    &s );
+  f.run( [ & ] { return s.done > 0; } );
+  EXPECT_EQ( s.err, 0 );
+  EXPECT_EQ( attr.type, (uint32_t) NF3REG );
+  EXPECT_EQ( attr.size, 12u );
+
+  f.lookup( "/sub/../missing", &err );
+  EXPECT_EQ( err, -ENOENT );
+  f.lookup( "/sub", &err );
+  EXPECT_EQ( err, 0 );
+
+  /* names that are not a single component are refused, and do not poison the inode map */
+  for ( const char* name : { "", ".", "..", "sub/hello" } ) {
+    EXPECT_EQ( f.raw_lookup( name ), NFS3ERR_INVAL ) << "'" << name << "'";
+  }
+  EXPECT_EQ( f.raw_lookup( "sub" ), NFS3_OK );
+  f.lookup( "/sub", &err );
+  EXPECT_EQ( err, 0 );
+}
+
+TEST( nfs_v3_server, write_read_back ) {
+  server_fixture f;
+  write_file( f.dir + "/data", "" );
+  f.mount();
+
+  int                  err;
+  struct nfs_fh_inline ifh = f.lookup( "data", &err );
+  ASSERT_EQ( err, 0 );
+  struct nfs_fh h = nfs_fh_inline_get( &ifh );
+
+  std::string data( 600 * 1024, '\0' );
+  for ( size_t i = 0; i < data.size(); i++ ) {
+    data[ i ] = (char) ( i * 7 + 3 );
+  }
+  struct nfsfh* fh = nfs_open_fh( f.nfs, &h );
+  op_state      w {};
+  ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, 0, data.size(), data.data(), op_cb, &w ), 0 );
+  op_state sync {};
+  ASSERT_EQ( nfs_fsync_async( f.nfs, fh, op_cb, &sync ), 0 );
+  f.run( [ & ] { return sync.done > 0; } );
+  EXPECT_EQ( sync.err, 0 );
+  EXPECT_EQ( read_file( f.dir + "/data" ), data );
+
+  std::string back( data.size(), '\0' );
+  op_state    r {};
+  ASSERT_EQ( nfs_pread_async( f.nfs, &h, 0, back.size(), &back[ 0 ], op_cb, &r ), 0 );
+  f.run( [ & ] { return r.done > 0; } );
+  EXPECT_GE( r.err, 0 );
+  EXPECT_EQ( back, data );
+
+  op_state c {};
+  nfs_close_async( f.nfs, fh, op_cb, &c );
+  f.run( [ & ] { return c.done > 0; } );
+
+  /* a handle outlives its file only as a stale one */
+  unlink( ( f.dir + "/data" ).c_str() );
+  op_state stale {};
+  ASSERT_EQ( nfs_pread_async( f.nfs, &h, 0, 10, &back[ 0 ], op_cb, &stale ), 0 );
+  f.run( [ & ] { return stale.done > 0; } );
+  EXPECT_EQ( stale.err, -ESTALE );
+}
+
+TEST( nfs_v3_server, readdir ) {
+  server_fixture          f;
+  std::set< std::string > names = { ".", ".." };
+  for ( int i = 0; i < 300; i++ ) {
+    std::string name = "file-with-a-long-name-" + std::to_string( i );
+    write_file( f.dir + "/" + name, "" );
+    names.insert( name );
+  }
+  f.mount();
+  nfs_set_readdir_max_buffer_size( f.nfs, 4096, 8192 );
+
+  struct dir_state : op_state {
+    struct nfsdir* dir;
+  } s {};
+  struct nfs_fh root = nfs_fh_inline_get( &f.nfs->nfsi->rootfh );
+  nfs_opendir_async(
+    f.nfs, &root,
+    []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+      ( (dir_state*) private_data )->dir = err == 0 ? (struct nfsdir*) data : nullptr;
+      op_cb( err, nfs, data, private_data );
+    },
+    &s );
+  f.run( [ & ] { return s.done > 0; } );
+  ASSERT_EQ( s.err, 0 );
+  ASSERT_NE( s.dir, nullptr );
+
+  std::set< std::string > seen;
+  for ( struct nfsdirent* e; ( e = nfs_readdir( f.nfs, s.dir ) ); ) {
+    EXPECT_TRUE( seen.insert( e->name ).second ) << e->name;
+    EXPECT_TRUE( e->has_attr );
+  }
+  EXPECT_EQ( seen, names );
+  nfs_closedir( f.nfs, s.dir );
+}
+
+/* dropped replies are retransmitted until they get through */
+TEST( nfs_v3_server, loss_and_latency ) {
+  server_fixture f;
+  nfs_set_timeout( f.nfs, 100 );
+  nfs_set_retrans( f.nfs, 20 );
+  rpc_server_set_loss( nfs_server_get_rpc_server( f.srv ), 0.3 );
+  rpc_server_set_latency( nfs_server_get_rpc_server( f.srv ), 2000, 1000 );
+
+  op_state s {};
+  for ( int i = 0; i < 50; i++ ) {
+    ASSERT_EQ( nfs_null_async( f.nfs, op_cb, &s ), 0 );
+  }
+  f.run( [ & ] { return s.done == 50; } );
+  EXPECT_EQ( s.done, 50 );
+  EXPECT_EQ( s.err, 0 );
+
+  /* replies are counted once written, which may be after the client has them */
+  struct rpc_server_stats st;
+  for ( int i = 0; i < 1000; i++ ) {
+    rpc_server_get_stats( nfs_server_get_rpc_server( f.srv ), &st );
+    if ( st.num_replies >= 50 ) {
+      break;
+    }
+    usleep( 1000 );
+  }
+  EXPECT_GT( st.num_dropped, 0u );
+  EXPECT_GE( st.num_replies, 50u );
+  EXPECT_LE( st.num_replies + st.num_dropped, st.num_calls ); /* some may still be delayed */
+  EXPECT_EQ( st.num_conns, 1u );
+  EXPECT_EQ( st.num_rejected, 0u );
+}
+
+/* calls the server has no procedure for are rejected, not dropped */
+TEST( nfs_v3_server, unavailable ) {
+  server_fixture  f;
+  mnt_state       s {};
+  struct rpc_pdu* pdu = rpc_allocate_pdu( nfs_get_rpc_context( f.nfs ), NFS_PROGRAM, NFS_V3, 99, mnt_cb, &s, nullptr, 0, 0 );
+  ASSERT_EQ( rpc_queue_pdu( nfs_get_rpc_context( f.nfs ), pdu ), 0 );
+  f.run( [ & ] { return s.done > 0; } );
+  EXPECT_EQ( s.status, RPC_STATUS_ERROR );
+
+  mnt_state v {};
+  pdu = rpc_allocate_pdu( nfs_get_rpc_context( f.nfs ), NFS_PROGRAM, 4, 0, mnt_cb, &v, nullptr, 0, 0 );
+  ASSERT_EQ( rpc_queue_pdu( nfs_get_rpc_context( f.nfs ), pdu ), 0 );
+  f.run( [ & ] { return v.done > 0; } );
+  EXPECT_EQ( v.status, RPC_STATUS_ERROR );
+
+  struct rpc_server_stats st;
+  rpc_server_get_stats( nfs_server_get_rpc_server( f.srv ), &st );
+  EXPECT_EQ( st.num_rejected, 2u );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,258 @@
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <gtest/gtest.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <mount/v3/mount_v3.h>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * The io_uring transport against the loopback server. Where the kernel does
+ * not have what it needs the connection falls back to plain sockets, and
+ * the tests that are about io_uring itself are skipped.
+ */
+struct op_state {
+  int             done;
+  int             err;
+  struct nfs_attr attr;
+};
+
+static void op_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  op_state* s = (op_state*) private_data;
+  s->err      = err;
+  if ( err == 0 && data ) {
+    s->attr = *(struct nfs_attr*) data;
+  }
+  s->done++;
+}
+
+struct uring_fixture {
+  std::string         dir;
+  struct nfs_server*  srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+  int                 mounted;
+
+  uring_fixture( int transport ) {
+    char tmpl[] = "/tmp/nfs_uring_test.XXXXXX";
+    dir         = mkdtemp( tmpl );
+    srv         = nfs_server_start( dir.c_str(), 0, 2 );
+    loop        = rpc_loop_create();
+    nfs         = nfs_init_context();
+    nfs_set_transport( nfs, transport );
+    nfs_set_attrcache( nfs, 0 );
+    nfs_loop_add( loop, nfs );
+  }
+
+  ~uring_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+    nfs_server_stop( srv );
+    std::filesystem::remove_all( dir );
+  }
+
+  void run( const std::function< bool() >& done ) {
+    for ( int i = 0; i < 3000 && !done(); i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  static void mnt_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    uring_fixture* f   = (uring_fixture*) private_data;
+    mountres3*     res = (mountres3*) data;
+    if ( status == RPC_STATUS_SUCCESS && res->fhs_status == MNT3_OK ) {
+      struct nfs_fh fh { (int) res->mountres3_u.mountinfo.fhandle.fhandle3_len, res->mountres3_u.mountinfo.fhandle.fhandle3_val };
+      nfs_fh_inline_set( &f->nfs->nfsi->rootfh, &fh );
+    }
+    f->mounted = 1;
+  }
+
+  bool mount() {
+    op_state conn {};
+    nfs_connect_async( nfs, "127.0.0.1", nfs_server_get_port( srv ), op_cb, &conn );
+    run( [ & ] { return conn.done > 0; } );
+    if ( conn.err != 0 ) {
+      return false;
+    }
+    dirpath         p   = (dirpath) nfs_server_get_export( srv );
+    struct rpc_pdu* pdu = rpc_allocate_pdu( nfs_get_rpc_context( nfs ), MOUNT_PROGRAM, MOUNT_V3, MOUNT3_MNT, mnt_cb, this,
+                                            (zdrproc_t) zdr_mountres3, sizeof( mountres3 ), 0 );
+    mounted             = 0;
+    if ( !pdu || !zdr_dirpath( &pdu->zdr, &p ) || rpc_queue_pdu( nfs_get_rpc_context( nfs ), pdu ) < 0 ) {
+      return false;
+    }
+    run( [ & ] { return mounted > 0; } );
+    return nfs->nfsi->rootfh.len > 0;
+  }
+
+  struct nfs_fh_inline lookup( const char* path ) {
+    struct lookup_state : op_state {
+      struct nfs_fh_inline fh;
+    } s {};
+    nfs_lookup_path_async(
+      nfs, path,
+      []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+        lookup_state* s = (lookup_state*) private_data;
+        if ( err == 0 ) {
+          s->fh = ( (struct nfsdirent*) data )->fh;
+        }
+        op_cb( err, nfs, nullptr, private_data );
+      },
+      &s );
+    run( [ & ] { return s.done > 0; } );
+    EXPECT_EQ( s.err, 0 );
+    return s.fh;
+  }
+
+  void write_file( const char* name, const std::string& data ) {
+    int fd = open( ( dir + "/" + name ).c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644 );
+    ASSERT_GE( fd, 0 );
+    ASSERT_EQ( write( fd, data.data(), data.size() ), (ssize_t) data.size() );
+    close( fd );
+  }
+};
+
+TEST( nfs_v3_uring, url_argument ) {
+  struct nfs_context* nfs = nfs_init_context();
+
+  struct nfs_url* url = nfs_parse_url_full( nfs, "nfs://127.0.0.1/export/f?nconnect=2&transport=uring" );
+  ASSERT_NE( url, nullptr );
+  EXPECT_EQ( nfs_get_connection( nfs, 0 )->transport, RPC_TRANSPORT_URING );
+  EXPECT_EQ( nfs_get_connection( nfs, 1 )->transport, RPC_TRANSPORT_URING );
+  nfs_destroy_url( url );
+
+  url = nfs_parse_url_full( nfs, "nfs://127.0.0.1/export/f?transport=socket" );
+  ASSERT_NE( url, nullptr );
+  EXPECT_EQ( nfs_get_rpc_context( nfs )->transport, RPC_TRANSPORT_SOCKET );
+  nfs_destroy_url( url );
+
+  EXPECT_EQ( nfs_parse_url_full( nfs, "nfs://127.0.0.1/export/f?transport=rdma" ), nullptr );
+
+  /* not connected: no ring yet */
+  EXPECT_EQ( rpc_get_transport( nfs_get_rpc_context( nfs ) ), RPC_TRANSPORT_SOCKET );
+  nfs_destroy_context( nfs );
+}
+
+/* replies larger than one provided buffer, and many of them at once */
+TEST( nfs_v3_uring, getattr_and_read ) {
+  uring_fixture f( RPC_TRANSPORT_URING );
+  std::string   data( 3 << 20, '\0' );
+  for ( size_t i = 0; i < data.size(); i++ ) {
+    data[ i ] = (char) ( i * 7 + i / 4096 );
+  }
+  f.write_file( "big", data );
+  ASSERT_TRUE( f.mount() );
+  if ( rpc_get_transport( nfs_get_rpc_context( f.nfs ) ) != RPC_TRANSPORT_URING ) {
+    GTEST_SKIP() << "io_uring is not available, fell back to sockets";
+  }
+
+  struct nfs_fh_inline ifh = f.lookup( "/big" );
+  struct nfs_fh        fh  = nfs_fh_inline_get( &ifh );
+
+  std::vector< op_state > getattrs( 500 );
+  for ( op_state& s : getattrs ) {
+    ASSERT_EQ( nfs_getattr_async( f.nfs, &fh, op_cb, &s ), 0 );
+  }
+  std::string buf( data.size(), '\0' );
+  op_state    read {};
+  ASSERT_EQ( nfs_pread_async( f.nfs, &fh, 0, buf.size(), &buf[ 0 ], op_cb, &read ), 0 );
+  f.run( [ & ] {
+    for ( op_state& s : getattrs ) {
+      if ( !s.done ) {
+        return false;
+      }
+    }
+    return read.done > 0;
+  } );
+
+  for ( op_state& s : getattrs ) {
+    ASSERT_EQ( s.done, 1 );
+    ASSERT_EQ( s.err, 0 );
+    ASSERT_EQ( s.attr.size, data.size() );
+  }
+  ASSERT_EQ( read.done, 1 );
+  EXPECT_EQ( read.err, (int) data.size() );
+  EXPECT_TRUE( buf == data );
+  EXPECT_EQ( nfs_get_rpc_context( f.nfs )->stats.num_retransmitted, 0u );
+}
+
+/* at queue depth 64, well under one system call per RPC */
+TEST( nfs_v3_uring, syscalls_per_rpc ) {
+  double per_rpc[ 2 ];
+  for ( int transport : { RPC_TRANSPORT_SOCKET, RPC_TRANSPORT_URING } ) {
+    uring_fixture f( transport );
+    ASSERT_TRUE( f.mount() );
+    if ( rpc_get_transport( nfs_get_rpc_context( f.nfs ) ) != transport ) {
+      GTEST_SKIP() << "io_uring is not available, fell back to sockets";
+    }
+
+    struct rpc_context* rpc    = nfs_get_rpc_context( f.nfs );
+    uint64_t            calls  = rpc->stats.num_syscalls;
+    uint64_t            sent   = rpc->stats.num_req_sent;
+    const int           depth  = 64;
+    const int           total  = 64 * 100;
+    int                 issued = 0;
+    int                 done   = 0;
+    int                 failed = 0;
+    std::function< void() > issue;
+    struct null_state {
+      int*                     done;
+      int*                     failed;
+      std::function< void() >* issue;
+    } s { &done, &failed, &issue };
+    issue = [ & ] {
+      while ( issued < total && issued - done < depth ) {
+        issued++;
+        nfs_null_async(
+          f.nfs,
+          []( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+            null_state* s = (null_state*) private_data;
+            ( *s->done )++;
+            *s->failed += err != 0;
+            ( *s->issue )();
+          },
+          &s );
+      }
+    };
+    issue();
+    for ( int i = 0; i < 100000 && done < total; i++ ) {
+      rpc_loop_run_once( f.loop, 10 );
+    }
+    ASSERT_EQ( done, total );
+    EXPECT_EQ( failed, 0 );
+    per_rpc[ transport ] = (double) ( rpc->stats.num_syscalls - calls ) / ( rpc->stats.num_req_sent - sent );
+  }
+  EXPECT_LT( per_rpc[ RPC_TRANSPORT_URING ], 0.5 ) << "sockets: " << per_rpc[ RPC_TRANSPORT_SOCKET ];
+  EXPECT_LT( per_rpc[ RPC_TRANSPORT_URING ], per_rpc[ RPC_TRANSPORT_SOCKET ] );
+}
+
+/* the server going away fails what is outstanding, and the ring with it */
+TEST( nfs_v3_uring, peer_close ) {
+  uring_fixture f( RPC_TRANSPORT_URING );
+  ASSERT_TRUE( f.mount() );
+  if ( rpc_get_transport( nfs_get_rpc_context( f.nfs ) ) != RPC_TRANSPORT_URING ) {
+    GTEST_SKIP() << "io_uring is not available, fell back to sockets";
+  }
+  nfs_set_autoreconnect( f.nfs, 0 );
+
+  /* queued, but not submitted before the server is gone */
+  op_state s {};
+  ASSERT_EQ( nfs_null_async( f.nfs, op_cb, &s ), 0 );
+  nfs_server_stop( f.srv );
+  f.srv = nfs_server_start( f.dir.c_str(), 0, 2 );
+  f.run( [ & ] { return s.done > 0; } );
+  EXPECT_EQ( s.done, 1 );
+  EXPECT_NE( s.err, 0 );
+  EXPECT_EQ( rpc_get_transport( nfs_get_rpc_context( f.nfs ) ), RPC_TRANSPORT_SOCKET );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,305 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <mutex>
+#include <vector>
+
+#include "../rpc/fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * A file on the fake server: WRITEs land in `data`, READs come from it,
+ * COMMIT copies it to `stable`, and reboot() throws away whatever was not committed and picks
+ * a new write verifier.
+ */
+struct fake_file {
+  std::mutex  mtx;
+  std::string data, stable;
+  uint32_t    verf = 1;
+  int         writes  = 0;
+  int         commits = 0;
+  int         reads   = 0;
+
+  void reboot() {
+    std::lock_guard< std::mutex > lock( mtx );
+    data = stable;
+    verf++;
+  }
+
+  static uint32_t get_u32( const char*& p ) {
+    uint32_t v;
+    memcpy( &v, p, 4 );
+    p += 4;
+    return ntohl( v );
+  }
+
+  std::string results( const std::vector< char >& call ) {
+    std::lock_guard< std::mutex > lock( mtx );
+    const char* p    = call.data() + 20;
+    uint32_t    proc = get_u32( p );
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* cred */
+    p += 4;
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* verf */
+    p += ZDR_ROUNDUP( get_u32( p ) ); /* fh */
+
+    std::string r;
+    fake_server::put_u32( r, NFS3_OK );
+    if ( proc == NFS3_READ ) {
+      uint64_t offset = (uint64_t) get_u32( p ) << 32;
+      offset |= get_u32( p );
+      uint32_t count = get_u32( p );
+      uint32_t n     = offset >= data.size() ? 0 : std::min< uint64_t >( count, data.size() - offset );
+      reads++;
+      fake_server::put_u32( r, 0 ); /* no post-op attributes */
+      fake_server::put_u32( r, n );
+      fake_server::put_u32( r, offset + n >= data.size() );
+      fake_server::put_u32( r, n );
+      r.append( data, offset < data.size() ? offset : 0, n );
+      r.append( ZDR_ROUNDUP( n ) - n, '\0' );
+      return r;
+    }
+    fake_server::put_u32( r, 0 ); /* no pre-op attributes */
+    fake_server::put_u32( r, 0 ); /* no post-op attributes */
+    if ( proc == NFS3_WRITE ) {
+      uint64_t offset = (uint64_t) get_u32( p ) << 32;
+      offset |= get_u32( p );
+      p += 8; /* count, stable */
+      uint32_t len = get_u32( p );
+      if ( data.size() < offset + len ) {
+        data.resize( offset + len );
+      }
+      data.replace( offset, len, p, len );
+      writes++;
+      fake_server::put_u32( r, len );
+      fake_server::put_u32( r, UNSTABLE );
+    } else if ( proc == NFS3_COMMIT ) {
+      stable = data;
+      commits++;
+    }
+    fake_server::put_u32( r, verf );
+    fake_server::put_u32( r, 0 );
+    return r;
+  }
+};
+
+struct wb_state {
+  int done;
+  int ok;
+  int result;
+};
+
+static void wb_cb( int err, struct nfs_context* nfs, void* data, void* private_data ) {
+  wb_state* s = (wb_state*) private_data;
+  s->result   = err;
+  s->ok += err >= 0;
+  s->done++;
+}
+
+struct wb_fixture {
+  fake_file           file;
+  fake_server         srv;
+  struct rpc_loop*    loop;
+  struct nfs_context* nfs;
+  char                fhdata[ 8 ] { 4, 2 };
+  struct nfs_fh       fh { sizeof( fhdata ), fhdata };
+
+  wb_fixture() : srv( fake_server::REPLY, [ this ]( const std::vector< char >& c ) { return file.results( c ); } ) {
+    loop = rpc_loop_create();
+    nfs  = nfs_init_context();
+    nfs_set_nconnect( nfs, 2 );
+    nfs_set_writemax( nfs, 256 * 1024 );
+    nfs_loop_add( loop, nfs );
+    wb_state conn {};
+    nfs_connect_async( nfs, "127.0.0.1", srv.port, wb_cb, &conn );
+    run( [ & ] { return conn.done > 0; } );
+  }
+
+  ~wb_fixture() {
+    nfs_destroy_context( nfs );
+    rpc_loop_destroy( loop );
+  }
+
+  void run( const std::function< bool() >& done ) {
+    for ( int i = 0; i < 3000 && !done(); i++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+
+  int count( int fake_file::*field ) {
+    std::lock_guard< std::mutex > lock( file.mtx );
+    return file.*field;
+  }
+
+  std::string stable() {
+    std::lock_guard< std::mutex > lock( file.mtx );
+    return file.stable;
+  }
+};
+
+static std::string make_data( size_t len, int seed ) {
+  std::string s( len, '\0' );
+  for ( size_t i = 0; i < len; i++ ) {
+    s[ i ] = (char) ( i * 13 + seed );
+  }
+  return s;
+}
+
+TEST( nfs_v3_write_behind, coalesces_and_commits_on_fsync ) {
+  wb_fixture    f;
+  struct nfsfh* fh = nfs_open_fh( f.nfs, &f.fh );
+  ASSERT_NE( fh, nullptr );
+
+  /* 3 MiB in 64 KiB pieces: twelve full 256 KiB WRITEs, no COMMIT yet */
+  std::string data = make_data( 3 << 20, 1 );
+  wb_state    writes {};
+  for ( size_t off = 0; off < data.size(); off += 65536 ) {
+    ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, off, 65536, data.data() + off, wb_cb, &writes ), 0 );
+  }
+  EXPECT_EQ( writes.ok, 48 );
+  f.run( [ & ] { return f.count( &fake_file::writes ) == 12; } );
+  EXPECT_EQ( f.count( &fake_file::writes ), 12 );
+  EXPECT_EQ( f.count( &fake_file::commits ), 0 );
+
+  /* overwrite a piece in the middle, and a short tail: both go out on fsync */
+  std::string patch = make_data( 1000, 7 );
+  data.replace( 5000, 1000, patch );
+  data += "tail";
+  ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, 5000, 1000, patch.data(), wb_cb, &writes ), 0 );
+  ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, 3 << 20, 4, "tail", wb_cb, &writes ), 0 );
+
+  wb_state sync {};
+  ASSERT_EQ( nfs_fsync_async( f.nfs, fh, wb_cb, &sync ), 0 );
+  f.run( [ & ] { return sync.done > 0; } );
+  ASSERT_EQ( sync.done, 1 );
+  EXPECT_EQ( sync.result, 0 );
+  EXPECT_EQ( f.count( &fake_file::writes ), 14 );
+  EXPECT_EQ( f.count( &fake_file::commits ), 1 );
+  EXPECT_TRUE( f.stable() == data );
+
+  wb_state closed {};
+  ASSERT_EQ( nfs_close_async( f.nfs, fh, wb_cb, &closed ), 0 );
+  EXPECT_EQ( closed.ok, 1 );
+  EXPECT_EQ( f.count( &fake_file::commits ), 1 );
+}
+
+TEST( nfs_v3_write_behind, replays_after_verifier_change ) {
+  wb_fixture    f;
+  struct nfsfh* fh = nfs_open_fh( f.nfs, &f.fh );
+
+  std::string data = make_data( 1 << 20, 3 );
+  wb_state    writes {};
+  ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, 0, data.size(), data.data(), wb_cb, &writes ), 0 );
+  f.run( [ & ] { return f.count( &fake_file::writes ) == 4; } );
+
+  /* the server loses everything uncommitted; the COMMIT verifier tells us */
+  f.file.reboot();
+  wb_state closed {};
+  ASSERT_EQ( nfs_close_async( f.nfs, fh, wb_cb, &closed ), 0 );
+  f.run( [ & ] { return closed.done > 0; } );
+  EXPECT_EQ( closed.result, 0 );
+  EXPECT_EQ( f.count( &fake_file::writes ), 8 );
+  EXPECT_EQ( f.count( &fake_file::commits ), 2 );
+  EXPECT_TRUE( f.stable() == data );
+}
+
+/* a full range must not overtake an older partial one it overlaps */
+TEST( nfs_v3_write_behind, overlap_keeps_write_order ) {
+  wb_fixture    f;
+  struct nfsfh* fh = nfs_open_fh( f.nfs, &f.fh );
+
+  std::string head = make_data( 100, 9 );
+  std::string body = make_data( 256 * 1024, 11 );
+  wb_state    writes {};
+  ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, 0, head.size(), head.data(), wb_cb, &writes ), 0 );
+  ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, 50, body.size(), body.data(), wb_cb, &writes ), 0 );
+  /* the full range waits for the older one it overlaps, which waits for fsync */
+  for ( int i = 0; i < 20; i++ ) {
+    rpc_loop_run_once( f.loop, 10 );
+  }
+  EXPECT_EQ( f.count( &fake_file::writes ), 0 );
+
+  wb_state sync {};
+  ASSERT_EQ( nfs_fsync_async( f.nfs, fh, wb_cb, &sync ), 0 );
+  f.run( [ & ] { return sync.done > 0; } );
+  ASSERT_EQ( sync.done, 1 );
+  EXPECT_EQ( sync.result, 0 );
+  std::string data = head.substr( 0, 50 ) + body;
+  EXPECT_TRUE( f.stable() == data );
+
+  wb_state closed {};
+  ASSERT_EQ( nfs_close_async( f.nfs, fh, wb_cb, &closed ), 0 );
+  f.run( [ & ] { return closed.done > 0; } );
+}
+
+/* reads through the nfsfh see its writes, whether buffered or read ahead */
+TEST( nfs_v3_write_behind, reads_see_own_writes ) {
+  wb_fixture f;
+  f.file.data      = make_data( 1 << 20, 13 );
+  struct nfsfh* fh = nfs_open_fh( f.nfs, &f.fh );
+
+  /* sequential reads fill readahead buffers well past 128 KiB */
+  std::vector< char > buf( 65536 );
+  for ( uint64_t off = 0; off < 131072; off += 65536 ) {
+    wb_state r {};
+    ASSERT_EQ( nfs_fh_pread_async( f.nfs, fh, off, buf.size(), buf.data(), wb_cb, &r ), 0 );
+    f.run( [ & ] { return r.done > 0; } );
+    ASSERT_EQ( r.result, 65536 );
+  }
+  f.run( [ & ] { return f.count( &fake_file::reads ) >= 3; } );
+  for ( int i = 0; i < 20; i++ ) {
+    rpc_loop_run_once( f.loop, 10 );
+  }
+
+  /* a small write stays DIRTY; reading it back must not use the old buffers */
+  std::string patch = make_data( 4096, 17 );
+  wb_state    writes {};
+  ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, 140000, patch.size(), patch.data(), wb_cb, &writes ), 0 );
+  EXPECT_EQ( f.count( &fake_file::writes ), 0 );
+
+  wb_state r {};
+  ASSERT_EQ( nfs_fh_pread_async( f.nfs, fh, 131072, buf.size(), buf.data(), wb_cb, &r ), 0 );
+  f.run( [ & ] { return r.done > 0; } );
+  ASSERT_EQ( r.result, 65536 );
+  EXPECT_EQ( f.count( &fake_file::writes ), 1 );
+  std::string expect = f.file.data.substr( 131072, 65536 );
+  EXPECT_EQ( expect.compare( 140000 - 131072, 4096, patch ), 0 );
+  EXPECT_TRUE( std::string( buf.data(), buf.size() ) == expect );
+
+  wb_state closed {};
+  ASSERT_EQ( nfs_close_async( f.nfs, fh, wb_cb, &closed ), 0 );
+  f.run( [ & ] { return closed.done > 0; } );
+}
+
+TEST( nfs_v3_write_behind, dirty_threshold_flushes_and_throttles ) {
+  wb_fixture f;
+  nfs_set_max_dirty( f.nfs, 512 * 1024 );
+  struct nfsfh* fh = nfs_open_fh( f.nfs, &f.fh );
+
+  /* small scattered writes never fill a range, only the threshold sends them */
+  std::string piece = make_data( 4096, 5 );
+  wb_state    writes {};
+  for ( int i = 0; i < 256; i++ ) {
+    ASSERT_EQ( nfs_pwrite_async( f.nfs, fh, (uint64_t) i * 8192, piece.size(), piece.data(), wb_cb, &writes ), 0 );
+  }
+  EXPECT_LT( writes.done, 256 );
+  f.run( [ & ] { return writes.done == 256; } );
+  EXPECT_EQ( writes.ok, 256 );
+  EXPECT_GT( f.count( &fake_file::commits ), 0 );
+
+  wb_state closed {};
+  ASSERT_EQ( nfs_close_async( f.nfs, fh, wb_cb, &closed ), 0 );
+  f.run( [ & ] { return closed.done > 0; } );
+  EXPECT_EQ( closed.result, 0 );
+  std::string stable = f.stable();
+  ASSERT_EQ( stable.size(), 255u * 8192 + 4096 );
+  for ( int i = 0; i < 256; i++ ) {
+    EXPECT_EQ( stable.compare( (size_t) i * 8192, 4096, piece ), 0 );
+  }
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -1,7 +1,10 @@
+#include <arpa/inet.h>
 #include <cstdint>
+#include <cstring>
 #include <gtest/gtest.h>
 
 #include <rpc/auth.h>
+#include <rpc/rpc.h>
 #include <unistd.h>
 
 TEST( rpc_auth, default_create ) {
@@ -13,6 +16,83 @@ TEST( rpc_auth, default_create ) {
 
   auto a = authunix_create( host, uid, gid, len, groups );
   ASSERT_NE( a, nullptr );
+  auth_destroy( a );
+}
+
+static uint32_t get_u32( const char* p ) {
+  return ntohl( *(const uint32_t*) p );
+}
+
+/* the uid of the AUTH_UNIX credential in a call, from the header words on */
+static uint32_t call_uid( const char* hdr ) {
+  const char* body = hdr + 6 * 4 + 8;
+  return get_u32( body + 8 + ZDR_ROUNDUP( get_u32( body + 4 ) ) );
+}
+
+TEST( rpc_auth, call_header_template ) {
+  struct rpc_context* rpc = rpc_init_context();
+  struct rpc_pdu*     a   = rpc_allocate_pdu( rpc, 100003, 3, 1, nullptr, nullptr, nullptr, 0, 0 );
+  struct rpc_pdu*     b   = rpc_allocate_pdu( rpc, 100003, 3, 6, nullptr, nullptr, nullptr, 0, 0 );
+  struct rpc_pdu*     m   = rpc_allocate_pdu( rpc, 100005, 3, 1, nullptr, nullptr, nullptr, 0, 0 );
+  const char*         ha  = a->outdata.data + 4;
+  const char*         hb  = b->outdata.data + 4;
+
+  EXPECT_EQ( get_u32( ha ), a->xid );
+  EXPECT_EQ( get_u32( ha + 4 ), (uint32_t) RPC_MSG_CALL );
+  EXPECT_EQ( get_u32( ha + 8 ), (uint32_t) RPC_MSG_VERSION );
+  EXPECT_EQ( get_u32( ha + 12 ), 100003u );
+  EXPECT_EQ( get_u32( ha + 16 ), 3u );
+  EXPECT_EQ( get_u32( ha + 20 ), 1u );
+  EXPECT_EQ( get_u32( ha + 24 ), (uint32_t) AUTH_UNIX );
+  EXPECT_EQ( call_uid( ha ), (uint32_t) getuid() );
+
+  /* the same but for xid and procedure */
+  uint32_t size = zdr_getpos( &a->zdr ) - 4;
+  EXPECT_EQ( zdr_getpos( &b->zdr ) - 4, size );
+  EXPECT_EQ( get_u32( hb ), b->xid );
+  EXPECT_EQ( get_u32( hb + 20 ), 6u );
+  EXPECT_EQ( memcmp( ha + 4, hb + 4, 16 ), 0 );
+  EXPECT_EQ( memcmp( ha + 24, hb + 24, size - 24 ), 0 );
+  EXPECT_EQ( get_u32( m->outdata.data + 4 + 12 ), 100005u );
+
+  rpc_free_pdu( rpc, a );
+  rpc_free_pdu( rpc, b );
+  rpc_free_pdu( rpc, m );
+  rpc_destroy_context( rpc );
+}
+
+TEST( rpc_auth, per_uid_credentials ) {
+  struct rpc_context* rpc   = rpc_init_context();
+  struct auth*        first = rpc_get_auth( rpc );
+
+  rpc_set_uid( rpc, 1234 );
+  rpc_set_gid( rpc, 99 );
+  struct auth* other = rpc_get_auth( rpc );
+  EXPECT_NE( other, first );
+
+  struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, 100003, 3, 1, nullptr, nullptr, nullptr, 0, 0 );
+  EXPECT_EQ( call_uid( pdu->outdata.data + 4 ), 1234u );
+  rpc_free_pdu( rpc, pdu );
+
+  /* switching back finds both in the cache */
+  rpc_set_uid( rpc, getuid() );
+  rpc_set_gid( rpc, getgid() );
+  EXPECT_EQ( rpc_get_auth( rpc ), first );
+  rpc_set_uid( rpc, 1234 );
+  rpc_set_gid( rpc, 99 );
+  EXPECT_EQ( rpc_get_auth( rpc ), other );
+
+  /* more users than fit: every header still carries its own uid */
+  for ( int round = 0; round < 2; round++ ) {
+    for ( int uid = 2000; uid < 2000 + 2 * RPC_CRED_CACHE_SIZE; uid++ ) {
+      rpc_set_uid( rpc, uid );
+      pdu = rpc_allocate_pdu( rpc, 100003, 3, 1, nullptr, nullptr, nullptr, 0, 0 );
+      ASSERT_NE( pdu, nullptr );
+      EXPECT_EQ( call_uid( pdu->outdata.data + 4 ), (uint32_t) uid );
+      rpc_free_pdu( rpc, pdu );
+    }
+  }
+  rpc_destroy_context( rpc );
 }
 
 int main( int argc, char* argv[] ) {
@@ -0,0 +1,241 @@
+#ifndef TEST_RPC_FAKE_SERVER_H
+#define TEST_RPC_FAKE_SERVER_H
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <rpc/rpc.h>
+
+/*
+ * Minimal TCP RPC peer: accepts connections, each served by its own thread,
+ * and answers every call with MSG_ACCEPTED / SUCCESS followed by whatever
+ * `results` returns for it (an empty body by default).
+ */
+struct fake_server {
+  enum mode { REPLY, FRAGMENTED, SHREDDED, SILENT };
+  using results_fn = std::function< std::string( const std::vector< char >& call ) >;
+
+  int                        lfd;
+  int                        port;
+  mode                       m;
+  results_fn                 results;
+  std::thread                th;
+  std::mutex                 mtx;
+  std::vector< int >         fds;
+  std::vector< std::thread > conns;
+  std::atomic< int >         num_calls { 0 };
+
+  explicit fake_server( mode m_ = REPLY, results_fn fn = nullptr ) : m( m_ ), results( fn ) {
+    struct sockaddr_in sin {};
+    socklen_t          len = sizeof( sin );
+    sin.sin_family         = AF_INET;
+    sin.sin_addr.s_addr    = htonl( INADDR_LOOPBACK );
+    lfd                    = socket( AF_INET, SOCK_STREAM, 0 );
+    bind( lfd, (struct sockaddr*) &sin, sizeof( sin ) );
+    listen( lfd, 16 );
+    getsockname( lfd, (struct sockaddr*) &sin, &len );
+    port = ntohs( sin.sin_port );
+    th   = std::thread( [ this ] { serve(); } );
+  }
+
+  ~fake_server() {
+    shutdown( lfd, SHUT_RDWR );
+    th.join();
+    drop();
+    for ( std::thread& t : conns ) {
+      t.join();
+    }
+    for ( int fd : fds ) {
+      close( fd );
+    }
+    close( lfd );
+  }
+
+  int num_connections() {
+    std::lock_guard< std::mutex > lock( mtx );
+    return (int) fds.size();
+  }
+
+  /* cut every connection accepted so far */
+  void drop() {
+    std::lock_guard< std::mutex > lock( mtx );
+    for ( int fd : fds ) {
+      shutdown( fd, SHUT_RDWR );
+    }
+  }
+
+  static bool read_full( int fd, void* buf, size_t len ) {
+    for ( size_t pos = 0; pos < len; ) {
+      ssize_t n = read( fd, (char*) buf + pos, len - pos );
+      if ( n <= 0 ) {
+        return false;
+      }
+      pos += n;
+    }
+    return true;
+  }
+
+  static void write_full( int fd, const void* buf, size_t len ) {
+    for ( size_t pos = 0; pos < len; ) {
+      ssize_t n = write( fd, (const char*) buf + pos, len - pos );
+      if ( n <= 0 ) {
+        return;
+      }
+      pos += n;
+    }
+  }
+
+  static void put_u32( std::string& s, uint32_t v ) {
+    v = htonl( v );
+    s.append( (const char*) &v, 4 );
+  }
+
+  void serve() {
+    int fd;
+    while ( ( fd = accept( lfd, nullptr, nullptr ) ) >= 0 ) {
+      std::lock_guard< std::mutex > lock( mtx );
+      fds.push_back( fd );
+      conns.emplace_back( [ this, fd ] { serve_connection( fd ); } );
+    }
+  }
+
+  void serve_connection( int fd ) {
+    uint32_t rm;
+    while ( read_full( fd, &rm, 4 ) ) {
+      std::vector< char > call( ntohl( rm ) & 0x7fffffff );
+      if ( !read_full( fd, call.data(), call.size() ) ) {
+        break;
+      }
+      num_calls++;
+      if ( m == SILENT ) {
+        continue;
+      }
+      std::string reply( call.data(), 4 );
+      put_u32( reply, RPC_MSG_REPLY );
+      put_u32( reply, RPC_MSG_ACCEPTED );
+      put_u32( reply, 0 );
+      put_u32( reply, 0 );
+      put_u32( reply, RPC_SUCCESS );
+      if ( results ) {
+        reply += results( call );
+      }
+
+      std::string out;
+      if ( m == FRAGMENTED ) {
+        put_u32( out, 8 );
+        out.append( reply, 0, 8 );
+        put_u32( out, 0x80000000u | ( reply.size() - 8 ) );
+        out.append( reply, 8, std::string::npos );
+      } else if ( m == SHREDDED ) {
+        /* 7-byte fragments, so that every other item straddles two of them */
+        for ( size_t pos = 0; pos < reply.size(); pos += 7 ) {
+          size_t n = reply.size() - pos < 7 ? reply.size() - pos : 7;
+          put_u32( out, ( pos + n == reply.size() ? 0x80000000u : 0 ) | n );
+          out.append( reply, pos, n );
+        }
+      } else {
+        put_u32( out, 0x80000000u | reply.size() );
+        out += reply;
+      }
+      write_full( fd, out.data(), out.size() );
+    }
+  }
+};
+
+/*
+ * The same over UDP, bound to `addr`:`port` (any free port for 0). Every
+ * call is answered from `responders` sockets, the first the server's own
+ * and the others on 127.0.0.2 and up, as if a broadcast had reached that
+ * many servers.
+ */
+struct fake_udp_server {
+  int                     fd;
+  int                     port;
+  fake_server::mode       m;
+  fake_server::results_fn results;
+  std::vector< int >      responders;
+  std::thread             th;
+  std::atomic< bool >     stop { false };
+  std::atomic< int >      num_calls { 0 };
+
+  explicit fake_udp_server( const char*             addr        = "127.0.0.1",
+                            int                     port_       = 0,
+                            fake_server::mode       m_          = fake_server::REPLY,
+                            fake_server::results_fn fn          = nullptr,
+                            int                     nresponders = 1 )
+    : m( m_ ), results( fn ) {
+    struct sockaddr_in sin {};
+    socklen_t          len = sizeof( sin );
+    sin.sin_family         = AF_INET;
+    sin.sin_port           = htons( port_ );
+    inet_pton( AF_INET, addr, &sin.sin_addr );
+    fd = socket( AF_INET, SOCK_DGRAM, 0 );
+    bind( fd, (struct sockaddr*) &sin, sizeof( sin ) );
+    getsockname( fd, (struct sockaddr*) &sin, &len );
+    port = ntohs( sin.sin_port );
+    responders.push_back( fd );
+    for ( int i = 1; i < nresponders; i++ ) {
+      struct sockaddr_in from {};
+      from.sin_family      = AF_INET;
+      from.sin_addr.s_addr = htonl( INADDR_LOOPBACK + i );
+      int rfd              = socket( AF_INET, SOCK_DGRAM, 0 );
+      bind( rfd, (struct sockaddr*) &from, sizeof( from ) );
+      responders.push_back( rfd );
+    }
+    th = std::thread( [ this ] { serve(); } );
+  }
+
+  ~fake_udp_server() {
+    stop = true;
+    th.join();
+    for ( int rfd : responders ) {
+      close( rfd );
+    }
+  }
+
+  void serve() {
+    std::vector< char > buf( 64 << 10 );
+    while ( !stop ) {
+      struct pollfd pfd { fd, POLLIN, 0 };
+      if ( poll( &pfd, 1, 20 ) <= 0 ) {
+        continue;
+      }
+      struct sockaddr_in from {};
+      socklen_t          len = sizeof( from );
+      ssize_t            n   = recvfrom( fd, buf.data(), buf.size(), 0, (struct sockaddr*) &from, &len );
+      if ( n < 4 ) {
+        continue;
+      }
+      num_calls++;
+      if ( m == fake_server::SILENT ) {
+        continue;
+      }
+      std::vector< char > call( buf.begin(), buf.begin() + n );
+      std::string         reply( call.data(), 4 );
+      fake_server::put_u32( reply, RPC_MSG_REPLY );
+      fake_server::put_u32( reply, RPC_MSG_ACCEPTED );
+      fake_server::put_u32( reply, 0 );
+      fake_server::put_u32( reply, 0 );
+      fake_server::put_u32( reply, RPC_SUCCESS );
+      if ( results ) {
+        reply += results( call );
+      }
+      for ( int rfd : responders ) {
+        sendto( rfd, reply.data(), reply.size(), 0, (struct sockaddr*) &from, len );
+      }
+    }
+  }
+};
+
+#endif//! TEST_RPC_FAKE_SERVER_H
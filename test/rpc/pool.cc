@@ -0,0 +1,166 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <rpc/rpc.h>
+
+TEST( rpc_pool, size_classes_and_reuse ) {
+  struct rpc_pool pool;
+  rpc_pool_init( &pool, 1 << 20 );
+
+  uint32_t prev = 0;
+  for ( uint32_t size = 1; size <= ( 1 << 20 ); size = size * 5 / 4 + 1 ) {
+    uint32_t cap;
+    char*    p = rpc_pool_alloc( &pool, size, &cap );
+    ASSERT_NE( p, nullptr );
+    EXPECT_GE( cap, size );
+    EXPECT_LE( cap, size < RPC_POOL_MIN_SIZE ? RPC_POOL_MIN_SIZE : size + size / 4 );
+    EXPECT_GE( cap, prev );
+    prev = cap;
+    rpc_pool_free( &pool, p, cap );
+
+    /* the same class comes straight back */
+    uint32_t cap2;
+    EXPECT_EQ( rpc_pool_alloc( &pool, size, &cap2 ), p );
+    EXPECT_EQ( cap2, cap );
+    rpc_pool_free( &pool, p, cap2 );
+  }
+  EXPECT_GT( pool.stats.num_hits, 0u );
+  EXPECT_EQ( pool.stats.bytes_in_use, 0u );
+  EXPECT_EQ( pool.stats.num_oversize, 0u );
+
+  /* larger than the biggest class: plain heap, never cached */
+  uint32_t cap;
+  char*    big = rpc_pool_alloc( &pool, 4 << 20, &cap );
+  ASSERT_NE( big, nullptr );
+  EXPECT_EQ( cap, 4u << 20 );
+  uint64_t cached = pool.stats.bytes_cached;
+  rpc_pool_free( &pool, big, cap );
+  EXPECT_EQ( pool.stats.num_oversize, 1u );
+  EXPECT_EQ( pool.stats.bytes_cached, cached );
+
+  rpc_pool_destroy( &pool );
+  EXPECT_EQ( pool.stats.bytes_cached, 0u );
+}
+
+TEST( rpc_pool, trim_to_high_water ) {
+  struct rpc_pool pool;
+  rpc_pool_init( &pool, 1 << 20 );
+
+  std::vector< rpc_pdu* > pdus;
+  for ( int i = 0; i < 100; i++ ) {
+    pdus.push_back( rpc_pool_get_pdu( &pool ) );
+  }
+  for ( int i = 0; i < 100; i++ ) {
+    rpc_pool_put_pdu( &pool, pdus[ i ] );
+  }
+  EXPECT_EQ( pool.pdus.num_free, 100u );
+
+  /* the burst is within the current period: everything is kept */
+  rpc_pool_trim( &pool, false );
+  EXPECT_EQ( pool.pdus.num_free, 100u );
+
+  /* a quiet period: only what was used since is kept */
+  for ( int i = 0; i < 10; i++ ) {
+    pdus[ i ] = rpc_pool_get_pdu( &pool );
+  }
+  for ( int i = 0; i < 10; i++ ) {
+    rpc_pool_put_pdu( &pool, pdus[ i ] );
+  }
+  rpc_pool_trim( &pool, false );
+  EXPECT_EQ( pool.pdus.num_free, 10u );
+  rpc_pool_trim( &pool, false );
+  EXPECT_EQ( pool.pdus.num_free, 0u );
+
+  /* the byte cap bounds the cache regardless of the high-water mark */
+  pool.max_cached = 64 * 1024;
+  std::vector< char* > bufs;
+  uint32_t             cap = 0;
+  for ( int i = 0; i < 10; i++ ) {
+    bufs.push_back( rpc_pool_alloc( &pool, 16 * 1024, &cap ) );
+  }
+  for ( char* b : bufs ) {
+    rpc_pool_free( &pool, b, cap );
+  }
+  EXPECT_LE( pool.stats.bytes_cached, pool.max_cached );
+
+  /* a buffer from a class above a shrunken limit still leaves in_use */
+  char*    big  = rpc_pool_alloc( &pool, 512 * 1024, &cap );
+  uint32_t used = 0;
+  for ( const rpc_pool_list& l : pool.classes ) {
+    used += l.in_use;
+  }
+  EXPECT_EQ( used, 1u );
+  rpc_pool_set_max_size( &pool, 64 * 1024 );
+  rpc_pool_free( &pool, big, cap );
+  for ( const rpc_pool_list& l : pool.classes ) {
+    EXPECT_EQ( l.in_use, 0u );
+  }
+
+  rpc_pool_destroy( &pool );
+}
+
+TEST( rpc_pool, context_reuses_pdus ) {
+  struct rpc_context* rpc = rpc_init_context();
+  for ( int i = 0; i < 1000; i++ ) {
+    struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, 100003, 3, 0, nullptr, nullptr, nullptr, 0, 0 );
+    ASSERT_NE( pdu, nullptr );
+    rpc_free_pdu( rpc, pdu );
+  }
+
+  struct rpc_pool_stats stats;
+  rpc_get_pool_stats( rpc, &stats );
+  EXPECT_EQ( stats.num_allocs, 2000u );
+  EXPECT_EQ( stats.num_hits, 1998u );
+  EXPECT_EQ( stats.bytes_in_use, 0u );
+  rpc_destroy_context( rpc );
+}
+
+TEST( rpc_pool, iobuf_chain_refcounts ) {
+  struct rpc_pool pool;
+  rpc_pool_init( &pool, 1 << 20 );
+
+  /* a chain of three, the way the fragments of a record are linked */
+  struct rpc_iobuf* chain = nullptr;
+  struct rpc_iobuf* last  = nullptr;
+  for ( uint32_t size : { 100u, 0u, 5000u } ) {
+    struct rpc_iobuf* iob = rpc_iobuf_alloc( &pool, size );
+    ASSERT_NE( iob, nullptr );
+    EXPECT_EQ( iob->seg.size, size );
+    EXPECT_EQ( iob->seg.data, iob->mem + ZDR_UNIT );
+    EXPECT_GE( iob->capacity, ZDR_UNIT + size );
+    memset( iob->seg.data, 'x', size );
+    if ( last ) {
+      last->seg.next = &iob->seg;
+    } else {
+      chain = iob;
+    }
+    last = iob;
+  }
+  EXPECT_EQ( rpc_iobuf_length( chain ), 5100u );
+  EXPECT_EQ( pool.iobufs.in_use, 3u );
+
+  /* the last view to drop returns the segments and their memory */
+  rpc_iobuf_get( chain );
+  rpc_iobuf_put( &pool, chain );
+  EXPECT_EQ( pool.iobufs.in_use, 3u );
+  EXPECT_EQ( chain->seg.data[ 0 ], 'x' );
+  rpc_iobuf_put( &pool, chain );
+  EXPECT_EQ( pool.iobufs.in_use, 0u );
+  EXPECT_EQ( pool.stats.bytes_in_use, 0u );
+
+  /* and are reused from there */
+  uint64_t          hits = pool.stats.num_hits;
+  struct rpc_iobuf* iob  = rpc_iobuf_alloc( &pool, 5000 );
+  ASSERT_NE( iob, nullptr );
+  EXPECT_EQ( pool.stats.num_hits, hits + 2 );
+  rpc_iobuf_put( &pool, iob );
+
+  rpc_pool_destroy( &pool );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,133 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+
+#include "fake_server.h"
+#include <rpc/rpc.h>
+
+struct call_state {
+  int done;
+  int status;
+};
+
+static void call_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  call_state* s = (call_state*) private_data;
+  s->status     = status;
+  s->done++;
+}
+
+struct rtt_fixture {
+  struct rpc_context* rpc;
+  struct rpc_loop*    loop;
+
+  explicit rtt_fixture( int port ) {
+    rpc  = rpc_init_context();
+    loop = rpc_loop_create();
+    rpc_loop_add( loop, rpc );
+    rpc_connect_async( rpc, "127.0.0.1", port, nullptr, nullptr );
+  }
+
+  ~rtt_fixture() {
+    rpc_destroy_context( rpc );
+    rpc_loop_destroy( loop );
+  }
+
+  void run( const std::function< bool() >& done, int max_msecs = 5000 ) {
+    uint64_t end = rpc_current_time() + max_msecs;
+    while ( !done() && rpc_current_time() < end ) {
+      rpc_loop_run_once( loop, 5 );
+    }
+  }
+};
+
+TEST( rpc_rtt, estimates_from_replies ) {
+  fake_server srv;
+  rtt_fixture f( srv.port );
+
+  call_state calls {};
+  for ( int i = 0; i < 20; i++ ) {
+    ASSERT_EQ( rpc_null_async( f.rpc, 100003, 3, call_cb, &calls ), 0 );
+  }
+  f.run( [ & ] { return calls.done == 20; } );
+  ASSERT_EQ( calls.done, 20 );
+
+  const struct rpc_rtt_stats& rtt = f.rpc->stats.rtt[ RPC_RTT_METADATA ];
+  EXPECT_EQ( rtt.samples, 20u );
+  EXPECT_GT( rtt.srtt, 0u );
+  EXPECT_LT( rtt.srtt, 1000000u );
+  EXPECT_GE( rtt.rto, (uint32_t) RPC_MIN_RTO );
+  EXPECT_EQ( rtt.rto, std::max< uint32_t >( RPC_MIN_RTO, ( rtt.srtt + 4 * rtt.rttvar + 999 ) / 1000 ) );
+  EXPECT_EQ( f.rpc->stats.rtt[ RPC_RTT_READ ].samples, 0u );
+}
+
+TEST( rpc_rtt, retransmits_back_off_from_estimate ) {
+  fake_server srv( fake_server::SILENT );
+  rtt_fixture f( srv.port );
+  rpc_set_timeout( f.rpc, 1000 );
+  rpc_set_retrans( f.rpc, 2 );
+
+  /* as if earlier replies had come back in a few msecs */
+  struct rpc_rtt_stats& rtt = f.rpc->stats.rtt[ RPC_RTT_METADATA ];
+  rtt                       = { 10, 2000, 500, RPC_MIN_RTO };
+
+  call_state calls {};
+  uint64_t   start = rpc_current_time();
+  ASSERT_EQ( rpc_null_async( f.rpc, 100003, 3, call_cb, &calls ), 0 );
+
+  /* after RPC_MIN_RTO, then twice that, the class estimate left alone */
+  f.run( [ & ] { return f.rpc->stats.num_retransmitted == 1; } );
+  EXPECT_LT( rpc_current_time() - start, 500u );
+  f.run( [ & ] { return f.rpc->stats.num_retransmitted == 2; } );
+  EXPECT_LT( rpc_current_time() - start, 800u );
+  EXPECT_EQ( rtt.rto, (uint32_t) RPC_MIN_RTO );
+  EXPECT_EQ( calls.done, 0 );
+
+  /* and the last attempt waits the full timeout */
+  f.run( [ & ] { return calls.done > 0; } );
+  EXPECT_EQ( calls.status, RPC_STATUS_TIMEOUT );
+  EXPECT_GE( rpc_current_time() - start, 1000u );
+  EXPECT_EQ( f.rpc->stats.num_major_timedout, 1u );
+  EXPECT_EQ( rtt.samples, 10u );
+}
+
+TEST( rpc_rtt, concurrent_timeouts_do_not_compound ) {
+  fake_server srv( fake_server::SILENT );
+  rtt_fixture f( srv.port );
+  rpc_set_timeout( f.rpc, 2000 );
+  rpc_set_retrans( f.rpc, 3 );
+  f.rpc->stats.rtt[ RPC_RTT_METADATA ] = { 10, 2000, 500, RPC_MIN_RTO };
+
+  call_state calls {};
+  for ( int i = 0; i < 64; i++ ) {
+    ASSERT_EQ( rpc_null_async( f.rpc, 100003, 3, call_cb, &calls ), 0 );
+  }
+
+  /* each call backs off on its own: RPC_MIN_RTO, then 2 * RPC_MIN_RTO */
+  uint64_t start = rpc_current_time();
+  f.run( [ & ] { return f.rpc->stats.num_retransmitted == 128; } );
+  EXPECT_EQ( f.rpc->stats.num_retransmitted, 128u );
+  EXPECT_LT( rpc_current_time() - start, 1000u );
+  EXPECT_EQ( f.rpc->stats.rtt[ RPC_RTT_METADATA ].rto, (uint32_t) RPC_MIN_RTO );
+  EXPECT_EQ( calls.done, 0 );
+}
+
+TEST( rpc_rtt, fixed_timeout ) {
+  fake_server srv( fake_server::SILENT );
+  rtt_fixture f( srv.port );
+  rpc_set_timeout( f.rpc, 400 );
+  rpc_set_retrans( f.rpc, 1 );
+  rpc_set_adaptive_timeout( f.rpc, 0 );
+  f.rpc->stats.rtt[ RPC_RTT_METADATA ] = { 10, 2000, 500, RPC_MIN_RTO };
+
+  call_state calls {};
+  ASSERT_EQ( rpc_null_async( f.rpc, 100003, 3, call_cb, &calls ), 0 );
+  f.run( [ & ] { return false; }, 300 );
+  EXPECT_EQ( f.rpc->stats.num_retransmitted, 0u );
+  f.run( [ & ] { return calls.done > 0; } );
+  EXPECT_EQ( f.rpc->stats.num_retransmitted, 1u );
+  EXPECT_EQ( calls.status, RPC_STATUS_TIMEOUT );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,259 @@
+#include <chrono>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fake_server.h"
+#include <mount/v3/mount_v3.h>
+#include <rpc/rpc.h>
+
+struct call_state {
+  int done;
+  int status[ 3 ];
+};
+
+static void count_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  call_state* s = (call_state*) private_data;
+  if ( status <= RPC_STATUS_TIMEOUT ) {
+    s->status[ status == RPC_STATUS_SUCCESS ? 0 : status == RPC_STATUS_TIMEOUT ? 2 : 1 ]++;
+  }
+  s->done++;
+}
+
+TEST( rpc_service, builtin_loop ) {
+  fake_server         srv;
+  struct rpc_context* rpc  = rpc_init_context();
+  struct rpc_loop*    loop = rpc_loop_create();
+  ASSERT_NE( loop, nullptr );
+  ASSERT_EQ( rpc_loop_add( loop, rpc ), 0 );
+
+  call_state conn {}, calls {};
+  ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, count_cb, &conn ), 0 );
+
+  /* queued before the connect completes, flushed once it does */
+  for ( int i = 0; i < 100; i++ ) {
+    ASSERT_EQ( rpc_null_async( rpc, 100003, 3, count_cb, &calls ), 0 );
+  }
+  EXPECT_EQ( rpc_queue_length( rpc ), 100 );
+
+  for ( int i = 0; i < 1000 && calls.done < 100; i++ ) {
+    ASSERT_GE( rpc_loop_run_once( loop, 100 ), 0 );
+  }
+  EXPECT_EQ( conn.status[ 0 ], 1 );
+  EXPECT_EQ( calls.status[ 0 ], 100 );
+  EXPECT_EQ( rpc_queue_length( rpc ), 0 );
+  EXPECT_EQ( rpc->stats.num_req_sent, 100u );
+  EXPECT_EQ( rpc->stats.num_resp_rcvd, 100u );
+
+  rpc_destroy_context( rpc );
+  rpc_loop_destroy( loop );
+}
+
+TEST( rpc_service, external_poll_and_fragments ) {
+  fake_server         srv( fake_server::FRAGMENTED );
+  struct rpc_context* rpc = rpc_init_context();
+
+  call_state calls {};
+  ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, nullptr, nullptr ), 0 );
+  for ( int i = 0; i < 10; i++ ) {
+    ASSERT_EQ( rpc_null_async( rpc, 100003, 3, count_cb, &calls ), 0 );
+  }
+
+  for ( int i = 0; i < 1000 && calls.done < 10; i++ ) {
+    struct pollfd pfd { rpc_get_fd( rpc ), (short) rpc_which_events( rpc ), 0 };
+    ASSERT_GE( poll( &pfd, 1, 100 ), 0 );
+    ASSERT_EQ( rpc_service( rpc, pfd.revents ), 0 );
+  }
+  EXPECT_EQ( calls.status[ 0 ], 10 );
+  EXPECT_EQ( rpc_which_events( rpc ), POLLIN );
+
+  rpc_destroy_context( rpc );
+}
+
+/* an EXPORT body of `dirs`, each with one group */
+static std::string export_list( const std::vector< std::string >& dirs ) {
+  std::string body;
+  for ( const std::string& d : dirs ) {
+    for ( const std::string& s : { d, std::string( "@all" ) } ) {
+      fake_server::put_u32( body, 1 );
+      fake_server::put_u32( body, s.size() );
+      body += s;
+      body.append( ZDR_ROUNDUP( s.size() ) - s.size(), '\0' );
+    }
+    fake_server::put_u32( body, 0 ); /* end of groups */
+  }
+  fake_server::put_u32( body, 0 ); /* end of exports */
+  return body;
+}
+
+struct export_state {
+  int                        done;
+  std::vector< std::string > dirs;
+  const char*                kept;  /* a view, still valid while chain is held */
+  struct rpc_iobuf*          chain;
+};
+
+/* a reply in 7-byte fragments is decoded where it was received */
+TEST( rpc_service, shredded_reply_decodes_in_place ) {
+  std::vector< std::string > dirs = { "/export", "/srv/nfs/a-much-longer-directory-name", "/abc" };
+  fake_server                srv( fake_server::SHREDDED, [ & ]( const std::vector< char >& call ) {
+    /* NULL has an empty body, EXPORT the list */
+    return zdr_get_u32( &call[ 20 ] ) ? export_list( dirs ) : std::string();
+  } );
+  struct rpc_context*        rpc = rpc_init_context();
+  ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, nullptr, nullptr ), 0 );
+
+  call_state   calls {};
+  export_state ex {};
+  ASSERT_EQ( rpc_null_async( rpc, 100003, 3, count_cb, &calls ), 0 );
+  ASSERT_EQ( mount3_export_async(
+               rpc,
+               []( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+                 export_state* s = (export_state*) private_data;
+                 s->done++;
+                 ASSERT_EQ( status, RPC_STATUS_SUCCESS );
+                 for ( exports e = *(exports*) data; e; e = e->ex_next ) {
+                   ASSERT_NE( e->ex_groups, nullptr );
+                   EXPECT_STREQ( e->ex_groups->gr_name, "@all" );
+                   s->dirs.push_back( e->ex_dir );
+                 }
+                 /* keep the views past the callback */
+                 s->chain = rpc_get_reply_iobuf( rpc );
+                 ASSERT_NE( s->chain, nullptr );
+                 rpc_iobuf_get( s->chain );
+                 s->kept = ( *(exports*) data )->ex_next->ex_dir;
+               },
+               &ex ),
+             0 );
+
+  for ( int i = 0; i < 1000 && ( calls.done < 1 || ex.done < 1 ); i++ ) {
+    struct pollfd pfd { rpc_get_fd( rpc ), (short) rpc_which_events( rpc ), 0 };
+    ASSERT_GE( poll( &pfd, 1, 100 ), 0 );
+    ASSERT_EQ( rpc_service( rpc, pfd.revents ), 0 );
+  }
+  EXPECT_EQ( calls.status[ 0 ], 1 );
+  ASSERT_EQ( ex.done, 1 );
+  EXPECT_EQ( ex.dirs, dirs );
+  EXPECT_EQ( rpc->pool.iobufs.in_use, ( rpc_iobuf_length( ex.chain ) + 6 ) / 7 );
+  EXPECT_STREQ( ex.kept, dirs[ 1 ].c_str() );
+  rpc_iobuf_put( &rpc->pool, ex.chain );
+  EXPECT_EQ( rpc->pool.iobufs.in_use, 0u );
+
+  rpc_destroy_context( rpc );
+}
+
+TEST( rpc_service, timeout_and_cancel ) {
+  fake_server         srv( fake_server::SILENT );
+  struct rpc_context* rpc  = rpc_init_context();
+  struct rpc_loop*    loop = rpc_loop_create();
+  ASSERT_EQ( rpc_loop_add( loop, rpc ), 0 );
+  rpc->poll_timeout = 10;
+  rpc_set_timeout( rpc, 50 );
+
+  call_state calls {};
+  ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, nullptr, nullptr ), 0 );
+  ASSERT_EQ( rpc_null_async( rpc, 100003, 3, count_cb, &calls ), 0 );
+  for ( int i = 0; i < 100 && !calls.done; i++ ) {
+    rpc_loop_run_once( loop, 10 );
+  }
+  EXPECT_EQ( calls.status[ 2 ], 1 );
+  EXPECT_EQ( rpc->stats.num_timedout, 1u );
+
+  /* whatever is still pending when the context goes away is cancelled */
+  rpc_set_timeout( rpc, 0 );
+  ASSERT_EQ( rpc_null_async( rpc, 100003, 3, count_cb, &calls ), 0 );
+  rpc_loop_run_once( loop, 10 );
+  rpc_destroy_context( rpc );
+  EXPECT_EQ( calls.done, 2 );
+  EXPECT_EQ( calls.status[ 1 ], 1 );
+  rpc_loop_destroy( loop );
+}
+
+/* contexts without events or due timers are not serviced at all */
+TEST( rpc_service, loop_leaves_idle_contexts_alone ) {
+  fake_server         srv;
+  struct rpc_loop*    loop = rpc_loop_create();
+  struct rpc_context* busy = rpc_init_context();
+  struct rpc_context* idle = rpc_init_context();
+  call_state          conn {}, calls {};
+  for ( struct rpc_context* rpc : { busy, idle } ) {
+    ASSERT_EQ( rpc_loop_add( loop, rpc ), 0 );
+    ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, count_cb, &conn ), 0 );
+  }
+  for ( int i = 0; i < 100 && conn.done < 2; i++ ) {
+    rpc_loop_run_once( loop, 10 );
+  }
+  ASSERT_EQ( conn.status[ 0 ], 2 );
+  for ( int i = 0; i < 10; i++ ) {
+    rpc_loop_run_once( loop, 10 );
+  }
+
+  uint64_t scanned = idle->last_timeout_scan;
+  for ( int i = 0; i < 50; i++ ) {
+    ASSERT_EQ( rpc_null_async( busy, 100003, 3, count_cb, &calls ), 0 );
+    for ( int j = 0; j < 100 && calls.done <= i; j++ ) {
+      rpc_loop_run_once( loop, 10 );
+    }
+  }
+  EXPECT_EQ( calls.status[ 0 ], 50 );
+  EXPECT_GT( busy->last_timeout_scan, scanned );
+  EXPECT_EQ( idle->last_timeout_scan, scanned );
+
+  rpc_destroy_context( busy );
+  rpc_destroy_context( idle );
+  rpc_loop_destroy( loop );
+}
+
+struct destroy_state {
+  struct rpc_context* rpcs[ 2 ];
+  int                 replies;
+};
+
+static void destroy_other_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  destroy_state* s = (destroy_state*) private_data;
+  if ( status != RPC_STATUS_SUCCESS ) {
+    return;
+  }
+  s->replies++;
+  int other = s->rpcs[ 0 ] == rpc ? 1 : 0;
+  if ( s->rpcs[ other ] ) {
+    rpc_destroy_context( s->rpcs[ other ] );
+    s->rpcs[ other ] = nullptr;
+  }
+}
+
+/* a context destroyed by a callback must not be serviced for events already returned */
+TEST( rpc_service, loop_survives_destroy_in_callback ) {
+  fake_server      srv;
+  struct rpc_loop* loop = rpc_loop_create();
+  destroy_state    s { { rpc_init_context(), rpc_init_context() }, 0 };
+  call_state       conn {};
+  for ( struct rpc_context* rpc : s.rpcs ) {
+    ASSERT_EQ( rpc_loop_add( loop, rpc ), 0 );
+    ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, count_cb, &conn ), 0 );
+  }
+  for ( int i = 0; i < 100 && conn.done < 2; i++ ) {
+    rpc_loop_run_once( loop, 10 );
+  }
+  ASSERT_EQ( conn.status[ 0 ], 2 );
+
+  /* both replies are waiting before the loop looks */
+  for ( struct rpc_context* rpc : s.rpcs ) {
+    ASSERT_EQ( rpc_null_async( rpc, 100003, 3, destroy_other_cb, &s ), 0 );
+  }
+  std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+  rpc_loop_run_once( loop, 10 );
+  EXPECT_EQ( s.replies, 1 );
+  EXPECT_TRUE( !s.rpcs[ 0 ] != !s.rpcs[ 1 ] );
+
+  rpc_destroy_context( s.rpcs[ 0 ] ? s.rpcs[ 0 ] : s.rpcs[ 1 ] );
+  rpc_loop_destroy( loop );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
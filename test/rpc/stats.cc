@@ -0,0 +1,121 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "fake_server.h"
+#include <rpc/rpc.h>
+
+struct call_state {
+  int done;
+  int status;
+};
+
+static void call_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  call_state* s = (call_state*) private_data;
+  s->status     = status;
+  s->done++;
+}
+
+static void run_calls( fake_server& srv, struct rpc_context* rpc, uint32_t procedure, int n ) {
+  struct rpc_loop* loop = rpc_loop_create();
+  rpc_loop_add( loop, rpc );
+  rpc_connect_async( rpc, "127.0.0.1", srv.port, nullptr, nullptr );
+
+  call_state calls {};
+  for ( int i = 0; i < n; i++ ) {
+    struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, 100003, 3, procedure, call_cb, &calls, nullptr, 0, 0 );
+    ASSERT_NE( pdu, nullptr );
+    ASSERT_EQ( rpc_queue_pdu( rpc, pdu ), 0 );
+  }
+  for ( int i = 0; i < 1000 && calls.done < n; i++ ) {
+    rpc_loop_run_once( loop, 10 );
+  }
+  EXPECT_EQ( calls.done, n );
+  rpc_loop_destroy( loop );
+}
+
+TEST( rpc_stats, per_procedure_latencies ) {
+  fake_server         srv;
+  struct rpc_context* rpc = rpc_init_context();
+  run_calls( srv, rpc, 1, 100 );
+  run_calls( srv, rpc, 0, 3 );
+
+  std::unique_ptr< struct rpc_stats, void ( * )( struct rpc_stats* ) > s( rpc_alloc_stats(), rpc_free_stats );
+  rpc_get_stats( rpc, s.get() );
+  EXPECT_EQ( s->num_resp_rcvd, 103u );
+
+  const struct rpc_proc_stats& getattr = s->procs[ 1 ];
+  EXPECT_EQ( getattr.ops, 100u );
+  EXPECT_EQ( getattr.errors, 0u );
+  EXPECT_GT( getattr.bytes_sent, 0u );
+  EXPECT_EQ( getattr.bytes_sent % 100, 0u ); /* all calls are the same size */
+  EXPECT_EQ( getattr.bytes_rcvd, 100u * 24 );
+  ASSERT_NE( getattr.latency, nullptr );
+  for ( int l = 0; l < RPC_LAT_NUM; l++ ) {
+    const struct rpc_histogram& h = getattr.latency[ l ];
+    EXPECT_EQ( h.count, 100u );
+    uint64_t p50 = rpc_histogram_percentile( &h, 0.5 );
+    uint64_t p99 = rpc_histogram_percentile( &h, 0.99 );
+    EXPECT_LE( p50, p99 );
+    EXPECT_LE( p99, h.max );
+    EXPECT_EQ( rpc_histogram_percentile( &h, 1.0 ), h.max );
+  }
+  const struct rpc_histogram& total = getattr.latency[ RPC_LAT_TOTAL ];
+  EXPECT_GE( total.sum, getattr.latency[ RPC_LAT_WIRE ].sum );
+  EXPECT_EQ( s->procs[ 0 ].ops, 3u );
+  EXPECT_EQ( s->procs[ 2 ].ops, 0u );
+  EXPECT_EQ( s->procs[ 2 ].latency, nullptr );
+
+  /* two connections add up */
+  rpc_merge_stats( s.get(), &rpc->stats );
+  EXPECT_EQ( s->procs[ 1 ].latency[ RPC_LAT_TOTAL ].count, 200u );
+  EXPECT_EQ( s->procs[ 1 ].latency[ RPC_LAT_TOTAL ].max, total.max );
+
+  /* a snapshot taken again replaces the old one */
+  rpc_get_stats( rpc, s.get() );
+  EXPECT_EQ( s->procs[ 1 ].latency[ RPC_LAT_TOTAL ].count, 100u );
+
+  rpc_destroy_context( rpc );
+}
+
+TEST( rpc_stats, timeouts_are_errors ) {
+  fake_server         srv( fake_server::SILENT );
+  struct rpc_context* rpc = rpc_init_context();
+  rpc_set_timeout( rpc, 30 );
+  run_calls( srv, rpc, 6, 2 );
+
+  EXPECT_EQ( rpc->stats.procs[ 6 ].ops, 0u );
+  EXPECT_EQ( rpc->stats.procs[ 6 ].errors, 2u );
+  EXPECT_EQ( rpc->stats.procs[ 6 ].latency, nullptr );
+  rpc_destroy_context( rpc );
+}
+
+TEST( rpc_stats, text_and_json ) {
+  fake_server         srv;
+  struct rpc_context* rpc = rpc_init_context();
+  run_calls( srv, rpc, 3, 5 );
+  run_calls( srv, rpc, 30, 1 );
+
+  const char* names[ RPC_STATS_NUM_PROCS ] = { "NULL", "GETATTR", "SETATTR", "LOOKUP" };
+  std::string text                         = rpc_format_stats( &rpc->stats, names, false );
+  EXPECT_NE( text.find( "sent 6 rcvd 6" ), std::string::npos ) << text;
+  EXPECT_NE( text.find( "LOOKUP: ops 5 errors 0" ), std::string::npos ) << text;
+  EXPECT_NE( text.find( "  wire    avg " ), std::string::npos ) << text;
+  EXPECT_EQ( text.find( "GETATTR" ), std::string::npos ) << text;
+
+  std::string json = rpc_format_stats( &rpc->stats, nullptr, true );
+  EXPECT_EQ( json.front(), '{' );
+  EXPECT_EQ( json.back(), '}' );
+  EXPECT_NE( json.find( "\"num_resp_rcvd\":6," ), std::string::npos ) << json;
+  EXPECT_NE( json.find( "\"procs\":{\"proc3\":{\"ops\":5,\"errors\":0," ), std::string::npos ) << json;
+  EXPECT_NE( json.find( "\"total\":{\"count\":5," ), std::string::npos ) << json;
+  EXPECT_NE( json.find( "\"rtt\":{\"metadata\":{\"samples\":6," ), std::string::npos ) << json;
+
+  rpc_destroy_context( rpc );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
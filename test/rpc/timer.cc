@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "fake_server.h"
+#include <rpc/rpc.h>
+
+static std::vector< uint64_t > expire_all( struct rpc_timer_wheel* w, uint64_t now ) {
+  std::vector< uint64_t > due;
+  struct rpc_timer*       t;
+  while ( ( t = rpc_timer_expire( w, now ) ) ) {
+    due.push_back( t->expires );
+  }
+  return due;
+}
+
+TEST( rpc_timer, arm_cancel_expire ) {
+  struct rpc_timer_wheel w;
+  struct rpc_timer       t[ 4 ] {};
+  rpc_timer_init( &w, 1000 );
+  w.slack = 1;
+
+  EXPECT_EQ( rpc_timer_next( &w ), UINT64_MAX );
+  rpc_timer_arm( &w, &t[ 0 ], 1005 );
+  rpc_timer_arm( &w, &t[ 1 ], 1005 );
+  rpc_timer_arm( &w, &t[ 2 ], 1010 );
+  rpc_timer_arm( &w, &t[ 3 ], 1020 );
+  EXPECT_EQ( rpc_timer_next( &w ), 1005u );
+
+  rpc_timer_cancel( &w, &t[ 1 ] );
+  rpc_timer_cancel( &w, &t[ 1 ] );
+  rpc_timer_arm( &w, &t[ 3 ], 1007 );
+
+  EXPECT_TRUE( expire_all( &w, 1004 ).empty() );
+  EXPECT_EQ( expire_all( &w, 1008 ), ( std::vector< uint64_t >{ 1005, 1007 } ) );
+  EXPECT_EQ( expire_all( &w, 2000 ), ( std::vector< uint64_t >{ 1010 } ) );
+  EXPECT_EQ( rpc_timer_next( &w ), UINT64_MAX );
+
+  /* already overdue when armed: due on the next tick */
+  rpc_timer_arm( &w, &t[ 0 ], 10 );
+  EXPECT_EQ( rpc_timer_next( &w ), 2001u );
+  EXPECT_EQ( expire_all( &w, 2001 ).size(), 1u );
+}
+
+TEST( rpc_timer, cascades_in_order ) {
+  struct rpc_timer_wheel   w;
+  std::vector< rpc_timer > t( 120 );
+  rpc_timer_init( &w, 0 );
+  w.slack = 1;
+
+  /* spread over every level, and one beyond the wheel */
+  uint64_t deadline = 1;
+  for ( struct rpc_timer& timer : t ) {
+    rpc_timer_arm( &w, &timer, deadline );
+    deadline = deadline * 11 / 10 + 7;
+  }
+  rpc_timer_arm( &w, &t.back(), 1ull << 26 );
+
+  std::vector< uint64_t > due;
+  for ( uint64_t now = 0; due.size() < t.size(); now += 997 ) {
+    for ( uint64_t d : expire_all( &w, now ) ) {
+      EXPECT_LE( d, now );
+      EXPECT_GT( d + 997, now );
+      due.push_back( d );
+    }
+    ASSERT_LT( now, 1ull << 27 );
+  }
+  EXPECT_TRUE( std::is_sorted( due.begin(), due.end() ) );
+  EXPECT_EQ( due.back(), 1ull << 26 );
+}
+
+TEST( rpc_timer, slack_batches_deadlines ) {
+  struct rpc_timer_wheel w;
+  struct rpc_timer       t[ 3 ] {};
+  rpc_timer_init( &w, 0 );
+  w.slack = 50;
+
+  rpc_timer_arm( &w, &t[ 0 ], 101 );
+  rpc_timer_arm( &w, &t[ 1 ], 130 );
+  rpc_timer_arm( &w, &t[ 2 ], 150 );
+  EXPECT_LE( rpc_timer_next( &w ), 150u );
+  EXPECT_TRUE( expire_all( &w, 149 ).empty() );
+  EXPECT_EQ( expire_all( &w, 150 ).size(), 3u );
+}
+
+struct call_state {
+  int done;
+  int status;
+};
+
+static void call_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  call_state* s = (call_state*) private_data;
+  s->status     = status;
+  s->done++;
+}
+
+TEST( rpc_timer, retransmits_then_major_timeout ) {
+  fake_server         srv( fake_server::SILENT );
+  struct rpc_context* rpc  = rpc_init_context();
+  struct rpc_loop*    loop = rpc_loop_create();
+  ASSERT_EQ( rpc_loop_add( loop, rpc ), 0 );
+  rpc_set_timeout( rpc, 30 );
+  rpc_set_retrans( rpc, 2 );
+
+  call_state calls {};
+  ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, nullptr, nullptr ), 0 );
+  ASSERT_EQ( rpc_null_async( rpc, 100003, 3, call_cb, &calls ), 0 );
+  for ( int i = 0; i < 300 && !calls.done; i++ ) {
+    rpc_loop_run_once( loop, 10 );
+  }
+  EXPECT_EQ( calls.done, 1 );
+  EXPECT_EQ( calls.status, RPC_STATUS_TIMEOUT );
+  EXPECT_EQ( srv.num_calls, 3 );
+  EXPECT_EQ( rpc->stats.num_retransmitted, 2u );
+  EXPECT_EQ( rpc->stats.num_timedout, 3u );
+  EXPECT_EQ( rpc->stats.num_major_timedout, 1u );
+  EXPECT_EQ( rpc_queue_length( rpc ), 0 );
+
+  rpc_destroy_context( rpc );
+  rpc_loop_destroy( loop );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
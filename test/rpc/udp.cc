@@ -0,0 +1,335 @@
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fake_server.h"
+#include <mount/v3/mount_v3.h>
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+/*
+ * The UDP transport against fake servers on 127.0.0.0/8, all of which is
+ * on the loopback interface, so every server has an address of its own.
+ */
+struct udp_reply {
+  int         status;
+  std::string from;
+  std::string dir; /* first export, for EXPORT replies */
+};
+
+static std::string udp_src( struct rpc_context* rpc ) {
+  char buf[ INET_ADDRSTRLEN ] {};
+  inet_ntop( AF_INET, &( (const struct sockaddr_in*) rpc_get_udp_src( rpc ) )->sin_addr, buf, sizeof( buf ) );
+  return buf;
+}
+
+static void reply_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  udp_reply r { status, udp_src( rpc ), "" };
+  if ( status == RPC_STATUS_SUCCESS && data && *(exports*) data ) {
+    r.dir = ( *(exports*) data )->ex_dir;
+  }
+  ( (std::vector< udp_reply >*) private_data )->push_back( r );
+}
+
+static void run_until( struct rpc_context* rpc, const std::function< bool() >& done ) {
+  for ( int i = 0; i < 500 && !done(); i++ ) {
+    struct pollfd pfd { rpc_get_fd( rpc ), (short) rpc_which_events( rpc ), 0 };
+    ASSERT_GE( poll( &pfd, 1, 10 ), 0 );
+    ASSERT_EQ( rpc_service( rpc, pfd.revents ), 0 );
+  }
+}
+
+/* an EXPORT body listing "/export/<address of the server>" */
+static std::string export_of( const std::string& addr ) {
+  std::string body;
+  std::string dir = "/export/" + addr;
+  fake_server::put_u32( body, 1 );
+  fake_server::put_u32( body, dir.size() );
+  body += dir;
+  body.append( ZDR_ROUNDUP( dir.size() ) - dir.size(), '\0' );
+  fake_server::put_u32( body, 0 ); /* no groups */
+  fake_server::put_u32( body, 0 ); /* end of list */
+  return body;
+}
+
+static struct rpc_context* udp_context() {
+  struct rpc_context* rpc = rpc_init_context();
+  EXPECT_EQ( rpc_bind_udp( rpc, nullptr, 0 ), 0 );
+  return rpc;
+}
+
+/* a burst goes out in RPC_UDP_BATCH datagrams per system call, and comes back in batches too */
+TEST( rpc_udp, batched_calls ) {
+  fake_udp_server     srv;
+  struct rpc_context* rpc  = udp_context();
+  int                 done = 0;
+  auto                cb   = []( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    ( *(int*) private_data ) += status == RPC_STATUS_SUCCESS;
+  };
+
+  /* nowhere to send it yet */
+  EXPECT_EQ( mount3_null_async( rpc, cb, &done ), -1 );
+  ASSERT_EQ( rpc_set_udp_destination( rpc, "127.0.0.1", srv.port, 0 ), 0 );
+
+  const int n = 128;
+  rpc_cork( rpc );
+  for ( int i = 0; i < n; i++ ) {
+    ASSERT_EQ( mount3_null_async( rpc, cb, &done ), 0 );
+  }
+  uint64_t calls = rpc->stats.num_syscalls;
+  rpc_uncork( rpc );
+  EXPECT_EQ( rpc->stats.num_req_sent, (uint64_t) n );
+  EXPECT_LE( rpc->stats.num_syscalls - calls, (uint64_t) ( n + RPC_UDP_BATCH - 1 ) / RPC_UDP_BATCH );
+
+  /* every reply already waiting: read RPC_UDP_RECV_BATCH at a time */
+  for ( int i = 0; i < 500 && srv.num_calls < n; i++ ) {
+    std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );
+  }
+  std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+  calls = rpc->stats.num_syscalls;
+  ASSERT_EQ( rpc_service( rpc, POLLIN ), 0 );
+  EXPECT_EQ( done, n );
+  EXPECT_LE( rpc->stats.num_syscalls - calls, (uint64_t) n / RPC_UDP_RECV_BATCH + 1 );
+  EXPECT_EQ( rpc->stats.num_resp_rcvd, (uint64_t) n );
+
+  rpc_destroy_context( rpc );
+}
+
+/* one EXPORT to each of many servers, every reply telling who sent it */
+TEST( rpc_udp, discover_exports ) {
+  std::vector< std::unique_ptr< fake_udp_server > > servers;
+  std::vector< std::string >                        addrs;
+  int                                               port = 0;
+  for ( int i = 0; i < 32; i++ ) {
+    std::string addr = "127.0.0." + std::to_string( i + 1 );
+    servers.emplace_back( new fake_udp_server( addr.c_str(), port, fake_server::REPLY,
+                                               [ addr ]( const std::vector< char >& ) { return export_of( addr ); } ) );
+    port = servers[ 0 ]->port;
+    addrs.push_back( addr );
+  }
+
+  struct rpc_context*      rpc = udp_context();
+  std::vector< udp_reply > replies;
+  ASSERT_EQ( mount3_discover_async( rpc, addrs, port, true, 0, reply_cb, &replies ), (int) addrs.size() );
+  run_until( rpc, [ & ] { return replies.size() >= addrs.size(); } );
+
+  ASSERT_EQ( replies.size(), addrs.size() );
+  std::map< std::string, std::string > seen;
+  for ( const udp_reply& r : replies ) {
+    EXPECT_EQ( r.status, RPC_STATUS_SUCCESS );
+    EXPECT_EQ( r.dir, "/export/" + r.from );
+    seen[ r.from ] = r.dir;
+  }
+  EXPECT_EQ( seen.size(), addrs.size() );
+  EXPECT_EQ( rpc->waitpdu.count, 0u );
+
+  rpc_destroy_context( rpc );
+}
+
+/* a broadcast takes every answer, and ends with its timeout */
+TEST( rpc_udp, broadcast_collects_replies ) {
+  fake_udp_server     srv( "127.0.0.1", 0, fake_server::REPLY, nullptr, 3 );
+  struct rpc_context* rpc = udp_context();
+  rpc_set_timeout( rpc, 200 );
+
+  std::vector< udp_reply > replies;
+  ASSERT_EQ( mount3_discover_async( rpc, { "127.0.0.1" }, srv.port, false, 1, reply_cb, &replies ), 1 );
+  run_until( rpc, [ & ] { return !replies.empty() && replies.back().status == RPC_STATUS_TIMEOUT; } );
+
+  ASSERT_EQ( replies.size(), 4u );
+  std::map< std::string, int > seen;
+  for ( int i = 0; i < 3; i++ ) {
+    EXPECT_EQ( replies[ i ].status, RPC_STATUS_SUCCESS );
+    seen[ replies[ i ].from ]++;
+  }
+  EXPECT_EQ( seen.size(), 3u );
+  EXPECT_EQ( replies[ 3 ].from, "127.0.0.1" );
+  EXPECT_EQ( rpc->stats.num_timedout, 0u );
+  EXPECT_EQ( rpc->stats.num_retransmitted, 0u );
+  EXPECT_EQ( rpc->waitpdu.count, 0u );
+
+  rpc_destroy_context( rpc );
+}
+
+/* a server that does not answer times out on its own, and says which it was */
+TEST( rpc_udp, silent_server_times_out ) {
+  fake_udp_server     quiet( "127.0.0.1", 0, fake_server::SILENT );
+  fake_udp_server     srv( "127.0.0.2", quiet.port );
+  struct rpc_context* rpc = udp_context();
+  rpc_set_timeout( rpc, 200 );
+  rpc_set_retrans( rpc, 1 );
+
+  std::vector< udp_reply > replies;
+  ASSERT_EQ( mount3_discover_async( rpc, { "127.0.0.1", "127.0.0.2" }, quiet.port, false, 0, reply_cb, &replies ), 2 );
+  run_until( rpc, [ & ] { return replies.size() >= 2; } );
+
+  ASSERT_EQ( replies.size(), 2u );
+  EXPECT_EQ( replies[ 0 ].status, RPC_STATUS_SUCCESS );
+  EXPECT_EQ( replies[ 0 ].from, "127.0.0.2" );
+  EXPECT_EQ( replies[ 1 ].status, RPC_STATUS_TIMEOUT );
+  EXPECT_EQ( replies[ 1 ].from, "127.0.0.1" );
+  /* sent again once before giving up */
+  EXPECT_EQ( quiet.num_calls, 2 );
+
+  rpc_destroy_context( rpc );
+}
+
+/* a reply larger than RPC_UDP_BUF_SIZE fails its call */
+TEST( rpc_udp, reply_too_large ) {
+  fake_udp_server srv( "127.0.0.1", 0, fake_server::REPLY,
+                       []( const std::vector< char >& ) { return std::string( RPC_UDP_BUF_SIZE, '\0' ); } );
+  struct rpc_context* rpc = udp_context();
+  ASSERT_EQ( rpc_set_udp_destination( rpc, "127.0.0.1", srv.port, 0 ), 0 );
+
+  std::vector< udp_reply > replies;
+  ASSERT_EQ( mount3_export_async( rpc, reply_cb, &replies ), 0 );
+  run_until( rpc, [ & ] { return !replies.empty(); } );
+
+  ASSERT_EQ( replies.size(), 1u );
+  EXPECT_EQ( replies[ 0 ].status, RPC_STATUS_ERROR );
+  EXPECT_NE( strstr( rpc_get_error( rpc ), "too large for UDP" ), nullptr );
+  EXPECT_EQ( rpc->waitpdu.count, 0u );
+
+  rpc_destroy_context( rpc );
+}
+
+/*
+ * NFSv3 results from a server whose files are as large as the last octet
+ * of its address: GETATTR, ACCESS granting what was asked, and LOOKUP of
+ * anything but "missing".
+ */
+static std::string nfs_results( const std::string& addr, const std::vector< char >& call ) {
+  uint32_t    proc, last;
+  std::string r;
+  memcpy( &proc, call.data() + 20, 4 );
+  memcpy( &last, call.data() + call.size() - 4, 4 );
+  switch ( ntohl( proc ) ) {
+    case NFS3_GETATTR:
+      fake_server::put_u32( r, NFS3_OK );
+      fake_server::put_u32( r, NF3REG );
+      fake_server::put_u32( r, 0644 );
+      for ( int i = 0; i < 3; i++ ) {
+        fake_server::put_u32( r, 1 ); /* nlink, uid, gid */
+      }
+      fake_server::put_u32( r, 0 );
+      fake_server::put_u32( r, std::stoi( addr.substr( addr.rfind( '.' ) + 1 ) ) );
+      for ( int i = 0; i < 14; i++ ) {
+        fake_server::put_u32( r, 0 ); /* used, rdev, fsid, fileid and times */
+      }
+      break;
+    case NFS3_ACCESS:
+      fake_server::put_u32( r, NFS3_OK );
+      fake_server::put_u32( r, 0 );
+      r.append( (const char*) &last, 4 );
+      break;
+    case NFS3_LOOKUP:
+      if ( std::string( call.data() + call.size() - 8, 7 ) == "missing" ) {
+        fake_server::put_u32( r, NFS3ERR_NOENT );
+        fake_server::put_u32( r, 0 );
+        break;
+      }
+      fake_server::put_u32( r, NFS3_OK );
+      fake_server::put_u32( r, 4 );
+      r += "fh42";
+      fake_server::put_u32( r, 0 );
+      fake_server::put_u32( r, 0 );
+      break;
+  }
+  return r;
+}
+
+/* metadata calls go to many servers from the one socket, like MOUNT */
+TEST( rpc_udp, nfs_metadata_scan ) {
+  std::vector< std::unique_ptr< fake_udp_server > > servers;
+  int                                               port = 0;
+  for ( int i = 0; i < 4; i++ ) {
+    std::string addr = "127.0.0." + std::to_string( i + 1 );
+    servers.emplace_back( new fake_udp_server( addr.c_str(), port, fake_server::REPLY,
+                                               [ addr ]( const std::vector< char >& call ) { return nfs_results( addr, call ); } ) );
+    port = servers[ 0 ]->port;
+  }
+
+  struct scan {
+    std::map< std::string, uint64_t > sizes;
+    std::map< std::string, uint32_t > access;
+    int                               found, missing, failed;
+  } sc {};
+  char          root[] = "root";
+  struct nfs_fh fh { 4, root };
+  rpc_cb getattr_cb = []( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    scan*        sc  = (scan*) private_data;
+    GETATTR3res* res = (GETATTR3res*) data;
+    if ( status != RPC_STATUS_SUCCESS || res->status != NFS3_OK ) {
+      sc->failed++;
+      return;
+    }
+    sc->sizes[ udp_src( rpc ) ] = res->GETATTR3res_u.resok.obj_attributes.size;
+  };
+  rpc_cb access_cb = []( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    scan*       sc  = (scan*) private_data;
+    ACCESS3res* res = (ACCESS3res*) data;
+    if ( status != RPC_STATUS_SUCCESS || res->status != NFS3_OK ) {
+      sc->failed++;
+      return;
+    }
+    sc->access[ udp_src( rpc ) ] = res->ACCESS3res_u.resok.access;
+  };
+  rpc_cb lookup_cb = []( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+    scan*       sc  = (scan*) private_data;
+    LOOKUP3res* res = (LOOKUP3res*) data;
+    if ( status != RPC_STATUS_SUCCESS ) {
+      sc->failed++;
+    } else if ( res->status == NFS3ERR_NOENT ) {
+      sc->missing++;
+    } else if ( res->status == NFS3_OK && std::string( res->LOOKUP3res_u.resok.object.data.data_val, 4 ) == "fh42" ) {
+      sc->found++;
+    } else {
+      sc->failed++;
+    }
+  };
+
+  struct rpc_context* rpc = udp_context();
+  rpc_cork( rpc );
+  for ( int i = 0; i < 4; i++ ) {
+    ASSERT_EQ( rpc_set_udp_destination( rpc, ( "127.0.0." + std::to_string( i + 1 ) ).c_str(), port, 0 ), 0 );
+    ASSERT_EQ( nfs3_getattr_async( rpc, &fh, getattr_cb, &sc ), 0 );
+    ASSERT_EQ( nfs3_access_async( rpc, &fh, ACCESS3_READ | ACCESS3_LOOKUP, access_cb, &sc ), 0 );
+    ASSERT_EQ( nfs3_lookup_async( rpc, &fh, i % 2 ? "missing" : "present", lookup_cb, &sc ), 0 );
+  }
+  uint64_t calls = rpc->stats.num_syscalls;
+  rpc_uncork( rpc );
+  EXPECT_EQ( rpc->stats.num_syscalls - calls, 1u );
+  run_until( rpc, [ & ] { return sc.sizes.size() + sc.access.size() + sc.found + sc.missing + sc.failed >= 12; } );
+
+  EXPECT_EQ( sc.failed, 0 );
+  ASSERT_EQ( sc.sizes.size(), 4u );
+  for ( int i = 0; i < 4; i++ ) {
+    std::string addr = "127.0.0." + std::to_string( i + 1 );
+    EXPECT_EQ( sc.sizes[ addr ], (uint64_t) i + 1 );
+    EXPECT_EQ( sc.access[ addr ], (uint32_t) ( ACCESS3_READ | ACCESS3_LOOKUP ) );
+  }
+  EXPECT_EQ( sc.found, 2 );
+  EXPECT_EQ( sc.missing, 2 );
+
+  /* a handle that can not be sent fails at once */
+  struct nfs_fh bad { NFS3_FHSIZE + 1, root };
+  EXPECT_EQ( nfs3_getattr_async( rpc, &bad, getattr_cb, &sc ), -1 );
+  EXPECT_NE( strstr( rpc_get_error( rpc ), "Invalid file handle length" ), nullptr );
+  EXPECT_EQ( rpc_get_errno( rpc ), EINVAL );
+
+  rpc_destroy_context( rpc );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,61 @@
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <rpc/rpc.h>
+
+TEST( rpc_waitpdu, insert_lookup_remove ) {
+  struct rpc_hash_table t {};
+  ASSERT_TRUE( rpc_hash_init( &t, 4 ) );
+
+  std::vector< rpc_pdu > pdus( 10000 );
+  for ( uint32_t i = 0; i < pdus.size(); i++ ) {
+    pdus[ i ].xid = 0xfffff000u + i;/* wraps around zero */
+    ASSERT_TRUE( rpc_hash_insert( &t, &pdus[ i ] ) );
+  }
+  EXPECT_EQ( t.count, pdus.size() );
+  EXPECT_LE( t.count * 2, t.mask + 1 );
+
+  for ( auto& pdu : pdus ) {
+    EXPECT_EQ( rpc_hash_lookup( &t, pdu.xid ), &pdu );
+  }
+  EXPECT_EQ( rpc_hash_lookup( &t, 0x12345678 ), nullptr );
+
+  /* remove every third entry, the rest must still be reachable */
+  for ( uint32_t i = 0; i < pdus.size(); i += 3 ) {
+    EXPECT_EQ( rpc_hash_remove( &t, pdus[ i ].xid ), &pdus[ i ] );
+    EXPECT_EQ( rpc_hash_remove( &t, pdus[ i ].xid ), nullptr );
+  }
+  for ( uint32_t i = 0; i < pdus.size(); i++ ) {
+    EXPECT_EQ( rpc_hash_lookup( &t, pdus[ i ].xid ), i % 3 ? &pdus[ i ] : nullptr );
+  }
+
+  rpc_hash_destroy( &t );
+}
+
+TEST( rpc_waitpdu, context_tracks_len ) {
+  struct rpc_context* rpc = rpc_init_context();
+  ASSERT_NE( rpc, nullptr );
+
+  rpc_pdu a{}, b{};
+  a.xid = 1;
+  b.xid = 2;
+  ASSERT_TRUE( rpc_add_waitpdu( rpc, &a ) );
+  ASSERT_TRUE( rpc_add_waitpdu( rpc, &b ) );
+  EXPECT_EQ( rpc->waitpdu_len, 2u );
+  EXPECT_FALSE( rpc_set_hash_size( rpc, 1024 ) );
+
+  EXPECT_EQ( rpc_find_waitpdu( rpc, 2 ), &b );
+  EXPECT_EQ( rpc_remove_waitpdu( rpc, 1 ), &a );
+  EXPECT_EQ( rpc->waitpdu_len, 1u );
+  EXPECT_EQ( rpc->max_waitpdu_len, 2u );
+
+  /* the pdus live on the stack, so none may be left to cancel */
+  EXPECT_EQ( rpc_remove_waitpdu( rpc, 2 ), &b );
+  rpc_destroy_context( rpc );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,110 @@
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <poll.h>
+#include <vector>
+
+#include "fake_server.h"
+#include <nfs/v3/nfs_v3.h>
+#include <rpc/rpc.h>
+
+static void done_cb( struct rpc_context* rpc, int status, void* data, void* private_data ) {
+  if ( status == RPC_STATUS_SUCCESS ) {
+    ( *(int*) private_data )++;
+  }
+}
+
+static void run_until( struct rpc_loop* loop, const int& done, int want ) {
+  for ( int i = 0; i < 1000 && done < want; i++ ) {
+    ASSERT_GE( rpc_loop_run_once( loop, 100 ), 0 );
+  }
+}
+
+TEST( rpc_writev, cork_batches_a_burst ) {
+  fake_server         srv;
+  struct rpc_context* rpc  = rpc_init_context();
+  struct rpc_loop*    loop = rpc_loop_create();
+  ASSERT_EQ( rpc_loop_add( loop, rpc ), 0 );
+
+  int connected = 0, done = 0;
+  ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, done_cb, &connected ), 0 );
+  run_until( loop, connected, 1 );
+  ASSERT_EQ( connected, 1 );
+
+  rpc_cork( rpc );
+  rpc_cork( rpc );
+  for ( int i = 0; i < 50; i++ ) {
+    ASSERT_EQ( rpc_null_async( rpc, 100003, 3, done_cb, &done ), 0 );
+  }
+  rpc_loop_run_once( loop, 10 );
+  EXPECT_EQ( rpc->stats.num_req_sent, 0u );
+  EXPECT_EQ( rpc_which_events( rpc ) & POLLOUT, 0 );
+
+  rpc_uncork( rpc );
+  EXPECT_EQ( rpc->stats.num_req_sent, 0u );
+  rpc_uncork( rpc );
+  EXPECT_EQ( rpc->stats.num_req_sent, 50u );
+  EXPECT_EQ( rpc->outqueue.head, nullptr );
+
+  run_until( loop, done, 50 );
+  EXPECT_EQ( done, 50 );
+
+  rpc_destroy_context( rpc );
+  rpc_loop_destroy( loop );
+}
+
+TEST( rpc_writev, write_payload_is_not_copied ) {
+  std::atomic< int > good { 0 };
+  std::vector< char > payload( ( 4 << 20 ) - 3 );
+  for ( size_t i = 0; i < payload.size(); i++ ) {
+    payload[ i ] = (char) ( i * 13 );
+  }
+
+  /* the payload is the last opaque of the call, followed by its padding */
+  fake_server srv( fake_server::REPLY, [ & ]( const std::vector< char >& call ) {
+    size_t pad = ZDR_ROUNDUP( payload.size() ) - payload.size();
+    if ( call.size() > payload.size() + pad
+         && !memcmp( call.data() + call.size() - pad - payload.size(), payload.data(), payload.size() ) ) {
+      good++;
+    }
+    return std::string();
+  } );
+
+  struct rpc_context* rpc  = rpc_init_context();
+  struct rpc_loop*    loop = rpc_loop_create();
+  ASSERT_EQ( rpc_loop_add( loop, rpc ), 0 );
+  ASSERT_EQ( rpc_connect_async( rpc, "127.0.0.1", srv.port, nullptr, nullptr ), 0 );
+
+  char fh[ 8 ] {};
+  int  done = 0;
+  for ( int i = 0; i < 4; i++ ) {
+    WRITE3args args {};
+    args.file.data.data_len = sizeof( fh );
+    args.file.data.data_val = fh;
+    args.count              = payload.size();
+    args.stable             = UNSTABLE;
+    args.data.data_len      = payload.size();
+    args.data.data_val      = payload.data();
+
+    /* far too small for the payload, so it cannot have been copied */
+    struct rpc_pdu* pdu = rpc_allocate_pdu( rpc, NFS_PROGRAM, NFS_V3, NFS3_WRITE, done_cb, &done, nullptr, 0, 128 );
+    ASSERT_NE( pdu, nullptr );
+    rpc_pdu_set_payload( pdu, payload.data(), payload.size() );
+    ASSERT_TRUE( zdr_WRITE3args( &pdu->zdr, &args ) );
+    ASSERT_EQ( rpc_queue_pdu( rpc, pdu ), 0 );
+    ASSERT_EQ( rpc_null_async( rpc, 100003, 3, done_cb, &done ), 0 );
+  }
+
+  run_until( loop, done, 8 );
+  EXPECT_EQ( done, 8 );
+  EXPECT_EQ( good, 4 );
+
+  rpc_destroy_context( rpc );
+  rpc_loop_destroy( loop );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}
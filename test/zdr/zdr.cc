@@ -0,0 +1,267 @@
+#include <cstdint>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include <nfs/v3/nfs_v3.h>
+#include <zdr/zdr.h>
+
+TEST( zdr, primitives_round_trip ) {
+  char  buf[ 64 ];
+  zdr_t zdrs;
+
+  uint32_t u   = 0xdeadbeef;
+  uint64_t u64 = 0x0102030405060708ull;
+  uint32_t b   = 1;
+  zdrmem_create( &zdrs, buf, sizeof( buf ), ZDR_ENCODE );
+  ASSERT_TRUE( zdr_u_int( &zdrs, &u ) );
+  ASSERT_TRUE( zdr_uint64_t( &zdrs, &u64 ) );
+  ASSERT_TRUE( zdr_bool( &zdrs, &b ) );
+  EXPECT_EQ( zdr_getpos( &zdrs ), 16u );
+  EXPECT_EQ( (uint8_t) buf[ 0 ], 0xde );
+  EXPECT_EQ( (uint8_t) buf[ 4 ], 0x01 );
+
+  uint32_t du = 0, db = 0;
+  uint64_t du64 = 0;
+  zdrmem_create( &zdrs, buf, 16, ZDR_DECODE );
+  ASSERT_TRUE( zdr_u_int( &zdrs, &du ) );
+  ASSERT_TRUE( zdr_uint64_t( &zdrs, &du64 ) );
+  ASSERT_TRUE( zdr_bool( &zdrs, &db ) );
+  EXPECT_EQ( du, u );
+  EXPECT_EQ( du64, u64 );
+  EXPECT_EQ( db, 1u );
+  EXPECT_FALSE( zdr_u_int( &zdrs, &du ) );
+}
+
+TEST( zdr, read3res_payload_is_a_view ) {
+  char payload[ 13 ];
+  memset( payload, 'x', sizeof( payload ) );
+
+  READ3res    res{};
+  READ3resok& ok = res.READ3res_u.resok;
+  res.status     = NFS3_OK;
+  ok.file_attributes.attributes_follow              = 1;
+  ok.file_attributes.post_op_attr_u.attributes.size = 13;
+  ok.count                                          = sizeof( payload );
+  ok.eof                                            = 1;
+  ok.data.data_len                                  = sizeof( payload );
+  ok.data.data_val                                  = payload;
+
+  char  buf[ 256 ];
+  zdr_t zdrs;
+  zdrmem_create( &zdrs, buf, sizeof( buf ), ZDR_ENCODE );
+  ASSERT_TRUE( zdr_READ3res( &zdrs, &res ) );
+  uint32_t len = zdr_getpos( &zdrs );
+  EXPECT_EQ( len % 4, 0u );
+
+  READ3res out{};
+  zdrmem_create( &zdrs, buf, len, ZDR_DECODE );
+  ASSERT_TRUE( zdr_READ3res( &zdrs, &out ) );
+  EXPECT_EQ( zdr_getpos( &zdrs ), len );
+  EXPECT_EQ( out.status, NFS3_OK );
+  EXPECT_EQ( out.READ3res_u.resok.file_attributes.post_op_attr_u.attributes.size, 13u );
+  EXPECT_EQ( out.READ3res_u.resok.eof, 1u );
+  ASSERT_EQ( out.READ3res_u.resok.data.data_len, sizeof( payload ) );
+  EXPECT_GE( out.READ3res_u.resok.data.data_val, buf );
+  EXPECT_LT( out.READ3res_u.resok.data.data_val, buf + len );
+  EXPECT_EQ( memcmp( out.READ3res_u.resok.data.data_val, payload, sizeof( payload ) ), 0 );
+
+  /* a truncated reply must be rejected, not over-read */
+  READ3res shortres{};
+  zdrmem_create( &zdrs, buf, len - 4, ZDR_DECODE );
+  EXPECT_FALSE( zdr_READ3res( &zdrs, &shortres ) );
+}
+
+TEST( zdr, readdirplus_list_uses_scratch ) {
+  char        fh[ 4 ] = { 1, 2, 3, 4 };
+  entryplus3  e[ 3 ]{};
+  const char* names[] = { "a", "four", "seven.." };
+  for ( int i = 0; i < 3; i++ ) {
+    e[ i ].fileid                                         = 100 + i;
+    e[ i ].name                                           = const_cast< char* >( names[ i ] );
+    e[ i ].cookie                                         = i + 1;
+    e[ i ].name_handle.handle_follows                     = 1;
+    e[ i ].name_handle.post_op_fh3_u.handle.data.data_len = sizeof( fh );
+    e[ i ].name_handle.post_op_fh3_u.handle.data.data_val = fh;
+    e[ i ].nextentry                                      = i < 2 ? &e[ i + 1 ] : nullptr;
+  }
+
+  READDIRPLUS3res res{};
+  res.status                                = NFS3_OK;
+  res.READDIRPLUS3res_u.resok.reply.entries = &e[ 0 ];
+  res.READDIRPLUS3res_u.resok.reply.eof     = 1;
+
+  char  buf[ 1024 ];
+  zdr_t zdrs;
+  zdrmem_create( &zdrs, buf, sizeof( buf ), ZDR_ENCODE );
+  ASSERT_TRUE( zdr_READDIRPLUS3res( &zdrs, &res ) );
+  uint32_t len = zdr_getpos( &zdrs );
+
+  /* without a scratch arena there is nowhere to put the entries */
+  char copy[ 1024 ];
+  memcpy( copy, buf, len );
+  READDIRPLUS3res out{};
+  zdrmem_create( &zdrs, copy, len, ZDR_DECODE );
+  EXPECT_FALSE( zdr_READDIRPLUS3res( &zdrs, &out ) );
+
+  char scratch[ 3 * sizeof( entryplus3 ) + 64 ];
+  out = {};
+  zdrmem_create( &zdrs, buf, len, ZDR_DECODE );
+  zdr_set_scratch( &zdrs, scratch, sizeof( scratch ) );
+  ASSERT_TRUE( zdr_READDIRPLUS3res( &zdrs, &out ) );
+  EXPECT_EQ( out.READDIRPLUS3res_u.resok.reply.eof, 1u );
+
+  int n = 0;
+  for ( entryplus3* p = out.READDIRPLUS3res_u.resok.reply.entries; p; p = p->nextentry, n++ ) {
+    EXPECT_EQ( p->fileid, 100u + n );
+    EXPECT_STREQ( p->name, names[ n ] );
+    EXPECT_GE( p->name, buf );
+    EXPECT_LT( p->name, buf + len );
+    ASSERT_EQ( p->name_handle.post_op_fh3_u.handle.data.data_len, sizeof( fh ) );
+    EXPECT_EQ( memcmp( p->name_handle.post_op_fh3_u.handle.data.data_val, fh, sizeof( fh ) ), 0 );
+  }
+  EXPECT_EQ( n, 3 );
+}
+
+TEST( zdr, mountres3_auth_flavors_in_place ) {
+  char fh[ 8 ]      = { 9, 8, 7, 6, 5, 4, 3, 2 };
+  int  flavors[ 2 ] = { AUTH_NONE, AUTH_UNIX };
+
+  mountres3 res{};
+  res.fhs_status                                          = MNT3_OK;
+  res.mountres3_u.mountinfo.fhandle.fhandle3_len          = sizeof( fh );
+  res.mountres3_u.mountinfo.fhandle.fhandle3_val          = fh;
+  res.mountres3_u.mountinfo.auth_flavors.auth_flavors_len = 2;
+  res.mountres3_u.mountinfo.auth_flavors.auth_flavors_val = flavors;
+
+  char  buf[ 128 ];
+  zdr_t zdrs;
+  zdrmem_create( &zdrs, buf, sizeof( buf ), ZDR_ENCODE );
+  ASSERT_TRUE( zdr_mountres3( &zdrs, &res ) );
+  uint32_t len = zdr_getpos( &zdrs );
+
+  mountres3 out{};
+  zdrmem_create( &zdrs, buf, len, ZDR_DECODE );
+  ASSERT_TRUE( zdr_mountres3( &zdrs, &out ) );
+  ASSERT_EQ( out.mountres3_u.mountinfo.auth_flavors.auth_flavors_len, 2u );
+  EXPECT_EQ( out.mountres3_u.mountinfo.auth_flavors.auth_flavors_val[ 1 ], AUTH_UNIX );
+  EXPECT_EQ( memcmp( out.mountres3_u.mountinfo.fhandle.fhandle3_val, fh, sizeof( fh ) ), 0 );
+
+  /* handles longer than FHSIZE3 are refused */
+  char     big[ FHSIZE3 + 4 ]{};
+  fhandle3 h{ sizeof( big ), big };
+  zdrmem_create( &zdrs, buf, sizeof( buf ), ZDR_ENCODE );
+  EXPECT_FALSE( zdr_fhandle3( &zdrs, &h ) );
+}
+
+/* buf cut into segments of `cut` bytes, each with ZDR_UNIT bytes of room in front */
+struct zdr_chain {
+  std::vector< std::vector< char > > mem;
+  std::vector< struct zdr_seg >      segs;
+
+  zdr_chain( const char* buf, uint32_t len, uint32_t cut ) {
+    for ( uint32_t pos = 0; pos < len; pos += cut ) {
+      uint32_t n = len - pos < cut ? len - pos : cut;
+      mem.emplace_back( ZDR_UNIT + n );
+      memcpy( mem.back().data() + ZDR_UNIT, buf + pos, n );
+      segs.push_back( { nullptr, mem.back().data() + ZDR_UNIT, n } );
+    }
+    for ( size_t i = 0; i + 1 < segs.size(); i++ ) {
+      segs[ i ].next = &segs[ i + 1 ];
+    }
+  }
+};
+
+TEST( zdr, chain_decodes_across_segments ) {
+  char        fh[ 6 ] = { 1, 2, 3, 4, 5, 6 };
+  entryplus3  e[ 3 ]{};
+  const char* names[] = { "a", "four", "seven.." };
+  for ( int i = 0; i < 3; i++ ) {
+    e[ i ].fileid                                         = 100 + i;
+    e[ i ].name                                           = const_cast< char* >( names[ i ] );
+    e[ i ].cookie                                         = i + 1;
+    e[ i ].name_attributes.attributes_follow              = 1;
+    e[ i ].name_attributes.post_op_attr_u.attributes.size = 1000 + i;
+    e[ i ].name_handle.handle_follows                     = 1;
+    e[ i ].name_handle.post_op_fh3_u.handle.data.data_len = sizeof( fh );
+    e[ i ].name_handle.post_op_fh3_u.handle.data.data_val = fh;
+    e[ i ].nextentry                                      = i < 2 ? &e[ i + 1 ] : nullptr;
+  }
+  READDIRPLUS3res res{};
+  res.status                                = NFS3_OK;
+  res.READDIRPLUS3res_u.resok.reply.entries = &e[ 0 ];
+  res.READDIRPLUS3res_u.resok.reply.eof     = 1;
+
+  char  buf[ 1024 ];
+  zdr_t zdrs;
+  zdrmem_create( &zdrs, buf, sizeof( buf ), ZDR_ENCODE );
+  ASSERT_TRUE( zdr_READDIRPLUS3res( &zdrs, &res ) );
+  uint32_t len = zdr_getpos( &zdrs );
+
+  /* every cut puts a different mix of items across a boundary */
+  for ( uint32_t cut = 1; cut <= 13; cut++ ) {
+    zdr_chain chain( buf, len, cut );
+    char      scratch[ 3 * sizeof( entryplus3 ) + 1024 ];
+    zdr_chain_create( &zdrs, &chain.segs[ 0 ] );
+    zdr_set_scratch( &zdrs, scratch, sizeof( scratch ) );
+    EXPECT_EQ( zdr_remaining( &zdrs ), len );
+
+    READDIRPLUS3res out{};
+    ASSERT_TRUE( zdr_READDIRPLUS3res( &zdrs, &out ) ) << "cut " << cut;
+    EXPECT_EQ( zdr_remaining( &zdrs ), 0u );
+    EXPECT_EQ( out.READDIRPLUS3res_u.resok.reply.eof, 1u );
+    int n = 0;
+    for ( entryplus3* p = out.READDIRPLUS3res_u.resok.reply.entries; p; p = p->nextentry, n++ ) {
+      EXPECT_EQ( p->fileid, 100u + n );
+      EXPECT_EQ( p->cookie, 1u + n );
+      EXPECT_STREQ( p->name, names[ n ] );
+      EXPECT_EQ( p->name_attributes.post_op_attr_u.attributes.size, 1000u + n );
+      ASSERT_EQ( p->name_handle.post_op_fh3_u.handle.data.data_len, sizeof( fh ) );
+      EXPECT_EQ( memcmp( p->name_handle.post_op_fh3_u.handle.data.data_val, fh, sizeof( fh ) ), 0 );
+    }
+    EXPECT_EQ( n, 3 ) << "cut " << cut;
+  }
+
+  /* one byte short of the end is still refused */
+  zdr_chain       chain( buf, len - 1, 5 );
+  char            scratch[ 3 * sizeof( entryplus3 ) + 1024 ];
+  READDIRPLUS3res out{};
+  zdr_chain_create( &zdrs, &chain.segs[ 0 ] );
+  zdr_set_scratch( &zdrs, scratch, sizeof( scratch ) );
+  EXPECT_FALSE( zdr_READDIRPLUS3res( &zdrs, &out ) );
+}
+
+TEST( zdr, chain_payload_is_gathered ) {
+  char payload[ 1001 ];
+  for ( size_t i = 0; i < sizeof( payload ); i++ ) {
+    payload[ i ] = (char) i;
+  }
+  READ3res    res{};
+  READ3resok& ok   = res.READ3res_u.resok;
+  res.status       = NFS3_OK;
+  ok.count         = sizeof( payload );
+  ok.data.data_len = sizeof( payload );
+  ok.data.data_val = payload;
+
+  char  buf[ 2048 ];
+  zdr_t zdrs;
+  zdrmem_create( &zdrs, buf, sizeof( buf ), ZDR_ENCODE );
+  ASSERT_TRUE( zdr_READ3res( &zdrs, &res ) );
+  uint32_t len = zdr_getpos( &zdrs );
+
+  zdr_chain chain( buf, len, 97 );
+  char      dst[ sizeof( payload ) ];
+  READ3res  out{};
+  zdr_chain_create( &zdrs, &chain.segs[ 0 ] );
+  zdr_set_payload( &zdrs, dst, sizeof( dst ) );
+  ASSERT_TRUE( zdr_READ3res( &zdrs, &out ) );
+  EXPECT_EQ( zdrs.ext_have, sizeof( payload ) );
+  EXPECT_EQ( zdr_remaining( &zdrs ), 0u );
+  EXPECT_EQ( out.READ3res_u.resok.data.data_val, dst );
+  EXPECT_EQ( memcmp( dst, payload, sizeof( payload ) ), 0 );
+}
+
+int main( int argc, char* argv[] ) {
+  ::testing::InitGoogleTest( &argc, argv );
+  return RUN_ALL_TESTS();
+}